@@ -0,0 +1,970 @@
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <iomanip>
+#include "src/sim/Utils.hpp"
+#include "src/sim/SpatialHash.hpp"
+#include "src/sim/SweepAndPrune.hpp"
+#include "src/sim/AABBTree.hpp"
+#include "src/sim/VerletList.hpp"
+#include "src/sim/Narrowphase.hpp"
+#include "src/sim/Integrators.hpp"
+#include "src/sim/BatchIntegrator.hpp"
+#include "src/sim/FrameGraph.hpp"
+#include "src/sim/BarnesHut.hpp"
+#include "src/sim/TiledCoulomb.hpp"
+#include "src/sim/FastMultipole.hpp"
+#include "src/sim/ParticleMesh.hpp"
+#include "src/sim/Multigrid.hpp"
+
+// Benchmarks for the simulation's hot paths. Build with `make benchmark`.
+// Usage:  benchmark [max_particles] [max_all_pairs_particles]
+// Exits with a failure if any fast path doesn't match the reference it's timed against.
+
+const int FRAMES = 5;
+const float COVERAGE = 0.2f;    // fraction of the box area covered by balls
+
+int mismatches = 0;             // checks against a reference that failed
+
+
+
+// Returns the number of milliseconds spent running fn() once.
+template <typename Fn>
+double timeMs(Fn fn)
+{
+    auto start = std::chrono::steady_clock::now();
+    fn();
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+
+// Returns the tag printed after a check against a reference, and counts the check if it failed.
+const char* verdict(bool matches)
+{
+    if (!matches) mismatches++;
+    return matches ? "  (matches)" : "  (MISMATCH)";
+}
+
+
+// Scatters n balls (radii 10-20, as in main.cpp) at random in a square box
+// that grows with n, so the density (and the number of contacts per ball) stays constant.
+std::vector<Particle2D> makeParticles(int n, unsigned int seed)
+{
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> radius(10.0f, 20.0f);
+    std::uniform_real_distribution<float> speed(-50.0f, 50.0f);
+    float side = std::sqrt(n * 3.14159265f * 15.0f * 15.0f / COVERAGE);
+    std::uniform_real_distribution<float> position(0.0f, side);
+
+    std::vector<Particle2D> particles;
+    particles.reserve(n);
+    for (int i = 0; i < n; i++)
+    {
+        float r = radius(rng);
+        particles.emplace_back("", r / 10.0f, r, sf::Color::White, Vec2D(position(rng), position(rng)), Vec2D(speed(rng), speed(rng)), g, 1.0f);
+    }
+    return particles;
+}
+
+
+
+// Compares the all-pairs resolveCollisions() loop against the SpatialHash, SweepAndPrune and AABBTree broadphases.
+void benchmarkBroadphase(int max_particles, int max_all_pairs)
+{
+    std::cout << std::endl << "Broadphase: ms per resolveCollisions() call (" << FRAMES << " frames)" << std::endl;
+    std::cout << std::setw(10) << "N" << std::setw(14) << "all-pairs" << std::setw(14) << "spatial hash"
+              << std::setw(14) << "sweep+prune" << std::setw(14) << "aabb tree" << std::setw(12) << "speedup" << std::setw(12) << "pairs/N" << std::endl;
+
+    for (int n = 100; n <= max_particles; n *= 10)
+    {
+        std::vector<Particle2D> reference = makeParticles(n, 42u);
+        std::vector<Particle2D> hashed = reference;
+        std::vector<Particle2D> swept = reference;
+        std::vector<Particle2D> treed = reference;
+        SpatialHash grid;
+        SweepAndPrune sap;
+        AABBTree tree;
+        std::vector<Vec2D> centers;
+        std::vector<float> radii;
+        gatherBounds(treed, centers, radii);
+        tree.Rebuild(centers, radii);       // Built before the timing starts, so the frames time its refit and query, not the build
+
+        double hash_ms = timeMs([&]() { for (int f = 0; f < FRAMES; f++) resolveCollisions(hashed, grid); }) / FRAMES;
+        double sap_ms = timeMs([&]() { for (int f = 0; f < FRAMES; f++) resolveCollisions(swept, sap); }) / FRAMES;
+        double tree_ms = timeMs([&]() { for (int f = 0; f < FRAMES; f++) resolveCollisions(treed, tree); }) / FRAMES;
+        double best_ms = std::min(hash_ms, std::min(sap_ms, tree_ms));
+
+        std::cout << std::setw(10) << n;
+        if (n <= max_all_pairs)
+        {
+            double brute_ms = timeMs([&]() { for (int f = 0; f < FRAMES; f++) resolveCollisions(reference); }) / FRAMES;
+            std::cout << std::setw(14) << brute_ms << std::setw(14) << hash_ms << std::setw(14) << sap_ms << std::setw(14) << tree_ms << std::setw(12) << brute_ms / best_ms;
+        }
+        else
+            std::cout << std::setw(14) << "skipped" << std::setw(14) << hash_ms << std::setw(14) << sap_ms << std::setw(14) << tree_ms << std::setw(12) << "-";
+        std::cout << std::setw(12) << (double)grid.pairs.size() / n << std::endl;
+    }
+}
+
+
+// Balls with radii from 2 to 100 (50:1, spread evenly in log radius, so most are small), moving at main.cpp's speeds
+// and bouncing off the walls of a box, with each broadphase asked for the pairs every frame. This is the case the
+// AABB tree is for (the spatial hash sizes its cells for the biggest ball). Prints what the tree spent per frame
+// on rebuilding, on refitting (reinserting the leaves that left their fat boxes) and on the pair query.
+void benchmarkMixedRadii(int n)
+{
+    const int MOVING_FRAMES = 10;
+    const float dt = 1.0f / 60.0f;
+    std::mt19937 rng(3u);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    std::uniform_real_distribution<float> speed(-50.0f, 50.0f);
+
+    std::vector<float> radii(n);
+    float area = 0.0f;
+    for (int i = 0; i < n; i++) {
+        radii[i] = 2.0f * std::pow(50.0f, unit(rng));
+        area += 3.14159265f * radii[i] * radii[i];
+    }
+    const float side = std::sqrt(area / COVERAGE);
+    std::vector<Vec2D> centers, velocities;
+    for (int i = 0; i < n; i++) {
+        centers.emplace_back(radii[i] + unit(rng) * (side - 2 * radii[i]), radii[i] + unit(rng) * (side - 2 * radii[i]));
+        velocities.emplace_back(speed(rng), speed(rng));
+    }
+
+    SpatialHash grid;
+    SweepAndPrune sap;
+    AABBTree tree;
+    std::cout << std::endl << "Broadphase on " << n << " moving balls with radii 2-100: ms per FindPairs() call" << std::endl;
+    std::cout << std::setw(8) << "frame" << std::setw(14) << "spatial hash" << std::setw(14) << "sweep+prune" << std::setw(14) << "aabb tree"
+              << std::setw(12) << "rebuild" << std::setw(12) << "refit" << std::setw(12) << "reinserted" << std::setw(12) << "query" << std::endl;
+
+    double hash_total = 0.0, sap_total = 0.0, tree_total = 0.0;
+    for (int f = 0; f <= MOVING_FRAMES; f++)
+    {
+        if (f > 0)
+            for (int i = 0; i < n; i++)
+            {
+                centers[i] += velocities[i] * dt;
+                if (centers[i].x < radii[i] || centers[i].x > side - radii[i])  velocities[i].x = -velocities[i].x;
+                if (centers[i].y < radii[i] || centers[i].y > side - radii[i])  velocities[i].y = -velocities[i].y;
+            }
+        double hash_ms = timeMs([&]() { grid.FindPairs(centers, radii); });
+        double sap_ms = timeMs([&]() { sap.FindPairs(centers, radii); });
+        double tree_ms = timeMs([&]() { tree.FindPairs(centers, radii); });
+        if (f > 0) {
+            hash_total += hash_ms;
+            sap_total += sap_ms;
+            tree_total += tree_ms;
+        }
+        std::cout << std::setw(8) << f << std::setw(14) << hash_ms << std::setw(14) << sap_ms << std::setw(14) << tree_ms
+                  << std::setw(12) << tree.stats.rebuild_ms << std::setw(12) << tree.stats.refit_ms
+                  << std::setw(12) << tree.stats.reinserted << std::setw(12) << tree.stats.query_ms << std::endl;
+    }
+    std::cout << std::setw(8) << "mean" << std::setw(14) << hash_total / MOVING_FRAMES << std::setw(14) << sap_total / MOVING_FRAMES
+              << std::setw(14) << tree_total / MOVING_FRAMES << "   (frames 1-" << MOVING_FRAMES << ", after the tree is built)" << std::endl;
+
+    // Every pair that overlaps after the last frame has to be among each broadphase's candidates
+    std::vector<std::pair<int,int>> overlapping;
+    for (auto& pair : grid.pairs)
+    {
+        const float reach = radii[pair.first] + radii[pair.second];
+        if ((centers[pair.first] - centers[pair.second]).magnitude() < reach)
+            overlapping.emplace_back(std::min(pair.first, pair.second), std::max(pair.first, pair.second));
+    }
+    auto covers = [&](std::vector<std::pair<int,int>> found) {
+        for (auto& pair : found)  pair = std::make_pair(std::min(pair.first, pair.second), std::max(pair.first, pair.second));
+        std::sort(found.begin(), found.end());
+        for (auto& pair : overlapping)
+            if (!std::binary_search(found.begin(), found.end(), pair))  return false;
+        return true;
+    };
+    std::cout << "   > sweep+prune and aabb tree find the hash's " << overlapping.size() << " overlapping pairs"
+              << verdict(covers(sap.pairs) && covers(tree.pairs)) << std::endl;
+}
+
+
+
+// The collision response as it was before it went trig-free: rotate both velocities into the
+// collision frame, exchange the x-components, and rotate back. Kept to check the new kernel against.
+void resolveCollisionTrig(Particle2D& a, Particle2D& b)
+{
+    float dvx = a.state.velocity.x - b.state.velocity.x;
+    float dvy = a.state.velocity.y - b.state.velocity.y;
+    float dx = b.state.position.x - a.state.position.x;
+    float dy = b.state.position.y - a.state.position.y;
+    if (a.overlapping(b) && dvx * dx + dvy * dy >= 0)
+    {
+        float angle = -atan2(dy, dx);
+        float m1 = a.mass;
+        float m2 = b.mass;
+        Vec2D u1 = a.rotate(a.state.velocity, angle);
+        Vec2D u2 = a.rotate(b.state.velocity, angle);
+        Vec2D v1 = Vec2D( (u1.x * (m1 - m2) / (m1 + m2)) + (u2.x * 2 * m2 / (m1 + m2)), u1.y );
+        Vec2D v2 = Vec2D( (u2.x * (m2 - m1) / (m1 + m2)) + (u1.x * 2 * m1 / (m1 + m2)), u2.y );
+        a.state.velocity = a.rotate(v1, -angle) * a.restitution;
+        b.state.velocity = a.rotate(v2, -angle) * a.restitution;
+    }
+}
+
+
+// Checks Particle2D::resolveCollision() against the trig version on random colliding pairs
+// (with and without restitution), and times the two.
+void benchmarkCollisionResponse()
+{
+    const int PAIRS = 200000;
+    std::mt19937 rng(7u);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+    std::uniform_real_distribution<float> mass(0.5f, 8.0f);
+
+    std::vector<Particle2D> particles;
+    particles.reserve(2 * PAIRS);
+    for (int k = 0; k < PAIRS; k++)
+    {
+        float restitution = (k % 2 == 0) ? 1.0f : 0.9f;
+        Vec2D offset = Vec2D(unit(rng), unit(rng)) * 10.0f;     // closer than the radii, so always overlapping
+        Vec2D velocity = Vec2D(unit(rng), unit(rng)) * 50.0f;
+        particles.emplace_back("", mass(rng), 10.0f, sf::Color::White, Vec2D(100.0f, 100.0f), velocity + offset, g, restitution);
+        particles.emplace_back("", mass(rng), 10.0f, sf::Color::White, Vec2D(100.0f, 100.0f) + offset, velocity, g, restitution);
+    }
+    std::vector<Particle2D> reference = particles;
+
+    double trig_ms = timeMs([&]() { for (int k = 0; k < PAIRS; k++) resolveCollisionTrig(reference[2*k], reference[2*k+1]); });
+    double normal_ms = timeMs([&]() { for (int k = 0; k < PAIRS; k++) particles[2*k].resolveCollision(particles[2*k+1]); });
+
+    float worst = 0.0f;
+    for (size_t i = 0; i < particles.size(); i++)
+    {
+        float scale = std::max(1.0f, reference[i].state.velocity.magnitude());
+        worst = std::max(worst, (particles[i].state.velocity - reference[i].state.velocity).magnitude() / scale);
+    }
+
+    std::cout << std::endl << "Collision response: " << PAIRS << " colliding pairs" << std::endl;
+    std::cout << "   > atan2 + rotate:  " << trig_ms << " ms" << std::endl;
+    std::cout << "   > normal impulse:  " << normal_ms << " ms  (" << trig_ms / normal_ms << "x)" << std::endl;
+    std::cout << "   > max relative velocity difference: " << std::scientific << worst << std::fixed << verdict(worst < 1e-4f) << std::endl;
+}
+
+
+// Times the narrowphase on one frame's candidate pairs: calling resolveCollision() on each pair
+// against BatchNarrowphase at every instruction set the CPU supports, and checks they agree.
+void benchmarkNarrowphase(int n)
+{
+    std::vector<Particle2D> particles = makeParticles(n, 42u);
+    std::vector<Vec2D> centers;
+    std::vector<float> radii;
+    gatherBounds(particles, centers, radii);
+    SpatialHash grid;
+    const std::vector<std::pair<int,int>> pairs = grid.FindPairs(centers, radii);
+
+    std::vector<float> px(n), py(n), vx(n), vy(n), mass(n), restitution(n);
+    for (int i = 0; i < n; i++)
+    {
+        px[i] = particles[i].state.position.x;
+        py[i] = particles[i].state.position.y;
+        vx[i] = particles[i].state.velocity.x;
+        vy[i] = particles[i].state.velocity.y;
+        mass[i] = particles[i].mass;
+        restitution[i] = particles[i].restitution;
+    }
+
+    std::vector<Particle2D> reference = particles;
+    double reference_ms = timeMs([&]() { for (auto& pair : pairs) reference[pair.first].resolveCollision(reference[pair.second]); });
+
+    std::cout << std::endl << "Narrowphase: " << n << " particles, " << pairs.size() << " candidate pairs" << std::endl;
+    std::cout << "   > resolveCollision() per pair:  " << reference_ms << " ms" << std::endl;
+    for (int level = BatchNarrowphase::SCALAR; level <= BatchNarrowphase::Detect(); level++)
+    {
+        BatchNarrowphase narrowphase((BatchNarrowphase::Level)level);
+        std::vector<float> wx = vx, wy = vy;
+        double ms = timeMs([&]() { narrowphase.Resolve(pairs, px.data(), py.data(), wx.data(), wy.data(), mass.data(), radii.data(), restitution.data(), true); });
+
+        float worst = 0.0f;
+        for (int i = 0; i < n; i++)
+        {
+            float scale = std::max(1.0f, reference[i].state.velocity.magnitude());
+            worst = std::max(worst, (Vec2D(wx[i], wy[i]) - reference[i].state.velocity).magnitude() / scale);
+        }
+        std::cout << "   > " << std::left << std::setw(8) << BatchNarrowphase::Name(narrowphase.level) << std::right << " batched:  " << ms << " ms  ("
+                  << reference_ms / ms << "x, " << narrowphase.stats.resolved << " resolved, " << narrowphase.stats.batched << " in lanes)" << verdict(worst < 1e-4f) << std::endl;
+    }
+}
+
+
+// Times the colored, multithreaded contact resolution for growing thread counts,
+// and checks that every thread count gives bit-identical velocities.
+void benchmarkParallelCollisions(int n)
+{
+    const std::vector<Particle2D> start = makeParticles(n, 42u);
+    std::vector<Particle2D> serial;
+    std::vector<int> thread_counts;
+    for (int threads = 1; threads < (int)std::thread::hardware_concurrency(); threads *= 2)
+        thread_counts.push_back(threads);
+    thread_counts.push_back((int)std::max(1u, std::thread::hardware_concurrency()));
+
+    std::cout << std::endl << "Parallel collision resolution: " << n << " particles, ms per frame (" << FRAMES << " frames)" << std::endl;
+    for (int threads : thread_counts)
+    {
+        std::vector<Particle2D> particles = start;
+        SpatialHash grid;
+        ContactManager contacts;
+        ContactColoring coloring;
+        ThreadPool pool(threads);
+        double ms = timeMs([&]() { for (int f = 0; f < FRAMES; f++) resolveCollisions(particles, grid, contacts, coloring, pool); }) / FRAMES;
+
+        bool identical = true;
+        if (threads == 1) serial = particles;
+        for (int i = 0; i < n && identical; i++)
+            identical = (particles[i].state.velocity.x == serial[i].state.velocity.x && particles[i].state.velocity.y == serial[i].state.velocity.y);
+        if (!identical) mismatches++;
+
+        std::cout << "   > " << std::setw(3) << threads << " threads:  " << ms << " ms  (" << coloring.Colors() << " colors, "
+                  << contacts.contacts.size() << " contacts)" << (identical ? "" : "  (NOT DETERMINISTIC)") << std::endl;
+    }
+}
+
+
+
+// Times a frame (broadphase, batched narrowphase and RK4 update) on a std::vector<Particle2D>
+// against the same frame on a ParticleSystem, and checks the two end up in the same state.
+// updateRK() has the 800x600 walls built in, which would crush a large scene onto the floor, so the vector side
+// runs the same gravity-only RK4 step as ParticleSystem::UpdateRK inline, and the system's walls are moved out of the way.
+void benchmarkParticleSystem(int n)
+{
+    std::vector<Particle2D> particles = makeParticles(n, 42u);
+    ParticleSystem system(1e9f, 1e9f);
+    for (auto& particle : particles)
+    {
+        particle.state.position = particle.state.position + Vec2D(1000.0f, 1000.0f);    // clear of the top and left walls too
+        particle.center = particle.center + Vec2D(1000.0f, 1000.0f);
+        system.Add(particle);
+    }
+    SpatialHash grid1, grid2;
+    BatchNarrowphase narrowphase1, narrowphase2;
+    const float dt = 1.0f / 60.0f;
+
+    double vector_collide_ms = 0.0, vector_integrate_ms = 0.0, system_collide_ms = 0.0, system_integrate_ms = 0.0;
+    for (int f = 0; f < FRAMES; f++)
+    {
+        vector_collide_ms += timeMs([&]() { resolveCollisions(particles, grid1, narrowphase1); }) / FRAMES;
+        vector_integrate_ms += timeMs([&]() {
+            for (auto& particle : particles) {
+                Particle2D::State& state = particle.state;
+                Vec2D b = state.velocity - g * (dt * 0.5f);
+                Vec2D d = state.velocity - g * dt;
+                Vec2D x = 2.0f * (b + b);
+                Vec2D z = state.velocity + x + d;
+                Vec2D h = 2.0f * (g + g);
+                Vec2D j = g + h + g;
+                Vec2D dposdt = (1.0f / 6.0f) * z;
+                Vec2D dveldt = (1.0f / 6.0f) * j;
+                state.position = state.position + dposdt * dt;
+                state.velocity = state.velocity + dveldt * dt;
+                particle.center = Vec2D(state.position.x + particle.radius, state.position.y + particle.radius);
+            }
+        }) / FRAMES;
+        system_collide_ms += timeMs([&]() { system.ResolveCollisions(grid2, narrowphase2); }) / FRAMES;
+        system_integrate_ms += timeMs([&]() { system.UpdateRK(dt); }) / FRAMES;
+    }
+
+    bool identical = true;
+    for (int i = 0; i < n && identical; i++)
+        identical = (particles[i].state.position == system.Position(i) && particles[i].state.velocity == system.Velocity(i));
+
+    std::cout << std::endl << "ParticleSystem: " << n << " particles, ms per frame (" << FRAMES << " frames)" << std::endl;
+    std::cout << "   > bytes per particle:  " << sizeof(Particle2D) << " in a Particle2D, " << 8 * sizeof(float) << " in the hot arrays" << std::endl;
+    std::cout << "   > std::vector<Particle2D>:  collide " << vector_collide_ms << " ms,  integrate " << vector_integrate_ms << " ms" << std::endl;
+    std::cout << "   > ParticleSystem:           collide " << system_collide_ms << " ms,  integrate " << system_integrate_ms << " ms  ("
+              << vector_integrate_ms / system_integrate_ms << "x on the integrate loop)" << verdict(identical) << std::endl;
+}
+
+
+
+// Steps n Particles under gravity in a box (so they bounce off the walls) with Particle::Update one particle at a time
+// against BatchRK4, for each of Update's overloads, checks both end up in exactly the same state, and times them.
+// The batched time includes loading the particles into the arrays and storing them back once, as a frame would.
+void benchmarkBatchIntegrator(int n)
+{
+    const int STEPS = 20;
+    const float dt = 1.0f / 60.0f;
+    const float side = std::sqrt(n * 3.14159265f * 15.0f * 15.0f / COVERAGE);     // as in makeParticles
+    const Vec2D force(0.0f, 9.8f);
+    std::mt19937 rng(42u);
+    std::uniform_real_distribution<float> radius(10.0f, 20.0f);
+    std::uniform_real_distribution<float> speed(-50.0f, 50.0f);
+    std::uniform_real_distribution<float> position(0.0f, side - 40.0f);
+
+    std::vector<Particle> start;
+    start.reserve(n);
+    for (int i = 0; i < n; i++)
+    {
+        float r = radius(rng);
+        start.emplace_back("", sf::Color::White, r / 10.0f, r, Vec2D(position(rng), position(rng)), Vec2D(speed(rng), speed(rng)), Vec2D(0.0f, 9.8f));
+        start.back().trail_enabled = false;
+        start.back().SetBounds(0.0f, side, 0.0f, side);
+    }
+
+    std::cout << std::endl << "Batched RK4: " << n << " Particles, ms per step (" << STEPS << " steps)" << std::endl;
+    const char* names[4] = { "Update(t, dt, force)", "... restitution", "... damping", "... damping, restitution" };
+    for (int overload = 0; overload < 4; overload++)
+    {
+        std::vector<Particle> particles = start;
+        double single_ms = timeMs([&]() {
+            for (int s = 0; s < STEPS; s++)
+                for (auto& particle : particles)
+                    switch (overload) {
+                        case 0:  particle.Update(s * dt, dt, force);  break;
+                        case 1:  particle.Update(s * dt, dt, force, 0.9f);  break;
+                        case 2:  particle.Update(s * dt, dt, force, 0.999);  break;
+                        default: particle.Update(s * dt, dt, force, 0.999, 0.9f);  break;
+                    }
+        }) / STEPS;
+
+        std::vector<Particle> batched = start;
+        BatchRK4 batch;
+        double batch_ms = timeMs([&]() {
+            batch.Load(batched);
+            batch.SetForce(force);
+            for (int s = 0; s < STEPS; s++)
+                switch (overload) {
+                    case 0:  batch.Update(s * dt, dt);  break;
+                    case 1:  batch.Update(s * dt, dt, 0.9f);  break;
+                    case 2:  batch.Update(s * dt, dt, 0.999);  break;
+                    default: batch.Update(s * dt, dt, 0.999, 0.9f);  break;
+                }
+            batch.Store(batched, dt);
+        }) / STEPS;
+
+        bool identical = true;
+        for (int i = 0; i < n && identical; i++)
+            identical = (batched[i].kinematics.position == particles[i].kinematics.position && batched[i].kinematics.velocity == particles[i].kinematics.velocity
+                         && batched[i].kinematics.acceleration == particles[i].kinematics.acceleration && batched[i].center == particles[i].center);
+        std::cout << "   > " << std::left << std::setw(26) << names[overload] << std::right << " per particle " << single_ms << " ms,  batched "
+                  << batch_ms << " ms  (" << single_ms / batch_ms << "x)" << verdict(identical) << std::endl;
+    }
+}
+
+
+
+// Runs n balls in a box for half a second of substeps (four a frame, as a dense run would take), finding the collision pairs
+// with a SpatialHash every step and with Verlet lists of a few skins, and prints the cost of finding and resolving them per step,
+// how often each list was rebuilt and its size. The lists hand the narrowphase the same touching pairs in the same order,
+// so every run should end in the same state.
+void benchmarkVerletList(int n)
+{
+    const int STEPS = 120;
+    const float dt = 1.0f / 240.0f;
+    const float side = std::sqrt(n * 3.14159265f * 15.0f * 15.0f / COVERAGE);     // as in makeParticles
+    ParticleSystem start(side, side);
+    for (auto& particle : makeParticles(n, 42u))
+        start.Add(particle);
+
+    std::cout << std::endl << "Verlet lists: " << n << " particles, " << STEPS << " steps, ms per step to find and resolve collisions" << std::endl;
+    ParticleSystem hashed = start;
+    SpatialHash grid;
+    BatchNarrowphase narrowphase;
+    double hash_ms = 0.0;
+    for (int s = 0; s < STEPS; s++)
+    {
+        hash_ms += timeMs([&]() { hashed.ResolveCollisions(grid, narrowphase); }) / STEPS;
+        hashed.UpdateRK(dt);
+    }
+    std::cout << "   > spatial hash every step:  " << hash_ms << " ms,  " << (double)grid.pairs.size() / n << " pairs per particle" << std::endl;
+
+    for (float skin : { 1.0f, 2.0f, 4.0f, 8.0f })
+    {
+        ParticleSystem listed = start;
+        VerletList neighbours(skin);
+        BatchNarrowphase list_narrowphase;
+        double list_ms = 0.0;
+        for (int s = 0; s < STEPS; s++)
+        {
+            list_ms += timeMs([&]() { listed.ResolveCollisions(neighbours, list_narrowphase); }) / STEPS;
+            listed.UpdateRK(dt);
+        }
+        bool identical = true;
+        for (int i = 0; i < n && identical; i++)
+            identical = (listed.Position(i) == hashed.Position(i) && listed.Velocity(i) == hashed.Velocity(i));
+        std::cout << "   > skin " << skin << ":  " << list_ms << " ms  (" << hash_ms / list_ms << "x),  " << neighbours.stats.rebuilds
+                  << " rebuilds (every " << neighbours.stats.StepsPerRebuild() << " steps),  " << (double)neighbours.pairs.size() / n
+                  << " pairs per particle,  " << neighbours.stats.bytes / 1024 << " KB" << verdict(identical) << std::endl;
+    }
+}
+
+
+
+// Times a ParticleSystem frame (collisions, RK4 step and energy) run serially against the same frame run as a FrameGraph
+// on a JobSystem, for growing thread counts, checks every thread count ends up in the serial loop's state,
+// and prints the per-stage timings of the largest pool.
+void benchmarkFrameGraph(int n)
+{
+    ParticleSystem start(1e9f, 1e9f);
+    for (auto& particle : makeParticles(n, 42u))
+    {
+        particle.state.position = particle.state.position + Vec2D(1000.0f, 1000.0f);
+        start.Add(particle);
+    }
+    const float dt = 1.0f / 60.0f;
+    std::vector<int> thread_counts;
+    for (int threads = 1; threads < (int)std::thread::hardware_concurrency(); threads *= 2)
+        thread_counts.push_back(threads);
+    thread_counts.push_back((int)std::max(1u, std::thread::hardware_concurrency()));
+
+    ParticleSystem serial = start;
+    SpatialHash grid;
+    BatchNarrowphase narrowphase;
+    float serial_energy = 0.0f;
+    double serial_ms = timeMs([&]() {
+        for (int f = 0; f < FRAMES; f++) {
+            serial.ResolveCollisions(grid, narrowphase);
+            serial.UpdateRK(dt);
+            serial_energy = serial.TotalEnergy();
+        }
+    }) / FRAMES;
+
+    std::cout << std::endl << "Frame task graph: " << n << " particles, ms per frame (" << FRAMES << " frames)" << std::endl;
+    std::cout << "   > serial:      " << serial_ms << " ms" << std::endl;
+    for (int threads : thread_counts)
+    {
+        ParticleSystem system = start;
+        JobSystem jobs(threads);
+        FrameGraph frame(system, dt);
+        frame.build_vertices = false;
+        double ms = timeMs([&]() { for (int f = 0; f < FRAMES; f++) frame.Step(jobs); }) / FRAMES;
+
+        bool identical = true;
+        for (int i = 0; i < n && identical; i++)
+            identical = (system.Position(i) == serial.Position(i) && system.Velocity(i) == serial.Velocity(i));
+        std::cout << "   > " << std::setw(3) << threads << " threads:  " << ms << " ms  (energy " << frame.energy << " vs " << serial_energy << ")"
+                  << verdict(identical) << std::endl;
+        if (threads == thread_counts.back())
+            std::cout << frame.graph << std::endl << "   " << jobs.GetStats() << std::endl;
+    }
+}
+
+
+
+// Scatters n charges of +-1 microcoulomb (half of each sign) uniformly over a square the size makeParticles would use.
+void makeCharges(int n, unsigned int seed, std::vector<Vec2D>& centers, std::vector<float>& charges)
+{
+    std::mt19937 rng(seed);
+    float side = std::sqrt(n * 3.14159265f * 15.0f * 15.0f / COVERAGE);
+    std::uniform_real_distribution<float> position(0.0f, side);
+    centers.resize(n);
+    charges.resize(n);
+    for (int i = 0; i < n; i++)
+    {
+        centers[i] = Vec2D(position(rng), position(rng));
+        charges[i] = (i % 2 == 0) ? 1e-6f : -1e-6f;
+    }
+}
+
+
+// Times the Barnes-Hut tree (build and solve) for a few opening angles against the direct sum over all pairs,
+// and reports the force and potential errors against the direct sum.
+void benchmarkBarnesHut(int n)
+{
+    std::vector<Vec2D> centers;
+    std::vector<float> charges;
+    makeCharges(n, 42u, centers, charges);
+    ThreadPool pool;
+
+    std::vector<Vec2D> direct_forces;
+    std::vector<float> direct_potentials;
+    double direct_ms = timeMs([&]() { BarnesHut::DirectSum(centers, charges, 1.0f, direct_forces, direct_potentials, &pool); });
+
+    std::cout << std::endl << "Barnes-Hut Coulomb forces: " << n << " charges, " << pool.Size() << " threads" << std::endl;
+    std::cout << "   > direct sum:   " << direct_ms << " ms" << std::endl;
+    for (float theta : { 0.3f, 0.5f, 0.7f, 1.0f })
+    {
+        BarnesHut tree(theta, 1.0f);
+        double build_ms = timeMs([&]() { tree.Build(centers, charges); });
+        double solve_ms = timeMs([&]() { tree.Solve(&pool); });
+        const BarnesHut::Error error = BarnesHut::Compare(tree.forces, tree.potentials, direct_forces, direct_potentials);
+        std::cout << "   > theta " << theta << ":  build " << build_ms << " ms,  solve " << solve_ms << " ms  ("
+                  << direct_ms / (build_ms + solve_ms) << "x),  " << (double)(tree.stats.cell_terms + tree.stats.pair_terms) / n
+                  << " terms per charge,  force error rms " << std::scientific << error.force_rms << " max " << error.force_max
+                  << ",  potential error rms " << error.potential_rms << std::fixed << std::endl;
+    }
+}
+
+
+// Times the tiled all-pairs Coulomb sum with each instruction set, and threaded, for a few sizes up to n,
+// against the double-precision direct sum (one pass per charge over all the others), and reports the errors against it.
+void benchmarkTiledCoulomb(int n)
+{
+    ThreadPool pool;
+    std::cout << std::endl << "Tiled Coulomb direct sum: " << pool.Size() << " threads" << std::endl;
+    for (int size : { 1000, 5000, 20000, 50000 })
+    {
+        if (size > n) break;
+        std::vector<Vec2D> centers;
+        std::vector<float> charges;
+        makeCharges(size, 42u, centers, charges);
+
+        std::vector<Vec2D> direct_forces, forces;
+        std::vector<float> direct_potentials, potentials;
+        double direct_ms = timeMs([&]() { BarnesHut::DirectSum(centers, charges, 1.0f, direct_forces, direct_potentials); });
+        std::cout << "   > " << size << " charges:  direct sum " << direct_ms << " ms" << std::endl;
+
+        for (int level = BatchNarrowphase::SCALAR; level <= BatchNarrowphase::Detect(); level++)
+        {
+            TiledCoulomb tiled(1.0f, 0.0f, (BatchNarrowphase::Level)level);
+            tiled.Load(centers, charges);
+            double ms = timeMs([&]() { tiled.Solve(); });
+            double threaded_ms = (pool.Size() > 1) ? timeMs([&]() { tiled.Solve(&pool); }) : ms;
+            tiled.Results(forces, potentials);
+            const BarnesHut::Error error = BarnesHut::Compare(forces, potentials, direct_forces, direct_potentials);
+            std::cout << "        " << std::left << std::setw(8) << BatchNarrowphase::Name(tiled.level) << std::right << ms << " ms  ("
+                      << direct_ms / ms << "x),  threaded " << threaded_ms << " ms  (" << direct_ms / threaded_ms << "x),  "
+                      << (double)size * (size - 1) / 2 / (ms * 1e3) << " M pairs/s,  force error rms " << std::scientific
+                      << error.force_rms << " max " << error.force_max << ",  potential error rms " << error.potential_rms << std::fixed << std::endl;
+        }
+    }
+}
+
+
+// Times the fast multipole method at a few expansion orders, and Barnes-Hut, for n charges,
+// and reports their errors against the tiled direct sum.
+void benchmarkFastMultipole(int n)
+{
+    std::vector<Vec2D> centers;
+    std::vector<float> charges;
+    makeCharges(n, 42u, centers, charges);
+    ThreadPool pool;
+
+    TiledCoulomb direct(1.0f);
+    direct.Load(centers, charges);
+    double direct_ms = timeMs([&]() { direct.Solve(&pool); });
+    std::vector<Vec2D> direct_forces;
+    std::vector<float> direct_potentials;
+    direct.Results(direct_forces, direct_potentials);
+
+    std::cout << std::endl << "Fast multipole Coulomb forces: " << n << " charges, " << pool.Size() << " threads" << std::endl;
+    std::cout << "   > tiled direct sum:   " << direct_ms << " ms" << std::endl;
+    for (int order : { 4, 8, 12 })
+    {
+        FastMultipole fmm(order, 1.0f);
+        double build_ms = timeMs([&]() { fmm.Build(centers, charges); });
+        double solve_ms = timeMs([&]() { fmm.Solve(&pool); });
+        const BarnesHut::Error error = BarnesHut::Compare(fmm.forces, fmm.potentials, direct_forces, direct_potentials);
+        std::cout << "   > order " << order << ":  build " << build_ms << " ms,  solve " << solve_ms << " ms  (" << direct_ms / (build_ms + solve_ms)
+                  << "x),  " << fmm.stats.levels << " levels,  force error rms " << std::scientific << error.force_rms << " max " << error.force_max
+                  << ",  potential error rms " << error.potential_rms << ",  bound " << FastMultipole::ErrorBound(order) << std::fixed << std::endl;
+    }
+
+    BarnesHut tree(0.5f, 1.0f);
+    double tree_ms = timeMs([&]() { tree.Build(centers, charges); tree.Solve(&pool); });
+    const BarnesHut::Error error = BarnesHut::Compare(tree.forces, tree.potentials, direct_forces, direct_potentials);
+    std::cout << "   > Barnes-Hut, theta 0.5:  " << tree_ms << " ms  (" << direct_ms / tree_ms << "x),  force error rms "
+              << std::scientific << error.force_rms << std::fixed << std::endl;
+}
+
+
+// Times the particle-mesh solver for n charges, with the grid spacing at half the mean distance between charges
+// and a few cutoffs, and reports its errors against the tiled direct sum.
+void benchmarkParticleMesh(int n)
+{
+    std::vector<Vec2D> centers;
+    std::vector<float> charges;
+    makeCharges(n, 42u, centers, charges);
+    ThreadPool pool;
+
+    TiledCoulomb direct(1.0f);
+    direct.Load(centers, charges);
+    double direct_ms = timeMs([&]() { direct.Solve(&pool); });
+    std::vector<Vec2D> direct_forces;
+    std::vector<float> direct_potentials;
+    direct.Results(direct_forces, direct_potentials);
+
+    const float spacing = std::sqrt(3.14159265f * 15.0f * 15.0f / COVERAGE);     // as in makeCharges
+    std::cout << std::endl << "Particle-mesh Coulomb forces: " << n << " charges, " << pool.Size() << " threads" << std::endl;
+    std::cout << "   > tiled direct sum:   " << direct_ms << " ms" << std::endl;
+    for (int cells : { 4, 6, 8 })
+    {
+        ParticleMesh mesh(0.5f * spacing, 0.5f * spacing * cells, 1.0f);
+        double build_ms = timeMs([&]() { mesh.Build(centers, charges); });
+        mesh.Solve(&pool);      // the first Solve on a new grid also works out the kernel's spectrum
+        double solve_ms = timeMs([&]() { mesh.Solve(&pool); });
+        const BarnesHut::Error error = BarnesHut::Compare(mesh.forces, mesh.potentials, direct_forces, direct_potentials);
+        std::cout << "   > cutoff " << cells << " cells:  " << mesh.grid_x << "x" << mesh.grid_y << " grid,  build " << build_ms << " ms,  solve "
+                  << solve_ms << " ms  (" << direct_ms / (build_ms + solve_ms) << "x),  " << (double)mesh.stats.pair_terms / n
+                  << " pairs per charge,  force error rms " << std::scientific << error.force_rms << ",  potential error rms "
+                  << error.potential_rms << std::fixed << std::endl;
+    }
+}
+
+
+// Times the multigrid solver for n charges inside a Wire, from zero and then warm-started over a few steps in which every
+// charge moves a little, and reports the residual and force error each step is left with against a solve run to convergence.
+void benchmarkMultigrid(int n)
+{
+    std::vector<Vec2D> centers;
+    std::vector<float> charges;
+    makeCharges(n, 42u, centers, charges);
+    ThreadPool pool;
+
+    const float side = std::sqrt(n * 3.14159265f * 15.0f * 15.0f / COVERAGE);     // as in makeCharges
+    Wire wire(20.0f);
+    wire.SetBounds(-20.0f, side + 20.0f, -20.0f, side + 20.0f);
+    MultigridPoisson grid(wire, 0.5f * std::sqrt(3.14159265f * 15.0f * 15.0f / COVERAGE), 50, 1e-6f);
+    MultigridPoisson converged(wire, grid.cell, 50, 1e-6f);
+
+    std::cout << std::endl << "Multigrid potential in a wire: " << n << " charges, " << grid.stats.nodes_x << "x" << grid.stats.nodes_y
+              << " grid, " << grid.stats.levels << " levels, " << pool.Size() << " threads" << std::endl;
+    grid.Build(centers, charges);
+    double cold_ms = timeMs([&]() { grid.Reset(); grid.Solve(&pool); });
+    std::cout << "   > from zero:     " << cold_ms << " ms,  " << grid.stats.cycles << " V-cycles to residual " << std::scientific
+              << grid.stats.residual << std::fixed << std::endl;
+
+    std::mt19937 rng(7u);
+    std::normal_distribution<float> nudge(0.0f, 0.5f);
+    grid.cycles = 2;
+    grid.tolerance = 1e-4f;
+    for (int step = 1; step <= 4; step++)
+    {
+        for (Vec2D& center : centers)
+            center = Vec2D(std::max(0.0f, std::min(side, center.x + nudge(rng))), std::max(0.0f, std::min(side, center.y + nudge(rng))));
+        grid.Build(centers, charges);
+        double warm_ms = timeMs([&]() { grid.Solve(&pool); });
+        converged.Build(centers, charges);
+        converged.Solve(&pool);
+        const BarnesHut::Error error = BarnesHut::Compare(grid.forces, grid.potentials, converged.forces, converged.potentials);
+        std::cout << "   > warm step " << step << ":     " << warm_ms << " ms,  " << grid.stats.cycles << " V-cycles to residual "
+                  << std::scientific << grid.stats.residual << ",  force error rms " << error.force_rms << std::fixed << std::endl;
+    }
+}
+
+
+
+// A point mass at (cx, cy) pulling every ball towards it, softened so a close pass doesn't blow up.
+// Unlike gravity, it changes over a step, so it's what separates the schemes' energy behaviour.
+struct CentralGravity
+{
+    float cx, cy;
+    float gm;               // G times the point mass.
+    float softening2;       // Softening length squared.
+
+    void operator()(const ParticleSystem& system, const float* x, const float* y, float* ax, float* ay) const
+    {
+        for (int i = 0; i < system.Size(); i++)
+        {
+            const float dx = cx - (x[i] + system.radius[i]);
+            const float dy = cy - (y[i] + system.radius[i]);
+            const float d2 = dx * dx + dy * dy + softening2;
+            const float s = gm / (d2 * std::sqrt(d2));
+            ax[i] = dx * s;
+            ay[i] = dy * s;
+        }
+    }
+};
+
+
+// Total energy of the system in each field, summed in double so the sum doesn't add error of its own.
+double fieldEnergy(const ParticleSystem& system, const UniformGravity&)
+{
+    double energy = 0.0;
+    for (int i = 0; i < system.Size(); i++)
+        energy += 0.5 * system.mass[i] * ((double)system.vx[i] * system.vx[i] + (double)system.vy[i] * system.vy[i])
+                + (double)system.mass[i] * g.y * (system.height - system.y[i] - system.radius[i] * 2.0);
+    return energy;
+}
+
+double fieldEnergy(const ParticleSystem& system, const CentralGravity& field)
+{
+    double energy = 0.0;
+    for (int i = 0; i < system.Size(); i++)
+    {
+        const double dx = field.cx - (system.x[i] + system.radius[i]);
+        const double dy = field.cy - (system.y[i] + system.radius[i]);
+        energy += 0.5 * system.mass[i] * ((double)system.vx[i] * system.vx[i] + (double)system.vy[i] * system.vy[i])
+                - system.mass[i] * field.gm / std::sqrt(dx * dx + dy * dy + field.softening2);
+    }
+    return energy;
+}
+
+
+double fieldEnergy(const ParticleSystem& system, const CoulombField& field)
+{
+    double energy = 0.0;
+    for (int i = 0; i < system.Size(); i++)
+        energy += 0.5 * system.mass[i] * ((double)system.vx[i] * system.vx[i] + (double)system.vy[i] * system.vy[i]);
+    for (int i = 0; i < system.Size(); i++)
+        for (int j = i + 1; j < system.Size(); j++)
+        {
+            const double dx = (system.x[i] + system.radius[i]) - (system.x[j] + system.radius[j]);
+            const double dy = (system.y[i] + system.radius[i]) - (system.y[j] + system.radius[j]);
+            energy += 8.987551787e9 * field.charge[i] * field.charge[j] / std::sqrt(dx * dx + dy * dy + field.softening);
+        }
+    return energy;
+}
+
+
+// Runs one scheme for `steps` steps from `start`, and prints its cost per particle per step
+// and its energy drift (at the end, and the largest seen along the way) relative to the starting energy.
+template <typename Scheme, typename Field>
+void benchmarkScheme(const ParticleSystem& start, const Field& field, int steps, float dt)
+{
+    ParticleSystem system = start;
+    Integrator<Scheme, Field> integrator(field);
+    const double e0 = fieldEnergy(system, field);
+    double worst = 0.0;
+    double ms = 0.0;
+    for (int done = 0; done < steps; done += 1000)
+    {
+        const int block = std::min(1000, steps - done);
+        ms += timeMs([&]() { for (int s = 0; s < block; s++) integrator.Step(system, dt); });
+        worst = std::max(worst, std::abs(fieldEnergy(system, field) - e0));
+    }
+    const double drift = (fieldEnergy(system, field) - e0) / std::abs(e0);
+
+    std::cout << "   > " << std::left << std::setw(18) << Integrator<Scheme, Field>::Name() << std::right
+              << std::setw(3) << Scheme::EVALUATIONS << " field samples,  " << std::setw(7) << ms * 1e6 / ((double)steps * system.Size()) << " ns per particle-step,  "
+              << "energy drift " << std::scientific << std::setprecision(2) << std::setw(10) << drift
+              << " (worst " << worst / std::abs(e0) << ")" << std::fixed << std::setprecision(3) << std::endl;
+}
+
+
+// Compares the integration schemes on n balls for `steps` steps: under the world's gravity, bouncing off the walls,
+// and orbiting a point mass. ParticleSystem::UpdateRK (Particle2D's RK4 step and wall handling) is timed too for reference.
+void benchmarkIntegrators(int n, int steps)
+{
+    const float dt = 1.0f / 60.0f;
+    std::mt19937 rng(42u);
+    std::uniform_real_distribution<float> radius(10.0f, 20.0f);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+    ParticleSystem box(800.0f, 600.0f);
+    for (int i = 0; i < n; i++)
+        box.Add("", 1.0f, radius(rng), sf::Color::White, Vec2D(unit(rng) * 760.0f, unit(rng) * 560.0f),
+                Vec2D(unit(rng) * 200.0f - 100.0f, unit(rng) * 200.0f - 100.0f), 1.0f);
+
+    // Orbits of radius 100-400 around the middle of a box big enough that nothing reaches the walls
+    CentralGravity central = { 5000.0f, 5000.0f, 1e6f, 1.0f };
+    ParticleSystem orbits(10000.0f, 10000.0f);
+    for (int i = 0; i < n; i++)
+    {
+        const float r = 100.0f + 300.0f * unit(rng);
+        const float angle = 6.2831853f * unit(rng);
+        const float speed = std::sqrt(central.gm / r) * (0.8f + 0.3f * unit(rng));
+        const float size = radius(rng);
+        orbits.Add("", 1.0f, size, sf::Color::White, Vec2D(central.cx + r * std::cos(angle) - size, central.cy + r * std::sin(angle) - size),
+                   Vec2D(-speed * std::sin(angle), speed * std::cos(angle)), 1.0f);
+    }
+
+    std::cout << std::endl << "Integrators: " << n << " particles, " << steps << " steps of " << dt << " s" << std::endl;
+    std::cout << "   Gravity, bouncing off the walls:" << std::endl;
+    benchmarkScheme<SymplecticEuler>(box, UniformGravity(), steps, dt);
+    benchmarkScheme<VelocityVerlet>(box, UniformGravity(), steps, dt);
+    benchmarkScheme<Leapfrog>(box, UniformGravity(), steps, dt);
+    benchmarkScheme<RK4>(box, UniformGravity(), steps, dt);
+    {
+        ParticleSystem system = box;
+        const double e0 = fieldEnergy(system, UniformGravity());
+        const double ms = timeMs([&]() { for (int s = 0; s < steps; s++) system.UpdateRK(dt); });
+        std::cout << "   > " << std::left << std::setw(18) << "UpdateRK" << std::right << std::setw(3) << 4 << " field samples,  "
+                  << std::setw(7) << ms * 1e6 / ((double)steps * n) << " ns per particle-step,  energy drift " << std::scientific << std::setprecision(2)
+                  << std::setw(10) << (fieldEnergy(system, UniformGravity()) - e0) / std::abs(e0) << std::fixed << std::setprecision(3) << std::endl;
+    }
+    std::cout << "   Orbiting a point mass:" << std::endl;
+    benchmarkScheme<SymplecticEuler>(orbits, central, steps, dt);
+    benchmarkScheme<VelocityVerlet>(orbits, central, steps, dt);
+    benchmarkScheme<Leapfrog>(orbits, central, steps, dt);
+    benchmarkScheme<RK4>(orbits, central, steps, dt);
+}
+
+
+
+// Compares fixed-step RK4 (with 1 to 1000 substeps per frame) against adaptive Dormand-Prince (at a few tolerances)
+// on n unit charges (as made by ChargedParticle("+"/"-", 5)) fired across the 800x600 box at 3000 px/s, over `frames` frames of main.cpp's dt.
+// Opposite charges swing hard around each other as they pass, so the field is stiff for brief moments and quiet in between.
+void benchmarkAdaptive(int n, int frames)
+{
+    const float dt = 5.0f / 60.0f;
+    std::mt19937 rng(7u);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    ParticleSystem start(800.0f, 600.0f);
+    CoulombField field;
+    field.softening = 25.0f;
+    for (int i = 0; i < n; i++)
+    {
+        const float angle = 6.2831853f * unit(rng);
+        start.Add(i % 2 ? "-" : "+", 0.000001f, 5.0f, sf::Color::White, Vec2D(50.0f + unit(rng) * 700.0f, 50.0f + unit(rng) * 500.0f),
+                  Vec2D(std::cos(angle), std::sin(angle)) * 3000.0f, 1.0f);
+        field.charge.push_back(i % 2 ? -0.00005f : 0.00005f);
+    }
+    const double e0 = fieldEnergy(start, field);
+
+    std::cout << std::endl << "Adaptive stepping: " << n << " charges, " << frames << " frames of " << dt << " s" << std::endl;
+    for (int substeps : { 1, 10, 100, 1000 })
+    {
+        ParticleSystem system = start;
+        Integrator<RK4, CoulombField> integrator(field);
+        const double ms = timeMs([&]() {
+            for (int f = 0; f < frames; f++)
+                for (int s = 0; s < substeps; s++)
+                    integrator.Step(system, dt / substeps);
+        });
+        std::cout << "   > RK4, " << std::setw(4) << substeps << " substeps:          " << std::setw(6) << 4 * substeps << " field samples per frame,  "
+                  << std::setw(8) << ms / frames << " ms per frame,  energy drift " << std::scientific << std::setprecision(2)
+                  << (fieldEnergy(system, field) - e0) / std::abs(e0) << std::fixed << std::setprecision(3) << std::endl;
+    }
+    for (float tolerance : { 1e-3f, 1e-4f, 1e-5f })
+    {
+        ParticleSystem system = start;
+        Integrator<DormandPrince, CoulombField> integrator(field);
+        integrator.scheme.relative_tolerance = tolerance;
+        integrator.scheme.absolute_tolerance = tolerance;
+        long long accepted = 0, rejected = 0, evaluations = 0;
+        float smallest = dt, largest = 0.0f;
+        const double ms = timeMs([&]() {
+            for (int f = 0; f < frames; f++)
+            {
+                integrator.Step(system, dt);
+                const DormandPrince::Stats& stats = integrator.scheme.stats;
+                accepted += stats.accepted;
+                rejected += stats.rejected;
+                evaluations += stats.evaluations;
+                smallest = std::min(smallest, stats.smallest);
+                largest = std::max(largest, stats.largest);
+            }
+        });
+        std::cout << "   > Dormand-Prince, tol " << std::scientific << std::setprecision(0) << tolerance << std::fixed << std::setprecision(3) << ":  "
+                  << std::setw(6) << (double)evaluations / frames << " field samples per frame,  " << std::setw(8) << ms / frames << " ms per frame,  energy drift "
+                  << std::scientific << std::setprecision(2) << (fieldEnergy(system, field) - e0) / std::abs(e0) << std::fixed << std::setprecision(3)
+                  << "  (" << accepted << " substeps accepted, " << rejected << " rejected, " << smallest * 1000.0f << "-" << largest * 1000.0f << " ms long)" << std::endl;
+    }
+}
+
+
+
+int main(int argc, char** argv)
+{
+    int max_particles = (argc > 1) ? std::atoi(argv[1]) : 1000000;
+    int max_all_pairs = (argc > 2) ? std::atoi(argv[2]) : 10000;
+
+    std::cout << std::fixed << std::setprecision(3);
+    benchmarkBroadphase(max_particles, max_all_pairs);
+    benchmarkMixedRadii(std::min(max_particles, 100000));
+    benchmarkCollisionResponse();
+    benchmarkNarrowphase(std::min(max_particles, 200000));
+    benchmarkParallelCollisions(std::min(max_particles, 1000000));
+    benchmarkParticleSystem(std::min(max_particles, 200000));
+    benchmarkBatchIntegrator(std::min(max_particles, 200000));
+    benchmarkFrameGraph(std::min(max_particles, 200000));
+    benchmarkVerletList(std::min(max_particles, 200000));
+    benchmarkBarnesHut(std::min(max_particles, 20000));
+    benchmarkTiledCoulomb(std::min(max_particles, 20000));
+    benchmarkFastMultipole(std::min(max_particles, 100000));
+    benchmarkParticleMesh(std::min(max_particles, 100000));
+    benchmarkMultigrid(std::min(max_particles, 100000));
+    benchmarkIntegrators(std::min(max_particles, 64), 1000000);
+    benchmarkAdaptive(std::min(max_particles, 16), 600);
+
+    if (mismatches > 0)
+        std::cout << std::endl << mismatches << " check(s) didn't match their reference" << std::endl;
+    return (mismatches == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -1,21 +1,45 @@
+#include <atomic>
+#include <thread>
 #include <vector>
 #include "src/sim/Utils.hpp"
 #include "src/sim/Events.hpp"
+#include "src/sim/SpatialHash.hpp"
+#include "src/sim/SimulationClock.hpp"
+#include "src/sim/Headless.hpp"
+#include "src/sim/TripleBuffer.hpp"
+#include "src/sim/Snapshot.hpp"
 
 const int W = 800;
 const int H = 600;
 
-const int FPS = 60;
-float dt = 5.0f / FPS;
+const int FPS = 60;                 // Frames drawn per second
+const float TIME_SCALE = 5.0f;      // Simulation seconds per real second
+const int STEPS_PER_FRAME = 1;      // Physics steps per frame at FPS (the step is TIME_SCALE / (FPS * STEPS_PER_FRAME))
+float dt = TIME_SCALE / (FPS * STEPS_PER_FRAME);
 
+// Run the physics as fast as possible, publishing a snapshot to draw only every TURBO_RENDER_EVERY steps
+const bool TURBO = false;
+const int TURBO_RENDER_EVERY = 100;
 
+// Use the exact event-driven engine (perfectly elastic) instead of the fixed-step loop
+const bool EVENT_DRIVEN = false;
 
-int main()
+
+
+int main(int argc, char** argv)
 {
+    // `main --headless [options]` runs the physics with no window (see Headless.hpp for the options)
+    for (int i = 1; i < argc; i++)
+        if (std::string(argv[i]) == "--headless")
+            return runHeadless(argc, argv);
+
     sf::RenderWindow window(sf::VideoMode(W,H), "Bouncing Balls");
     window.setFramerateLimit(FPS);
 
     std::vector<Particle2D> particles;
+    SpatialHash broadphase;
+    ContactManager contacts;
+    SleepManager sleep;
 
     Particle2D testParticle = Particle2D("Test Particle 1", 1.0f, 10.0f, sf::Color::Blue, Vec2D(90.0f, 50.0f), Vec2D(60.0f, 50.0f), g, 0.99825f);
     Particle2D testParticle2 = Particle2D("Test Particle 2", 1.0f, 10.0f, sf::Color::Red, Vec2D(100.0f, 100.0f), Vec2D(0.0f, -50.0f), g, 0.99825f);
@@ -55,23 +79,85 @@ int main()
     particles.push_back(testParticle17);
     particles.push_back(testParticle18);
 
-    int iter = 0;
-    double t = 0.0;
+    EventDrivenSimulation simulation(0.0f, W, 0.0f, H, g);
+    if (EVENT_DRIVEN)
+        loadEventDriven(particles, simulation);
+
+    // The physics runs on its own thread and publishes a snapshot of the particles after every batch of steps,
+    // while this thread draws the newest snapshot at the display rate, so neither ever waits for the other.
+    TripleBuffer<Snapshot> snapshots;
+    std::atomic<bool> running(true);
+
+    std::thread physics([&]()
+    {
+        SimulationClock clock(dt, TIME_SCALE);
+        clock.turbo = TURBO;
+        clock.render_every = TURBO_RENDER_EVERY;
+
+        int iter = 0;
+        double t = 0.0;
 
+        while (running)
+        {
+            const int steps = clock.Tick();
+            if (steps == 0) {
+                std::this_thread::sleep_for(std::chrono::duration<double>(clock.NextStepIn()));
+                continue;
+            }
+
+            // The positions one step before the last are kept in the snapshot, so frames can be drawn between the two
+            Snapshot& snapshot = snapshots.Back();
+            if (EVENT_DRIVEN)
+            {
+                t = clock.Time();
+                simulation.Advance(t - dt);
+                storeEventDriven(simulation, t - dt, particles);
+                savePositions(particles, snapshot.previous);
+                simulation.Advance(t);
+                storeEventDriven(simulation, t, particles);
+            }
+            else
+            {
+                for (int s = 0; s < steps; s++)
+                {
+                    if (s == steps - 1)
+                        savePositions(particles, snapshot.previous);
+                    resolveCollisions(particles, broadphase, contacts, sleep);
+                    stepRK(particles, t, dt, iter, FPS*50, contacts, sleep);
+                    t += dt;
+                    iter+=1;
+                }
+            }
+
+            snapshot.Capture(particles);
+            snapshot.step = iter;
+            snapshot.time = t;
+            snapshot.last_steps = steps;
+            snapshot.alpha = clock.Alpha();
+            snapshot.taken = std::chrono::steady_clock::now();
+            snapshot.awake = sleep.stats.awake;
+            snapshot.asleep = sleep.stats.asleep;
+            snapshots.Publish();
+        }
+    });
+
+    SnapshotRenderer renderer;
     while (window.isOpen())
     {
         event::CheckForClose(window);
-        window.clear();
-
-        resolveCollisions(particles);
-        // update(particles, dt, window, iter, FPS*5);
-        updateRK(particles, t, dt, window, iter, FPS*50);
+        const Snapshot& snapshot = snapshots.Front();
 
+        window.clear();
+        renderer.Draw(snapshot, snapshot.Alpha(dt / TIME_SCALE), window);
+        if (!EVENT_DRIVEN)
+            window.setTitle("Bouncing Balls  |  awake: " + std::to_string(snapshot.awake) + "  asleep: " + std::to_string(snapshot.asleep)
+                            + "  |  steps/batch: " + std::to_string(snapshot.last_steps));
         window.display();
-        t += dt;
-        iter+=1;
     }
 
+    running = false;
+    physics.join();
+
 
     return EXIT_SUCCESS;
 }
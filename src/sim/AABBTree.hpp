@@ -0,0 +1,521 @@
+/********************
+*
+*    AABBTree.hpp
+*
+*    Defines the AABBTree class, a dynamic bounding volume hierarchy
+*    used as a collision broadphase and for ray casts and region queries.
+*
+*********************/
+
+#pragma once
+#include <cmath>
+#include <chrono>
+#include <vector>
+#include <utility>
+#include <iostream>
+#include <algorithm>
+#include "Vec2D.hpp"    // includes:  <cmath> and <SFML/Graphics.hpp>
+
+
+
+
+
+/*  An axis-aligned bounding box.  */
+struct AABB
+{
+    Vec2D lower;        // The top-left corner of the box.
+    Vec2D upper;        // The bottom-right corner of the box.
+
+    AABB() : lower(0, 0), upper(0, 0) { }
+    AABB(const Vec2D& lower, const Vec2D& upper) : lower(lower), upper(upper) { }
+
+    /*  Returns the box around a circle, grown on every side by a margin.
+     *  @param center: The center of the circle.
+     *  @param radius: The radius of the circle.
+     *  @param margin: The extra space to leave on every side.  */
+    static AABB AroundCircle(const Vec2D& center, float radius, float margin = 0.f) {
+        float r = radius + margin;
+        return AABB(Vec2D(center.x - r, center.y - r), Vec2D(center.x + r, center.y + r));
+    }
+
+    /*  Returns the smallest box containing both given boxes.  */
+    static AABB Union(const AABB& a, const AABB& b) {
+        return AABB(Vec2D(std::min(a.lower.x, b.lower.x), std::min(a.lower.y, b.lower.y)),
+                    Vec2D(std::max(a.upper.x, b.upper.x), std::max(a.upper.y, b.upper.y)));
+    }
+
+    /*  Returns the perimeter of the box, which is the cost metric used when building the tree.  */
+    float Perimeter() const { return 2.f * ((upper.x - lower.x) + (upper.y - lower.y)); }
+
+    /*  Returns true if this box overlaps (or touches) another.  */
+    bool Overlaps(const AABB& box) const {
+        return !(box.lower.x > upper.x || box.lower.y > upper.y || lower.x > box.upper.x || lower.y > box.upper.y);
+    }
+
+    /*  Returns true if this box entirely contains another.  */
+    bool Contains(const AABB& box) const {
+        return lower.x <= box.lower.x && lower.y <= box.lower.y && box.upper.x <= upper.x && box.upper.y <= upper.y;
+    }
+};
+
+
+
+
+
+
+/*  Dynamic AABB tree (bounding volume hierarchy) over a set of circular particles.
+ *  Each particle is a leaf holding a "fat" box, i.e. its bounding box grown by a margin.
+ *  From frame to frame, only the leaves whose particle has moved outside of its fat box are
+ *  removed and reinserted (which refits their ancestors on the way); everything else is left alone.
+ *  The tree is kept balanced with rotations, so pair, ray and region queries all run in O(log N).
+ *  It doesn't rely on a cell size, so it copes with very mixed radii.
+ *  Has the same FindPairs(centers, radii) interface as the other broadphases.  */
+class AABBTree
+{
+public:
+    float margin;                               // How far each leaf's fat box extends beyond the particle's own bounding box.
+    std::vector<std::pair<int,int>> pairs;      // Candidate pairs found on the last call to FindPairs.
+
+    /*  Costs of the last call to Update (or FindPairs), for tuning the margin.  */
+    struct Stats
+    {
+        bool rebuilt = false;       // Whether the whole tree was rebuilt (happens when the particle count changes).
+        int reinserted = 0;         // Number of leaves that escaped their fat box and were reinserted.
+        double rebuild_ms = 0.0;    // Time spent rebuilding the tree from scratch.
+        double refit_ms = 0.0;      // Time spent checking leaves and reinserting the ones that escaped.
+        double query_ms = 0.0;      // Time spent collecting the candidate pairs.
+    };
+    Stats stats;
+
+
+    AABBTree() : margin(2.f), root(-1), free_list(-1) { }
+    AABBTree(float margin) : margin(margin), root(-1), free_list(-1) { }
+
+    void Rebuild(const std::vector<Vec2D>& centers, const std::vector<float>& radii);
+    void Update(const std::vector<Vec2D>& centers, const std::vector<float>& radii);
+    const std::vector<std::pair<int,int>>& FindPairs(const std::vector<Vec2D>& centers, const std::vector<float>& radii);
+
+    void Query(const AABB& region, std::vector<int>& found) const;
+    int RayCast(const Vec2D& origin, const Vec2D& direction, float max_distance, float& hit_distance) const;
+
+    int Height() const { return (root == -1) ? 0 : nodes[root].height; }
+
+
+private:
+    /*  A node of the tree. Leaves hold a particle; internal nodes hold two children.  */
+    struct Node
+    {
+        AABB box;           // Fat box for leaves; union of the children's boxes for internal nodes.
+        int parent;         // Parent node (or the next free node, while on the free list).
+        int child1;         // First child (-1 for leaves).
+        int child2;         // Second child (-1 for leaves).
+        int height;         // Height of the subtree (0 for leaves, -1 for free nodes).
+        int particle;       // Index of the particle held by a leaf.
+
+        bool IsLeaf() const { return child1 == -1; }
+    };
+
+    std::vector<Node> nodes;            // Node pool.
+    std::vector<int> leaf_of;           // Leaf node of each particle.
+    std::vector<AABB> tight;            // Exact bounding box of each particle, as of the last update.
+    std::vector<Vec2D> centers;         // Center of each particle, as of the last update.
+    std::vector<float> radii;           // Radius of each particle, as of the last update.
+    int root;                           // Root node (-1 when empty).
+    int free_list;                      // First free node in the pool (-1 when none).
+
+    int AllocateNode();
+    void FreeNode(int node);
+    void InsertLeaf(int leaf);
+    void RemoveLeaf(int leaf);
+    int Balance(int node);
+
+    /*  Overloaded << for printing the tree's per-frame costs.  */
+    friend std::ostream& operator<<(std::ostream& os, const AABBTree& tree)
+    {
+        os << "AABBTree: " << tree.leaf_of.size() << " leaves, height " << tree.Height()
+           << (tree.stats.rebuilt ? ", rebuilt in " : ", rebuild ") << tree.stats.rebuild_ms << " ms"
+           << ", refit " << tree.stats.refit_ms << " ms (" << tree.stats.reinserted << " reinserted)"
+           << ", pair query " << tree.stats.query_ms << " ms (" << tree.pairs.size() << " pairs)";
+        return os;
+    }
+};
+
+
+
+
+
+
+/*  Takes a node from the free list, growing the pool if it's empty.  */
+int AABBTree::AllocateNode()
+{
+    if (free_list == -1) {
+        nodes.push_back(Node());
+        nodes.back().parent = -1;
+        free_list = (int)nodes.size() - 1;
+    }
+    int node = free_list;
+    free_list = nodes[node].parent;
+    nodes[node].parent = -1;
+    nodes[node].child1 = -1;
+    nodes[node].child2 = -1;
+    nodes[node].height = 0;
+    nodes[node].particle = -1;
+    return node;
+}
+
+
+/*  Returns a node to the free list.  */
+void AABBTree::FreeNode(int node)
+{
+    nodes[node].parent = free_list;
+    nodes[node].height = -1;
+    free_list = node;
+}
+
+
+/*  Inserts a leaf next to the sibling that grows the tree's total perimeter the least,
+ *  then walks back up to the root, rebalancing and refitting the ancestors.
+ *  @param leaf: The leaf node to insert.  */
+void AABBTree::InsertLeaf(int leaf)
+{
+    if (root == -1) {
+        root = leaf;
+        nodes[root].parent = -1;
+        return;
+    }
+
+    // Find the best sibling
+    const AABB leaf_box = nodes[leaf].box;
+    int index = root;
+    while (!nodes[index].IsLeaf())
+    {
+        const int child1 = nodes[index].child1;
+        const int child2 = nodes[index].child2;
+        const float area = nodes[index].box.Perimeter();
+        const float combined_area = AABB::Union(nodes[index].box, leaf_box).Perimeter();
+
+        // Cost of pairing the leaf with this node, and the cost every descendant inherits for growing it
+        const float cost = 2.f * combined_area;
+        const float inheritance_cost = 2.f * (combined_area - area);
+
+        float cost1 = AABB::Union(leaf_box, nodes[child1].box).Perimeter() + inheritance_cost;
+        if (!nodes[child1].IsLeaf())  cost1 -= nodes[child1].box.Perimeter();
+        float cost2 = AABB::Union(leaf_box, nodes[child2].box).Perimeter() + inheritance_cost;
+        if (!nodes[child2].IsLeaf())  cost2 -= nodes[child2].box.Perimeter();
+
+        if (cost < cost1 && cost < cost2) break;
+        index = (cost1 < cost2) ? child1 : child2;
+    }
+    const int sibling = index;
+
+    // Create a new parent for the leaf and its sibling
+    const int old_parent = nodes[sibling].parent;
+    const int new_parent = AllocateNode();
+    nodes[new_parent].parent = old_parent;
+    nodes[new_parent].box = AABB::Union(leaf_box, nodes[sibling].box);
+    nodes[new_parent].height = nodes[sibling].height + 1;
+    nodes[new_parent].child1 = sibling;
+    nodes[new_parent].child2 = leaf;
+    nodes[sibling].parent = new_parent;
+    nodes[leaf].parent = new_parent;
+    if (old_parent == -1)  root = new_parent;
+    else if (nodes[old_parent].child1 == sibling)  nodes[old_parent].child1 = new_parent;
+    else  nodes[old_parent].child2 = new_parent;
+
+    // Refit the ancestors
+    index = nodes[leaf].parent;
+    while (index != -1)
+    {
+        index = Balance(index);
+        const int child1 = nodes[index].child1;
+        const int child2 = nodes[index].child2;
+        nodes[index].height = 1 + std::max(nodes[child1].height, nodes[child2].height);
+        nodes[index].box = AABB::Union(nodes[child1].box, nodes[child2].box);
+        index = nodes[index].parent;
+    }
+}
+
+
+/*  Removes a leaf from the tree (without freeing it), replacing its parent with its sibling,
+ *  then refits the ancestors.
+ *  @param leaf: The leaf node to remove.  */
+void AABBTree::RemoveLeaf(int leaf)
+{
+    if (leaf == root) {
+        root = -1;
+        return;
+    }
+
+    const int parent = nodes[leaf].parent;
+    const int grand_parent = nodes[parent].parent;
+    const int sibling = (nodes[parent].child1 == leaf) ? nodes[parent].child2 : nodes[parent].child1;
+
+    if (grand_parent == -1) {
+        root = sibling;
+        nodes[sibling].parent = -1;
+        FreeNode(parent);
+        return;
+    }
+
+    if (nodes[grand_parent].child1 == parent)  nodes[grand_parent].child1 = sibling;
+    else  nodes[grand_parent].child2 = sibling;
+    nodes[sibling].parent = grand_parent;
+    FreeNode(parent);
+
+    int index = grand_parent;
+    while (index != -1)
+    {
+        index = Balance(index);
+        const int child1 = nodes[index].child1;
+        const int child2 = nodes[index].child2;
+        nodes[index].box = AABB::Union(nodes[child1].box, nodes[child2].box);
+        nodes[index].height = 1 + std::max(nodes[child1].height, nodes[child2].height);
+        index = nodes[index].parent;
+    }
+}
+
+
+/*  Performs a left or right rotation if the subtree rooted at the given node is unbalanced.
+ *  Returns the node now at the top of the subtree.
+ *  @param a: The root of the subtree to balance.  */
+int AABBTree::Balance(int a)
+{
+    if (nodes[a].IsLeaf() || nodes[a].height < 2) return a;
+
+    const int b = nodes[a].child1;
+    const int c = nodes[a].child2;
+    const int balance = nodes[c].height - nodes[b].height;
+
+    // Rotate C up
+    if (balance > 1)
+    {
+        const int f = nodes[c].child1;
+        const int g = nodes[c].child2;
+
+        nodes[c].child1 = a;
+        nodes[c].parent = nodes[a].parent;
+        nodes[a].parent = c;
+        if (nodes[c].parent == -1)  root = c;
+        else if (nodes[nodes[c].parent].child1 == a)  nodes[nodes[c].parent].child1 = c;
+        else  nodes[nodes[c].parent].child2 = c;
+
+        const int taller = (nodes[f].height > nodes[g].height) ? f : g;
+        const int shorter = (taller == f) ? g : f;
+        nodes[c].child2 = taller;
+        nodes[a].child2 = shorter;
+        nodes[shorter].parent = a;
+        nodes[a].box = AABB::Union(nodes[b].box, nodes[shorter].box);
+        nodes[c].box = AABB::Union(nodes[a].box, nodes[taller].box);
+        nodes[a].height = 1 + std::max(nodes[b].height, nodes[shorter].height);
+        nodes[c].height = 1 + std::max(nodes[a].height, nodes[taller].height);
+        return c;
+    }
+
+    // Rotate B up
+    if (balance < -1)
+    {
+        const int d = nodes[b].child1;
+        const int e = nodes[b].child2;
+
+        nodes[b].child1 = a;
+        nodes[b].parent = nodes[a].parent;
+        nodes[a].parent = b;
+        if (nodes[b].parent == -1)  root = b;
+        else if (nodes[nodes[b].parent].child1 == a)  nodes[nodes[b].parent].child1 = b;
+        else  nodes[nodes[b].parent].child2 = b;
+
+        const int taller = (nodes[d].height > nodes[e].height) ? d : e;
+        const int shorter = (taller == d) ? e : d;
+        nodes[b].child2 = taller;
+        nodes[a].child1 = shorter;
+        nodes[shorter].parent = a;
+        nodes[a].box = AABB::Union(nodes[c].box, nodes[shorter].box);
+        nodes[b].box = AABB::Union(nodes[a].box, nodes[taller].box);
+        nodes[a].height = 1 + std::max(nodes[c].height, nodes[shorter].height);
+        nodes[b].height = 1 + std::max(nodes[a].height, nodes[taller].height);
+        return b;
+    }
+
+    return a;
+}
+
+
+
+
+
+
+/*  Throws away the current tree and inserts every particle again.
+ *  @param centers: The center of each particle.
+ *  @param radii: The radius of each particle (same length as centers).  */
+void AABBTree::Rebuild(const std::vector<Vec2D>& centers, const std::vector<float>& radii)
+{
+    auto start = std::chrono::steady_clock::now();
+    const int n = (int)centers.size();
+    nodes.clear();
+    nodes.reserve(2 * n);
+    root = -1;
+    free_list = -1;
+
+    this->centers = centers;
+    this->radii = radii;
+    tight.resize(n);
+    leaf_of.resize(n);
+    for (int i = 0; i < n; i++)
+    {
+        tight[i] = AABB::AroundCircle(centers[i], radii[i]);
+        const int leaf = AllocateNode();
+        nodes[leaf].box = AABB::AroundCircle(centers[i], radii[i], margin);
+        nodes[leaf].particle = i;
+        leaf_of[i] = leaf;
+        InsertLeaf(leaf);
+    }
+
+    stats.rebuilt = true;
+    stats.rebuild_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+
+/*  Brings the tree up to date with the particles' new positions.
+ *  Only leaves whose particle has left its fat box are reinserted; the tree is rebuilt if the particle count changed.
+ *  @param centers: The center of each particle.
+ *  @param radii: The radius of each particle (same length as centers).  */
+void AABBTree::Update(const std::vector<Vec2D>& centers, const std::vector<float>& radii)
+{
+    stats = Stats();
+    if (centers.size() != leaf_of.size()) {
+        Rebuild(centers, radii);
+        return;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    this->centers = centers;
+    this->radii = radii;
+    for (int i = 0; i < (int)centers.size(); i++)
+    {
+        tight[i] = AABB::AroundCircle(centers[i], radii[i]);
+        const int leaf = leaf_of[i];
+        if (nodes[leaf].box.Contains(tight[i])) continue;
+
+        RemoveLeaf(leaf);
+        nodes[leaf].box = AABB::AroundCircle(centers[i], radii[i], margin);
+        InsertLeaf(leaf);
+        stats.reinserted++;
+    }
+    stats.refit_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+
+/*  Updates the tree and returns the list of candidate pairs,
+ *  i.e. pairs whose (exact) bounding boxes overlap.
+ *  @param centers: The center of each particle.
+ *  @param radii: The radius of each particle (same length as centers).  */
+const std::vector<std::pair<int,int>>& AABBTree::FindPairs(const std::vector<Vec2D>& centers, const std::vector<float>& radii)
+{
+    Update(centers, radii);
+
+    auto start = std::chrono::steady_clock::now();
+    pairs.clear();
+    std::vector<int> stack;
+    for (int i = 0; i < (int)tight.size(); i++)
+    {
+        const size_t first = pairs.size();
+        stack.clear();
+        if (root != -1)  stack.push_back(root);
+        while (!stack.empty())
+        {
+            const Node& node = nodes[stack.back()];
+            stack.pop_back();
+            if (!node.box.Overlaps(tight[i])) continue;
+            if (node.IsLeaf()) {
+                const int j = node.particle;
+                if (j > i && tight[j].Overlaps(tight[i]))  pairs.emplace_back(i, j);
+            }
+            else {
+                stack.push_back(node.child1);
+                stack.push_back(node.child2);
+            }
+        }
+        // Keep the all-pairs visiting order, so the narrowphase runs in a deterministic order
+        std::sort(pairs.begin() + first, pairs.end());
+    }
+    stats.query_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    return pairs;
+}
+
+
+/*  Collects every particle whose bounding box overlaps the given region.
+ *  @param region: The region to search.
+ *  @param found: Filled with the indices of the particles found.  */
+void AABBTree::Query(const AABB& region, std::vector<int>& found) const
+{
+    found.clear();
+    if (root == -1) return;
+    std::vector<int> stack { root };
+    while (!stack.empty())
+    {
+        const Node& node = nodes[stack.back()];
+        stack.pop_back();
+        if (!node.box.Overlaps(region)) continue;
+        if (node.IsLeaf()) {
+            if (tight[node.particle].Overlaps(region))  found.push_back(node.particle);
+        }
+        else {
+            stack.push_back(node.child1);
+            stack.push_back(node.child2);
+        }
+    }
+}
+
+
+/*  Casts a ray through the particles and returns the index of the first one it hits (or -1 if it hits none).
+ *  Subtrees whose box the ray misses, or only reaches beyond the closest hit so far, are skipped.
+ *  @param origin: The start of the ray.
+ *  @param direction: The direction of the ray (needn't be normalized).
+ *  @param max_distance: How far along the ray to search.
+ *  @param hit_distance: Set to the distance along the ray to the hit, if there is one.  */
+int AABBTree::RayCast(const Vec2D& origin, const Vec2D& direction, float max_distance, float& hit_distance) const
+{
+    const float length = direction.magnitude();
+    if (root == -1 || length == 0.f) return -1;
+    const Vec2D d = direction / length;
+    const float inv_x = 1.f / d.x;      // Infinite for axis-aligned rays, which the slab test handles
+    const float inv_y = 1.f / d.y;
+
+    int hit = -1;
+    float best = max_distance;
+    std::vector<int> stack { root };
+    while (!stack.empty())
+    {
+        const Node& node = nodes[stack.back()];
+        stack.pop_back();
+
+        // Slab test against the node's box
+        float tx1 = (node.box.lower.x - origin.x) * inv_x, tx2 = (node.box.upper.x - origin.x) * inv_x;
+        float ty1 = (node.box.lower.y - origin.y) * inv_y, ty2 = (node.box.upper.y - origin.y) * inv_y;
+        float t_enter = std::max(std::min(tx1, tx2), std::min(ty1, ty2));
+        float t_exit = std::min(std::max(tx1, tx2), std::max(ty1, ty2));
+        if (std::isnan(t_enter) || std::isnan(t_exit) || t_exit < 0.f || t_enter > t_exit || t_enter > best) continue;
+
+        if (node.IsLeaf())
+        {
+            // Ray-circle test
+            const Vec2D m = origin - centers[node.particle];
+            const float b = m.dot(d);
+            const float c = m.dot(m) - radii[node.particle] * radii[node.particle];
+            if (c > 0.f && b > 0.f) continue;
+            const float discriminant = b * b - c;
+            if (discriminant < 0.f) continue;
+            const float t = std::max(0.f, -b - std::sqrt(discriminant));
+            if (t <= best) {
+                best = t;
+                hit = node.particle;
+            }
+        }
+        else {
+            stack.push_back(node.child1);
+            stack.push_back(node.child2);
+        }
+    }
+    if (hit != -1)  hit_distance = best;
+    return hit;
+}
@@ -0,0 +1,135 @@
+/********************
+*
+*    AdaptiveCoulomb.hpp
+*
+*    Defines the AdaptiveCoulomb class, which steps ChargedParticles under their Coulomb forces with the
+*    adaptive DormandPrince scheme, so close encounters between charges get short substeps and the rest of a frame doesn't.
+*
+*********************/
+
+#pragma once
+#include <vector>
+#include "Vec2D.hpp"
+#include "ThreadPool.hpp"
+#include "ChargedParticle.hpp"  // includes:  "Particle.hpp"
+#include "TiledCoulomb.hpp"
+#include "Integrators.hpp"      // for DormandPrince; includes "ParticleSystem.hpp"
+
+
+
+
+
+/*  Field for the Integrators.hpp schemes: the Coulomb forces between the charges of a ParticleSystem, summed by a TiledCoulomb,
+ *  plus each particle's own acceleration (as Entity::Acceleration adds it).
+ *  The system is laid out so that its walls are where ChargedParticle has them (a radius in from its bounds), which puts
+ *  ChargedParticle's centers (a radius past its positions) at x + origin + 2 * radius; the forces are worked out between those,
+ *  so they're the ones TiledCoulomb::Load(particles) gives.  */
+struct TiledCoulombField
+{
+    TiledCoulomb coulomb;
+    std::vector<float> charge;      // Charge of each particle.
+    std::vector<Vec2D> own;         // Each particle's own acceleration (kinematics.acceleration).
+    Vec2D origin;                   // Top-left corner of the particles' bounds.
+    ThreadPool* pool = nullptr;     // Threads to split each Solve across (the calling thread does it all if null).
+
+    void operator()(const ParticleSystem& system, const float* x, const float* y, float* ax, float* ay)
+    {
+        const int n = system.Size();
+        centers.resize(n);
+        for (int i = 0; i < n; i++)
+            centers[i] = Vec2D(x[i] + origin.x + 2.0f * system.radius[i], y[i] + origin.y + 2.0f * system.radius[i]);
+        coulomb.Load(centers, charge);
+        coulomb.Solve(pool);
+        for (int i = 0; i < n; i++) {
+            ax[i] = own[i].x + coulomb.fx[i] * system.inv_mass[i];
+            ay[i] = own[i].y + coulomb.fy[i] * system.inv_mass[i];
+        }
+    }
+
+
+private:
+    std::vector<Vec2D> centers;
+};
+
+
+
+
+
+
+/*  Adaptive stepping for a vector of ChargedParticles, for the close encounters a fixed step gets wrong
+ *  (two charges passing closer than they move in a step get a kick from where they were, not from where they pass).
+ *  Each Step loads the particles into a ParticleSystem, covers dt with DormandPrince under TiledCoulombField,
+ *  and writes the positions and velocities back, with everything Particle::Update keeps up to date (center, momentum,
+ *  kinetic energy, image and trail) and each particle's potential energy in the others' field.
+ *  The walls bounce as in Particle::Update(t, dt, force) (no restitution), and come from the first particle's bounds.
+ *  Collisions between the particles are left to the caller, as with Particle::Update
+ *  (e.g. ResolveCollisions(particles, broadphase) before each Step).  */
+class AdaptiveCoulomb
+{
+public:
+    DormandPrince scheme;           // Tolerances, and the stats of the last Step.
+    TiledCoulombField field;
+
+
+    AdaptiveCoulomb() = default;
+    AdaptiveCoulomb(float relative_tolerance, float absolute_tolerance, float softening = 0.0f, float max_force = 0.0f)
+        : scheme(relative_tolerance, absolute_tolerance, 1e-6f, 0.1f) { field.coulomb.softening = softening; field.coulomb.max_force = max_force; }
+
+    void Step(std::vector<ChargedParticle>& particles, float dt, ThreadPool* pool = nullptr);
+
+
+private:
+    ParticleSystem system;
+};
+
+
+
+
+
+
+/*  Advances the particles by dt in adaptive substeps.
+ *  @param particles: The charged particles.
+ *  @param dt: The time to cover.
+ *  @param pool: Threads to split the Coulomb sums across (the calling thread does it all if null).  */
+void AdaptiveCoulomb::Step(std::vector<ChargedParticle>& particles, float dt, ThreadPool* pool)
+{
+    const int n = (int)particles.size();
+    if (n == 0) return;
+    const Particle::Bounds& bounds = particles[0].bounds;
+
+    system.Clear();
+    system.Reserve(n);
+    system.width = bounds.right - bounds.left;
+    system.height = bounds.bottom - bounds.top;
+    field.origin = Vec2D(bounds.left, bounds.top);
+    field.pool = pool;
+    field.charge.resize(n);
+    field.own.resize(n);
+    for (int i = 0; i < n; i++)
+    {
+        const ChargedParticle& particle = particles[i];
+        const Vec2D corner = particle.kinematics.position - field.origin - Vec2D(particle.radius, particle.radius);
+        system.Add("", particle.mass, particle.radius, sf::Color::White, corner, particle.kinematics.velocity, 1.0f);
+        field.charge[i] = particle.charge;
+        field.own[i] = particle.kinematics.acceleration;
+    }
+
+    scheme.Step(system, dt, field);
+
+    // The field's last sample was at the end of the last substep, so its potentials are at the new positions
+    for (int i = 0; i < n; i++)
+    {
+        ChargedParticle& particle = particles[i];
+        particle.kinematics.position = system.Position(i) + field.origin + Vec2D(particle.radius, particle.radius);
+        particle.kinematics.velocity = system.Velocity(i);
+        particle.center = particle.kinematics.position + Vec2D(particle.radius, particle.radius);
+        particle.kinematics.momentum = particle.mass * particle.kinematics.velocity;
+        particle.kinetic_energy = particle.ResolveKineticEnergy(particle.kinematics.velocity);
+        particle.potential_energy = particle.charge * field.coulomb.potentials[i];
+        particle.image.setPosition(particle.kinematics.position);
+        if (particle.trail_enabled) {
+            particle.AddToTrail();
+            particle.UpdateTrail(dt);
+        }
+    }
+}
@@ -0,0 +1,385 @@
+/********************
+*
+*    BarnesHut.hpp
+*
+*    Defines the BarnesHut class, which works out the net Coulomb force and potential
+*    on every one of N charges in O(N log N), from a quadtree over their positions.
+*
+*********************/
+
+#pragma once
+#include <cmath>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include "Vec2D.hpp"
+#include "ThreadPool.hpp"
+
+
+
+
+
+/*  Barnes-Hut solver for the Coulomb force between every pair of charges.
+ *  Build sorts the charges into a quadtree, splitting any cell with more than `leaf_size` charges into four,
+ *  and gives every cell its total charge and its dipole moment about its charges' center (weighted by |charge|).
+ *  Solve then walks the tree for each charge: a cell of side s at distance d is taken as a whole, from its charge and
+ *  dipole, when s / d < theta, and opened up otherwise; the charges in the leaves it does open are summed directly.
+ *  The dipole term matters here, unlike for gravity: a cell of mixed charges can have almost no net charge, and then
+ *  the dipole is most of its field. Each charge's walk is independent, so the walks are split across a ThreadPool.
+ *  A theta of 0 opens every cell, which gives the direct sum. DirectSum and Compare measure the error against it.
+ *  The forces follow ChargedParticle::CoulombForce (like charges repel, with k = 8.987551787e9), between particle centers.  */
+class BarnesHut
+{
+public:
+    float theta;                        // Opening angle: cells with side / distance below it are taken as a whole.
+    float softening;                    // Added to every squared distance, to keep close passes finite (0 for plain Coulomb).
+    int leaf_size;                      // Most charges in a cell before it's split.
+
+    std::vector<Vec2D> forces;          // Net Coulomb force on each charge, from the last Solve.
+    std::vector<float> potentials;      // Electric potential at each charge due to all the others (its potential energy is charge * potential).
+
+    /*  Size of the last tree built, and the work done by the last Solve.  */
+    struct Stats
+    {
+        int nodes = 0;
+        int depth = 0;
+        long long cell_terms = 0;       // Charge-cell interactions.
+        long long pair_terms = 0;       // Charge-charge interactions.
+    };
+    Stats stats;
+
+    /*  Relative error of a set of forces and potentials against a reference.  */
+    struct Error
+    {
+        float force_rms = 0.0f;         // sqrt(sum |F - F_ref|^2 / sum |F_ref|^2)
+        float force_max = 0.0f;         // Largest |F - F_ref| / |F_ref| over the charges.
+        float potential_rms = 0.0f;     // sqrt(sum (V - V_ref)^2 / sum V_ref^2)
+    };
+
+
+    BarnesHut(float theta = 0.5f, float softening = 0.0f, int leaf_size = 8) : theta(theta), softening(softening), leaf_size(leaf_size) { }
+
+    void Build(const std::vector<Vec2D>& centers, const std::vector<float>& charges);
+    void Solve(ThreadPool* pool = nullptr);
+    template <typename P>
+    void Solve(const std::vector<P>& particles, ThreadPool* pool = nullptr);
+    float PotentialEnergy() const;
+
+    static void DirectSum(const std::vector<Vec2D>& centers, const std::vector<float>& charges, float softening,
+                          std::vector<Vec2D>& forces, std::vector<float>& potentials, ThreadPool* pool = nullptr);
+    static Error Compare(const std::vector<Vec2D>& forces, const std::vector<float>& potentials,
+                         const std::vector<Vec2D>& reference_forces, const std::vector<float>& reference_potentials);
+
+
+private:
+    static const int MAX_DEPTH = 40;    // Cells this deep aren't split, however many charges they hold (they'd all be on one spot).
+
+    struct Node
+    {
+        float cx, cy, half;             // The cell: a square with this center and half-side.
+        int begin, end;                 // Its charges: order[begin, end).
+        int child;                      // First of its four children (-1 for a leaf).
+        float q, abs_q;                 // Total charge, and total |charge|.
+        float ex, ey;                   // Center of the expansion (the |charge|-weighted mean position).
+        float px, py;                   // Dipole moment about (ex, ey).
+    };
+
+    std::vector<Node> nodes;
+    std::vector<int> order;             // Charge indices, grouped by cell.
+    std::vector<float> x, y, q;         // Positions and charges, in the order they were given.
+
+    void Split(int node, int depth);
+    void Moments(int node);
+    void Walk(int i, float& ex, float& ey, float& phi, long long& cells, long long& pairs) const;
+};
+
+
+
+
+
+
+/*  Builds the quadtree over the charges.
+ *  @param centers: Position of each charge (the particles' centers).
+ *  @param charges: Charge of each one.  */
+void BarnesHut::Build(const std::vector<Vec2D>& centers, const std::vector<float>& charges)
+{
+    const int n = (int)centers.size();
+    x.resize(n); y.resize(n);
+    q.assign(charges.begin(), charges.begin() + n);
+    order.resize(n);
+    nodes.clear();
+    stats = Stats();
+
+    float min_x = n ? centers[0].x : 0.0f, max_x = min_x;
+    float min_y = n ? centers[0].y : 0.0f, max_y = min_y;
+    for (int i = 0; i < n; i++)
+    {
+        x[i] = centers[i].x;    y[i] = centers[i].y;
+        order[i] = i;
+        min_x = std::min(min_x, x[i]);  max_x = std::max(max_x, x[i]);
+        min_y = std::min(min_y, y[i]);  max_y = std::max(max_y, y[i]);
+    }
+
+    // Root: the bounding square, padded a little so no charge sits on its far edge
+    const float half = 0.5f * std::max(max_x - min_x, max_y - min_y) * 1.0001f + 1e-3f;
+    nodes.push_back(Node{ 0.5f * (min_x + max_x), 0.5f * (min_y + max_y), half, 0, n, -1, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f });
+    Split(0, 0);
+    Moments(0);
+    stats.nodes = (int)nodes.size();
+}
+
+
+/*  Splits a cell into four if it holds too many charges, and the children likewise.  */
+void BarnesHut::Split(int node, int depth)
+{
+    stats.depth = std::max(stats.depth, depth);
+    const Node cell = nodes[node];
+    if (cell.end - cell.begin <= leaf_size || depth >= MAX_DEPTH) return;
+
+    // Partition its charges by quadrant: top half first, then each half left before right
+    int* first = order.data() + cell.begin;
+    int* last = order.data() + cell.end;
+    int* middle = std::partition(first, last, [&](int i) { return y[i] < cell.cy; });
+    int* top_right = std::partition(first, middle, [&](int i) { return x[i] < cell.cx; });
+    int* bottom_right = std::partition(middle, last, [&](int i) { return x[i] < cell.cx; });
+    const int bounds[5] = { cell.begin, (int)(top_right - order.data()), (int)(middle - order.data()),
+                            (int)(bottom_right - order.data()), cell.end };
+
+    const int child = (int)nodes.size();
+    nodes[node].child = child;
+    const float h = cell.half * 0.5f;
+    for (int k = 0; k < 4; k++)
+        nodes.push_back(Node{ cell.cx + ((k & 1) ? h : -h), cell.cy + ((k & 2) ? h : -h), h, bounds[k], bounds[k + 1], -1,
+                              0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f });
+    for (int k = 0; k < 4; k++)
+        Split(child + k, depth + 1);
+}
+
+
+/*  Works out a cell's total charge, expansion center and dipole moment, from its children's (or its charges' for a leaf).  */
+void BarnesHut::Moments(int node)
+{
+    Node& cell = nodes[node];
+    double total = 0.0, total_abs = 0.0, sx = 0.0, sy = 0.0;
+    if (cell.child < 0)
+    {
+        for (int k = cell.begin; k < cell.end; k++)
+        {
+            const int i = order[k];
+            total += q[i];
+            total_abs += std::fabs(q[i]);
+            sx += std::fabs(q[i]) * x[i];
+            sy += std::fabs(q[i]) * y[i];
+        }
+    }
+    else
+    {
+        for (int k = 0; k < 4; k++)
+        {
+            Moments(cell.child + k);
+            const Node& c = nodes[cell.child + k];
+            total += c.q;
+            total_abs += c.abs_q;
+            sx += (double)c.abs_q * c.ex;
+            sy += (double)c.abs_q * c.ey;
+        }
+    }
+    cell.q = (float)total;
+    cell.abs_q = (float)total_abs;
+    cell.ex = total_abs > 0.0 ? (float)(sx / total_abs) : cell.cx;
+    cell.ey = total_abs > 0.0 ? (float)(sy / total_abs) : cell.cy;
+
+    double px = 0.0, py = 0.0;
+    if (cell.child < 0)
+        for (int k = cell.begin; k < cell.end; k++) {
+            const int i = order[k];
+            px += q[i] * (double)(x[i] - cell.ex);
+            py += q[i] * (double)(y[i] - cell.ey);
+        }
+    else
+        for (int k = 0; k < 4; k++) {
+            const Node& c = nodes[cell.child + k];
+            px += c.px + (double)c.q * (c.ex - cell.ex);
+            py += c.py + (double)c.q * (c.ey - cell.ey);
+        }
+    cell.px = (float)px;
+    cell.py = (float)py;
+}
+
+
+/*  Walks the tree for charge i, adding up the field (ex, ey) and potential phi at it, without the Coulomb constant.  */
+void BarnesHut::Walk(int i, float& ex, float& ey, float& phi, long long& cells, long long& pairs) const
+{
+    const float xi = x[i], yi = y[i];
+    const float theta2 = theta * theta;
+    int stack[4 * MAX_DEPTH + 4];
+    int top = 0;
+    stack[top++] = 0;
+
+    while (top > 0)
+    {
+        const Node& cell = nodes[stack[--top]];
+        if (cell.begin == cell.end) continue;
+
+        const float dx = xi - cell.ex, dy = yi - cell.ey;
+        const float d2 = dx * dx + dy * dy;
+        const float side = 2.0f * cell.half;
+        const bool inside = std::fabs(xi - cell.cx) <= cell.half && std::fabs(yi - cell.cy) <= cell.half;
+        if (!inside && side * side < theta2 * d2)
+        {
+            // Far enough: the cell's charge and dipole
+            const float r2 = d2 + softening;
+            const float inv = 1.0f / std::sqrt(r2);
+            const float inv3 = inv * inv * inv;
+            const float inv5 = inv3 * inv * inv;
+            const float pd = cell.px * dx + cell.py * dy;
+            phi += cell.q * inv + pd * inv3;
+            ex += cell.q * dx * inv3 + 3.0f * pd * dx * inv5 - cell.px * inv3;
+            ey += cell.q * dy * inv3 + 3.0f * pd * dy * inv5 - cell.py * inv3;
+            cells++;
+        }
+        else if (cell.child >= 0)
+        {
+            for (int k = 0; k < 4; k++)
+                stack[top++] = cell.child + k;
+        }
+        else
+        {
+            // A leaf that's too close: its charges one by one
+            for (int k = cell.begin; k < cell.end; k++)
+            {
+                const int j = order[k];
+                if (j == i) continue;
+                const float rx = xi - x[j], ry = yi - y[j];
+                const float r2 = rx * rx + ry * ry + softening;
+                if (r2 == 0.0f) continue;
+                const float inv = 1.0f / std::sqrt(r2);
+                const float inv3 = inv * inv * inv;
+                phi += q[j] * inv;
+                ex += q[j] * rx * inv3;
+                ey += q[j] * ry * inv3;
+            }
+            pairs += cell.end - cell.begin;
+        }
+    }
+}
+
+
+/*  Works out the force on and potential at every charge in the tree from the last Build.
+ *  @param pool: Threads to split the charges' walks across (the calling thread does them all if null).  */
+void BarnesHut::Solve(ThreadPool* pool)
+{
+    const int n = (int)order.size();
+    forces.resize(n);
+    potentials.resize(n);
+    std::atomic<long long> cells(0), pairs(0);
+
+    // In tree order, so neighbouring walks (which open the same cells) run one after the other
+    auto walk = [&](int begin, int end) {
+        long long chunk_cells = 0, chunk_pairs = 0;
+        for (int k = begin; k < end; k++)
+        {
+            const int i = order[k];
+            float ex = 0.0f, ey = 0.0f, phi = 0.0f;
+            Walk(i, ex, ey, phi, chunk_cells, chunk_pairs);
+            forces[i] = Vec2D(8.987551787e9f * q[i] * ex, 8.987551787e9f * q[i] * ey);
+            potentials[i] = 8.987551787e9f * phi;
+        }
+        cells += chunk_cells;
+        pairs += chunk_pairs;
+    };
+    if (pool) pool->ParallelFor(0, n, walk, 64);
+    else walk(0, n);
+
+    stats.cell_terms = cells;
+    stats.pair_terms = pairs;
+}
+
+
+/*  Builds the tree over a vector of ChargedParticles (or anything with a center and a charge) and solves it.
+ *  forces[i] and charge * potentials[i] are then the net force on and potential energy of particles[i], e.g. for
+ *  ChargedParticle::UpdateUnderField(t, dt, force, potential_energy).
+ *  @param particles: The charges.
+ *  @param pool: Threads to split the walks across (may be null).  */
+template <typename P>
+void BarnesHut::Solve(const std::vector<P>& particles, ThreadPool* pool)
+{
+    std::vector<Vec2D> centers(particles.size());
+    std::vector<float> charges(particles.size());
+    for (size_t i = 0; i < particles.size(); i++)
+    {
+        centers[i] = particles[i].center;
+        charges[i] = particles[i].charge;
+    }
+    Build(centers, charges);
+    Solve(pool);
+}
+
+
+/*  Returns the total electric potential energy, half the sum of charge * potential (each pair is in two potentials).  */
+float BarnesHut::PotentialEnergy() const
+{
+    double energy = 0.0;
+    for (size_t i = 0; i < potentials.size(); i++)
+        energy += 0.5 * q[i] * potentials[i];
+    return (float)energy;
+}
+
+
+/*  Works out the forces and potentials by summing over every pair, as a reference for the tree's.
+ *  @param centers, charges: The charges.
+ *  @param softening: Added to every squared distance.
+ *  @param forces, potentials: Filled with the force on and potential at each charge.
+ *  @param pool: Threads to split the charges across (may be null).  */
+void BarnesHut::DirectSum(const std::vector<Vec2D>& centers, const std::vector<float>& charges, float softening,
+                          std::vector<Vec2D>& forces, std::vector<float>& potentials, ThreadPool* pool)
+{
+    const int n = (int)centers.size();
+    forces.resize(n);
+    potentials.resize(n);
+    auto sum = [&](int begin, int end) {
+        for (int i = begin; i < end; i++)
+        {
+            double ex = 0.0, ey = 0.0, phi = 0.0;
+            for (int j = 0; j < n; j++)
+            {
+                if (j == i) continue;
+                const double rx = centers[i].x - centers[j].x, ry = centers[i].y - centers[j].y;
+                const double r2 = rx * rx + ry * ry + softening;
+                if (r2 == 0.0) continue;
+                const double inv = 1.0 / std::sqrt(r2);
+                phi += charges[j] * inv;
+                ex += charges[j] * rx * inv * inv * inv;
+                ey += charges[j] * ry * inv * inv * inv;
+            }
+            forces[i] = Vec2D((float)(8.987551787e9 * charges[i] * ex), (float)(8.987551787e9 * charges[i] * ey));
+            potentials[i] = (float)(8.987551787e9 * phi);
+        }
+    };
+    if (pool) pool->ParallelFor(0, n, sum, 16);
+    else sum(0, n);
+}
+
+
+/*  Returns the relative error of forces and potentials against reference ones (e.g. from DirectSum).  */
+BarnesHut::Error BarnesHut::Compare(const std::vector<Vec2D>& forces, const std::vector<float>& potentials,
+                                    const std::vector<Vec2D>& reference_forces, const std::vector<float>& reference_potentials)
+{
+    Error error;
+    double diff2 = 0.0, ref2 = 0.0, pdiff2 = 0.0, pref2 = 0.0;
+    for (size_t i = 0; i < forces.size(); i++)
+    {
+        const double dx = forces[i].x - reference_forces[i].x, dy = forces[i].y - reference_forces[i].y;
+        const double rx = reference_forces[i].x, ry = reference_forces[i].y;
+        diff2 += dx * dx + dy * dy;
+        ref2 += rx * rx + ry * ry;
+        if (rx * rx + ry * ry > 0.0)
+            error.force_max = std::max(error.force_max, (float)std::sqrt((dx * dx + dy * dy) / (rx * rx + ry * ry)));
+        const double dp = potentials[i] - reference_potentials[i];
+        pdiff2 += dp * dp;
+        pref2 += (double)reference_potentials[i] * reference_potentials[i];
+    }
+    error.force_rms = ref2 > 0.0 ? (float)std::sqrt(diff2 / ref2) : 0.0f;
+    error.potential_rms = pref2 > 0.0 ? (float)std::sqrt(pdiff2 / pref2) : 0.0f;
+    return error;
+}
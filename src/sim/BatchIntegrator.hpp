@@ -0,0 +1,240 @@
+/********************
+*
+*    BatchIntegrator.hpp
+*
+*    Defines the BatchRK4 class, which advances a whole set of particles
+*    with Entity::Integrate's Runge-Kutta step in one pass over structure-of-arrays data.
+*
+*********************/
+
+#pragma once
+#include <cmath>
+#include <vector>
+#include "Particle.hpp"         // includes:  "Entity.hpp", "DrawableVec2D.hpp", "Vec2D.hpp", <cmath>, and <SFML/Graphics.hpp>
+#include "ParticleSystem.hpp"   // for AlignedVector
+
+
+
+
+
+/*  Batched version of Particle::Update for a whole vector of particles.
+ *  Particle::Update calls Entity::Integrate, which makes four Evaluate calls per particle (each building a Kinematics
+ *  and returning Derivatives by value), then does the boundary and bookkeeping work, one particle at a time.
+ *  Here the particles' kinematics live in aligned arrays, and each Update overload is a single loop over all of them
+ *  with no function calls or branches in it, which the compiler vectorizes.
+ *  The force on each particle is held constant over the step, as in Entity::Integrate, so the four stage derivatives
+ *  are worked out in closed form, in the same order of operations; the results match Particle::Update exactly.
+ *  Load copies the particles in, Store copies the results back out (and does the rest of Update's bookkeeping:
+ *  center, momentum, kinetic energy, image position, trail), so Store only needs calling on frames that get drawn.  */
+class BatchRK4
+{
+public:
+    AlignedVector<float> x, y;          // Position.
+    AlignedVector<float> vx, vy;        // Velocity.
+    AlignedVector<float> ax, ay;        // Acceleration (added to force / mass, as in Entity::Acceleration).
+    AlignedVector<float> fx, fy;        // Force applied over the step.
+    AlignedVector<float> mass;
+    AlignedVector<float> radius;
+    AlignedVector<float> angular_velocity;
+    Particle::Bounds bounds;            // Boundary shared by all the particles (taken from the first one on Load).
+
+
+    int Size() const { return (int)x.size(); }
+
+    template <typename P>
+    void Load(const std::vector<P>& particles);
+    template <typename P>
+    void Store(std::vector<P>& particles, float dt);
+
+    void SetForce(Vec2D force);
+
+    void Update(double t, float dt);
+    void Update(double t, float dt, float collision_restitution);
+    void Update(double t, float dt, double velocity_damping);
+    void Update(double t, float dt, double velocity_damping, float collision_restitution);
+
+
+private:
+    template <bool DAMPED, bool TRACK_ACCELERATION>
+    void Step(float dt, float damping, float restitution);
+};
+
+
+
+
+
+
+/*  Copies the particles' mass, radius and kinematics into the arrays.
+ *  Works on a vector of Particles, or of any class derived from it (e.g. ChargedParticle).  */
+template <typename P>
+void BatchRK4::Load(const std::vector<P>& particles)
+{
+    const int n = (int)particles.size();
+    x.resize(n); y.resize(n);
+    vx.resize(n); vy.resize(n);
+    ax.resize(n); ay.resize(n);
+    fx.assign(n, 0.0f); fy.assign(n, 0.0f);
+    mass.resize(n); radius.resize(n);
+    angular_velocity.resize(n);
+    if (n > 0) bounds = particles[0].bounds;
+
+    for (int i = 0; i < n; i++)
+    {
+        const Entity::Kinematics& k = particles[i].kinematics;
+        x[i] = k.position.x;        y[i] = k.position.y;
+        vx[i] = k.velocity.x;       vy[i] = k.velocity.y;
+        ax[i] = k.acceleration.x;   ay[i] = k.acceleration.y;
+        mass[i] = particles[i].mass;
+        radius[i] = particles[i].radius;
+        angular_velocity[i] = k.angular_velocity;
+    }
+}
+
+
+/*  Copies the arrays back into the particles, and does the rest of what Particle::Update does after integrating:
+ *  updates the center, momentum and kinetic energy, moves the image, and adds to the trail.
+ *  @param particles: The particles that were loaded.
+ *  @param dt: The time step (for the trail).  */
+template <typename P>
+void BatchRK4::Store(std::vector<P>& particles, float dt)
+{
+    for (int i = 0; i < (int)particles.size(); i++)
+    {
+        P& p = particles[i];
+        p.kinematics.position = Vec2D(x[i], y[i]);
+        p.kinematics.velocity = Vec2D(vx[i], vy[i]);
+        p.kinematics.acceleration = Vec2D(ax[i], ay[i]);
+        p.kinematics.angular_velocity = angular_velocity[i];
+        p.center = Vec2D(p.kinematics.position.x+p.radius, p.kinematics.position.y+p.radius);
+        p.kinematics.momentum = p.mass * p.kinematics.velocity;
+        p.kinetic_energy = p.ResolveKineticEnergy(p.kinematics.velocity);
+        p.image.setPosition(p.kinematics.position);
+        if (p.trail_enabled) {
+            p.AddToTrail();
+            p.UpdateTrail(dt);
+        }
+    }
+}
+
+
+/*  Applies the same force to every particle for the following steps.  */
+void BatchRK4::SetForce(Vec2D force)
+{
+    fx.assign(Size(), force.x);
+    fy.assign(Size(), force.y);
+}
+
+
+/*  One RK4 step followed by the boundary collisions, for particles [0, n).
+ *  DAMPED multiplies the new velocity by `damping` (Entity::Integrate's damped overload);
+ *  TRACK_ACCELERATION stores the change in velocity as the acceleration and updates the angular velocity,
+ *  as Particle::Update(t, dt, force, velocity_damping) does. A restitution of 1 gives the plain boundary bounce.
+ *  A free function so the restrict-qualified arrays are parameters (GCC ignores restrict on locals when checking aliasing).
+ *  Turning off floating-point traps doesn't change any result, but lets the boundary selects be vectorized instead of
+ *  branched on. sqrt still branches to set errno unless the file is built with -fno-math-errno (the benchmark target is).  */
+template <bool DAMPED, bool TRACK_ACCELERATION>
+__attribute__((optimize("tree-vectorize", "no-trapping-math")))
+static void RK4StepKernel(int n, float dt, float damping, float restitution, Particle::Bounds bounds,
+                          float* __restrict px, float* __restrict py, float* __restrict pvx, float* __restrict pvy,
+                          float* __restrict pax, float* __restrict pay, float* __restrict pw,
+                          const float* __restrict pfx, const float* __restrict pfy, const float* __restrict m, const float* __restrict r)
+{
+    const float h = dt * 0.5f;
+    const float w = 1.0f / 6.0f;
+    const float left = bounds.left, right = bounds.right, top = bounds.top, bottom = bounds.bottom;
+
+    for (int i = 0; i < n; i++)
+    {
+        // Entity::Acceleration: the same at every stage, since the force is held over the step
+        const float accx = pax[i] + pfx[i] / m[i];
+        const float accy = pay[i] + pfy[i] / m[i];
+
+        // Stage position derivatives: v, v - a dt/2, v - a dt/2, v - a dt (as Entity::Evaluate works them out)
+        const float bx = pvx[i] - accx * h, dx = pvx[i] - accx * dt;
+        const float by = pvy[i] - accy * h, dy = pvy[i] - accy * dt;
+        const float dposdt_x = w * ((pvx[i] + 2.0f * (bx + bx)) + dx);
+        const float dposdt_y = w * ((pvy[i] + 2.0f * (by + by)) + dy);
+        const float dveldt_x = w * ((accx + 2.0f * (accx + accx)) + accx);
+        const float dveldt_y = w * ((accy + 2.0f * (accy + accy)) + accy);
+
+        float X = px[i] + dposdt_x * dt;
+        float Y = py[i] + dposdt_y * dt;
+        float VX = pvx[i] + dveldt_x * dt;
+        float VY = pvy[i] + dveldt_y * dt;
+        if constexpr (DAMPED) {
+            VX = VX * damping;
+            VY = VY * damping;
+        }
+        if constexpr (TRACK_ACCELERATION) {
+            pax[i] = VX - pvx[i];
+            pay[i] = VY - pvy[i];
+            const float length = sqrtf(X * X + Y * Y);     // not std::sqrt, which doesn't inline into a function with its own optimize flags
+            pw[i] = ((X * VY) - (Y * VX)) / (length * length);
+        }
+
+        // Particle::ResolveBoundaryCollisions, written as selects so the loop stays branch-free
+        const float R = r[i];
+        bool hit = Y + R > bottom;
+        Y = hit ? bottom - R : Y;           VY = hit ? -VY * restitution : VY;
+        hit = Y - R < top;
+        Y = hit ? top + R : Y;              VY = hit ? -VY * restitution : VY;
+        hit = X - R < left;
+        X = hit ? left + R : X;             VX = hit ? -VX * restitution : VX;
+        hit = X + R > right;
+        X = hit ? right - R : X;            VX = hit ? -VX * restitution : VX;
+
+        px[i] = X;      py[i] = Y;
+        pvx[i] = VX;    pvy[i] = VY;
+    }
+}
+
+
+/*  Runs the step kernel over the arrays.  */
+template <bool DAMPED, bool TRACK_ACCELERATION>
+void BatchRK4::Step(float dt, float damping, float restitution)
+{
+    RK4StepKernel<DAMPED, TRACK_ACCELERATION>(Size(), dt, damping, restitution, bounds,
+                                               x.data(), y.data(), vx.data(), vy.data(), ax.data(), ay.data(), angular_velocity.data(),
+                                               fx.data(), fy.data(), mass.data(), radius.data());
+}
+
+
+/*  Batched Particle::Update(t, dt, force): RK4 step, then the boundary collisions.
+ *  @param t: The current simulation time.
+ *  @param dt: The time step.  */
+void BatchRK4::Update([[maybe_unused]] double t, float dt)
+{
+    Step<false, false>(dt, 1.0f, 1.0f);
+}
+
+
+/*  Batched Particle::Update(t, dt, force, collision_restitution).
+ *  @param t: The current simulation time.
+ *  @param dt: The time step.
+ *  @param collision_restitution: The coefficient of restitution for the boundary collisions.  */
+void BatchRK4::Update([[maybe_unused]] double t, float dt, float collision_restitution)
+{
+    Step<false, false>(dt, 1.0f, collision_restitution);
+}
+
+
+/*  Batched Particle::Update(t, dt, force, velocity_damping).
+ *  Like that overload, stores the change in velocity over the step as the acceleration, which feeds into the next step.
+ *  @param t: The current simulation time.
+ *  @param dt: The time step.
+ *  @param velocity_damping: The velocity damping coefficient.  */
+void BatchRK4::Update([[maybe_unused]] double t, float dt, double velocity_damping)
+{
+    Step<true, true>(dt, (float)velocity_damping, 1.0f);
+}
+
+
+/*  Batched Particle::Update(t, dt, force, velocity_damping, collision_restitution).
+ *  @param t: The current simulation time.
+ *  @param dt: The time step.
+ *  @param velocity_damping: The velocity damping coefficient.
+ *  @param collision_restitution: The coefficient of restitution for the boundary collisions.  */
+void BatchRK4::Update([[maybe_unused]] double t, float dt, double velocity_damping, float collision_restitution)
+{
+    Step<true, false>(dt, (float)velocity_damping, collision_restitution);
+}
@@ -9,6 +9,7 @@
 *
 *********************/
 
+#pragma once
 #include "Particle.hpp"     // includes:  "Entity.hpp", "Vec2D.hpp", <cmath>, and <SFML/Graphics.hpp>
 
 
@@ -100,6 +101,7 @@ public:
     void Update(double t, float dt, ChargedParticle& nearby_charge, float collision_restitution, float max_force);
     // void Update(double t, float dt, ChargedParticle& nearby_charge, double velocity_damping, float collision_restitution);
     void Update(double t, float dt, ChargedParticle& nearby_charge, double velocity_damping, float collision_restitution, float max_force);
+    void UpdateUnderField(double t, float dt, Vec2D net_force, float potential_energy);
 
 
 
@@ -552,13 +554,14 @@ float ChargedParticle::ResolvePotentialEnergy(ChargedParticle& other)
 
 
 /*  Returns the Coulomb Force between
- *  this charged particle and another.
+ *  this charged particle and another
+ *  (along the line between their centers, from a single square root).
  *  @param particle: other charged particle  */
 Vec2D ChargedParticle::CoulombForce(ChargedParticle& particle)
 {
-    float force = -(8.987551787e9f * this->charge * particle.charge) / (this->Particle::DistanceTo(particle) * this->Particle::DistanceTo(particle));
-    Vec2D vector = force * this->Particle::UnitVectorTo(particle);
-    return vector;
+    Vec2D d = this->center - particle.center;
+    float inv = 1.f / std::sqrt(d.x*d.x + d.y*d.y);
+    return d * (8.987551787e9f * this->charge * particle.charge * inv*inv*inv);
 }
 
 
@@ -568,10 +571,12 @@ Vec2D ChargedParticle::CoulombForce(ChargedParticle& particle)
  *  @param max_force: maximum allowable force  */
 Vec2D ChargedParticle::CoulombForce(ChargedParticle& particle, float max_force)
 {
-    float force = -(8.987551787e9f * this->charge * particle.charge) / (this->Particle::DistanceTo(particle) * this->Particle::DistanceTo(particle));
-    Vec2D vector = force * this->Particle::UnitVectorTo(particle);
-    if (vector.magnitude() > max_force)  vector = vector.normalize() * max_force;
-    return vector;
+    Vec2D d = this->center - particle.center;
+    float inv = 1.f / std::sqrt(d.x*d.x + d.y*d.y);
+    float kqq = 8.987551787e9f * this->charge * particle.charge;
+    float force = std::fabs(kqq) * inv*inv;
+    if (force > max_force)  kqq *= max_force / force;
+    return d * (kqq * inv*inv*inv);
 }
 
 
@@ -667,3 +672,17 @@ void ChargedParticle::Update(double t, float dt, ChargedParticle& nearby_charge,
     Particle::Update(t, dt, this->CoulombForce(nearby_charge, max_force), velocity_damping, collision_restitution);
     this->potential_energy = ResolvePotentialEnergy(nearby_charge);
 }
+
+
+/*  Updates the charged particle under a net force worked out elsewhere,
+ *  e.g. by a BarnesHut solver over every charge in the simulation.
+ *  (Not an Update overload: it would have the same signature as Particle::Update(t, dt, force, collision_restitution).)
+ *  @param t: simulation time
+ *  @param dt: simulation time step
+ *  @param net_force: net Coulomb force on the particle
+ *  @param potential_energy: the particle's potential energy in the other charges' field  */
+void ChargedParticle::UpdateUnderField(double t, float dt, Vec2D net_force, float potential_energy)
+{
+    Particle::Update(t, dt, net_force);
+    this->potential_energy = potential_energy;
+}
@@ -0,0 +1,112 @@
+/********************
+*
+*    ContactColoring.hpp
+*
+*    Defines the ContactColoring class, which splits a list of contacts
+*    into batches that share no particles, so each batch can be resolved in parallel.
+*
+*********************/
+
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <utility>
+#include <algorithm>
+#include "ContactManager.hpp"
+
+
+
+
+
+/*  Greedy edge coloring of the contact graph (particles are vertices, contacts are edges).
+ *  Contacts are visited in order and each one gets the lowest color that neither of its particles has used yet,
+ *  so no two contacts of the same color touch the same particle. Colors are then resolved one after the other,
+ *  with the contacts inside a color spread over threads. The coloring only depends on the contact list,
+ *  so the result is the same for any number of threads.
+ *  A particle in more than MAX_COLORS contacts sends its extra contacts to one last batch, which is resolved serially.  */
+class ContactColoring
+{
+public:
+    static const int MAX_COLORS = 64;   // Colors tracked per particle (one bit each).
+
+    std::vector<int> order;             // Contact indices grouped by color, in contact order within each color.
+    std::vector<int> color_start;       // Where each color starts in `order`, plus one past the end.
+    bool overflow;                      // Whether the last batch holds leftover contacts that must be resolved serially.
+
+    int Colors() const { return (int)color_start.size() - 1; }
+
+    void Color(const std::vector<ContactManager::Contact>& contacts, int particle_count);
+    void Color(const std::vector<std::pair<int,int>>& pairs, int particle_count);
+
+
+private:
+    std::vector<uint64_t> used;         // Colors each particle is already in, as a bit set.
+    std::vector<int> color;             // Color given to each contact.
+
+    template <typename Ends>
+    void Build(int count, int particle_count, Ends ends);
+};
+
+
+
+
+
+
+/*  Colors the contacts, grouping them into `order` by color.
+ *  @param count: The number of contacts.
+ *  @param particle_count: The number of particles.
+ *  @param ends: Callable giving the two particles of contact k as a pair.  */
+template <typename Ends>
+void ContactColoring::Build(int count, int particle_count, Ends ends)
+{
+    used.assign(particle_count, 0);
+    color.resize(count);
+    overflow = false;
+
+    int colors = 0;
+    for (int k = 0; k < count; k++)
+    {
+        const std::pair<int,int> e = ends(k);
+        const uint64_t taken = used[e.first] | used[e.second];
+        if (taken == ~0ULL) {
+            color[k] = MAX_COLORS;
+            overflow = true;
+            continue;
+        }
+        const int c = __builtin_ctzll(~taken);
+        color[k] = c;
+        used[e.first] |= 1ULL << c;
+        used[e.second] |= 1ULL << c;
+        colors = std::max(colors, c + 1);
+    }
+    if (overflow)  colors = MAX_COLORS + 1;
+
+    // Counting sort by color keeps contact order within each color
+    color_start.assign(colors + 1, 0);
+    for (int k = 0; k < count; k++)
+        color_start[color[k] + 1]++;
+    for (int c = 0; c < colors; c++)
+        color_start[c + 1] += color_start[c];
+    order.resize(count);
+    std::vector<int> next(color_start.begin(), color_start.end() - 1);
+    for (int k = 0; k < count; k++)
+        order[next[color[k]]++] = k;
+}
+
+
+/*  Colors a ContactManager's contact list.
+ *  @param contacts: The contacts.
+ *  @param particle_count: The number of particles.  */
+void ContactColoring::Color(const std::vector<ContactManager::Contact>& contacts, int particle_count)
+{
+    Build((int)contacts.size(), particle_count, [&](int k) { return std::make_pair(contacts[k].a, contacts[k].b); });
+}
+
+
+/*  Colors a list of (i, j) pairs, e.g. straight from a broadphase.
+ *  @param pairs: The pairs.
+ *  @param particle_count: The number of particles.  */
+void ContactColoring::Color(const std::vector<std::pair<int,int>>& pairs, int particle_count)
+{
+    Build((int)pairs.size(), particle_count, [&](int k) { return pairs[k]; });
+}
@@ -0,0 +1,121 @@
+/********************
+*
+*    ContactManager.hpp
+*
+*    Defines the ContactManager class, which keeps a persistent list of
+*    touching particle pairs across frames and reports when contacts begin, persist and end.
+*
+*********************/
+
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <utility>
+#include <algorithm>
+#include <functional>
+#include "Vec2D.hpp"    // includes:  <cmath> and <SFML/Graphics.hpp>
+
+
+
+
+
+/*  Turns the candidate pairs from a broadphase into a list of actual contacts.
+ *  Each unordered pair of particles is tested once, and contacts are kept from one frame to the next,
+ *  keyed by the two particles' IDs (their indices in the particle vector), so per-contact data such as
+ *  the last impulse survives for warm starting. Callbacks fire when a contact begins, persists or ends.  */
+class ContactManager
+{
+public:
+    /*  A pair of overlapping particles.  */
+    struct Contact
+    {
+        int a;                      // ID of the first particle (always the lower of the two).
+        int b;                      // ID of the second particle.
+        int frames;                 // Number of consecutive frames the two have been in contact.
+        float normal_impulse;       // Impulse applied along the contact normal the last time the contact was resolved.
+
+        uint64_t Key() const { return ((uint64_t)(uint32_t)a << 32) | (uint32_t)b; }
+    };
+
+    std::vector<Contact> contacts;              // Current contacts, sorted by (a, b).
+
+    std::function<void(const Contact&)> on_begin;       // Called for each contact that started this frame.
+    std::function<void(const Contact&)> on_persist;     // Called for each contact that was already there last frame.
+    std::function<void(const Contact&)> on_end;         // Called for each contact from last frame that's no longer touching.
+
+    /*  Counts from the last call to Update.  */
+    struct Stats
+    {
+        int tested = 0;         // Candidate pairs run through the overlap test.
+        int begun = 0;          // Contacts that started.
+        int persisted = 0;      // Contacts carried over from the previous frame.
+        int ended = 0;          // Contacts that ended.
+    };
+    Stats stats;
+
+
+    void Update(const std::vector<std::pair<int,int>>& candidates, const std::vector<Vec2D>& centers, const std::vector<float>& radii);
+
+
+private:
+    std::vector<Contact> previous;      // Last frame's contacts, kept to merge against.
+};
+
+
+
+
+
+
+/*  Tests each candidate pair for overlap and merges the result with last frame's contacts,
+ *  carrying over the cached data of contacts that persist and firing the contact callbacks.
+ *  @param candidates: Candidate pairs (i, j) from a broadphase.
+ *  @param centers: The center of each particle.
+ *  @param radii: The radius of each particle (same length as centers).  */
+void ContactManager::Update(const std::vector<std::pair<int,int>>& candidates, const std::vector<Vec2D>& centers, const std::vector<float>& radii)
+{
+    stats = Stats();
+    previous.swap(contacts);
+    contacts.clear();
+
+    // Each unordered pair is tested once, as (lower ID, higher ID)
+    for (auto& pair : candidates)
+    {
+        const int a = std::min(pair.first, pair.second);
+        const int b = std::max(pair.first, pair.second);
+        if (a == b) continue;
+        stats.tested++;
+        const Vec2D d = centers[b] - centers[a];
+        const float reach = radii[a] + radii[b];
+        if (d.x * d.x + d.y * d.y < reach * reach)
+            contacts.push_back(Contact{ a, b, 0, 0.f });
+    }
+    std::sort(contacts.begin(), contacts.end(), [](const Contact& l, const Contact& r) { return l.Key() < r.Key(); });
+    contacts.erase(std::unique(contacts.begin(), contacts.end(), [](const Contact& l, const Contact& r) { return l.Key() == r.Key(); }), contacts.end());
+
+    // Both lists are sorted by key, so one merge pass matches them up
+    size_t p = 0;
+    for (auto& contact : contacts)
+    {
+        while (p < previous.size() && previous[p].Key() < contact.Key()) {
+            stats.ended++;
+            if (on_end) on_end(previous[p]);
+            p++;
+        }
+        if (p < previous.size() && previous[p].Key() == contact.Key()) {
+            contact.frames = previous[p].frames + 1;
+            contact.normal_impulse = previous[p].normal_impulse;
+            stats.persisted++;
+            if (on_persist) on_persist(contact);
+            p++;
+        }
+        else {
+            contact.frames = 1;
+            stats.begun++;
+            if (on_begin) on_begin(contact);
+        }
+    }
+    for (; p < previous.size(); p++) {
+        stats.ended++;
+        if (on_end) on_end(previous[p]);
+    }
+}
@@ -9,6 +9,7 @@
 *
 *********************/
 
+#pragma once
 #include <iostream>
 #include "Vec2D.hpp"    // includes:  <cmath> and <SFML/Graphics.hpp>
 
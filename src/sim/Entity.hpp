@@ -8,6 +8,7 @@
 *
 *********************/
 
+#pragma once
 #include "DrawableVec2D.hpp"    // includes:  "Vec2D.hpp", <cmath>, and <SFML/Graphics.hpp>
 
 
@@ -0,0 +1,487 @@
+/********************
+*
+*    EventDriven.hpp
+*
+*    Defines the EventDrivenSimulation class, an exact hard-sphere collision engine
+*    that jumps from one collision to the next instead of taking fixed time steps.
+*
+*********************/
+
+#pragma once
+#include <cmath>
+#include <queue>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include "Vec2D.hpp"    // includes:  <cmath> and <SFML/Graphics.hpp>
+
+
+
+
+
+/*  Event-driven hard-sphere simulation inside a rectangular box, under constant gravity.
+ *  Between collisions every ball follows a parabola, so the time of each particle-particle and
+ *  particle-wall impact can be solved for exactly. Predicted impacts go into a priority queue,
+ *  and the simulation jumps straight from one impact to the next.
+ *  Each ball keeps the time it was last updated, and is only moved when it's involved in an event;
+ *  its position at any other time is found from its parabola, so frames can be drawn at any time.
+ *  Events are invalidated lazily: each one remembers how many collisions its balls had had when it was
+ *  predicted, and is thrown away when popped if either ball has collided since.
+ *  Nothing can tunnel, as no step size is involved.
+ *  A ball that sits on a wall gravity pushes it into (or whose bounce off it would be lower than rest_height) rests
+ *  there: it's held on the wall, with no velocity or gravity along that axis, until an impact lifts it off again.
+ *  Without that, a ball on the floor would fall through it, and an inelastic ball would bounce ever faster and lower
+ *  (inelastic collapse), so Advance() would never get past the time it comes to rest.  */
+class EventDrivenSimulation
+{
+public:
+    /*  A ball, stored as it was the last time it took part in an event.  */
+    struct Ball
+    {
+        Vec2D position;     // Center of the ball at time `time`.
+        Vec2D velocity;     // Velocity of the ball at time `time`.
+        float radius;       // Radius of the ball.
+        float mass;         // Mass of the ball.
+        double time;        // Simulation time the position and velocity refer to.
+        int collisions;     // Number of collisions the ball has had (used to invalidate stale events).
+        bool resting[2];    // Whether the ball is resting on the wall gravity pushes it into, along x and along y.
+    };
+
+    /*  The walls of the box, as used by Event::other.  */
+    enum Wall { LEFT_WALL = -1, RIGHT_WALL = -2, TOP_WALL = -3, BOTTOM_WALL = -4 };
+
+    /*  A predicted impact.  */
+    struct Event
+    {
+        double time;            // When the impact happens.
+        int ball;               // The ball involved.
+        int other;              // The other ball involved, or one of the Wall values.
+        int ball_collisions;    // The ball's collision count when the event was predicted.
+        int other_collisions;   // The other ball's collision count when the event was predicted (unused for walls).
+
+        bool operator>(const Event& e) const { return time > e.time; }
+    };
+
+    std::vector<Ball> balls;        // The balls in the simulation.
+    Vec2D gravity;                  // Constant acceleration acting on every ball.
+    float restitution;              // Coefficient of restitution for every impact (1 for perfectly elastic).
+    float rest_height;              // Bounces lower than this end in a rest, and slower impacts are elastic.
+    float left, right, top, bottom; // The walls of the box.
+    double now;                     // Current simulation time.
+
+    /*  Counters, for comparing against the fixed-step loop.  */
+    struct Stats
+    {
+        long long events = 0;           // Events processed.
+        long long invalidated = 0;      // Stale events discarded.
+        long long wall_collisions = 0;  // Impacts with a wall.
+        long long ball_collisions = 0;  // Impacts between two balls.
+    };
+    Stats stats;
+
+
+    EventDrivenSimulation(float left, float right, float top, float bottom, Vec2D gravity);
+    EventDrivenSimulation(float left, float right, float top, float bottom, Vec2D gravity, float restitution);
+
+    void Add(Vec2D center, Vec2D velocity, float radius, float mass);
+    void Initialize();
+    void Advance(double t);
+
+    Vec2D AccelerationOf(int i) const;
+    Vec2D PositionAt(int i, double t) const;
+    Vec2D VelocityAt(int i, double t) const;
+    float TotalEnergy(double t) const;
+
+
+private:
+    std::priority_queue<Event, std::vector<Event>, std::greater<Event>> events;
+
+    double BallImpact(int i, int j) const;
+    double WallImpact(int i, float target, bool x_axis, bool moving_positive) const;
+    void Predict(int i);
+    void MoveTo(int i, double t);
+    float RestSpeed(float acceleration) const;
+    void Settle(int i);
+    void Resolve(const Event& event);
+
+    static int RealRoots(const double* c, int degree, double lo, double hi, double* roots);
+    static double Polynomial(const double* c, int degree, double x);
+};
+
+
+
+
+
+
+/*  Event-driven simulation constructor (perfectly elastic impacts).
+ *  @param left: x-coordinate of the left wall.
+ *  @param right: x-coordinate of the right wall.
+ *  @param top: y-coordinate of the top wall.
+ *  @param bottom: y-coordinate of the bottom wall.
+ *  @param gravity: Constant acceleration acting on every ball.  */
+EventDrivenSimulation::EventDrivenSimulation(float left, float right, float top, float bottom, Vec2D gravity)
+: gravity(gravity), restitution(1.f), rest_height(1e-3f), left(left), right(right), top(top), bottom(bottom), now(0.0)
+{ }
+
+
+/*  Event-driven simulation constructor.
+ *  @param left: x-coordinate of the left wall.
+ *  @param right: x-coordinate of the right wall.
+ *  @param top: y-coordinate of the top wall.
+ *  @param bottom: y-coordinate of the bottom wall.
+ *  @param gravity: Constant acceleration acting on every ball.
+ *  @param restitution: Coefficient of restitution for every impact.  */
+EventDrivenSimulation::EventDrivenSimulation(float left, float right, float top, float bottom, Vec2D gravity, float restitution)
+: gravity(gravity), restitution(restitution), rest_height(1e-3f), left(left), right(right), top(top), bottom(bottom), now(0.0)
+{ }
+
+
+/*  Adds a ball at the current simulation time. Call Initialize() once all balls are added.
+ *  @param center: The center of the ball.
+ *  @param velocity: The velocity of the ball.
+ *  @param radius: The radius of the ball.
+ *  @param mass: The mass of the ball.  */
+void EventDrivenSimulation::Add(Vec2D center, Vec2D velocity, float radius, float mass)
+{
+    balls.push_back(Ball{ center, velocity, radius, mass, now, 0, { false, false } });
+}
+
+
+/*  Predicts the first round of events for every ball, after settling the ones already resting on a wall.  */
+void EventDrivenSimulation::Initialize()
+{
+    events = decltype(events)();
+    for (int i = 0; i < (int)balls.size(); i++) {
+        MoveTo(i, now);
+        Settle(i);
+    }
+    for (int i = 0; i < (int)balls.size(); i++)  Predict(i);
+}
+
+
+
+
+
+
+/*  Returns the acceleration of a ball: gravity, less its component along any axis the ball is resting on a wall.
+ *  @param i: Index of the ball.  */
+Vec2D EventDrivenSimulation::AccelerationOf(int i) const
+{
+    return Vec2D(balls[i].resting[0] ? 0.f : gravity.x, balls[i].resting[1] ? 0.f : gravity.y);
+}
+
+
+/*  Returns the center of a ball at time t, following its parabola from the last time it was updated.
+ *  Only valid up to the ball's next event, i.e. for any t up to the time passed to the next call to Advance().
+ *  @param i: Index of the ball.
+ *  @param t: Simulation time.  */
+Vec2D EventDrivenSimulation::PositionAt(int i, double t) const
+{
+    const float tau = (float)(t - balls[i].time);
+    return balls[i].position + balls[i].velocity * tau + AccelerationOf(i) * (0.5f * tau * tau);
+}
+
+
+/*  Returns the velocity of a ball at time t.
+ *  @param i: Index of the ball.
+ *  @param t: Simulation time.  */
+Vec2D EventDrivenSimulation::VelocityAt(int i, double t) const
+{
+    return balls[i].velocity + AccelerationOf(i) * (float)(t - balls[i].time);
+}
+
+
+/*  Returns the total (kinetic plus gravitational potential) energy of all the balls at time t.
+ *  Potential energy is measured from the bottom wall, as in Particle2D.
+ *  @param t: Simulation time.  */
+float EventDrivenSimulation::TotalEnergy(double t) const
+{
+    float energy = 0.f;
+    for (int i = 0; i < (int)balls.size(); i++)
+    {
+        const Vec2D v = VelocityAt(i, t);
+        const Vec2D p = PositionAt(i, t);
+        energy += 0.5f * balls[i].mass * v.dot(v) + balls[i].mass * gravity.y * (bottom - balls[i].radius - p.y);
+    }
+    return energy;
+}
+
+
+
+
+
+
+/*  Returns how long from now until balls i and j touch, or infinity if they don't.
+ *  If gravity acts on both equally, their relative motion is a straight line. If one of them is resting on a wall
+ *  it's a parabola, and the squared distance between them less the sum of their radii squared is a quartic in the
+ *  time from now, so the impact is its first root where it's falling.
+ *  @param i: Index of the first ball.
+ *  @param j: Index of the second ball.  */
+double EventDrivenSimulation::BallImpact(int i, int j) const
+{
+    const Vec2D dr = PositionAt(j, now) - PositionAt(i, now);
+    const Vec2D dv = VelocityAt(j, now) - VelocityAt(i, now);
+    const Vec2D da = AccelerationOf(j) - AccelerationOf(i);
+    const double b = dr.dot(dv);
+    const double sigma = balls[i].radius + balls[j].radius;
+    const double c = dr.dot(dr) - sigma * sigma;
+
+    if (da.x != 0.f || da.y != 0.f)
+    {
+        const Vec2D half = da * 0.5f;
+        const double quartic[5] = { c, 2.0 * b, dv.dot(dv) + 2.0 * dr.dot(half), 2.0 * dv.dot(half), half.dot(half) };
+        if (c <= 0.0 && b < 0.0) return 0.0;
+
+        double bound = 0.0;                 // No root lies further out than this (Cauchy's bound)
+        for (int k = 0; k < 4; k++)  bound = std::max(bound, std::abs(quartic[k] / quartic[4]));
+        const double derivative[4] = { quartic[1], 2.0 * quartic[2], 3.0 * quartic[3], 4.0 * quartic[4] };
+        double roots[4];
+        const int count = RealRoots(quartic, 4, 0.0, 1.0 + bound, roots);
+        for (int k = 0; k < count; k++)
+            if (Polynomial(derivative, 3, roots[k]) < 0.0)  return roots[k];
+        return INFINITY;
+    }
+
+    if (b >= 0.0) return INFINITY;     // Moving apart
+    const double dvdv = dv.dot(dv);
+    if (c <= 0.0) return 0.0;           // Already overlapping and approaching, so collide right away
+
+    const double discriminant = b * b - dvdv * c;
+    if (discriminant < 0.0) return INFINITY;
+    return c / (-b + std::sqrt(discriminant));      // Smaller root, in a form that doesn't cancel
+}
+
+
+/*  Returns the value of the polynomial c[0] + c[1] x + ... + c[degree] x^degree at x.  */
+double EventDrivenSimulation::Polynomial(const double* c, int degree, double x)
+{
+    double value = c[degree];
+    for (int k = degree - 1; k >= 0; k--)  value = value * x + c[k];
+    return value;
+}
+
+
+/*  Finds the real roots of the polynomial c[0] + c[1] x + ... + c[degree] x^degree (degree up to 4) in (lo, hi],
+ *  writes them to roots in increasing order, and returns how many there are.
+ *  The polynomial is monotonic between the roots of its derivative (found the same way), so each of those intervals
+ *  holds at most one root, which is then bisected for. Roots where it only touches zero (double roots) are skipped.  */
+int EventDrivenSimulation::RealRoots(const double* c, int degree, double lo, double hi, double* roots)
+{
+    while (degree > 0 && c[degree] == 0.0)  degree--;
+    if (degree == 0) return 0;
+    if (degree == 1) {
+        const double x = -c[0] / c[1];
+        if (x > lo && x <= hi) { roots[0] = x; return 1; }
+        return 0;
+    }
+
+    double derivative[4];
+    for (int k = 0; k < degree; k++)  derivative[k] = (k + 1) * c[k + 1];
+    double ends[5];
+    int count = RealRoots(derivative, degree - 1, lo, hi, ends + 1) + 2;
+    ends[0] = lo;
+    ends[count - 1] = hi;
+
+    int found = 0;
+    for (int k = 0; k + 1 < count; k++)
+    {
+        double a = ends[k], b = ends[k + 1];
+        const bool negative = Polynomial(c, degree, a) < 0.0;
+        if (negative == (Polynomial(c, degree, b) < 0.0)) continue;
+        for (int iteration = 0; iteration < 200; iteration++)
+        {
+            const double middle = 0.5 * (a + b);
+            if (middle <= a || middle >= b) break;
+            if ((Polynomial(c, degree, middle) < 0.0) == negative)  a = middle;
+            else  b = middle;
+        }
+        roots[found++] = b;
+    }
+    return found;
+}
+
+
+/*  Returns how long from now until ball i reaches a wall along one axis, or infinity if it doesn't.
+ *  @param i: Index of the ball.
+ *  @param target: The coordinate the ball's center has at impact (the wall, less the radius).
+ *  @param x_axis: Whether the wall is a left/right wall (otherwise top/bottom).
+ *  @param moving_positive: Whether the ball has to be moving in the +x (or +y) direction to hit the wall.  */
+double EventDrivenSimulation::WallImpact(int i, float target, bool x_axis, bool moving_positive) const
+{
+    const Vec2D p = PositionAt(i, now);
+    const Vec2D v = VelocityAt(i, now);
+    const Vec2D acceleration = AccelerationOf(i);
+    const double a = 0.5 * (x_axis ? acceleration.x : acceleration.y);
+    const double b = x_axis ? v.x : v.y;
+    const double c = (x_axis ? p.x : p.y) - target;
+
+    // Roots of a*tau^2 + b*tau + c = 0
+    double roots[2] = { INFINITY, INFINITY };
+    if (a == 0.0) {
+        if (b != 0.0) roots[0] = -c / b;
+    }
+    else {
+        const double discriminant = b * b - 4.0 * a * c;
+        if (discriminant < 0.0) return INFINITY;
+        const double q = -0.5 * (b + std::copysign(std::sqrt(discriminant), b));
+        roots[0] = q / a;
+        roots[1] = (q != 0.0) ? c / q : INFINITY;
+        if (roots[0] > roots[1])  std::swap(roots[0], roots[1]);
+    }
+
+    // The first root ahead of us where the ball is heading into the wall
+    for (double tau : roots)
+    {
+        if (!(tau >= 0.0) || std::isinf(tau)) continue;
+        const double speed = b + 2.0 * a * tau;
+        if (moving_positive ? speed > 0.0 : speed < 0.0) return tau;
+    }
+    return INFINITY;
+}
+
+
+/*  Predicts ball i's next impact with every other ball and with each wall, and queues them.
+ *  @param i: Index of the ball.  */
+void EventDrivenSimulation::Predict(int i)
+{
+    for (int j = 0; j < (int)balls.size(); j++)
+    {
+        if (j == i) continue;
+        const double tau = BallImpact(i, j);
+        if (!std::isinf(tau))  events.push(Event{ now + tau, i, j, balls[i].collisions, balls[j].collisions });
+    }
+
+    const float r = balls[i].radius;
+    const double walls[4] = {
+        WallImpact(i, left + r, true, false),
+        WallImpact(i, right - r, true, true),
+        WallImpact(i, top + r, false, false),
+        WallImpact(i, bottom - r, false, true)
+    };
+    const int ids[4] = { LEFT_WALL, RIGHT_WALL, TOP_WALL, BOTTOM_WALL };
+    for (int w = 0; w < 4; w++)
+        if (!std::isinf(walls[w]))  events.push(Event{ now + walls[w], i, ids[w], balls[i].collisions, 0 });
+}
+
+
+/*  Moves ball i along its parabola to time t, making t its new reference time.
+ *  @param i: Index of the ball.
+ *  @param t: Simulation time.  */
+void EventDrivenSimulation::MoveTo(int i, double t)
+{
+    balls[i].position = PositionAt(i, t);
+    balls[i].velocity = VelocityAt(i, t);
+    balls[i].time = t;
+}
+
+
+/*  Returns the slowest a ball can leave a wall at and still rise rest_height off it, against this acceleration.
+ *  @param acceleration: The acceleration pushing the ball back into the wall.  */
+float EventDrivenSimulation::RestSpeed(float acceleration) const
+{
+    return std::sqrt(2.f * std::abs(acceleration) * rest_height);
+}
+
+
+/*  Updates whether ball i is resting along each axis, at the ball's reference time.
+ *  A ball within rest_height of the wall gravity pushes it into, and moving along that axis too slowly to rise
+ *  rest_height off it, comes to rest: it's put on the wall, and its velocity along the axis is dropped.
+ *  A resting ball that's been knocked off the wall faster than that is lifted, and falls freely again.
+ *  @param i: Index of the ball.  */
+void EventDrivenSimulation::Settle(int i)
+{
+    Ball& ball = balls[i];
+    for (int axis = 0; axis < 2; axis++)
+    {
+        const float pull = axis ? gravity.y : gravity.x;
+        float& p = axis ? ball.position.y : ball.position.x;
+        float& v = axis ? ball.velocity.y : ball.velocity.x;
+        if (pull == 0.f) { ball.resting[axis] = false; continue; }
+
+        const float wall = (pull > 0.f) ? (axis ? bottom : right) - ball.radius : (axis ? top : left) + ball.radius;
+        const float gap = (pull > 0.f) ? wall - p : p - wall;       // How far the ball is off the wall
+        const bool slow = std::abs(v) <= RestSpeed(pull);
+        ball.resting[axis] = slow && (ball.resting[axis] || gap <= rest_height);
+        if (ball.resting[axis]) {
+            p = wall;
+            v = 0.f;
+        }
+    }
+}
+
+
+/*  Applies the impulse for an event, at the current simulation time, and then settles the balls involved.
+ *  An impact slower than a bounce of rest_height is elastic, so that a ball on top of a resting one bounces on it
+ *  at a constant rate instead of collapsing onto it. A resting ball that's pushed into its wall is held by it,
+ *  so only the impulse's component along the wall moves it.
+ *  @param event: The event to resolve.  */
+void EventDrivenSimulation::Resolve(const Event& event)
+{
+    Ball& a = balls[event.ball];
+    switch (event.other)
+    {
+        case LEFT_WALL:     a.position.x = left + a.radius;     a.velocity.x = -a.velocity.x * restitution;  break;
+        case RIGHT_WALL:    a.position.x = right - a.radius;    a.velocity.x = -a.velocity.x * restitution;  break;
+        case TOP_WALL:      a.position.y = top + a.radius;      a.velocity.y = -a.velocity.y * restitution;  break;
+        case BOTTOM_WALL:   a.position.y = bottom - a.radius;   a.velocity.y = -a.velocity.y * restitution;  break;
+        default:
+        {
+            // Impulse along the line of centers, on whichever axes each ball is free to move along
+            Ball& b = balls[event.other];
+            Vec2D normal = b.position - a.position;
+            const float distance = normal.magnitude();
+            normal = (distance > 0.f) ? normal / distance : Vec2D(1.f, 0.f);
+            const float approach = (a.velocity - b.velocity).dot(normal);
+            const float e = (approach < RestSpeed(gravity.magnitude())) ? 1.f : restitution;
+
+            // The impulse pushes a along -normal and b along +normal
+            const bool a_held_x = a.resting[0] && gravity.x * -normal.x > 0.f,  a_held_y = a.resting[1] && gravity.y * -normal.y > 0.f;
+            const bool b_held_x = b.resting[0] && gravity.x * normal.x > 0.f,   b_held_y = b.resting[1] && gravity.y * normal.y > 0.f;
+            const Vec2D a_normal(a_held_x ? 0.f : normal.x, a_held_y ? 0.f : normal.y);
+            const Vec2D b_normal(b_held_x ? 0.f : normal.x, b_held_y ? 0.f : normal.y);
+            const float inverse_mass = a_normal.dot(normal) / a.mass + b_normal.dot(normal) / b.mass;
+            if (inverse_mass > 0.f) {
+                const float impulse = (1.f + e) * approach / inverse_mass;
+                a.velocity -= a_normal * (impulse / a.mass);
+                b.velocity += b_normal * (impulse / b.mass);
+            }
+            stats.ball_collisions++;
+            Settle(event.ball);
+            Settle(event.other);
+            return;
+        }
+    }
+    stats.wall_collisions++;
+    Settle(event.ball);
+}
+
+
+/*  Processes every event up to time t, then sets the simulation time to t.
+ *  Positions at t (or at any time before the next event) can then be read with PositionAt().
+ *  @param t: The simulation time to advance to.  */
+void EventDrivenSimulation::Advance(double t)
+{
+    while (!events.empty() && events.top().time <= t)
+    {
+        const Event event = events.top();
+        events.pop();
+
+        const bool is_ball = event.other >= 0;
+        if (balls[event.ball].collisions != event.ball_collisions || (is_ball && balls[event.other].collisions != event.other_collisions)) {
+            stats.invalidated++;
+            continue;
+        }
+
+        now = event.time;
+        MoveTo(event.ball, now);
+        if (is_ball)  MoveTo(event.other, now);
+        Resolve(event);
+        stats.events++;
+
+        balls[event.ball].collisions++;
+        if (is_ball)  balls[event.other].collisions++;
+        Predict(event.ball);
+        if (is_ball)  Predict(event.other);
+    }
+    now = t;
+}
@@ -0,0 +1,454 @@
+/********************
+*
+*    FastMultipole.hpp
+*
+*    Defines the FastMultipole class, which works out the net Coulomb force and potential
+*    on every one of N charges in O(N), from multipole and local expansions on a grid of boxes.
+*
+*********************/
+
+#pragma once
+#include <cmath>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <functional>
+#include "Vec2D.hpp"
+#include "ThreadPool.hpp"
+
+
+
+
+
+/*  Fast multipole method for the Coulomb force between every pair of charges.
+ *  The charges' bounding square is split into 4^l boxes at each level l, down to leaves holding about `leaf_size` charges.
+ *  Upward pass: every leaf gets a multipole expansion of its charges about its center, and every box above it the sum of its
+ *  four children's, shifted to its center. Downward pass: every box gets a local (Taylor) expansion of the field from the
+ *  boxes in its interaction list (the children of its parent's neighbours that aren't its own neighbours), plus its parent's,
+ *  shifted to its center. The leaves then evaluate their local expansion at each of their charges, and add the charges in the
+ *  3x3 leaves around them directly. Every box's expansions only depend on boxes at the level before, so each level of both
+ *  passes is split across a ThreadPool, and the result doesn't depend on the number of threads.
+ *  The force law is the 3D one, 1/r^2 between charges in the plane (as in ChargedParticle::CoulombForce), so the potential
+ *  1/r isn't harmonic in 2D and has no complex-variable (z^-k) expansions. The expansions are Cartesian Taylor series instead,
+ *  in x^a y^b / (a! b!) up to total degree a + b <= order, with the derivatives of 1/r worked out by recurrence.
+ *  The error falls off as ErrorBound(order): every far-field term is a Taylor series truncated at degree `order`, in an offset
+ *  no more than 1 / sqrt(2) of the distance between the boxes' centers.
+ *  The forces follow ChargedParticle::CoulombForce (like charges repel, with k = 8.987551787e9), between particle centers.  */
+class FastMultipole
+{
+public:
+    int order;                          // Highest total degree in the expansions.
+    float softening;                    // Added to the squared distances summed directly (the far field is too far for it to matter).
+    int leaf_size;                      // Charges per leaf, on average, that the number of levels is picked for.
+
+    std::vector<Vec2D> forces;          // Net Coulomb force on each charge, from the last Solve.
+    std::vector<float> potentials;      // Electric potential at each charge due to all the others (its potential energy is charge * potential).
+
+    /*  Size of the last grid built, and the work done by the last Solve.  */
+    struct Stats
+    {
+        int levels = 0;                 // Leaf level (the root is level 0).
+        int leaves = 0;
+        long long translations = 0;     // Multipole-to-local translations.
+        long long pair_terms = 0;       // Charge-charge interactions.
+    };
+    Stats stats;
+
+
+    FastMultipole(int order = 8, float softening = 0.0f, int leaf_size = 32) : order(order), softening(softening), leaf_size(leaf_size) { }
+
+    void Build(const std::vector<Vec2D>& centers, const std::vector<float>& charges);
+    void Solve(ThreadPool* pool = nullptr);
+    template <typename P>
+    void Solve(const std::vector<P>& particles, ThreadPool* pool = nullptr);
+    float PotentialEnergy() const;
+
+    static double ErrorBound(int order);
+
+
+private:
+    static const int MAX_LEVELS = 10;   // 4^10 leaves; deeper grids would need more memory than they save time.
+    static const int MAX_ORDER = 24;
+
+    int levels;
+    int terms;                          // Coefficients in an expansion: (order + 1) (order + 2) / 2.
+    double x0, y0, side;                // Root box: lower corner and side.
+
+    std::vector<int> sorted;            // Charge indices, grouped by leaf.
+    std::vector<int> leaf_start;        // The charges of leaf b are sorted[leaf_start[b], leaf_start[b + 1]).
+    std::vector<float> xs, ys, qs;      // Positions and charges, in leaf order.
+    std::vector<std::vector<int>> counts;           // Charges in each box, per level.
+    std::vector<std::vector<double>> multipoles;    // `terms` coefficients per box, per level.
+    std::vector<std::vector<double>> locals;
+    std::vector<std::vector<double>> kernels;       // Derivatives of 1/r at each of the 7x7 box offsets in an interaction list, per level.
+
+    static int Index(int a, int b) { const int t = a + b; return t * (t + 1) / 2 + b; }
+    static void Derivatives(double x, double y, int order, double* d);
+    double Center(int level, int i) const { return (i + 0.5) * side / (1 << level); }
+
+    void Upward(int level, int box);
+    void Downward(int level, int box, long long& translations);
+    void Evaluate(int leaf, long long& pairs);
+};
+
+
+
+
+
+
+/*  Fills d with the derivatives of 1/r at (x, y), d[Index(a, b)] = d^(a+b) / dx^a dy^b (1/r), for a + b <= order.
+ *  From (a + b) r^2 D(a,b) = -(2(a + b) - 1) (a x D(a-1,b) + b y D(a,b-1)) - (a + b - 1) (a (a-1) D(a-2,b) + b (b-1) D(a,b-2)).  */
+void FastMultipole::Derivatives(double x, double y, int order, double* d)
+{
+    const double r2 = x * x + y * y;
+    d[0] = 1.0 / std::sqrt(r2);
+    for (int t = 1; t <= order; t++)
+        for (int b = 0; b <= t; b++)
+        {
+            const int a = t - b;
+            double first = 0.0, second = 0.0;
+            if (a >= 1) first += a * x * d[Index(a - 1, b)];
+            if (b >= 1) first += b * y * d[Index(a, b - 1)];
+            if (a >= 2) second += a * (a - 1) * d[Index(a - 2, b)];
+            if (b >= 2) second += b * (b - 1) * d[Index(a, b - 2)];
+            d[Index(a, b)] = -((2 * t - 1) * first + (t - 1) * second) / (t * r2);
+        }
+}
+
+
+/*  Returns the worst-case error of one box's far field on a charge, as a fraction of (total |charge| of the box) / (distance):
+ *  rho^(order+1) / (1 - rho), with rho = 1 / sqrt(2), the largest offset from the centers over the distance between them.
+ *  It's a bound; the error on a whole set of charges, whose far fields partly cancel, is usually orders of magnitude lower.  */
+double FastMultipole::ErrorBound(int order)
+{
+    const double rho = std::sqrt(0.5);
+    return std::pow(rho, order + 1) / (1.0 - rho);
+}
+
+
+/*  Sorts the charges into the leaves of a grid over them, and sizes the expansions.
+ *  @param centers: Position of each charge (the particles' centers).
+ *  @param charges: Charge of each one.  */
+void FastMultipole::Build(const std::vector<Vec2D>& centers, const std::vector<float>& charges)
+{
+    if (order < 1 || order > MAX_ORDER)
+        throw std::invalid_argument("FastMultipole::Build: The order has to be between 1 and " + std::to_string(MAX_ORDER));
+    const int n = (int)centers.size();
+    terms = (order + 1) * (order + 2) / 2;
+    levels = 2;
+    while (levels < MAX_LEVELS && (double)n / (1 << (2 * levels)) > leaf_size)
+        levels++;
+    stats = Stats();
+    stats.levels = levels;
+    stats.leaves = 1 << (2 * levels);
+
+    // Root: the bounding square, padded a little so no charge sits on its far edge
+    double min_x = n ? centers[0].x : 0.0, max_x = min_x;
+    double min_y = n ? centers[0].y : 0.0, max_y = min_y;
+    for (int i = 0; i < n; i++)
+    {
+        min_x = std::min(min_x, (double)centers[i].x);  max_x = std::max(max_x, (double)centers[i].x);
+        min_y = std::min(min_y, (double)centers[i].y);  max_y = std::max(max_y, (double)centers[i].y);
+    }
+    side = std::max(max_x - min_x, max_y - min_y) * 1.0001 + 1e-3;
+    x0 = 0.5 * (min_x + max_x - side);
+    y0 = 0.5 * (min_y + max_y - side);
+
+    // Counting sort into the leaves (row by row)
+    const int per_row = 1 << levels;
+    std::vector<int> leaf(n);
+    leaf_start.assign(stats.leaves + 1, 0);
+    for (int i = 0; i < n; i++)
+    {
+        const int ix = std::min(per_row - 1, (int)((centers[i].x - x0) / side * per_row));
+        const int iy = std::min(per_row - 1, (int)((centers[i].y - y0) / side * per_row));
+        leaf[i] = iy * per_row + ix;
+        leaf_start[leaf[i] + 1]++;
+    }
+    for (int b = 0; b < stats.leaves; b++)
+        leaf_start[b + 1] += leaf_start[b];
+    sorted.resize(n);
+    xs.resize(n); ys.resize(n); qs.resize(n);
+    std::vector<int> next(leaf_start.begin(), leaf_start.end() - 1);
+    for (int i = 0; i < n; i++)
+    {
+        const int k = next[leaf[i]]++;
+        sorted[k] = i;
+        xs[k] = centers[i].x;
+        ys[k] = centers[i].y;
+        qs[k] = charges[i];
+    }
+
+    // Charges per box at every level, from the leaves up
+    counts.assign(levels + 1, std::vector<int>());
+    counts[levels].resize(stats.leaves);
+    for (int b = 0; b < stats.leaves; b++)
+        counts[levels][b] = leaf_start[b + 1] - leaf_start[b];
+    for (int l = levels - 1; l >= 0; l--)
+    {
+        const int row = 1 << l;
+        counts[l].assign(row * row, 0);
+        for (int b = 0; b < 4 * row * row; b++)
+            counts[l][((b / (2 * row)) / 2) * row + (b % (2 * row)) / 2] += counts[l + 1][b];
+    }
+
+    multipoles.assign(levels + 1, std::vector<double>());
+    locals.assign(levels + 1, std::vector<double>());
+    kernels.assign(levels + 1, std::vector<double>());
+    for (int l = 2; l <= levels; l++)
+    {
+        multipoles[l].resize((size_t)terms << (2 * l));
+        locals[l].resize((size_t)terms << (2 * l));
+        kernels[l].resize(49 * terms);
+        const double size = side / (1 << l);
+        for (int ox = -3; ox <= 3; ox++)
+            for (int oy = -3; oy <= 3; oy++)
+                if (std::abs(ox) > 1 || std::abs(oy) > 1)
+                    Derivatives(ox * size, oy * size, order, &kernels[l][((ox + 3) * 7 + (oy + 3)) * terms]);
+    }
+}
+
+
+/*  Works out box `box`'s multipole expansion: from its charges for a leaf, or from its four children's otherwise.
+ *  The coefficients are sum(q (-d)^n / n!) over its charges, d being a charge's offset from the box center,
+ *  so the potential at offset R from the center is sum(M_n D_n(R)).  */
+void FastMultipole::Upward(int level, int box)
+{
+    double* m = &multipoles[level][(size_t)box * terms];
+    std::fill(m, m + terms, 0.0);
+    if (counts[level][box] == 0) return;
+
+    const int row = 1 << level;
+    const double cx = Center(level, box % row), cy = Center(level, box / row);
+    double px[MAX_ORDER + 1], py[MAX_ORDER + 1];
+    auto powers = [&](double dx, double dy) {
+        px[0] = py[0] = 1.0;
+        for (int k = 1; k <= order; k++) {
+            px[k] = px[k - 1] * dx / k;
+            py[k] = py[k - 1] * dy / k;
+        }
+    };
+
+    if (level == levels)
+    {
+        for (int k = leaf_start[box]; k < leaf_start[box + 1]; k++)
+        {
+            powers(-(xs[k] - x0 - cx), -(ys[k] - y0 - cy));
+            for (int t = 0; t <= order; t++)
+                for (int b = 0; b <= t; b++)
+                    m[Index(t - b, b)] += qs[k] * px[t - b] * py[b];
+        }
+        return;
+    }
+
+    // Shift each child's expansion to this center: M_n = sum over k <= n of M_child_k w^(n-k) / (n-k)!, w = center - child center
+    const int ix = box % row, iy = box / row;
+    for (int c = 0; c < 4; c++)
+    {
+        const int child = (2 * iy + c / 2) * (2 * row) + 2 * ix + c % 2;
+        if (counts[level + 1][child] == 0) continue;
+        const double* mc = &multipoles[level + 1][(size_t)child * terms];
+        powers(cx - Center(level + 1, 2 * ix + c % 2), cy - Center(level + 1, 2 * iy + c / 2));
+        for (int t = 0; t <= order; t++)
+            for (int b = 0; b <= t; b++)
+            {
+                const int a = t - b;
+                double sum = 0.0;
+                for (int i = 0; i <= a; i++)
+                    for (int j = 0; j <= b; j++)
+                        sum += mc[Index(i, j)] * px[a - i] * py[b - j];
+                m[Index(a, b)] += sum;
+            }
+    }
+}
+
+
+/*  Works out box `box`'s local expansion, L_m = d^m phi / dx^a dy^b at its center: its parent's, shifted to its center,
+ *  plus the field of every box in its interaction list, L_m = sum over n of M_n D_(n+m)(center - source center).  */
+void FastMultipole::Downward(int level, int box, long long& translations)
+{
+    double* l = &locals[level][(size_t)box * terms];
+    std::fill(l, l + terms, 0.0);
+    if (counts[level][box] == 0) return;
+
+    const int row = 1 << level;
+    const int ix = box % row, iy = box / row;
+    if (level > 2)
+    {
+        // L_k = sum over m >= k of L_parent_m s^(m-k) / (m-k)!, s = center - parent center
+        const double* lp = &locals[level - 1][(size_t)((iy / 2) * (row / 2) + ix / 2) * terms];
+        const double shift_x = Center(level, ix) - Center(level - 1, ix / 2), shift_y = Center(level, iy) - Center(level - 1, iy / 2);
+        double px[MAX_ORDER + 1], py[MAX_ORDER + 1];
+        px[0] = py[0] = 1.0;
+        for (int k = 1; k <= order; k++) {
+            px[k] = px[k - 1] * shift_x / k;
+            py[k] = py[k - 1] * shift_y / k;
+        }
+        for (int t = 0; t <= order; t++)
+            for (int b = 0; b <= t; b++)
+            {
+                const int a = t - b;
+                double sum = 0.0;
+                for (int i = a; i <= order; i++)
+                    for (int j = b; i + j <= order; j++)
+                        sum += lp[Index(i, j)] * px[i - a] * py[j - b];
+                l[Index(a, b)] = sum;
+            }
+    }
+
+    const int px0 = ix / 2, py0 = iy / 2;
+    for (int sy = std::max(0, 2 * (py0 - 1)); sy <= std::min(row - 1, 2 * (py0 + 1) + 1); sy++)
+        for (int sx = std::max(0, 2 * (px0 - 1)); sx <= std::min(row - 1, 2 * (px0 + 1) + 1); sx++)
+        {
+            if (std::abs(sx - ix) <= 1 && std::abs(sy - iy) <= 1) continue;
+            const int source = sy * row + sx;
+            if (counts[level][source] == 0) continue;
+            const double* m = &multipoles[level][(size_t)source * terms];
+            const double* d = &kernels[level][((ix - sx + 3) * 7 + (iy - sy + 3)) * terms];
+            for (int t = 0; t <= order; t++)
+                for (int b = 0; b <= t; b++)
+                {
+                    const int a = t - b;
+                    double sum = 0.0;
+                    for (int u = 0; u <= order - t; u++)
+                        for (int j = 0; j <= u; j++)
+                            sum += m[Index(u - j, j)] * d[Index(a + u - j, b + j)];
+                    l[Index(a, b)] += sum;
+                }
+            translations++;
+        }
+}
+
+
+/*  Works out the force and potential at every charge in a leaf: its local expansion and the gradient of it at the charge,
+ *  plus the charges in the 3x3 leaves around it, summed directly.  */
+void FastMultipole::Evaluate(int leaf, long long& pairs)
+{
+    const int row = 1 << levels;
+    const int ix = leaf % row, iy = leaf / row;
+    const double cx = Center(levels, ix), cy = Center(levels, iy);
+    const double* l = &locals[levels][(size_t)leaf * terms];
+    double px[MAX_ORDER + 1], py[MAX_ORDER + 1];
+
+    for (int k = leaf_start[leaf]; k < leaf_start[leaf + 1]; k++)
+    {
+        // phi = sum L_(a,b) r^(a,b) / (a! b!), and its gradient from the terms one degree up
+        const double rx = xs[k] - x0 - cx, ry = ys[k] - y0 - cy;
+        px[0] = py[0] = 1.0;
+        for (int i = 1; i <= order; i++) {
+            px[i] = px[i - 1] * rx / i;
+            py[i] = py[i - 1] * ry / i;
+        }
+        double phi = 0.0, gx = 0.0, gy = 0.0;
+        for (int t = 0; t <= order; t++)
+            for (int b = 0; b <= t; b++)
+            {
+                const int a = t - b;
+                const double w = px[a] * py[b];
+                phi += l[Index(a, b)] * w;
+                if (t < order) {
+                    gx += l[Index(a + 1, b)] * w;
+                    gy += l[Index(a, b + 1)] * w;
+                }
+            }
+
+        // Near field: the leaf and its neighbours
+        const float xi = xs[k], yi = ys[k];
+        float ex = 0.0f, ey = 0.0f, near_phi = 0.0f;
+        for (int ny = std::max(0, iy - 1); ny <= std::min(row - 1, iy + 1); ny++)
+            for (int nx = std::max(0, ix - 1); nx <= std::min(row - 1, ix + 1); nx++)
+            {
+                const int neighbour = ny * row + nx;
+                for (int j = leaf_start[neighbour]; j < leaf_start[neighbour + 1]; j++)
+                {
+                    if (j == k) continue;
+                    const float dx = xi - xs[j], dy = yi - ys[j];
+                    const float r2 = dx * dx + dy * dy + softening;
+                    if (r2 == 0.0f) continue;
+                    const float inv = 1.0f / std::sqrt(r2);
+                    const float inv3 = inv * inv * inv;
+                    near_phi += qs[j] * inv;
+                    ex += qs[j] * dx * inv3;
+                    ey += qs[j] * dy * inv3;
+                }
+                pairs += leaf_start[neighbour + 1] - leaf_start[neighbour];
+            }
+
+        const int i = sorted[k];
+        forces[i] = Vec2D((float)(8.987551787e9 * qs[k] * (ex - gx)), (float)(8.987551787e9 * qs[k] * (ey - gy)));
+        potentials[i] = (float)(8.987551787e9 * (near_phi + phi));
+    }
+}
+
+
+/*  Works out the force on and potential at every charge in the grid from the last Build.
+ *  @param pool: Threads to split each level's boxes across (the calling thread does them all if null).  */
+void FastMultipole::Solve(ThreadPool* pool)
+{
+    const int n = (int)sorted.size();
+    forces.resize(n);
+    potentials.resize(n);
+    std::atomic<long long> translations(0), pairs(0);
+    auto run = [&](int count, int grain, const std::function<void(int, int)>& body) {
+        if (pool) pool->ParallelFor(0, count, body, grain);
+        else body(0, count);
+    };
+
+    // Upward pass, leaves first (levels 0 and 1 have no interaction lists, so they're never needed)
+    for (int l = levels; l >= 2; l--)
+        run(1 << (2 * l), 16, [&](int begin, int end) {
+            for (int box = begin; box < end; box++)
+                Upward(l, box);
+        });
+
+    // Downward pass, root first
+    for (int l = 2; l <= levels; l++)
+        run(1 << (2 * l), 4, [&](int begin, int end) {
+            long long chunk_translations = 0;
+            for (int box = begin; box < end; box++)
+                Downward(l, box, chunk_translations);
+            translations += chunk_translations;
+        });
+
+    run(stats.leaves, 4, [&](int begin, int end) {
+        long long chunk_pairs = 0;
+        for (int leaf = begin; leaf < end; leaf++)
+            Evaluate(leaf, chunk_pairs);
+        pairs += chunk_pairs;
+    });
+
+    stats.translations = translations;
+    stats.pair_terms = pairs;
+}
+
+
+/*  Builds the grid over a vector of ChargedParticles (or anything with a center and a charge) and solves it.
+ *  forces[i] and charge * potentials[i] are then the net force on and potential energy of particles[i], e.g. for
+ *  ChargedParticle::UpdateUnderField(t, dt, force, potential_energy).
+ *  @param particles: The charges.
+ *  @param pool: Threads to split each level across (may be null).  */
+template <typename P>
+void FastMultipole::Solve(const std::vector<P>& particles, ThreadPool* pool)
+{
+    std::vector<Vec2D> centers(particles.size());
+    std::vector<float> charges(particles.size());
+    for (size_t i = 0; i < particles.size(); i++)
+    {
+        centers[i] = particles[i].center;
+        charges[i] = particles[i].charge;
+    }
+    Build(centers, charges);
+    Solve(pool);
+}
+
+
+/*  Returns the total electric potential energy, half the sum of charge * potential (each pair is in two potentials).  */
+float FastMultipole::PotentialEnergy() const
+{
+    double energy = 0.0;
+    for (size_t k = 0; k < sorted.size(); k++)
+        energy += 0.5 * qs[k] * potentials[sorted[k]];
+    return (float)energy;
+}
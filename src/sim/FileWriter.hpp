@@ -7,6 +7,7 @@
 *
 *********************/
 
+#pragma once
 #include <fstream>
 #include <iostream>
 #include <SFML/Graphics.hpp>
@@ -45,6 +46,7 @@ public:
     void AddLine(int value1, float value2);
     void AddLine(int value1, float value2, float value3);
     void AddLine(int value1, float value2, float value3, float value4);
+    void AddLine(int value1, int value2, float value3, float value4, float value5, float value6);
 
 
 
@@ -199,4 +201,10 @@ void FileWriter::AddLine(int value1, float value2, float value3, float value4)
 {
     this->output_stream << value1 << separator << value2 << separator << value3 << separator << value4 << "\n";
     this->lines++;
+}
+
+void FileWriter::AddLine(int value1, int value2, float value3, float value4, float value5, float value6)
+{
+    this->output_stream << value1 << separator << value2 << separator << value3 << separator << value4 << separator << value5 << separator << value6 << "\n";
+    this->lines++;
 }
\ No newline at end of file
@@ -0,0 +1,175 @@
+/********************
+*
+*    FrameGraph.hpp
+*
+*    Defines the FrameGraph class, which runs a ParticleSystem's frame
+*    (collisions, RK4 step, energy, render buffer and output) as a TaskGraph of stages on a JobSystem.
+*
+*********************/
+
+#pragma once
+#include <cmath>
+#include <vector>
+#include <iostream>
+#include "ParticleSystem.hpp"   // includes:  "Particle2D.hpp", "Narrowphase.hpp", <vector> and <string>
+#include "SpatialHash.hpp"
+#include "TaskGraph.hpp"        // includes:  "JobSystem.hpp"
+#include "FileWriter.hpp"
+
+
+
+
+
+/*  One frame of a ParticleSystem as a graph of stages:
+ *
+ *      bounds -> broadphase -> narrowphase -> integrate -+-> energy -> io
+ *                                                        +-> render buffer
+ *
+ *  bounds, integrate, energy and the render buffer are split into chunks of particles that run on every thread;
+ *  the broadphase and narrowphase run as one job each (the narrowphase's pairs share particles).
+ *  The energy sums and the render buffer are built side by side once the step is done, and the printing and file
+ *  output run as soon as the energy is in, while the rest of the render buffer is still being built.
+ *  The wall bounces are part of integrate, since UpdateRK checks the side walls against the position before the step.
+ *  The energy is summed per chunk, and the chunks' sums added in order, so it's the same on any number of threads.
+ *  The render buffer holds a fan of triangles for every particle, so drawing is a single draw call.  */
+class FrameGraph
+{
+public:
+    static const int SEGMENTS = 12;         // Triangles per circle in the render buffer.
+
+    TaskGraph graph;
+    std::vector<sf::Vertex> vertices;       // Render buffer, rebuilt after every step (3 * SEGMENTS vertices per particle).
+    bool build_vertices;                    // Whether to build the render buffer (nothing to draw without one).
+    float energy;                           // Total energy after the last step.
+    long long frame;                        // Steps run so far.
+    int print_every;                        // Print the total energy every this many steps (never if 0).
+    FileWriter* output;                     // If set, step;particle;x;y;vx;vy rows are written to it every `output_every` steps.
+    int output_every;
+
+
+    FrameGraph(ParticleSystem& system, float dt, int grain = 2048);
+
+    void Step(JobSystem& jobs);
+    void Draw(sf::RenderWindow& window) const;
+
+
+private:
+    ParticleSystem& system;
+    float dt;
+    int grain;                              // Particles per chunk.
+
+    SpatialHash broadphase;
+    BatchNarrowphase narrowphase;
+    std::vector<Vec2D> centers;
+    std::vector<float> radii;
+    const std::vector<std::pair<int,int>>* pairs;
+    std::vector<float> partial_energy;      // One sum per chunk of particles.
+    float unit_x[SEGMENTS + 1], unit_y[SEGMENTS + 1];
+
+    void Gather(int begin, int end);
+    void BuildVertices(int begin, int end);
+    void Report();
+};
+
+
+
+
+
+
+/*  Builds the frame's stages.
+ *  @param system: The particles to step (kept by reference).
+ *  @param dt: The time step.
+ *  @param grain: The number of particles in a chunk.  */
+FrameGraph::FrameGraph(ParticleSystem& system, float dt, int grain)
+    : build_vertices(true), energy(0.0f), frame(0), print_every(0), output(nullptr), output_every(1), system(system), dt(dt), grain(grain), pairs(nullptr)
+{
+    for (int k = 0; k <= SEGMENTS; k++)
+    {
+        const float angle = 2.0f * 3.14159265f * k / SEGMENTS;
+        unit_x[k] = std::cos(angle);
+        unit_y[k] = std::sin(angle);
+    }
+
+    auto size = [this]() { return this->system.Size(); };
+    const int bounds = graph.AddParallel("bounds", size, [this](int b, int e) { Gather(b, e); }, grain);
+    const int broad = graph.Add("broadphase", [this]() { pairs = &broadphase.FindPairs(centers, radii); }, {bounds});
+    const int narrow = graph.Add("narrowphase", [this]() {
+        ParticleSystem& s = this->system;
+        narrowphase.Resolve(*pairs, s.x.data(), s.y.data(), s.vx.data(), s.vy.data(), s.mass.data(), s.radius.data(), s.restitution.data(), true);
+    }, {broad});
+    const int integrate = graph.AddParallel("integrate", size, [this](int b, int e) { this->system.UpdateRK(this->dt, b, e); }, grain, {narrow});
+    const int sum = graph.AddParallel("energy", size, [this](int b, int e) {
+        partial_energy[b / this->grain] = this->system.TotalEnergy(b, e);
+    }, grain, {integrate});
+    graph.AddParallel("render buffer", [this]() { return build_vertices ? this->system.Size() : 0; },
+                      [this](int b, int e) { BuildVertices(b, e); }, grain, {integrate});
+    graph.Add("io", [this]() { Report(); }, {sum});
+}
+
+
+/*  Runs one frame's stages on the job system (the calling thread helps).  */
+void FrameGraph::Step(JobSystem& jobs)
+{
+    const int n = system.Size();
+    centers.resize(n);
+    radii.resize(n);
+    vertices.resize(build_vertices ? (size_t)n * 3 * SEGMENTS : 0);
+    partial_energy.assign((n + grain - 1) / grain, 0.0f);
+    graph.Run(jobs);
+}
+
+
+/*  Draws the render buffer built on the last step.  */
+void FrameGraph::Draw(sf::RenderWindow& window) const
+{
+    if (!vertices.empty())
+        window.draw(vertices.data(), vertices.size(), sf::Triangles);
+}
+
+
+/*  Fills in the centers and radii of particles [begin, end) for the broadphase.  */
+void FrameGraph::Gather(int begin, int end)
+{
+    for (int i = begin; i < end; i++)
+    {
+        centers[i] = system.Center(i);
+        radii[i] = system.radius[i];
+    }
+}
+
+
+/*  Writes the triangles of particles [begin, end) into the render buffer.  */
+void FrameGraph::BuildVertices(int begin, int end)
+{
+    for (int i = begin; i < end; i++)
+    {
+        const float r = system.radius[i];
+        const sf::Vector2f center(system.x[i] + r, system.y[i] + r);
+        const sf::Color color = system.colors[i];
+        sf::Vertex* v = &vertices[(size_t)i * 3 * SEGMENTS];
+        for (int k = 0; k < SEGMENTS; k++)
+        {
+            v[3*k].position = center;
+            v[3*k + 1].position = sf::Vector2f(center.x + r * unit_x[k], center.y + r * unit_y[k]);
+            v[3*k + 2].position = sf::Vector2f(center.x + r * unit_x[k + 1], center.y + r * unit_y[k + 1]);
+            v[3*k].color = v[3*k + 1].color = v[3*k + 2].color = color;
+        }
+    }
+}
+
+
+/*  Adds up the chunks' energy sums, then does the frame's printing and file output.  */
+void FrameGraph::Report()
+{
+    double total = 0.0;
+    for (float partial : partial_energy)
+        total += partial;
+    energy = (float)total;
+    frame++;
+
+    if (print_every > 0 && frame % print_every == 0)
+        std::cout << std::endl << std::endl << "Total Energy: " << energy << std::endl << std::endl << std::endl;
+    if (output && frame % output_every == 0)
+        for (int i = 0; i < system.Size(); i++)
+            output->AddLine((int)frame, i, system.x[i], system.y[i], system.vx[i], system.vy[i]);
+}
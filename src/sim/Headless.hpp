@@ -0,0 +1,273 @@
+/********************
+*
+*    Headless.hpp
+*
+*    Runs the simulation from the command line without opening a window:
+*    builds a scene in a ParticleSystem, steps it, and writes the results to a file.
+*
+*********************/
+
+#pragma once
+#include <chrono>
+#include <random>
+#include <string>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include "ParticleSystem.hpp"   // includes:  "Particle2D.hpp", "Narrowphase.hpp", <vector> and <string>
+#include "Integrators.hpp"
+#include "SpatialHash.hpp"
+#include "VerletList.hpp"
+#include "FileWriter.hpp"
+#include "FrameGraph.hpp"      // includes:  "TaskGraph.hpp" and "JobSystem.hpp"
+
+
+
+
+
+// Settings for a headless run, as given on the command line.
+struct HeadlessOptions
+{
+    std::string scene = "test";         // "test" (main.cpp's balls), "random" or "grid"
+    int count = 100;                    // Number of balls in the random and grid scenes
+    unsigned int seed = 1;              // Seed for the random scene
+    float width = 800.0f;               // Box size
+    float height = 600.0f;
+    long long steps = 1000;             // Number of steps to run
+    float dt = 5.0f / 60.0f;            // Step size (main.cpp's by default)
+    std::string integrator = "rk";      // "rk" (ParticleSystem::UpdateRK, as main.cpp), "verlet", "leapfrog", "euler" or "rk4"
+    bool collisions = true;             // Whether the balls collide with each other
+    float skin = 0.0f;                  // Keep the collision pairs in a VerletList with this skin (hash them every step if 0)
+    std::string output;                 // File to write the particles' states to (none if empty)
+    int every = 1;                      // Write the states every this many steps
+    int threads = 0;                    // Run each step as a FrameGraph on this many threads (the plain loop if 0)
+};
+
+
+void printHeadlessUsage(std::ostream& os)
+{
+    os << "Usage:  main --headless [options]" << std::endl
+       << "   --scene test|random|grid   Scene to run (default test, the balls from main.cpp)" << std::endl
+       << "   --count N                  Balls in the random and grid scenes (default 100)" << std::endl
+       << "   --seed S                   Seed for the random scene (default 1)" << std::endl
+       << "   --size W H                 Box size (default 800 600)" << std::endl
+       << "   --steps N                  Steps to run (default 1000)" << std::endl
+       << "   --dt DT                    Step size (default 5/60)" << std::endl
+       << "   --integrator NAME          rk (default), verlet, leapfrog, euler or rk4" << std::endl
+       << "   --no-collisions            Don't collide the balls with each other" << std::endl
+       << "   --skin S                   Keep the collision pairs in a Verlet list with skin S, rebuilt as needed" << std::endl
+       << "   --output FILE              Write step;particle;x;y;vx;vy rows to FILE" << std::endl
+       << "   --every N                  Only write every Nth step (default 1)" << std::endl
+       << "   --threads N                Run each step as a task graph on N threads and print the stage timings" << std::endl;
+}
+
+
+// Fills in the options from the command line arguments (anything before --headless is ignored).
+// Returns false, after saying why, if an argument isn't recognized or is missing its value.
+bool parseHeadlessOptions(int argc, char** argv, HeadlessOptions& options)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        const std::string arg = argv[i];
+        const bool has_value = i + 1 < argc;
+        if (arg == "--headless")                          continue;
+        else if (arg == "--no-collisions")                options.collisions = false;
+        else if (arg == "--scene" && has_value)           options.scene = argv[++i];
+        else if (arg == "--count" && has_value)           options.count = std::atoi(argv[++i]);
+        else if (arg == "--seed" && has_value)            options.seed = (unsigned int)std::strtoul(argv[++i], nullptr, 10);
+        else if (arg == "--steps" && has_value)           options.steps = std::atoll(argv[++i]);
+        else if (arg == "--dt" && has_value)              options.dt = std::strtof(argv[++i], nullptr);
+        else if (arg == "--skin" && has_value)            options.skin = std::strtof(argv[++i], nullptr);
+        else if (arg == "--integrator" && has_value)      options.integrator = argv[++i];
+        else if (arg == "--output" && has_value)          options.output = argv[++i];
+        else if (arg == "--every" && has_value)           options.every = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--threads" && has_value)         options.threads = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--size" && i + 2 < argc) {
+            options.width = std::strtof(argv[++i], nullptr);
+            options.height = std::strtof(argv[++i], nullptr);
+        }
+        else {
+            std::cerr << "Unrecognized or incomplete argument: " << arg << std::endl;
+            return false;
+        }
+    }
+    if (options.steps < 0 || options.dt <= 0.0f || options.count < 0 || options.skin < 0.0f) {
+        std::cerr << "--steps, --count and --skin can't be negative, and --dt has to be positive" << std::endl;
+        return false;
+    }
+    if (options.threads > 0 && (options.integrator != "rk" || !options.collisions || options.skin > 0.0f)) {
+        std::cerr << "--threads runs FrameGraph's frame, which is the rk integrator with collisions found by a spatial hash" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+
+// Adds the scene's balls to the system (throws std::invalid_argument for an unknown scene).
+void buildScene(const HeadlessOptions& options, ParticleSystem& system)
+{
+    if (options.scene == "test")
+    {
+        // The balls main.cpp starts with
+        system.Add("Test Particle 1", 1.0f, 10.0f, sf::Color::Blue, Vec2D(90.0f, 50.0f), Vec2D(60.0f, 50.0f), 0.99825f);
+        system.Add("Test Particle 2", 1.0f, 10.0f, sf::Color::Red, Vec2D(100.0f, 100.0f), Vec2D(0.0f, -50.0f), 0.99825f);
+        system.Add("Test Particle 3", 2.0f, 15.0f, sf::Color::Green, Vec2D(200.0f, 200.0f), Vec2D(30.0f, 0.0f), 0.99825f);
+        system.Add("Test Particle 4", 2.0f, 15.0f, sf::Color::Magenta, Vec2D(300.0f, 300.0f), Vec2D(0.0f, 0.0f), 0.99825f);
+        system.Add("Test Particle 5", 4.0f, 20.0f, sf::Color::Cyan, Vec2D(400.0f, 400.0f), Vec2D(0.0f, 0.0f), 0.99825f);
+        system.Add("Test Particle 6", 4.0f, 20.0f, sf::Color::Yellow, Vec2D(500.0f, 500.0f), Vec2D(0.0f, 0.0f), 0.99825f);
+        system.Add("Test Particle 7", 1.0f, 10.0f, sf::Color::Blue, Vec2D(90.0f, 50.0f), Vec2D(10.0f, 50.0f), 0.99825f);
+        system.Add("Test Particle 8", 1.0f, 10.0f, sf::Color::Red, Vec2D(100.0f, 100.0f), Vec2D(-5.0f, 0.0f), 0.99825f);
+        system.Add("Test Particle 9", 2.0f, 15.0f, sf::Color::Green, Vec2D(150.0f, 50.0f), Vec2D(42.0f, 0.0f), 0.99825f);
+        system.Add("Test Particle 10", 2.0f, 15.0f, sf::Color::Magenta, Vec2D(200.0f, 60.0f), Vec2D(0.0f, 0.0f), 0.99825f);
+        system.Add("Test Particle 13", 1.0f, 10.0f, sf::Color::Blue, Vec2D(90.0f, 50.0f), Vec2D(60.0f, 50.0f), 0.99825f);
+        system.Add("Test Particle 14", 1.0f, 10.0f, sf::Color::Red, Vec2D(125.0f, 100.0f), Vec2D(80.0f, -50.0f), 0.99825f);
+        system.Add("Test Particle 15", 2.0f, 15.0f, sf::Color::Green, Vec2D(215.0f, 200.0f), Vec2D(30.0f, 70.0f), 0.99825f);
+        system.Add("Test Particle 16", 2.0f, 15.0f, sf::Color::Magenta, Vec2D(540.0f, 300.0f), Vec2D(0.0f, 55.0f), 0.99825f);
+        system.Add("Test Particle 17", 1.0f, 10.0f, sf::Color::Blue, Vec2D(90.0f, 50.0f), Vec2D(10.0f, 50.0f), 0.99825f);
+        system.Add("Test Particle 18", 1.0f, 10.0f, sf::Color::Red, Vec2D(100.0f, 100.0f), Vec2D(-5.0f, 0.0f), 0.99825f);
+    }
+    else if (options.scene == "random")
+    {
+        // Radii 10-20 and mass proportional to radius, as in the benchmarks, anywhere in the box
+        std::mt19937 rng(options.seed);
+        std::uniform_real_distribution<float> radius(10.0f, 20.0f);
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+        for (int i = 0; i < options.count; i++)
+        {
+            const float r = radius(rng);
+            system.Add("Particle " + std::to_string(i + 1), r / 10.0f, r, sf::Color::White,
+                       Vec2D(unit(rng) * (options.width - 2.0f * r), unit(rng) * (options.height - 2.0f * r)),
+                       Vec2D(unit(rng) * 100.0f - 50.0f, unit(rng) * 100.0f - 50.0f), 1.0f);
+        }
+    }
+    else if (options.scene == "grid")
+    {
+        // Equal balls at rest on a square grid, filling the box from the top
+        const int columns = std::max(1, (int)(options.width / 30.0f));
+        for (int i = 0; i < options.count; i++)
+            system.Add("Particle " + std::to_string(i + 1), 1.0f, 10.0f, sf::Color::White,
+                       Vec2D(5.0f + (i % columns) * 30.0f, 5.0f + (i / columns) * 30.0f), Vec2D(0.0f, 0.0f), 1.0f);
+    }
+    else throw std::invalid_argument("buildScene(const HeadlessOptions& options, ParticleSystem& system): Unknown scene \"" + options.scene + "\"");
+}
+
+
+// Runs the steps, calling step(system, dt) for each, and writes the states to the output file every `every` steps.
+// Returns the number of seconds the loop took.
+template <typename Step>
+double runHeadlessLoop(const HeadlessOptions& options, ParticleSystem& system, Step step)
+{
+    SpatialHash broadphase;
+    VerletList neighbours(options.skin);
+    BatchNarrowphase narrowphase;
+    FileWriter* output = options.output.empty() ? nullptr : new FileWriter(options.output, "step;particle;x;y;vx;vy");
+
+    const auto start = std::chrono::steady_clock::now();
+    for (long long n = 0; n <= options.steps; n++)
+    {
+        if (output && n % options.every == 0)
+            for (int i = 0; i < system.Size(); i++)
+                output->AddLine((int)n, i, system.x[i], system.y[i], system.vx[i], system.vy[i]);
+        if (n == options.steps) break;
+
+        if (options.collisions && options.skin > 0.0f)
+            system.ResolveCollisions(neighbours, narrowphase);
+        else if (options.collisions)
+            system.ResolveCollisions(broadphase, narrowphase);
+        step(system, options.dt);
+    }
+    const auto end = std::chrono::steady_clock::now();
+
+    if (options.collisions && options.skin > 0.0f)
+        std::cout << "Verlet list: " << neighbours.stats.rebuilds << " rebuilds in " << neighbours.stats.steps << " steps ("
+                  << neighbours.stats.StepsPerRebuild() << " steps each), " << neighbours.pairs.size() << " pairs, "
+                  << neighbours.stats.bytes / 1024 << " KB" << std::endl;
+
+    delete output;
+    return std::chrono::duration<double>(end - start).count();
+}
+
+
+// Runs the steps as a FrameGraph on a JobSystem, and prints the time each stage took.
+// Returns the number of seconds the loop took.
+double runHeadlessGraph(const HeadlessOptions& options, ParticleSystem& system)
+{
+    JobSystem jobs(options.threads);
+    FrameGraph frame(system, options.dt);
+    frame.build_vertices = false;
+    FileWriter* output = options.output.empty() ? nullptr : new FileWriter(options.output, "step;particle;x;y;vx;vy");
+    if (output) {
+        for (int i = 0; i < system.Size(); i++)
+            output->AddLine(0, i, system.x[i], system.y[i], system.vx[i], system.vy[i]);
+        frame.output = output;
+        frame.output_every = options.every;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    for (long long n = 0; n < options.steps; n++)
+        frame.Step(jobs);
+    const auto end = std::chrono::steady_clock::now();
+
+    std::cout << "Task graph on " << jobs.Size() << " threads:" << std::endl << frame.graph << std::endl
+              << "   " << jobs.GetStats() << std::endl;
+    delete output;
+    return std::chrono::duration<double>(end - start).count();
+}
+
+
+// Entry point for `main --headless ...`: runs the scene with no window and no shapes, and prints a summary.
+int runHeadless(int argc, char** argv)
+{
+    HeadlessOptions options;
+    if (!parseHeadlessOptions(argc, argv, options)) {
+        printHeadlessUsage(std::cerr);
+        return EXIT_FAILURE;
+    }
+
+    ParticleSystem system(options.width, options.height);
+    try {
+        buildScene(options, system);
+    }
+    catch (const std::invalid_argument& e) {
+        std::cerr << e.what() << std::endl;
+        printHeadlessUsage(std::cerr);
+        return EXIT_FAILURE;
+    }
+    const float start_energy = system.TotalEnergy();
+
+    // The integrator is picked once here; each loop is compiled for its own scheme
+    double seconds;
+    if (options.threads > 0)
+        seconds = runHeadlessGraph(options, system);
+    else if (options.integrator == "rk")
+        seconds = runHeadlessLoop(options, system, [](ParticleSystem& s, float dt) { s.UpdateRK(dt); });
+    else if (options.integrator == "verlet") {
+        Integrator<VelocityVerlet> integrator;
+        seconds = runHeadlessLoop(options, system, [&](ParticleSystem& s, float dt) { integrator.Step(s, dt); });
+    }
+    else if (options.integrator == "leapfrog") {
+        Integrator<Leapfrog> integrator;
+        seconds = runHeadlessLoop(options, system, [&](ParticleSystem& s, float dt) { integrator.Step(s, dt); });
+    }
+    else if (options.integrator == "euler") {
+        Integrator<SymplecticEuler> integrator;
+        seconds = runHeadlessLoop(options, system, [&](ParticleSystem& s, float dt) { integrator.Step(s, dt); });
+    }
+    else if (options.integrator == "rk4") {
+        Integrator<RK4> integrator;
+        seconds = runHeadlessLoop(options, system, [&](ParticleSystem& s, float dt) { integrator.Step(s, dt); });
+    }
+    else {
+        std::cerr << "Unknown integrator \"" << options.integrator << "\"" << std::endl;
+        printHeadlessUsage(std::cerr);
+        return EXIT_FAILURE;
+    }
+
+    std::cout << "Scene \"" << options.scene << "\": " << system.Size() << " particles, " << options.steps << " steps of " << options.dt
+              << " s (" << options.integrator << ")" << std::endl
+              << "   > Wall time: " << seconds << " s  (" << (seconds > 0.0 ? options.steps / seconds : 0.0) << " steps/s)" << std::endl
+              << "   > Total Energy: " << start_energy << " -> " << system.TotalEnergy() << std::endl;
+    if (!options.output.empty())
+        std::cout << "   > Wrote " << options.output << std::endl;
+    return EXIT_SUCCESS;
+}
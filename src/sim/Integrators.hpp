@@ -0,0 +1,521 @@
+/********************
+*
+*    Integrators.hpp
+*
+*    Defines the Integrator class template, which advances a ParticleSystem with
+*    an integration scheme picked at compile time (symplectic Euler, velocity Verlet, leapfrog, RK4,
+*    or adaptive Dormand-Prince).
+*
+*********************/
+
+#pragma once
+#include <cmath>
+#include <vector>
+#include <iostream>
+#include <algorithm>
+#include "ParticleSystem.hpp"   // includes:  "Particle2D.hpp", "Narrowphase.hpp", <vector> and <string>
+
+
+
+
+
+/*  Acceleration fields.
+ *  A field is a callable that fills ax, ay with the acceleration of each particle of the system,
+ *  with the particles at positions x, y (top-left corners, as in ParticleSystem) rather than where the system has them,
+ *  so the schemes can sample the field at intermediate positions without touching the system.  */
+
+/*  The world's constant gravity, g (the same everywhere, so the positions aren't needed).  */
+struct UniformGravity
+{
+    void operator()(const ParticleSystem& system, const float*, const float*, float* ax, float* ay) const
+    {
+        for (int i = 0; i < system.Size(); i++) {
+            ax[i] = g.x;
+            ay[i] = g.y;
+        }
+    }
+};
+
+
+/*  Coulomb forces between every pair of particles, with the same force law as ChargedParticle::CoulombForce
+ *  (measured between centers, like charges repel). Charges are kept here, one per particle, since the system has none.
+ *  Close encounters make this field stiff, which is what the DormandPrince scheme is for
+ *  (AdaptiveCoulomb runs it on ChargedParticles, with the forces from a TiledCoulomb).  */
+struct CoulombField
+{
+    std::vector<float> charge;      // Charge of each particle.
+    float max_force = 0.0f;         // Largest force one pair can exert, as in CoulombForce(particle, max_force) (0 for no limit).
+    float softening = 0.0f;         // Added to the squared distance, to keep a head-on pass finite (0 for none).
+
+    void operator()(const ParticleSystem& system, const float* x, const float* y, float* ax, float* ay) const
+    {
+        const int n = system.Size();
+        for (int i = 0; i < n; i++) {
+            ax[i] = 0.0f;
+            ay[i] = 0.0f;
+        }
+        for (int i = 0; i < n; i++)
+        {
+            const float cx = x[i] + system.radius[i], cy = y[i] + system.radius[i];
+            for (int j = i + 1; j < n; j++)
+            {
+                const float dx = cx - (x[j] + system.radius[j]);
+                const float dy = cy - (y[j] + system.radius[j]);
+                const float inv = 1.0f / std::sqrt(dx * dx + dy * dy + softening);
+                float force = (8.987551787e9f * charge[i] * charge[j]) * inv * inv;
+                if (max_force > 0.0f)  force = std::max(-max_force, std::min(max_force, force));
+                const float fx = force * dx * inv, fy = force * dy * inv;
+                ax[i] += fx * system.inv_mass[i];   ay[i] += fy * system.inv_mass[i];
+                ax[j] -= fx * system.inv_mass[j];   ay[j] -= fy * system.inv_mass[j];
+            }
+        }
+    }
+
+    /*  Returns the system's electric potential energy.  */
+    float PotentialEnergy(const ParticleSystem& system) const
+    {
+        float energy = 0.0f;
+        for (int i = 0; i < system.Size(); i++)
+            for (int j = i + 1; j < system.Size(); j++)
+            {
+                const Vec2D d = system.Center(i) - system.Center(j);
+                energy += (8.987551787e9f * charge[i] * charge[j]) / std::sqrt(d.x * d.x + d.y * d.y + softening);
+            }
+        return energy;
+    }
+};
+
+
+/*  The constant part of a field, which ResolveWalls needs to bounce particles without changing their energy.
+ *  Fields that don't have one give zero.  */
+template <typename Field>
+Vec2D wallGravity(const Field&) { return Vec2D(0.0f, 0.0f); }
+inline Vec2D wallGravity(const UniformGravity&) { return g; }
+
+
+
+
+/*  Integration schemes.
+ *  Each scheme has a Step(system, dt, field) that advances the positions and velocities by dt, and says how many
+ *  times a step samples the field. Step is a template on the field, so a scheme and field pair compiles down to
+ *  plain loops over the arrays, with no virtual calls or switches.  */
+
+/*  Symplectic (semi-implicit) Euler: kick the velocity, then drift the position with the new velocity.
+ *  First order, but symplectic, so the energy error stays bounded instead of growing.  */
+class SymplecticEuler
+{
+public:
+    static const int EVALUATIONS = 1;
+    static const char* Name() { return "symplectic Euler"; }
+
+    template <typename Field>
+    void Step(ParticleSystem& system, float dt, Field& field)
+    {
+        const int n = system.Size();
+        ax.resize(n); ay.resize(n);
+        field(system, system.x.data(), system.y.data(), ax.data(), ay.data());
+        for (int i = 0; i < n; i++)
+        {
+            system.vx[i] += ax[i] * dt;
+            system.vy[i] += ay[i] * dt;
+            system.x[i] += system.vx[i] * dt;
+            system.y[i] += system.vy[i] * dt;
+        }
+    }
+
+
+private:
+    AlignedVector<float> ax, ay;
+};
+
+
+/*  Velocity Verlet (kick-drift-kick): half kick, full drift, then half kick with the field at the new positions.
+ *  Second order and symplectic. The field at the end of one step is the field at the start of the next,
+ *  so it's kept and the field is sampled once per step (twice on the first step, or after particles are added or removed).
+ *  Collisions only change velocities, so they don't invalidate it; a wall bounce moves a particle by its overlap with the wall,
+ *  which only matters for fields that change over that distance.  */
+class VelocityVerlet
+{
+public:
+    static const int EVALUATIONS = 1;
+    static const char* Name() { return "velocity Verlet"; }
+
+    template <typename Field>
+    void Step(ParticleSystem& system, float dt, Field& field)
+    {
+        const int n = system.Size();
+        const float h = dt * 0.5f;
+        if ((int)ax.size() != n) {
+            ax.resize(n); ay.resize(n);
+            field(system, system.x.data(), system.y.data(), ax.data(), ay.data());
+        }
+        for (int i = 0; i < n; i++)
+        {
+            system.vx[i] += ax[i] * h;
+            system.vy[i] += ay[i] * h;
+            system.x[i] += system.vx[i] * dt;
+            system.y[i] += system.vy[i] * dt;
+        }
+        field(system, system.x.data(), system.y.data(), ax.data(), ay.data());
+        for (int i = 0; i < n; i++)
+        {
+            system.vx[i] += ax[i] * h;
+            system.vy[i] += ay[i] * h;
+        }
+    }
+
+    /*  Forgets the kept field, e.g. after moving particles by hand.  */
+    void Reset() { ax.clear(); ay.clear(); }
+
+
+private:
+    AlignedVector<float> ax, ay;    // Field at the current positions.
+};
+
+
+/*  Leapfrog (drift-kick-drift): half drift, full kick with the field at the midpoint, half drift.
+ *  Second order and symplectic like velocity Verlet, with one field sample per step and nothing kept between steps,
+ *  so particles can be moved freely between steps.  */
+class Leapfrog
+{
+public:
+    static const int EVALUATIONS = 1;
+    static const char* Name() { return "leapfrog"; }
+
+    template <typename Field>
+    void Step(ParticleSystem& system, float dt, Field& field)
+    {
+        const int n = system.Size();
+        const float h = dt * 0.5f;
+        ax.resize(n); ay.resize(n);
+        for (int i = 0; i < n; i++)
+        {
+            system.x[i] += system.vx[i] * h;
+            system.y[i] += system.vy[i] * h;
+        }
+        field(system, system.x.data(), system.y.data(), ax.data(), ay.data());
+        for (int i = 0; i < n; i++)
+        {
+            system.vx[i] += ax[i] * dt;
+            system.vy[i] += ay[i] * dt;
+            system.x[i] += system.vx[i] * h;
+            system.y[i] += system.vy[i] * h;
+        }
+    }
+
+
+private:
+    AlignedVector<float> ax, ay;
+};
+
+
+/*  Classical fourth-order Runge-Kutta, sampling the field at the start, twice at the midpoint, and at the end.
+ *  Fourth order, but not symplectic: the energy error grows steadily over a long run.
+ *  (Unlike ParticleSystem::UpdateRK, which reproduces Particle2D's RK4 step, this is the textbook method.)  */
+class RK4
+{
+public:
+    static const int EVALUATIONS = 4;
+    static const char* Name() { return "RK4"; }
+
+    template <typename Field>
+    void Step(ParticleSystem& system, float dt, Field& field)
+    {
+        const int n = system.Size();
+        const float h = dt * 0.5f;
+        const float w = dt / 6.0f;
+        sx.resize(n); sy.resize(n);
+        svx.resize(n); svy.resize(n);
+        dx.resize(n); dy.resize(n);
+        kx.resize(n); ky.resize(n);
+        ax.resize(n); ay.resize(n);
+        float* x = system.x.data();
+        float* y = system.y.data();
+        float* vx = system.vx.data();
+        float* vy = system.vy.data();
+
+        // Stage 1: derivatives at the start (velocity v, acceleration a)
+        field(system, x, y, ax.data(), ay.data());
+        for (int i = 0; i < n; i++)
+        {
+            dx[i] = vx[i] + ax[i] * h;      dy[i] = vy[i] + ay[i] * h;      // stage 2 velocity
+            kx[i] = x[i] + vx[i] * h;       ky[i] = y[i] + vy[i] * h;       // stage 2 position
+            sx[i] = vx[i];                  sy[i] = vy[i];
+            svx[i] = ax[i];                 svy[i] = ay[i];
+        }
+
+        // Stage 2: at the midpoint, from stage 1's derivatives
+        field(system, kx.data(), ky.data(), ax.data(), ay.data());
+        for (int i = 0; i < n; i++)
+        {
+            sx[i] += 2.0f * dx[i];          sy[i] += 2.0f * dy[i];
+            svx[i] += 2.0f * ax[i];         svy[i] += 2.0f * ay[i];
+            kx[i] = x[i] + dx[i] * h;       ky[i] = y[i] + dy[i] * h;       // stage 3 position
+            dx[i] = vx[i] + ax[i] * h;      dy[i] = vy[i] + ay[i] * h;      // stage 3 velocity
+        }
+
+        // Stage 3: at the midpoint again, from stage 2's derivatives
+        field(system, kx.data(), ky.data(), ax.data(), ay.data());
+        for (int i = 0; i < n; i++)
+        {
+            sx[i] += 2.0f * dx[i];          sy[i] += 2.0f * dy[i];
+            svx[i] += 2.0f * ax[i];         svy[i] += 2.0f * ay[i];
+            kx[i] = x[i] + dx[i] * dt;      ky[i] = y[i] + dy[i] * dt;      // stage 4 position
+            dx[i] = vx[i] + ax[i] * dt;     dy[i] = vy[i] + ay[i] * dt;     // stage 4 velocity
+        }
+
+        // Stage 4: at the end, from stage 3's derivatives; then the weighted sum
+        field(system, kx.data(), ky.data(), ax.data(), ay.data());
+        for (int i = 0; i < n; i++)
+        {
+            x[i] += (sx[i] + dx[i]) * w;
+            y[i] += (sy[i] + dy[i]) * w;
+            vx[i] += (svx[i] + ax[i]) * w;
+            vy[i] += (svy[i] + ay[i]) * w;
+        }
+    }
+
+
+private:
+    AlignedVector<float> sx, sy;        // Running sums of the position derivatives.
+    AlignedVector<float> svx, svy;      // Running sums of the velocity derivatives.
+    AlignedVector<float> dx, dy;        // Velocity at the current stage.
+    AlignedVector<float> kx, ky;        // Position at the current stage.
+    AlignedVector<float> ax, ay;        // Acceleration at the current stage.
+};
+
+
+/*  Adaptive Dormand-Prince 5(4): an embedded Runge-Kutta pair whose fourth-order solution, compared with the fifth-order one,
+ *  estimates the error of each step. Step(system, dt, field) covers dt in as many substeps as the tolerance needs:
+ *  a substep whose error is too large is rejected and retried shorter, and the next substep grows when the error is small.
+ *  The error is measured over all particles together (the worst one decides), so a close encounter anywhere shortens
+ *  the step for everyone, and the substep carries over between calls, so quiet stretches run at one substep per call.
+ *  The last stage is the field at the end of the substep, which is reused as the first stage of the next one,
+ *  so an accepted substep costs six field samples. Particles are bounced off the walls after every accepted substep,
+ *  and a substep that would take a particle more than `wall_overshoot` past a wall is retried, cut short to end about
+ *  where the particle meets the wall (bouncing from far past the wall would put it somewhere the field is different).
+ *  A substep that bounces any particle has to sample the field again at the start of the next one.  */
+class DormandPrince
+{
+public:
+    static const int EVALUATIONS = 6;
+    static const char* Name() { return "Dormand-Prince"; }
+
+    float relative_tolerance;   // Allowed error relative to the size of each position and velocity.
+    float absolute_tolerance;   // Allowed error near zero.
+    float min_step;             // Substeps are never made shorter than this (one this short is accepted whatever its error).
+    float wall_overshoot;       // How far past a wall a substep may take a particle.
+
+    /*  Counts from the last call to Step.  */
+    struct Stats
+    {
+        int accepted = 0;           // Substeps kept.
+        int rejected = 0;           // Substeps thrown away and retried shorter (for their error, or for overshooting a wall).
+        int evaluations = 0;        // Field samples.
+        float smallest = 0.0f;      // Shortest substep kept.
+        float largest = 0.0f;       // Longest substep kept.
+    };
+    Stats stats;
+
+
+    DormandPrince() : relative_tolerance(1e-4f), absolute_tolerance(1e-3f), min_step(1e-6f), wall_overshoot(0.1f), step(0.0f) { }
+    DormandPrince(float relative_tolerance, float absolute_tolerance, float min_step, float wall_overshoot)
+        : relative_tolerance(relative_tolerance), absolute_tolerance(absolute_tolerance), min_step(min_step), wall_overshoot(wall_overshoot), step(0.0f) { }
+
+    template <typename Field>
+    void Step(ParticleSystem& system, float dt, Field& field);
+
+    friend std::ostream& operator<<(std::ostream& os, const Stats& s)
+    {
+        os << "Substeps: " << s.accepted << " accepted, " << s.rejected << " rejected   Field samples: " << s.evaluations
+           << "   Substep: " << s.smallest << " to " << s.largest;
+        return os;
+    }
+
+
+private:
+    static const int STAGES = 7;
+
+    float step;                                     // Substep to try next (0 until the first call).
+    AlignedVector<float> vx[STAGES], vy[STAGES];    // Velocity at each stage (the position derivative).
+    AlignedVector<float> ax[STAGES], ay[STAGES];    // Field at each stage (the velocity derivative).
+    AlignedVector<float> x1, y1, vx1, vy1;          // Fifth-order solution at the end of the substep.
+    AlignedVector<float> sx, sy;                    // Position at the current stage.
+
+    template <typename Field>
+    float Attempt(ParticleSystem& system, float h, Field& field);
+    float WallStep(const ParticleSystem& system, float h) const;
+};
+
+
+/*  Takes one trial substep of length h from the system's current state, leaving the fifth-order result in x1, y1
+ *  and the last stage (and returns the error estimate, scaled so that 1 is exactly at the tolerance).
+ *  Expects stage 1 (the velocities and the field at the current state) to be filled in already.  */
+template <typename Field>
+float DormandPrince::Attempt(ParticleSystem& system, float h, Field& field)
+{
+    // Butcher tableau; the last row is also the fifth-order weights, and E is fifth-order minus fourth-order weights
+    static const float A[STAGES][STAGES - 1] = {
+        { },
+        { 1.0f/5 },
+        { 3.0f/40, 9.0f/40 },
+        { 44.0f/45, -56.0f/15, 32.0f/9 },
+        { 19372.0f/6561, -25360.0f/2187, 64448.0f/6561, -212.0f/729 },
+        { 9017.0f/3168, -355.0f/33, 46732.0f/5247, 49.0f/176, -5103.0f/18656 },
+        { 35.0f/384, 0.0f, 500.0f/1113, 125.0f/192, -2187.0f/6784, 11.0f/84 }
+    };
+    static const float E[STAGES] = { 71.0f/57600, 0.0f, -71.0f/16695, 71.0f/1920, -17253.0f/339200, 22.0f/525, -1.0f/40 };
+
+    const int n = system.Size();
+    for (int s = 1; s < STAGES; s++)
+    {
+        float* px = (s == STAGES - 1) ? x1.data() : sx.data();
+        float* py = (s == STAGES - 1) ? y1.data() : sy.data();
+        for (int i = 0; i < n; i++)
+        {
+            float dx = 0.0f, dy = 0.0f, dvx = 0.0f, dvy = 0.0f;
+            for (int j = 0; j < s; j++) {
+                dx += A[s][j] * vx[j][i];       dy += A[s][j] * vy[j][i];
+                dvx += A[s][j] * ax[j][i];      dvy += A[s][j] * ay[j][i];
+            }
+            px[i] = system.x[i] + h * dx;
+            py[i] = system.y[i] + h * dy;
+            vx[s][i] = system.vx[i] + h * dvx;
+            vy[s][i] = system.vy[i] + h * dvy;
+        }
+        field(system, px, py, ax[s].data(), ay[s].data());
+    }
+    stats.evaluations += STAGES - 1;
+
+    float error = 0.0f;
+    for (int i = 0; i < n; i++)
+    {
+        float ex = 0.0f, ey = 0.0f, evx = 0.0f, evy = 0.0f;
+        for (int j = 0; j < STAGES; j++) {
+            ex += E[j] * vx[j][i];      ey += E[j] * vy[j][i];
+            evx += E[j] * ax[j][i];     evy += E[j] * ay[j][i];
+        }
+        const float tolerance = absolute_tolerance + relative_tolerance * std::max(std::abs(system.x[i]), std::abs(x1[i]));
+        const float tolerance_y = absolute_tolerance + relative_tolerance * std::max(std::abs(system.y[i]), std::abs(y1[i]));
+        const float tolerance_vx = absolute_tolerance + relative_tolerance * std::max(std::abs(system.vx[i]), std::abs(vx[STAGES - 1][i]));
+        const float tolerance_vy = absolute_tolerance + relative_tolerance * std::max(std::abs(system.vy[i]), std::abs(vy[STAGES - 1][i]));
+        error = std::max(error, std::max(std::max(std::abs(h * ex) / tolerance, std::abs(h * ey) / tolerance_y),
+                                         std::max(std::abs(h * evx) / tolerance_vx, std::abs(h * evy) / tolerance_vy)));
+    }
+    return error;
+}
+
+
+/*  Returns how long the last trial substep (of length h) can be for no particle to end up more than wall_overshoot
+ *  past a wall: h if none does, otherwise cut back by the time the furthest one has spent past its wall.  */
+float DormandPrince::WallStep(const ParticleSystem& system, float h) const
+{
+    float shortest = h;
+    for (int i = 0; i < system.Size(); i++)
+    {
+        const float diameter = system.radius[i] * 2.0f;
+        const float past_x = std::max(-x1[i], x1[i] - (system.width - diameter));
+        const float past_y = std::max(-y1[i], y1[i] - (system.height - diameter));
+        if (past_x > wall_overshoot)  shortest = std::min(shortest, h - (past_x - 0.5f * wall_overshoot) / std::abs(vx[STAGES - 1][i]));
+        if (past_y > wall_overshoot)  shortest = std::min(shortest, h - (past_y - 0.5f * wall_overshoot) / std::abs(vy[STAGES - 1][i]));
+    }
+    return shortest;
+}
+
+
+/*  Advances the system by dt in adaptive substeps.
+ *  @param system: The particles.
+ *  @param dt: The time to cover.
+ *  @param field: The acceleration field.  */
+template <typename Field>
+void DormandPrince::Step(ParticleSystem& system, float dt, Field& field)
+{
+    const int n = system.Size();
+    for (int s = 0; s < STAGES; s++) {
+        vx[s].resize(n); vy[s].resize(n);
+        ax[s].resize(n); ay[s].resize(n);
+    }
+    x1.resize(n); y1.resize(n);
+    sx.resize(n); sy.resize(n);
+    stats = Stats();
+
+    // Stage 1 at the current state (after that, each accepted substep's last stage is the next one's first)
+    vx[0].assign(system.vx.begin(), system.vx.end());
+    vy[0].assign(system.vy.begin(), system.vy.end());
+    field(system, system.x.data(), system.y.data(), ax[0].data(), ay[0].data());
+    stats.evaluations++;
+    if (step <= 0.0f)  step = dt;
+
+    float remaining = dt;
+    while (remaining > 0.0f)
+    {
+        const bool last = step >= remaining;
+        const float h = last ? remaining : step;
+        const float error = Attempt(system, h, field);
+        const bool accept = error <= 1.0f || h <= min_step;
+
+        // Standard controller: aim for an error of 0.9 of the tolerance, growing at most 5x and shrinking at most 5x
+        float factor = (error > 0.0f) ? 0.9f * std::pow(error, -0.2f) : 5.0f;
+        factor = std::max(0.2f, std::min(accept ? 5.0f : 1.0f, factor));
+        const float next = std::max(min_step, h * factor);
+
+        if (!accept) {
+            stats.rejected++;
+            step = next;
+            continue;
+        }
+        const float wall_step = WallStep(system, h);
+        if (wall_step < h && h > min_step) {
+            stats.rejected++;
+            step = std::max(min_step, std::max(0.1f * h, wall_step));     // the next substep grows back from there as usual
+            continue;
+        }
+        system.x.swap(x1);      system.y.swap(y1);
+        std::swap(vx[0], vx[STAGES - 1]);   std::swap(vy[0], vy[STAGES - 1]);
+        std::swap(ax[0], ax[STAGES - 1]);   std::swap(ay[0], ay[STAGES - 1]);
+        system.vx.assign(vx[0].begin(), vx[0].end());
+        system.vy.assign(vy[0].begin(), vy[0].end());
+        if (system.ResolveWalls(wallGravity(field)) > 0)
+        {
+            vx[0].assign(system.vx.begin(), system.vx.end());
+            vy[0].assign(system.vy.begin(), system.vy.end());
+            field(system, system.x.data(), system.y.data(), ax[0].data(), ay[0].data());
+            stats.evaluations++;
+        }
+
+        stats.accepted++;
+        stats.smallest = (stats.accepted == 1) ? h : std::min(stats.smallest, h);
+        stats.largest = std::max(stats.largest, h);
+        step = last ? std::max(step, next) : next;     // a substep cut short to land on dt doesn't shrink the next one
+        remaining = last ? 0.0f : remaining - h;
+    }
+}
+
+
+
+
+/*  Advances a ParticleSystem with the scheme and field given as template parameters, then bounces the particles
+ *  off the walls with ParticleSystem::ResolveWalls (under the field's constant part, from wallGravity).
+ *  The scheme is a compile-time policy, so picking one costs nothing at run time; e.g. Integrator<VelocityVerlet> samples gravity once per step where Integrator<RK4> samples it four times.  */
+template <typename Scheme, typename Field = UniformGravity>
+class Integrator
+{
+public:
+    Scheme scheme;
+    Field field;
+
+
+    Integrator() = default;
+    Integrator(const Field& field) : field(field) { }
+
+    static const char* Name() { return Scheme::Name(); }
+
+    /*  Advances the system by dt.
+     *  @param system: The particles.
+     *  @param dt: The time step.  */
+    void Step(ParticleSystem& system, float dt)
+    {
+        scheme.Step(system, dt, field);
+        system.ResolveWalls(wallGravity(field));
+    }
+};
@@ -0,0 +1,253 @@
+/********************
+*
+*    JobSystem.hpp
+*
+*    Defines the JobSystem class, a pool of worker threads that each keep their own queue of jobs
+*    and steal from each other's queues when they run out.
+*
+*********************/
+
+#pragma once
+#include <mutex>
+#include <deque>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <iostream>
+#include <algorithm>
+#include <functional>
+#include <condition_variable>
+
+
+
+
+
+/*  A work-stealing job system.
+ *  Every thread has its own queue; a job submitted from inside a job goes on the submitting thread's queue,
+ *  and a thread takes its newest job first (the one most likely to still be in cache), so related work stays on one core.
+ *  A thread whose queue is empty steals the oldest job from another thread's queue, so uneven work spreads out by itself.
+ *  Threads outside the pool (the one that made it, usually) share queue 0, and help run jobs while they Wait,
+ *  so waiting inside a job never deadlocks and a pool of one thread runs everything on the caller.
+ *  Jobs in a group share a Counter, which Wait blocks on until it reaches zero.
+ *  This is a separate pool from ThreadPool on purpose. ThreadPool runs one loop at a time over a fixed, contiguous
+ *  split (which is what makes the colored contact solve and the field solvers deterministic), and its caller blocks
+ *  until the loop is done; a loop body can't start another loop on the same pool, since there's only one loop's state.
+ *  A frame's TaskGraph needs the opposite: stages of different sizes running side by side, jobs that submit the stages
+ *  depending on them as they finish, and idle threads picking up whatever is left. Both can live in one program; a run uses one or the other
+ *  for the frame, so they don't compete for cores.  */
+class JobSystem
+{
+public:
+    typedef std::function<void()> Job;
+    typedef std::atomic<int> Counter;       // Jobs in a group still to finish.
+
+    /*  Jobs run and stolen since the pool started.  */
+    struct Stats
+    {
+        long long jobs = 0;
+        long long steals = 0;
+    };
+
+
+    JobSystem() : JobSystem((int)std::max(1u, std::thread::hardware_concurrency())) { }
+    JobSystem(int threads);
+    ~JobSystem();
+
+    int Size() const { return (int)queues.size(); }
+    Stats GetStats() const;
+
+    void Submit(Job job, Counter* counter = nullptr);
+    void Wait(const Counter& counter);
+    void ParallelFor(int begin, int end, const std::function<void(int, int)>& body, int grain = 1024);
+
+    friend std::ostream& operator<<(std::ostream& os, const Stats& s)
+    {
+        os << "Jobs: " << s.jobs << "   Stolen: " << s.steals << " (" << (s.jobs ? 100.0 * s.steals / s.jobs : 0.0) << "%)";
+        return os;
+    }
+
+
+private:
+    struct Entry
+    {
+        Job job;
+        Counter* counter;                       // Decremented once the job has run (may be null).
+    };
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<Entry> entries;              // The owner takes from the back, thieves from the front.
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues; // One per thread; queue 0 belongs to threads outside the pool.
+    std::vector<std::thread> workers;
+    std::mutex sleep_mutex;
+    std::condition_variable wake;               // Signals idle workers that a job was submitted (or the pool is stopping).
+    std::atomic<int> queued;                    // Jobs submitted and not yet taken.
+    std::atomic<long long> jobs, steals;
+    bool stopping;
+
+    static thread_local const JobSystem* current_system;   // The pool the calling thread is a worker of (if any),
+    static thread_local int current_queue;                  // and its queue there.
+
+    int Self() const { return current_system == this ? current_queue : 0; }
+    bool Take(int self, Entry& entry);
+    bool RunOne(int self);
+    void Work(int index);
+};
+
+
+thread_local const JobSystem* JobSystem::current_system = nullptr;
+thread_local int JobSystem::current_queue = 0;
+
+
+
+
+
+
+/*  Starts the worker threads.
+ *  @param threads: Total number of threads to run jobs on, counting the threads outside the pool that Wait.  */
+JobSystem::JobSystem(int threads) : queued(0), jobs(0), steals(0), stopping(false)
+{
+    threads = std::max(1, threads);
+    for (int i = 0; i < threads; i++)
+        queues.push_back(std::make_unique<Queue>());
+    for (int i = 1; i < threads; i++)
+        workers.emplace_back(&JobSystem::Work, this, i);
+}
+
+
+/*  Stops and joins the worker threads. Jobs still queued are dropped.  */
+JobSystem::~JobSystem()
+{
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto& worker : workers)
+        worker.join();
+}
+
+
+/*  Returns the number of jobs run and stolen so far.  */
+JobSystem::Stats JobSystem::GetStats() const
+{
+    Stats stats;
+    stats.jobs = jobs.load();
+    stats.steals = steals.load();
+    return stats;
+}
+
+
+/*  Queues a job on the calling thread's queue.
+ *  @param job: The job to run.
+ *  @param counter: Decremented once the job has run; the caller increments it beforehand (may be null).  */
+void JobSystem::Submit(Job job, Counter* counter)
+{
+    Queue& queue = *queues[Self()];
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.entries.push_back(Entry{ std::move(job), counter });
+    }
+    queued.fetch_add(1);
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex);     // so a worker between checking `queued` and sleeping doesn't miss the signal
+    }
+    wake.notify_one();
+}
+
+
+/*  Takes the newest job from the thread's own queue, or else the oldest one from another thread's queue.  */
+bool JobSystem::Take(int self, Entry& entry)
+{
+    {
+        Queue& queue = *queues[self];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.entries.empty()) {
+            entry = std::move(queue.entries.back());
+            queue.entries.pop_back();
+            queued.fetch_sub(1);
+            return true;
+        }
+    }
+    for (int k = 1; k < Size(); k++)
+    {
+        Queue& victim = *queues[(self + k) % Size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.entries.empty()) {
+            entry = std::move(victim.entries.front());
+            victim.entries.pop_front();
+            queued.fetch_sub(1);
+            steals.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    return false;
+}
+
+
+/*  Runs one job if there's one to take, and returns whether it did.  */
+bool JobSystem::RunOne(int self)
+{
+    Entry entry;
+    if (!Take(self, entry)) return false;
+    entry.job();
+    jobs.fetch_add(1, std::memory_order_relaxed);
+    if (entry.counter) entry.counter->fetch_sub(1, std::memory_order_release);
+    return true;
+}
+
+
+/*  Worker thread loop: runs jobs while there are any, and sleeps when there aren't.  */
+void JobSystem::Work(int index)
+{
+    current_system = this;
+    current_queue = index;
+    while (true)
+    {
+        if (RunOne(index)) continue;
+        std::unique_lock<std::mutex> lock(sleep_mutex);
+        wake.wait(lock, [&]() { return stopping || queued.load() > 0; });
+        if (stopping) return;
+    }
+}
+
+
+/*  Runs queued jobs until the counter reaches zero.
+ *  @param counter: The counter the jobs being waited for were submitted with.  */
+void JobSystem::Wait(const Counter& counter)
+{
+    const int self = Self();
+    while (counter.load(std::memory_order_acquire) > 0)
+        if (!RunOne(self))
+            std::this_thread::yield();
+}
+
+
+/*  Runs body(chunk_begin, chunk_end) over [begin, end) in chunks of `grain` indices (the last one may be shorter),
+ *  one job per chunk, and returns once they're all done. The chunks don't depend on the number of threads,
+ *  so a loop that keeps one partial result per chunk, (chunk_begin - begin) / grain, and combines them in order
+ *  gives the same result on any pool.
+ *  @param begin, end: The index range.
+ *  @param body: The loop body, called with each chunk's range. Chunks run concurrently.
+ *  @param grain: The number of indices in a chunk.  */
+void JobSystem::ParallelFor(int begin, int end, const std::function<void(int, int)>& body, int grain)
+{
+    grain = std::max(1, grain);
+    if (end - begin <= grain || Size() == 1) {
+        for (int chunk_begin = begin; chunk_begin < end; chunk_begin += grain)
+            body(chunk_begin, std::min(end, chunk_begin + grain));
+        return;
+    }
+
+    Counter remaining(0);
+    for (int chunk_begin = begin; chunk_begin < end; chunk_begin += grain)
+    {
+        const int chunk_end = std::min(end, chunk_begin + grain);
+        remaining.fetch_add(1);
+        Submit([&body, chunk_begin, chunk_end]() { body(chunk_begin, chunk_end); }, &remaining);
+    }
+    Wait(remaining);
+}
@@ -0,0 +1,411 @@
+/********************
+*
+*    Multigrid.hpp
+*
+*    Defines the MultigridPoisson class, which solves for the electric potential of a set of charges
+*    inside a grounded Wire frame with multigrid V-cycles, and gives the force on each charge.
+*
+*********************/
+
+#pragma once
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <functional>
+#include "Vec2D.hpp"
+#include "Wire.hpp"
+#include "ThreadPool.hpp"
+
+
+
+
+
+/*  Geometric multigrid solver for Poisson's equation, -laplacian(phi) = 4 pi k rho, on a grid over a Wire.
+ *  The Wire's frame is a grounded conductor, so the grid spans its inner rectangle (`thickness` in from its outside
+ *  bounds) and the nodes along its edge are held at phi = 0 (Dirichlet). The cells are sized to split the rectangle evenly
+ *  down to a grid a few cells across, so the edge falls on nodes at every level (they may be a little off square). The
+ *  charges are deposited onto the nodes with cloud-in-cell weights; each V-cycle smooths with red-black Gauss-Seidel, hands
+ *  the residual down to a grid half as fine (full weighting), solves there the same way, and brings the correction back
+ *  up (bilinear). The potential is kept from one Solve to the next and the cycles start from it, so when the charges
+ *  have only moved a little since, one or two V-cycles are enough. Each colour of a sweep is split across a ThreadPool
+ *  by rows (a node only reads nodes of the other colour), so the result is the same on any number of threads.
+ *  The field at the nodes is taken by central differences, and interpolated back to the charges with their deposit weights.
+ *  Poisson's equation in the plane is the electrostatics of line charges: the potential of a charge goes as -2 k q ln(r)
+ *  and its force as 2 k q1 q2 / r, not the k q1 q2 / r^2 of ChargedParticle::CoulombForce, whose 1/r potential doesn't
+ *  come from any equation local to the plane. Boundaries like the Wire's are what this is for; FFT and multipole methods
+ *  can't hold a conductor at a fixed potential. Each charge's potential includes its own (cell-smoothed) share, and the
+ *  pull of the charge it induces on the frame, which is what draws charges to a conductor.  */
+class MultigridPoisson
+{
+public:
+    float cell;                         // Largest spacing of the finest grid.
+    int cycles;                         // Most V-cycles per Solve.
+    float tolerance;                    // Solve stops once the residual is below this fraction of the charge density (0 to always run `cycles`).
+    int smoothing;                      // Gauss-Seidel sweeps before and after each coarser solve.
+
+    std::vector<Vec2D> forces;          // Force on each charge, from the last Solve.
+    std::vector<float> potentials;      // Electric potential at each charge (its potential energy is charge * potential).
+
+    /*  Size of the grid, and the work done by the last Solve.  */
+    struct Stats
+    {
+        int nodes_x = 0, nodes_y = 0;   // Nodes of the finest grid.
+        int levels = 0;
+        int cycles = 0;                 // V-cycles run by the last Solve.
+        float residual = 0.0f;          // rms residual after them, as a fraction of the rms charge density (1 before any cycles).
+    };
+    Stats stats;
+
+
+    MultigridPoisson(const Wire& wire, float cell = 4.0f, int cycles = 2, float tolerance = 1e-3f);
+
+    void SetConductor(const Wire& wire);
+    void Reset();
+
+    void Build(const std::vector<Vec2D>& centers, const std::vector<float>& charges);
+    void Solve(ThreadPool* pool = nullptr);
+    template <typename P>
+    void Solve(const std::vector<P>& particles, ThreadPool* pool = nullptr);
+    float PotentialEnergy() const;
+    float PotentialAt(Vec2D point) const;
+
+
+private:
+    /*  One level of the grid: nodes_x by nodes_y nodes, spacing_x and spacing_y apart, over the inside of the Wire.  */
+    struct Level
+    {
+        int nodes_x, nodes_y;
+        double spacing_x, spacing_y;
+        std::vector<double> phi;        // Potential (a correction to the finer level's, below the finest); 0 along the edge.
+        std::vector<double> source;     // 4 pi rho (the finer level's restricted residual, below the finest).
+        std::vector<double> residual;
+    };
+
+    Vec2D origin;                       // Top-left corner of the inside of the Wire.
+    std::vector<Level> grid;            // Finest first.
+    std::vector<float> charges;
+    std::vector<int> node;              // Top-left node of each charge's cell (as iy * nodes_x + ix; -1 if it's in the frame),
+    std::vector<float> tx, ty;          // and its offset within the cell, as a fraction of the cell.
+    std::vector<float> field_x, field_y;
+
+    void Smooth(Level& level, int sweeps, ThreadPool* pool);
+    double Residual(Level& level, ThreadPool* pool);
+    void Restrict(const Level& fine, Level& coarse);
+    void Prolong(const Level& coarse, Level& fine);
+    void VCycle(int l, ThreadPool* pool);
+};
+
+
+
+
+
+
+/*  Builds the grid over a Wire (see SetConductor).
+ *  @param wire: The conductor frame (its bounds must be set).
+ *  @param cell: Spacing of the finest grid.
+ *  @param cycles: Most V-cycles per Solve.
+ *  @param tolerance: Residual, as a fraction of the charge density, at which Solve stops early.  */
+MultigridPoisson::MultigridPoisson(const Wire& wire, float cell, int cycles, float tolerance)
+    : cell(cell), cycles(cycles), tolerance(tolerance), smoothing(2)
+{
+    SetConductor(wire);
+}
+
+
+/*  Builds the levels of the grid over the inside of a Wire, halving the resolution down to a few cells across the
+ *  shorter side. Forgets the previous potential.  */
+void MultigridPoisson::SetConductor(const Wire& wire)
+{
+    const Wire::OutsideBounds& bounds = wire.outside_bounds;
+    const float left = bounds.left + wire.thickness, right = bounds.right - wire.thickness;
+    const float top = bounds.top + wire.thickness, bottom = bounds.bottom - wire.thickness;
+    if (right - left < 2.0f * cell || bottom - top < 2.0f * cell)
+        throw std::invalid_argument("MultigridPoisson::SetConductor(const Wire& wire): The inside of the wire has to be at least two cells across");
+
+    // Cells along each side, rounded up so they halve evenly down to the coarsest level
+    int cells_x = (int)std::ceil((right - left) / cell);
+    int cells_y = (int)std::ceil((bottom - top) / cell);
+    int coarsenings = 0;
+    while ((std::min(cells_x, cells_y) >> (coarsenings + 1)) >= 4)
+        coarsenings++;
+    const int multiple = 1 << coarsenings;
+    cells_x = (cells_x + multiple - 1) / multiple * multiple;
+    cells_y = (cells_y + multiple - 1) / multiple * multiple;
+
+    origin = Vec2D(left, top);
+    grid.assign(coarsenings + 1, Level());
+    for (int l = 0; l <= coarsenings; l++)
+    {
+        Level& level = grid[l];
+        level.nodes_x = (cells_x >> l) + 1;
+        level.nodes_y = (cells_y >> l) + 1;
+        level.spacing_x = (double)(right - left) / (cells_x >> l);
+        level.spacing_y = (double)(bottom - top) / (cells_y >> l);
+        const size_t size = (size_t)level.nodes_x * level.nodes_y;
+        level.phi.assign(size, 0.0);
+        level.source.assign(size, 0.0);
+        level.residual.assign(size, 0.0);
+    }
+    stats = Stats();
+    stats.nodes_x = grid[0].nodes_x;
+    stats.nodes_y = grid[0].nodes_y;
+    stats.levels = (int)grid.size();
+}
+
+
+/*  Forgets the potential from the last Solve, so the next one starts from zero.  */
+void MultigridPoisson::Reset()
+{
+    std::fill(grid[0].phi.begin(), grid[0].phi.end(), 0.0);
+}
+
+
+/*  Deposits the charges onto the finest grid (a charge's share on an edge node, or the whole of one in the frame,
+ *  goes to the conductor).
+ *  @param centers: Position of each charge (the particles' centers).
+ *  @param charges: Charge of each one.  */
+void MultigridPoisson::Build(const std::vector<Vec2D>& centers, const std::vector<float>& charges)
+{
+    const int n = (int)centers.size();
+    Level& fine = grid[0];
+    const int nx = fine.nodes_x;
+    this->charges.assign(charges.begin(), charges.begin() + n);
+    std::fill(fine.source.begin(), fine.source.end(), 0.0);
+    node.resize(n); tx.resize(n); ty.resize(n);
+
+    const double density = 4.0 * 3.14159265358979 / (fine.spacing_x * fine.spacing_y);
+    for (int i = 0; i < n; i++)
+    {
+        const double fx = (centers[i].x - origin.x) / fine.spacing_x, fy = (centers[i].y - origin.y) / fine.spacing_y;
+        if (!(fx >= 0.0 && fy >= 0.0 && fx < nx - 1 && fy < fine.nodes_y - 1))
+        {
+            node[i] = -1;
+            continue;
+        }
+        const int ix = (int)fx, iy = (int)fy;
+        node[i] = iy * nx + ix;
+        tx[i] = (float)(fx - ix);
+        ty[i] = (float)(fy - iy);
+        const double w[4] = { (1.0 - tx[i]) * (1.0 - ty[i]), tx[i] * (1.0 - ty[i]), (1.0 - tx[i]) * ty[i], tx[i] * ty[i] };
+        const int at[4] = { node[i], node[i] + 1, node[i] + nx, node[i] + nx + 1 };
+        for (int a = 0; a < 4; a++)
+            fine.source[at[a]] += density * charges[i] * w[a];
+    }
+    // The edge is the conductor
+    for (int x = 0; x < nx; x++)
+        fine.source[x] = fine.source[(size_t)(fine.nodes_y - 1) * nx + x] = 0.0;
+    for (int y = 0; y < fine.nodes_y; y++)
+        fine.source[(size_t)y * nx] = fine.source[(size_t)y * nx + nx - 1] = 0.0;
+}
+
+
+/*  Red-black Gauss-Seidel: every node inside the edge set so the five-point Laplacian matches the source there,
+ *  the red nodes (x + y even) then the black ones, `sweeps` times.  */
+void MultigridPoisson::Smooth(Level& level, int sweeps, ThreadPool* pool)
+{
+    const int nx = level.nodes_x;
+    const double ax = 1.0 / (level.spacing_x * level.spacing_x), ay = 1.0 / (level.spacing_y * level.spacing_y);
+    const double inv_diagonal = 1.0 / (2.0 * ax + 2.0 * ay);
+    for (int s = 0; s < sweeps; s++)
+        for (int colour = 0; colour < 2; colour++)
+        {
+            auto rows = [&](int begin, int end) {
+                for (int y = begin; y < end; y++)
+                {
+                    double* phi = &level.phi[(size_t)y * nx];
+                    const double* f = &level.source[(size_t)y * nx];
+                    for (int x = 1 + ((y + colour + 1) & 1); x < nx - 1; x += 2)
+                        phi[x] = (ax * (phi[x - 1] + phi[x + 1]) + ay * (phi[x - nx] + phi[x + nx]) + f[x]) * inv_diagonal;
+                }
+            };
+            if (pool) pool->ParallelFor(1, level.nodes_y - 1, rows, 16);
+            else rows(1, level.nodes_y - 1);
+        }
+}
+
+
+/*  Works out the residual, source + laplacian(phi), at every node inside the edge (zero on it), and returns its rms.  */
+double MultigridPoisson::Residual(Level& level, ThreadPool* pool)
+{
+    const int nx = level.nodes_x;
+    const double ax = 1.0 / (level.spacing_x * level.spacing_x), ay = 1.0 / (level.spacing_y * level.spacing_y);
+    std::vector<double> row_sums(level.nodes_y, 0.0);
+    auto rows = [&](int begin, int end) {
+        for (int y = begin; y < end; y++)
+        {
+            const double* phi = &level.phi[(size_t)y * nx];
+            const double* f = &level.source[(size_t)y * nx];
+            double* r = &level.residual[(size_t)y * nx];
+            for (int x = 1; x < nx - 1; x++)
+            {
+                r[x] = f[x] + ax * (phi[x - 1] + phi[x + 1] - 2.0 * phi[x]) + ay * (phi[x - nx] + phi[x + nx] - 2.0 * phi[x]);
+                row_sums[y] += r[x] * r[x];
+            }
+        }
+    };
+    if (pool) pool->ParallelFor(1, level.nodes_y - 1, rows, 16);
+    else rows(1, level.nodes_y - 1);
+
+    double sum = 0.0;
+    for (double s : row_sums)
+        sum += s;
+    return std::sqrt(sum / level.phi.size());
+}
+
+
+/*  Hands a level's residual down as the next coarser level's source, with full weighting (1-2-1 in each direction).  */
+void MultigridPoisson::Restrict(const Level& fine, Level& coarse)
+{
+    const int nx = fine.nodes_x;
+    for (int y = 1; y < coarse.nodes_y - 1; y++)
+        for (int x = 1; x < coarse.nodes_x - 1; x++)
+        {
+            const size_t c = (size_t)y * coarse.nodes_x + x;
+            const double* r = &fine.residual[(size_t)(2 * y) * nx + 2 * x];
+            coarse.source[c] = (4.0 * r[0] + 2.0 * (r[-1] + r[1] + r[-nx] + r[nx]) + r[-nx - 1] + r[-nx + 1] + r[nx - 1] + r[nx + 1]) / 16.0;
+        }
+}
+
+
+/*  Adds a coarser level's correction onto a level's nodes inside the edge, interpolated bilinearly.  */
+void MultigridPoisson::Prolong(const Level& coarse, Level& fine)
+{
+    const int cx = coarse.nodes_x;
+    for (int y = 1; y < fine.nodes_y - 1; y++)
+        for (int x = 1; x < fine.nodes_x - 1; x++)
+        {
+            const size_t f = (size_t)y * fine.nodes_x + x;
+            const double* e = &coarse.phi[(size_t)(y / 2) * cx + x / 2];
+            const double right = (x & 1) ? e[1] : e[0];
+            const double below = (y & 1) ? e[cx] : e[0];
+            const double diagonal = (x & 1) && (y & 1) ? e[cx + 1] : ((x & 1) ? right : below);
+            fine.phi[f] += 0.25 * (e[0] + right + below + diagonal);
+        }
+}
+
+
+/*  One V-cycle from level l down: smooth, restrict the residual, solve the coarser level for the correction, add it, smooth.  */
+void MultigridPoisson::VCycle(int l, ThreadPool* pool)
+{
+    Level& level = grid[l];
+    if (l + 1 == (int)grid.size())
+    {
+        Smooth(level, 4 * std::max(level.nodes_x, level.nodes_y), pool);
+        return;
+    }
+    Smooth(level, smoothing, pool);
+    Residual(level, pool);
+    Level& coarse = grid[l + 1];
+    Restrict(level, coarse);
+    std::fill(coarse.phi.begin(), coarse.phi.end(), 0.0);
+    VCycle(l + 1, pool);
+    Prolong(coarse, level);
+    Smooth(level, smoothing, pool);
+}
+
+
+/*  Runs V-cycles from the last Solve's potential until the residual is within the tolerance (or `cycles` have run),
+ *  then works out the force on and potential at every charge deposited by the last Build.
+ *  @param pool: Threads to split the sweeps' rows, and the charges, across (the calling thread does it all if null).  */
+void MultigridPoisson::Solve(ThreadPool* pool)
+{
+    Level& fine = grid[0];
+    double source = 0.0;
+    for (double f : fine.source)
+        source += f * f;
+    source = std::sqrt(source / fine.source.size());
+
+    stats.cycles = 0;
+    stats.residual = source > 0.0 ? (float)(Residual(fine, pool) / source) : 0.0f;
+    while (stats.cycles < cycles && stats.residual > tolerance)
+    {
+        VCycle(0, pool);
+        stats.cycles++;
+        stats.residual = source > 0.0 ? (float)(Residual(fine, pool) / source) : 0.0f;
+    }
+
+    // Field at the nodes (one-sided along the edge, where it's the field at the conductor's surface), then at the charges
+    const int nx = fine.nodes_x, ny = fine.nodes_y;
+    field_x.resize(fine.phi.size());
+    field_y.resize(fine.phi.size());
+    for (int y = 0; y < ny; y++)
+        for (int x = 0; x < nx; x++)
+        {
+            const double* phi = &fine.phi[(size_t)y * nx + x];
+            const int left = (x > 0), right = (x < nx - 1), up = (y > 0), down = (y < ny - 1);
+            field_x[(size_t)y * nx + x] = (float)(-(phi[right] - phi[-left]) / ((left + right) * fine.spacing_x));
+            field_y[(size_t)y * nx + x] = (float)(-(phi[down * nx] - phi[-up * nx]) / ((up + down) * fine.spacing_y));
+        }
+
+    const int n = (int)charges.size();
+    forces.resize(n);
+    potentials.resize(n);
+    auto interpolate = [&](int begin, int end) {
+        for (int i = begin; i < end; i++)
+        {
+            if (node[i] < 0)
+            {
+                forces[i] = Vec2D(0.0f, 0.0f);
+                potentials[i] = 0.0f;
+                continue;
+            }
+            const float w[4] = { (1.0f - tx[i]) * (1.0f - ty[i]), tx[i] * (1.0f - ty[i]), (1.0f - tx[i]) * ty[i], tx[i] * ty[i] };
+            const int at[4] = { node[i], node[i] + 1, node[i] + nx, node[i] + nx + 1 };
+            double ex = 0.0, ey = 0.0, phi = 0.0;
+            for (int a = 0; a < 4; a++)
+            {
+                ex += w[a] * field_x[at[a]];
+                ey += w[a] * field_y[at[a]];
+                phi += w[a] * fine.phi[at[a]];
+            }
+            forces[i] = Vec2D((float)(8.987551787e9 * charges[i] * ex), (float)(8.987551787e9 * charges[i] * ey));
+            potentials[i] = (float)(8.987551787e9 * phi);
+        }
+    };
+    if (pool) pool->ParallelFor(0, n, interpolate, 256);
+    else interpolate(0, n);
+}
+
+
+/*  Deposits a vector of ChargedParticles (or anything with a center and a charge) and solves for their potential,
+ *  starting from the last one. forces[i] and charge * potentials[i] are then the force on and potential energy of
+ *  particles[i], e.g. for ChargedParticle::UpdateUnderField(t, dt, force, potential_energy).
+ *  @param particles: The charges.
+ *  @param pool: Threads to split the work across (may be null).  */
+template <typename P>
+void MultigridPoisson::Solve(const std::vector<P>& particles, ThreadPool* pool)
+{
+    std::vector<Vec2D> centers(particles.size());
+    std::vector<float> charges(particles.size());
+    for (size_t i = 0; i < particles.size(); i++)
+    {
+        centers[i] = particles[i].center;
+        charges[i] = particles[i].charge;
+    }
+    Build(centers, charges);
+    Solve(pool);
+}
+
+
+/*  Returns the electric potential energy, half the sum of charge * potential.  */
+float MultigridPoisson::PotentialEnergy() const
+{
+    double energy = 0.0;
+    for (size_t i = 0; i < potentials.size(); i++)
+        energy += 0.5 * charges[i] * potentials[i];
+    return (float)energy;
+}
+
+
+/*  Returns the potential at a point, interpolated from the grid of the last Solve (0 on the frame, and outside it).  */
+float MultigridPoisson::PotentialAt(Vec2D point) const
+{
+    const Level& fine = grid[0];
+    const double fx = (point.x - origin.x) / fine.spacing_x, fy = (point.y - origin.y) / fine.spacing_y;
+    if (!(fx >= 0.0 && fy >= 0.0 && fx < fine.nodes_x - 1 && fy < fine.nodes_y - 1)) return 0.0f;
+    const int ix = (int)fx, iy = (int)fy;
+    const double u = fx - ix, v = fy - iy;
+    const double* p = &fine.phi[(size_t)iy * fine.nodes_x + ix];
+    return (float)(8.987551787e9 * ((1.0 - u) * (1.0 - v) * p[0] + u * (1.0 - v) * p[1] + (1.0 - u) * v * p[fine.nodes_x] + u * v * p[fine.nodes_x + 1]));
+}
@@ -0,0 +1,481 @@
+/********************
+*
+*    Narrowphase.hpp
+*
+*    Defines the BatchNarrowphase class, which runs the overlap test and the collision response for
+*    candidate pairs several at a time with SIMD, picking the instruction set at runtime.
+*
+*********************/
+
+#pragma once
+#include <cmath>
+#include <vector>
+#include <cstdint>
+#include <utility>
+#include <algorithm>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define NARROWPHASE_X86
+#include <immintrin.h>
+#endif
+
+
+
+
+
+/*  Batched narrowphase over structure-of-arrays particle data.
+ *  Candidate pairs are taken in chunks; for each chunk, the positions, velocities and radii of both
+ *  particles are gathered into SIMD lanes (4, 8 or 16 pairs at a time with SSE2, AVX2 or AVX-512),
+ *  and squared distances are compared against squared radii sums, so no square roots are taken for
+ *  the pairs that don't touch (which is nearly all of them).
+ *  The pairs that do collide are then split in two, in pair order: a pair that shares no particle with an earlier
+ *  colliding pair of the chunk can't be affected by any of them, so all of those get the normal-impulse response
+ *  together, gathered into SIMD lanes the same way and scattered back. The rest (a particle hit twice in one chunk,
+ *  which is rare) are resolved one at a time after them, in pair order, each re-tested with the updated velocities,
+ *  so the result is the same as resolving the pairs one at a time.
+ *  The instruction set is picked at runtime from what the CPU supports, so one build runs everywhere.  */
+class BatchNarrowphase
+{
+public:
+    /*  Instruction sets the overlap test can run with.  */
+    enum Level { SCALAR = 0, SSE2 = 1, AVX2 = 2, AVX512 = 3 };
+
+    Level level;        // Instruction set in use.
+
+    /*  Counts from the last call to Resolve.  */
+    struct Stats
+    {
+        long long tested = 0;       // Candidate pairs tested.
+        long long overlapping = 0;  // Pairs found overlapping.
+        long long resolved = 0;     // Pairs that were approaching and had a response applied.
+        long long batched = 0;      // Resolved pairs whose response was worked out in SIMD lanes.
+    };
+    Stats stats;
+
+
+    BatchNarrowphase() : level(Detect()), stamp(0) { }
+    BatchNarrowphase(Level max_level) : level(Detect() < max_level ? Detect() : max_level), stamp(0) { }
+
+    static Level Detect();
+    static const char* Name(Level level);
+
+    void Resolve(const std::vector<std::pair<int,int>>& pairs, const float* px, const float* py, float* vx, float* vy,
+                 const float* mass, const float* radius, const float* restitution, bool corners = false);
+
+
+private:
+    static const int CHUNK = 256;       // Pairs tested per batch before the responses are applied.
+
+    int first[CHUNK];                   // First particle of each pair in the chunk.
+    int second[CHUNK];                  // Second particle of each pair in the chunk.
+    uint8_t overlap[CHUNK];             // Whether each pair overlaps.
+    uint8_t approach[CHUNK];            // Whether each pair was approaching when the chunk was tested.
+    int batch_first[CHUNK];             // First particle of each pair whose response is worked out in lanes.
+    int batch_second[CHUNK];            // Second particle of each pair whose response is worked out in lanes.
+    int deferred[CHUNK];                // Chunk lanes of the colliding pairs that share a particle with an earlier one.
+    std::vector<int> touched;           // Chunk stamp of the last chunk in which each particle was in a colliding pair.
+    int stamp;                          // Current chunk stamp.
+
+    void Masks(int count, const float* px, const float* py, const float* vx, const float* vy, const float* radius, float skew);
+    void Respond(int count, const float* px, const float* py, float* vx, float* vy, const float* mass, const float* restitution);
+};
+
+
+
+
+
+
+/*  Tests lanes [begin, count) of a chunk one pair at a time.  */
+static void NarrowphaseMasksScalar(const int* a, const int* b, int begin, int count, const float* px, const float* py,
+                                   const float* vx, const float* vy, const float* radius, float skew, uint8_t* overlap, uint8_t* approach)
+{
+    for (int k = begin; k < count; k++)
+    {
+        const int i = a[k], j = b[k];
+        const float dx = px[j] - px[i];
+        const float dy = py[j] - py[i];
+        const float cx = (px[j] + skew * radius[j]) - (px[i] + skew * radius[i]);
+        const float cy = (py[j] + skew * radius[j]) - (py[i] + skew * radius[i]);
+        const float reach = radius[i] + radius[j];
+        overlap[k] = (cx * cx + cy * cy < reach * reach);
+        approach[k] = ((vx[i] - vx[j]) * dx + (vy[i] - vy[j]) * dy >= 0.f);
+    }
+}
+
+
+/*  Applies the elastic exchange along the unit normal (as in Particle2D::resolveCollision) to pairs [begin, count).  */
+static void NarrowphaseRespondScalar(const int* a, const int* b, int begin, int count, const float* px, const float* py,
+                                     float* vx, float* vy, const float* mass, const float* restitution)
+{
+    for (int k = begin; k < count; k++)
+    {
+        const int i = a[k], j = b[k];
+        const float dx = px[j] - px[i];
+        const float dy = py[j] - py[i];
+        const float distance = std::sqrt(dx * dx + dy * dy);
+        const float nx = (distance > 0.f) ? dx / distance : 1.f;
+        const float ny = (distance > 0.f) ? dy / distance : 0.f;
+        const float m1 = mass[i], m2 = mass[j];
+        const float u1 = vx[i] * nx + vy[i] * ny;
+        const float u2 = vx[j] * nx + vy[j] * ny;
+        const float v1 = (u1 * (m1 - m2) + u2 * 2 * m2) / (m1 + m2);
+        const float v2 = (u2 * (m2 - m1) + u1 * 2 * m1) / (m1 + m2);
+        const float e = restitution[i];
+        vx[i] = (vx[i] + nx * (v1 - u1)) * e;
+        vy[i] = (vy[i] + ny * (v1 - u1)) * e;
+        vx[j] = (vx[j] + nx * (v2 - u2)) * e;
+        vy[j] = (vy[j] + ny * (v2 - u2)) * e;
+    }
+}
+
+
+#ifdef NARROWPHASE_X86
+
+/*  Tests a chunk four pairs at a time with SSE2 (which has no gather instruction, so lanes are loaded one by one).  */
+__attribute__((target("sse2")))
+static void NarrowphaseMasksSSE2(const int* a, const int* b, int count, const float* px, const float* py,
+                                 const float* vx, const float* vy, const float* radius, float skew, uint8_t* overlap, uint8_t* approach)
+{
+    auto gather = [](const float* base, const int* index) { return _mm_setr_ps(base[index[0]], base[index[1]], base[index[2]], base[index[3]]); };
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 s = _mm_set1_ps(skew);
+    int k = 0;
+    for (; k + 4 <= count; k += 4)
+    {
+        const __m128 xa = gather(px, a + k), xb = gather(px, b + k);
+        const __m128 ya = gather(py, a + k), yb = gather(py, b + k);
+        const __m128 ra = gather(radius, a + k), rb = gather(radius, b + k);
+        const __m128 dx = _mm_sub_ps(xb, xa);
+        const __m128 dy = _mm_sub_ps(yb, ya);
+        const __m128 cx = _mm_sub_ps(_mm_add_ps(xb, _mm_mul_ps(s, rb)), _mm_add_ps(xa, _mm_mul_ps(s, ra)));
+        const __m128 cy = _mm_sub_ps(_mm_add_ps(yb, _mm_mul_ps(s, rb)), _mm_add_ps(ya, _mm_mul_ps(s, ra)));
+        const __m128 dvx = _mm_sub_ps(gather(vx, a + k), gather(vx, b + k));
+        const __m128 dvy = _mm_sub_ps(gather(vy, a + k), gather(vy, b + k));
+        const __m128 reach = _mm_add_ps(ra, rb);
+        const __m128 d2 = _mm_add_ps(_mm_mul_ps(cx, cx), _mm_mul_ps(cy, cy));
+        const __m128 dot = _mm_add_ps(_mm_mul_ps(dvx, dx), _mm_mul_ps(dvy, dy));
+        const int o = _mm_movemask_ps(_mm_cmplt_ps(d2, _mm_mul_ps(reach, reach)));
+        const int p = _mm_movemask_ps(_mm_cmpge_ps(dot, zero));
+        for (int l = 0; l < 4; l++) {
+            overlap[k + l] = (o >> l) & 1;
+            approach[k + l] = (p >> l) & 1;
+        }
+    }
+    NarrowphaseMasksScalar(a, b, k, count, px, py, vx, vy, radius, skew, overlap, approach);
+}
+
+
+/*  Responds to four pairs at a time with SSE2. No two pairs may share a particle, as the lanes are scattered back one by one.
+ *  The response kernels keep the compiler from fusing multiplies and adds, so every lane rounds exactly as the scalar
+ *  response does, and a pair gives the same velocities whether it's resolved in lanes or on its own.  */
+__attribute__((target("sse2"), optimize("fp-contract=off")))
+static void NarrowphaseRespondSSE2(const int* a, const int* b, int count, const float* px, const float* py,
+                                   float* vx, float* vy, const float* mass, const float* restitution)
+{
+    auto gather = [](const float* base, const int* index) { return _mm_setr_ps(base[index[0]], base[index[1]], base[index[2]], base[index[3]]); };
+    auto scatter = [](float* base, const int* index, __m128 value) {
+        float lanes[4];
+        _mm_storeu_ps(lanes, value);
+        for (int l = 0; l < 4; l++)  base[index[l]] = lanes[l];
+    };
+    auto select = [](__m128 mask, __m128 yes, __m128 no) { return _mm_or_ps(_mm_and_ps(mask, yes), _mm_andnot_ps(mask, no)); };
+    const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.f), two = _mm_set1_ps(2.f);
+    int k = 0;
+    for (; k + 4 <= count; k += 4)
+    {
+        const __m128 dx = _mm_sub_ps(gather(px, b + k), gather(px, a + k));
+        const __m128 dy = _mm_sub_ps(gather(py, b + k), gather(py, a + k));
+        const __m128 distance = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)));
+        const __m128 apart = _mm_cmpgt_ps(distance, zero);
+        const __m128 nx = select(apart, _mm_div_ps(dx, distance), one);
+        const __m128 ny = select(apart, _mm_div_ps(dy, distance), zero);
+        const __m128 m1 = gather(mass, a + k), m2 = gather(mass, b + k);
+        const __m128 vx1 = gather(vx, a + k), vy1 = gather(vy, a + k);
+        const __m128 vx2 = gather(vx, b + k), vy2 = gather(vy, b + k);
+        const __m128 u1 = _mm_add_ps(_mm_mul_ps(vx1, nx), _mm_mul_ps(vy1, ny));
+        const __m128 u2 = _mm_add_ps(_mm_mul_ps(vx2, nx), _mm_mul_ps(vy2, ny));
+        const __m128 total = _mm_add_ps(m1, m2);
+        const __m128 d1 = _mm_sub_ps(_mm_div_ps(_mm_add_ps(_mm_mul_ps(u1, _mm_sub_ps(m1, m2)), _mm_mul_ps(_mm_mul_ps(u2, two), m2)), total), u1);
+        const __m128 d2 = _mm_sub_ps(_mm_div_ps(_mm_add_ps(_mm_mul_ps(u2, _mm_sub_ps(m2, m1)), _mm_mul_ps(_mm_mul_ps(u1, two), m1)), total), u2);
+        const __m128 e = gather(restitution, a + k);
+        scatter(vx, a + k, _mm_mul_ps(_mm_add_ps(vx1, _mm_mul_ps(nx, d1)), e));
+        scatter(vy, a + k, _mm_mul_ps(_mm_add_ps(vy1, _mm_mul_ps(ny, d1)), e));
+        scatter(vx, b + k, _mm_mul_ps(_mm_add_ps(vx2, _mm_mul_ps(nx, d2)), e));
+        scatter(vy, b + k, _mm_mul_ps(_mm_add_ps(vy2, _mm_mul_ps(ny, d2)), e));
+    }
+    NarrowphaseRespondScalar(a, b, k, count, px, py, vx, vy, mass, restitution);
+}
+
+
+/*  Tests a chunk eight pairs at a time with AVX2, using hardware gathers.  */
+__attribute__((target("avx2")))
+static void NarrowphaseMasksAVX2(const int* a, const int* b, int count, const float* px, const float* py,
+                                 const float* vx, const float* vy, const float* radius, float skew, uint8_t* overlap, uint8_t* approach)
+{
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 s = _mm256_set1_ps(skew);
+    int k = 0;
+    for (; k + 8 <= count; k += 8)
+    {
+        const __m256i ia = _mm256_loadu_si256((const __m256i*)(a + k));
+        const __m256i ib = _mm256_loadu_si256((const __m256i*)(b + k));
+        const __m256 xa = _mm256_i32gather_ps(px, ia, 4), xb = _mm256_i32gather_ps(px, ib, 4);
+        const __m256 ya = _mm256_i32gather_ps(py, ia, 4), yb = _mm256_i32gather_ps(py, ib, 4);
+        const __m256 ra = _mm256_i32gather_ps(radius, ia, 4), rb = _mm256_i32gather_ps(radius, ib, 4);
+        const __m256 dx = _mm256_sub_ps(xb, xa);
+        const __m256 dy = _mm256_sub_ps(yb, ya);
+        const __m256 cx = _mm256_sub_ps(_mm256_add_ps(xb, _mm256_mul_ps(s, rb)), _mm256_add_ps(xa, _mm256_mul_ps(s, ra)));
+        const __m256 cy = _mm256_sub_ps(_mm256_add_ps(yb, _mm256_mul_ps(s, rb)), _mm256_add_ps(ya, _mm256_mul_ps(s, ra)));
+        const __m256 dvx = _mm256_sub_ps(_mm256_i32gather_ps(vx, ia, 4), _mm256_i32gather_ps(vx, ib, 4));
+        const __m256 dvy = _mm256_sub_ps(_mm256_i32gather_ps(vy, ia, 4), _mm256_i32gather_ps(vy, ib, 4));
+        const __m256 reach = _mm256_add_ps(ra, rb);
+        const __m256 d2 = _mm256_add_ps(_mm256_mul_ps(cx, cx), _mm256_mul_ps(cy, cy));
+        const __m256 dot = _mm256_add_ps(_mm256_mul_ps(dvx, dx), _mm256_mul_ps(dvy, dy));
+        const int o = _mm256_movemask_ps(_mm256_cmp_ps(d2, _mm256_mul_ps(reach, reach), _CMP_LT_OQ));
+        const int p = _mm256_movemask_ps(_mm256_cmp_ps(dot, zero, _CMP_GE_OQ));
+        for (int l = 0; l < 8; l++) {
+            overlap[k + l] = (o >> l) & 1;
+            approach[k + l] = (p >> l) & 1;
+        }
+    }
+    NarrowphaseMasksScalar(a, b, k, count, px, py, vx, vy, radius, skew, overlap, approach);
+}
+
+
+/*  Responds to eight pairs at a time with AVX2, using hardware gathers (AVX2 has no scatter, so lanes are stored one by one).
+ *  No two pairs may share a particle.  */
+__attribute__((target("avx2"), optimize("fp-contract=off")))
+static void NarrowphaseRespondAVX2(const int* a, const int* b, int count, const float* px, const float* py,
+                                   float* vx, float* vy, const float* mass, const float* restitution)
+{
+    float lanes[4][8];
+    const __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.f), two = _mm256_set1_ps(2.f);
+    int k = 0;
+    for (; k + 8 <= count; k += 8)
+    {
+        const __m256i ia = _mm256_loadu_si256((const __m256i*)(a + k));
+        const __m256i ib = _mm256_loadu_si256((const __m256i*)(b + k));
+        const __m256 dx = _mm256_sub_ps(_mm256_i32gather_ps(px, ib, 4), _mm256_i32gather_ps(px, ia, 4));
+        const __m256 dy = _mm256_sub_ps(_mm256_i32gather_ps(py, ib, 4), _mm256_i32gather_ps(py, ia, 4));
+        const __m256 distance = _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)));
+        const __m256 apart = _mm256_cmp_ps(distance, zero, _CMP_GT_OQ);
+        const __m256 nx = _mm256_blendv_ps(one, _mm256_div_ps(dx, distance), apart);
+        const __m256 ny = _mm256_blendv_ps(zero, _mm256_div_ps(dy, distance), apart);
+        const __m256 m1 = _mm256_i32gather_ps(mass, ia, 4), m2 = _mm256_i32gather_ps(mass, ib, 4);
+        const __m256 vx1 = _mm256_i32gather_ps(vx, ia, 4), vy1 = _mm256_i32gather_ps(vy, ia, 4);
+        const __m256 vx2 = _mm256_i32gather_ps(vx, ib, 4), vy2 = _mm256_i32gather_ps(vy, ib, 4);
+        const __m256 u1 = _mm256_add_ps(_mm256_mul_ps(vx1, nx), _mm256_mul_ps(vy1, ny));
+        const __m256 u2 = _mm256_add_ps(_mm256_mul_ps(vx2, nx), _mm256_mul_ps(vy2, ny));
+        const __m256 total = _mm256_add_ps(m1, m2);
+        const __m256 d1 = _mm256_sub_ps(_mm256_div_ps(_mm256_add_ps(_mm256_mul_ps(u1, _mm256_sub_ps(m1, m2)), _mm256_mul_ps(_mm256_mul_ps(u2, two), m2)), total), u1);
+        const __m256 d2 = _mm256_sub_ps(_mm256_div_ps(_mm256_add_ps(_mm256_mul_ps(u2, _mm256_sub_ps(m2, m1)), _mm256_mul_ps(_mm256_mul_ps(u1, two), m1)), total), u2);
+        const __m256 e = _mm256_i32gather_ps(restitution, ia, 4);
+        _mm256_storeu_ps(lanes[0], _mm256_mul_ps(_mm256_add_ps(vx1, _mm256_mul_ps(nx, d1)), e));
+        _mm256_storeu_ps(lanes[1], _mm256_mul_ps(_mm256_add_ps(vy1, _mm256_mul_ps(ny, d1)), e));
+        _mm256_storeu_ps(lanes[2], _mm256_mul_ps(_mm256_add_ps(vx2, _mm256_mul_ps(nx, d2)), e));
+        _mm256_storeu_ps(lanes[3], _mm256_mul_ps(_mm256_add_ps(vy2, _mm256_mul_ps(ny, d2)), e));
+        for (int l = 0; l < 8; l++) {
+            vx[a[k + l]] = lanes[0][l];
+            vy[a[k + l]] = lanes[1][l];
+            vx[b[k + l]] = lanes[2][l];
+            vy[b[k + l]] = lanes[3][l];
+        }
+    }
+    NarrowphaseRespondScalar(a, b, k, count, px, py, vx, vy, mass, restitution);
+}
+
+
+/*  Tests a chunk sixteen pairs at a time with AVX-512.  */
+__attribute__((target("avx512f")))
+static void NarrowphaseMasksAVX512(const int* a, const int* b, int count, const float* px, const float* py,
+                                   const float* vx, const float* vy, const float* radius, float skew, uint8_t* overlap, uint8_t* approach)
+{
+    const __m512 zero = _mm512_setzero_ps();
+    const __m512 s = _mm512_set1_ps(skew);
+    int k = 0;
+    for (; k + 16 <= count; k += 16)
+    {
+        const __m512i ia = _mm512_loadu_si512((const void*)(a + k));
+        const __m512i ib = _mm512_loadu_si512((const void*)(b + k));
+        const __m512 xa = _mm512_i32gather_ps(ia, px, 4), xb = _mm512_i32gather_ps(ib, px, 4);
+        const __m512 ya = _mm512_i32gather_ps(ia, py, 4), yb = _mm512_i32gather_ps(ib, py, 4);
+        const __m512 ra = _mm512_i32gather_ps(ia, radius, 4), rb = _mm512_i32gather_ps(ib, radius, 4);
+        const __m512 dx = _mm512_sub_ps(xb, xa);
+        const __m512 dy = _mm512_sub_ps(yb, ya);
+        const __m512 cx = _mm512_sub_ps(_mm512_add_ps(xb, _mm512_mul_ps(s, rb)), _mm512_add_ps(xa, _mm512_mul_ps(s, ra)));
+        const __m512 cy = _mm512_sub_ps(_mm512_add_ps(yb, _mm512_mul_ps(s, rb)), _mm512_add_ps(ya, _mm512_mul_ps(s, ra)));
+        const __m512 dvx = _mm512_sub_ps(_mm512_i32gather_ps(ia, vx, 4), _mm512_i32gather_ps(ib, vx, 4));
+        const __m512 dvy = _mm512_sub_ps(_mm512_i32gather_ps(ia, vy, 4), _mm512_i32gather_ps(ib, vy, 4));
+        const __m512 reach = _mm512_add_ps(ra, rb);
+        const __m512 d2 = _mm512_add_ps(_mm512_mul_ps(cx, cx), _mm512_mul_ps(cy, cy));
+        const __m512 dot = _mm512_add_ps(_mm512_mul_ps(dvx, dx), _mm512_mul_ps(dvy, dy));
+        const __mmask16 o = _mm512_cmp_ps_mask(d2, _mm512_mul_ps(reach, reach), _CMP_LT_OQ);
+        const __mmask16 p = _mm512_cmp_ps_mask(dot, zero, _CMP_GE_OQ);
+        for (int l = 0; l < 16; l++) {
+            overlap[k + l] = (o >> l) & 1;
+            approach[k + l] = (p >> l) & 1;
+        }
+    }
+    NarrowphaseMasksScalar(a, b, k, count, px, py, vx, vy, radius, skew, overlap, approach);
+}
+
+
+/*  Responds to sixteen pairs at a time with AVX-512, gathering and scattering the lanes. No two pairs may share a particle.  */
+__attribute__((target("avx512f"), optimize("fp-contract=off")))
+static void NarrowphaseRespondAVX512(const int* a, const int* b, int count, const float* px, const float* py,
+                                     float* vx, float* vy, const float* mass, const float* restitution)
+{
+    const __m512 zero = _mm512_setzero_ps(), one = _mm512_set1_ps(1.f), two = _mm512_set1_ps(2.f);
+    int k = 0;
+    for (; k + 16 <= count; k += 16)
+    {
+        const __m512i ia = _mm512_loadu_si512((const void*)(a + k));
+        const __m512i ib = _mm512_loadu_si512((const void*)(b + k));
+        const __m512 dx = _mm512_sub_ps(_mm512_i32gather_ps(ib, px, 4), _mm512_i32gather_ps(ia, px, 4));
+        const __m512 dy = _mm512_sub_ps(_mm512_i32gather_ps(ib, py, 4), _mm512_i32gather_ps(ia, py, 4));
+        const __m512 distance = _mm512_sqrt_ps(_mm512_add_ps(_mm512_mul_ps(dx, dx), _mm512_mul_ps(dy, dy)));
+        const __mmask16 apart = _mm512_cmp_ps_mask(distance, zero, _CMP_GT_OQ);
+        const __m512 nx = _mm512_mask_div_ps(one, apart, dx, distance);
+        const __m512 ny = _mm512_mask_div_ps(zero, apart, dy, distance);
+        const __m512 m1 = _mm512_i32gather_ps(ia, mass, 4), m2 = _mm512_i32gather_ps(ib, mass, 4);
+        const __m512 vx1 = _mm512_i32gather_ps(ia, vx, 4), vy1 = _mm512_i32gather_ps(ia, vy, 4);
+        const __m512 vx2 = _mm512_i32gather_ps(ib, vx, 4), vy2 = _mm512_i32gather_ps(ib, vy, 4);
+        const __m512 u1 = _mm512_add_ps(_mm512_mul_ps(vx1, nx), _mm512_mul_ps(vy1, ny));
+        const __m512 u2 = _mm512_add_ps(_mm512_mul_ps(vx2, nx), _mm512_mul_ps(vy2, ny));
+        const __m512 total = _mm512_add_ps(m1, m2);
+        const __m512 d1 = _mm512_sub_ps(_mm512_div_ps(_mm512_add_ps(_mm512_mul_ps(u1, _mm512_sub_ps(m1, m2)), _mm512_mul_ps(_mm512_mul_ps(u2, two), m2)), total), u1);
+        const __m512 d2 = _mm512_sub_ps(_mm512_div_ps(_mm512_add_ps(_mm512_mul_ps(u2, _mm512_sub_ps(m2, m1)), _mm512_mul_ps(_mm512_mul_ps(u1, two), m1)), total), u2);
+        const __m512 e = _mm512_i32gather_ps(ia, restitution, 4);
+        _mm512_i32scatter_ps(vx, ia, _mm512_mul_ps(_mm512_add_ps(vx1, _mm512_mul_ps(nx, d1)), e), 4);
+        _mm512_i32scatter_ps(vy, ia, _mm512_mul_ps(_mm512_add_ps(vy1, _mm512_mul_ps(ny, d1)), e), 4);
+        _mm512_i32scatter_ps(vx, ib, _mm512_mul_ps(_mm512_add_ps(vx2, _mm512_mul_ps(nx, d2)), e), 4);
+        _mm512_i32scatter_ps(vy, ib, _mm512_mul_ps(_mm512_add_ps(vy2, _mm512_mul_ps(ny, d2)), e), 4);
+    }
+    NarrowphaseRespondScalar(a, b, k, count, px, py, vx, vy, mass, restitution);
+}
+
+#endif
+
+
+
+
+
+
+/*  Returns the widest instruction set the CPU supports.  */
+BatchNarrowphase::Level BatchNarrowphase::Detect()
+{
+#ifdef NARROWPHASE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) return AVX512;
+    if (__builtin_cpu_supports("avx2")) return AVX2;
+    if (__builtin_cpu_supports("sse2")) return SSE2;
+#endif
+    return SCALAR;
+}
+
+
+/*  Returns a printable name for an instruction set.  */
+const char* BatchNarrowphase::Name(Level level)
+{
+    switch (level) {
+        case AVX512:    return "AVX-512";
+        case AVX2:      return "AVX2";
+        case SSE2:      return "SSE2";
+        default:        return "scalar";
+    }
+}
+
+
+/*  Fills the overlap and approach flags for the first `count` pairs in the chunk.  */
+void BatchNarrowphase::Masks(int count, const float* px, const float* py, const float* vx, const float* vy, const float* radius, float skew)
+{
+#ifdef NARROWPHASE_X86
+    switch (level) {
+        case AVX512:    NarrowphaseMasksAVX512(first, second, count, px, py, vx, vy, radius, skew, overlap, approach);  return;
+        case AVX2:      NarrowphaseMasksAVX2(first, second, count, px, py, vx, vy, radius, skew, overlap, approach);    return;
+        case SSE2:      NarrowphaseMasksSSE2(first, second, count, px, py, vx, vy, radius, skew, overlap, approach);    return;
+        default:        break;
+    }
+#endif
+    NarrowphaseMasksScalar(first, second, 0, count, px, py, vx, vy, radius, skew, overlap, approach);
+}
+
+
+/*  Applies the response to the first `count` batched pairs, which share no particles.  */
+void BatchNarrowphase::Respond(int count, const float* px, const float* py, float* vx, float* vy, const float* mass, const float* restitution)
+{
+#ifdef NARROWPHASE_X86
+    switch (level) {
+        case AVX512:    NarrowphaseRespondAVX512(batch_first, batch_second, count, px, py, vx, vy, mass, restitution);  return;
+        case AVX2:      NarrowphaseRespondAVX2(batch_first, batch_second, count, px, py, vx, vy, mass, restitution);    return;
+        case SSE2:      NarrowphaseRespondSSE2(batch_first, batch_second, count, px, py, vx, vy, mass, restitution);    return;
+        default:        break;
+    }
+#endif
+    NarrowphaseRespondScalar(batch_first, batch_second, 0, count, px, py, vx, vy, mass, restitution);
+}
+
+
+/*  Tests every candidate pair and applies the elastic response to the ones that collide, updating vx and vy in place.
+ *  All arrays are indexed by particle.
+ *  @param pairs: Candidate pairs (i, j) from a broadphase.
+ *  @param px, py: Position of each particle (its center, or its top-left corner if `corners` is set).
+ *  @param vx, vy: Velocity of each particle (updated).
+ *  @param mass: Mass of each particle.
+ *  @param radius: Radius of each particle.
+ *  @param restitution: Restitution of each particle (the first particle's applies to a pair, as in resolveCollision).
+ *  @param corners: The positions are top-left corners, as in Particle2D. Overlap is then tested between the centers
+ *                  (corner + radius) and the contact normal taken between the corners, as Particle2D::resolveCollision does.  */
+void BatchNarrowphase::Resolve(const std::vector<std::pair<int,int>>& pairs, const float* px, const float* py, float* vx, float* vy,
+                               const float* mass, const float* radius, const float* restitution, bool corners)
+{
+    const float skew = corners ? 1.f : 0.f;
+    stats = Stats();
+    int n = 0;
+    for (auto& pair : pairs)  n = std::max(n, std::max(pair.first, pair.second) + 1);
+    if ((int)touched.size() < n)  touched.resize(n, -1);
+
+    for (size_t start = 0; start < pairs.size(); start += CHUNK)
+    {
+        const int count = (int)std::min((size_t)CHUNK, pairs.size() - start);
+        for (int k = 0; k < count; k++) {
+            first[k] = pairs[start + k].first;
+            second[k] = pairs[start + k].second;
+        }
+        Masks(count, px, py, vx, vy, radius, skew);
+        stats.tested += count;
+        stamp++;
+
+        // A colliding pair that shares no particle with an earlier one sees the velocities from before the chunk,
+        // so its approach test holds and it goes in the batch; any other has to wait for the pairs before it
+        int batched = 0, later = 0;
+        for (int k = 0; k < count; k++)
+        {
+            if (!overlap[k]) continue;
+            stats.overlapping++;
+            const int i = first[k], j = second[k];
+            if (touched[i] == stamp || touched[j] == stamp)  deferred[later++] = k;
+            else if (approach[k]) {
+                batch_first[batched] = i;
+                batch_second[batched++] = j;
+            }
+            else continue;
+            touched[i] = touched[j] = stamp;
+        }
+        Respond(batched, px, py, vx, vy, mass, restitution);
+        stats.resolved += batched;
+        stats.batched += batched;
+
+        // Then the rest in pair order, re-tested with the velocities the pairs before them left
+        for (int d = 0; d < later; d++)
+        {
+            const int k = deferred[d];
+            const int i = first[k], j = second[k];
+            const float dx = px[j] - px[i];
+            const float dy = py[j] - py[i];
+            if ((vx[i] - vx[j]) * dx + (vy[i] - vy[j]) * dy < 0.f) continue;
+            NarrowphaseRespondScalar(first + k, second + k, 0, 1, px, py, vx, vy, mass, restitution);
+            stats.resolved++;
+        }
+    }
+}
@@ -8,7 +8,9 @@
 *
 *********************/
 
+#pragma once
 #include "Entity.hpp"   // includes:  "DrawableVec2D.hpp", "Vec2D.hpp", <cmath>, and <SFML/Graphics.hpp>
+#include "ThreadPool.hpp"
 
 
 
@@ -385,6 +387,8 @@ Vec2D Particle::Rotate(Vec2D velocity, float angle)
 
 /*  Swaps out two colliding particle's x and y velocities
  *  after running through an elastic collision reaction equation.
+ *  The exchange is done along the unit normal between the two particles,
+ *  which avoids rotating into the collision frame (and the trig that takes).
  *  @param particle: The particle to swap velocities with.  */
 void Particle::ResolveCollisionWith(Particle& particle)
 {
@@ -399,13 +403,14 @@ void Particle::ResolveCollisionWith(Particle& particle)
         {
             float m1 = this->mass;
             float m2 = particle.mass;
-            float angle = -atan2(particle.kinematics.position.y - this->kinematics.position.y, particle.kinematics.position.x - this->kinematics.position.x);
-            Vec2D u1 = Particle::Rotate(this->kinematics.velocity, angle);
-            Vec2D u2 = Particle::Rotate(particle.kinematics.velocity, angle);
-            Vec2D v1 = Vec2D( (u1.x * (m1 - m2) / (m1 + m2)) + (u2.x * 2 * m2 / (m1 + m2)), u1.y );
-            Vec2D v2 = Vec2D( (u2.x * (m2 - m1) / (m1 + m2)) + (u1.x * 2 * m1 / (m1 + m2)), u2.y );
-            Vec2D v1_final = Particle::Rotate(v1, -angle);
-            Vec2D v2_final = Particle::Rotate(v2, -angle);
+            float distance = std::sqrt(dx*dx + dy*dy);
+            Vec2D n = (distance > 0.f) ? Vec2D(dx / distance, dy / distance) : Vec2D(1.f, 0.f);
+            float u1 = this->kinematics.velocity.dot(n);
+            float u2 = particle.kinematics.velocity.dot(n);
+            float v1 = (u1 * (m1 - m2) + u2 * 2 * m2) / (m1 + m2);
+            float v2 = (u2 * (m2 - m1) + u1 * 2 * m1) / (m1 + m2);
+            Vec2D v1_final = (this->kinematics.velocity + n * (v1 - u1));
+            Vec2D v2_final = (particle.kinematics.velocity + n * (v2 - u2));
             this->kinematics.velocity = v1_final;
             particle.kinematics.velocity = v2_final;
         }
@@ -414,7 +419,8 @@ void Particle::ResolveCollisionWith(Particle& particle)
 
 
 /*  Swaps out two colliding particle's x and y velocities
- *  after running through an elastic collision reaction equation.
+ *  after running through an elastic collision reaction equation,
+ *  along the unit normal between the two particles.
  *  @param particle: The particle to swap velocities with.
  *  @param restitution: The coefficient of restitution for the collision.  */
 void Particle::ResolveCollisionWith(Particle& particle, float restitution)
@@ -430,13 +436,14 @@ void Particle::ResolveCollisionWith(Particle& particle, float restitution)
         {
             float m1 = this->mass;
             float m2 = particle.mass;
-            float angle = -atan2(particle.kinematics.position.y - this->kinematics.position.y, particle.kinematics.position.x - this->kinematics.position.x);
-            Vec2D u1 = Particle::Rotate(this->kinematics.velocity, angle);
-            Vec2D u2 = Particle::Rotate(particle.kinematics.velocity, angle);
-            Vec2D v1 = Vec2D( (u1.x * (m1 - m2) / (m1 + m2)) + (u2.x * 2 * m2 / (m1 + m2)), u1.y );
-            Vec2D v2 = Vec2D( (u2.x * (m2 - m1) / (m1 + m2)) + (u1.x * 2 * m1 / (m1 + m2)), u2.y );
-            Vec2D v1_final = Particle::Rotate(v1, -angle) * restitution;
-            Vec2D v2_final = Particle::Rotate(v2, -angle) * restitution;
+            float distance = std::sqrt(dx*dx + dy*dy);
+            Vec2D n = (distance > 0.f) ? Vec2D(dx / distance, dy / distance) : Vec2D(1.f, 0.f);
+            float u1 = this->kinematics.velocity.dot(n);
+            float u2 = particle.kinematics.velocity.dot(n);
+            float v1 = (u1 * (m1 - m2) + u2 * 2 * m2) / (m1 + m2);
+            float v2 = (u2 * (m2 - m1) + u1 * 2 * m1) / (m1 + m2);
+            Vec2D v1_final = (this->kinematics.velocity + n * (v1 - u1)) * restitution;
+            Vec2D v2_final = (particle.kinematics.velocity + n * (v2 - u2)) * restitution;
             this->kinematics.velocity = v1_final;
             particle.kinematics.velocity = v2_final;
         }
@@ -738,4 +745,72 @@ void Particle::UpdateTrail(float dt)
 void Particle::DrawTrail(sf::RenderWindow& window)
 {
     for (auto& particle : this->trail)  particle->Draw(window);
+}
+
+
+
+
+
+
+/*  Resolves collisions between the candidate pairs found by a broadphase
+ *  (SpatialHash, SweepAndPrune or AABBTree), rather than between every pair of particles.
+ *  Works on a vector of Particles, or of any class derived from it (e.g. ChargedParticle).
+ *  @param particles: The particles to resolve collisions between.
+ *  @param broadphase: A broadphase with a FindPairs(centers, radii) method returning (i, j) index pairs.  */
+template <typename P, typename Broadphase>
+void ResolveCollisions(std::vector<P>& particles, Broadphase& broadphase)
+{
+    std::vector<Vec2D> centers;
+    std::vector<float> radii;
+    centers.reserve(particles.size());
+    radii.reserve(particles.size());
+    for (auto& particle : particles) {
+        centers.push_back(particle.center);
+        radii.push_back(particle.radius);
+    }
+    for (auto& pair : broadphase.FindPairs(centers, radii))
+        particles[pair.first].ResolveCollisionWith(particles[pair.second]);
+}
+
+
+/*  Resolves collisions between the candidate pairs found by a broadphase,
+ *  with a coefficient of restitution applied to each collision.
+ *  @param particles: The particles to resolve collisions between.
+ *  @param broadphase: A broadphase with a FindPairs(centers, radii) method returning (i, j) index pairs.
+ *  @param restitution: The coefficient of restitution for the collisions.  */
+template <typename P, typename Broadphase>
+void ResolveCollisions(std::vector<P>& particles, Broadphase& broadphase, float restitution)
+{
+    std::vector<Vec2D> centers;
+    std::vector<float> radii;
+    centers.reserve(particles.size());
+    radii.reserve(particles.size());
+    for (auto& particle : particles) {
+        centers.push_back(particle.center);
+        radii.push_back(particle.radius);
+    }
+    for (auto& pair : broadphase.FindPairs(centers, radii))
+        particles[pair.first].ResolveCollisionWith(particles[pair.second], restitution);
+}
+
+
+/*  Calls Particle::Update(t, dt, args...) on every particle, with the particles split between the pool's threads.
+ *  Takes the same trailing arguments as any of Particle's Update methods (force, and optionally damping and restitution).
+ *  It's always Particle's Update that runs, also for derived classes whose own Update overloads hide it
+ *  (ChargedParticle's take a nearby charge, not a force).
+ *  Each particle's Update only touches that particle (its kinematics, image and trail), so the result is the same
+ *  as calling Update in a loop, on any number of threads. Drawing, and adding anything up over the particles,
+ *  belongs after this returns, on the calling thread.
+ *  Works on a vector of Particles, or of any class derived from it (e.g. ChargedParticle).
+ *  @param particles: The particles to update.
+ *  @param pool: The threads to update them on.
+ *  @param t: The current simulation time.
+ *  @param dt: The time step.  */
+template <typename P, typename... Args>
+void Update(std::vector<P>& particles, ThreadPool& pool, double t, float dt, Args... args)
+{
+    pool.ParallelFor(0, (int)particles.size(), [&](int begin, int end) {
+        for (int i = begin; i < end; i++)
+            particles[i].Particle::Update(t, dt, args...);
+    }, 64);
 }
\ No newline at end of file
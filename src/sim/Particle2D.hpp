@@ -1,4 +1,6 @@
+#pragma once
 #include <string>
+#include <iostream>
 #include "Vec2D.hpp"
 
 const Vec2D g = Vec2D(0.0f, 9.8f);
@@ -22,6 +24,7 @@ public:
     Vec2D top;      // topmost point of the particle
     Vec2D bottom;   // bottommost point of the particle
     float height;   // height of the particle from the ground (as measured from bottom of window to bottom of particle: height = 600 - bottom.y)
+    int wallHits = 0;   // walls hit on the last update (a bitmask of the WALL_* flags below)
 
     /* Particle image */
     sf::CircleShape image;
@@ -56,6 +59,7 @@ public:
     /* Particle methods */
     void draw(sf::RenderWindow& window);
     void update(float dt);
+    void update(float dt, bool report);
     
     float distanceTo(Particle2D& particle);
     bool overlapping(Particle2D& particle);
@@ -63,7 +67,10 @@ public:
     /* Collision methods */
     Vec2D rotate(Vec2D velocity, float angle);      // Collision helper method
     void resolveCollision(Particle2D& particle);
-    void handleWallCollisions();
+    void handleWallCollisions(bool report = true);
+    void printWallHits();
+
+    enum { WALL_BOTTOM = 1, WALL_TOP = 2, WALL_LEFT = 4, WALL_RIGHT = 8 };
     void handleParticleCollision();
 
 
@@ -263,6 +270,8 @@ Vec2D Particle2D::rotate(Vec2D velocity, float angle)
 
 // Swaps out two colliding particle's x and y velocities
 // after running through an elastic collision reaction equation.
+// The exchange happens along the unit normal between the two centers, so no rotations (or trig) are needed;
+// this gives the same result as rotating into the collision frame and back.
 //  @param particle: The particle this is colliding with.
 void Particle2D::resolveCollision(Particle2D& particle)
 {
@@ -276,24 +285,21 @@ void Particle2D::resolveCollision(Particle2D& particle)
     // std::cout << std::endl << std::endl << "Collision!" << std::endl << std::endl;
     // Prevent accidental overlap of particles
     if (dvx * dx + dvy * dy >= 0) {
-        // Get the angle between the two colliding particles
-        float angle = -atan2(particle.state.position.y - state.position.y, particle.state.position.x - state.position.x);
+        // Unit normal pointing from this particle to the other (the x-axis of the collision frame)
+        float distance = sqrt(dx * dx + dy * dy);
+        Vec2D n = (distance > 0.0f) ? Vec2D(dx / distance, dy / distance) : Vec2D(1.0f, 0.0f);
         // Store masses of the two particles
         float m1 = mass;
         float m2 = particle.mass;
-        // Velocity before collision
-        Vec2D u1 = rotate(state.velocity, angle);
-        Vec2D u2 = rotate(particle.state.velocity, angle);
-        // Velocity after collision
-        Vec2D v1 = Vec2D( (u1.x * (m1 - m2) / (m1 + m2)) + (u2.x * 2 * m2 / (m1 + m2)), u1.y );
-        // Vec2D v2 = Vec2D( (u2.x * (m1 - m2) / (m1 + m2)) + (u1.x * 2 * m2 / (m1 + m2)), u2.y );
-        Vec2D v2 = Vec2D( (u2.x * (m2 - m1) / (m1 + m2)) + (u1.x * 2 * m1 / (m1 + m2)), u2.y );
-        // Rotate the velocities back to their original positions
-        Vec2D v1final = rotate(v1, -angle) * restitution;
-        Vec2D v2final = rotate(v2, -angle) * restitution;
+        // Normal components of the velocities before collision
+        float u1 = state.velocity.dot(n);
+        float u2 = particle.state.velocity.dot(n);
+        // Normal components after collision (the tangential components don't change)
+        float v1 = (u1 * (m1 - m2) + u2 * 2 * m2) / (m1 + m2);
+        float v2 = (u2 * (m2 - m1) + u1 * 2 * m1) / (m1 + m2);
         // Swap the velocities
-        state.velocity = v1final;
-        particle.state.velocity = v2final;
+        state.velocity = (state.velocity + n * (v1 - u1)) * restitution;
+        particle.state.velocity = (particle.state.velocity + n * (v2 - u2)) * restitution;
     }
     }
     // Calculate the angle of collision
@@ -303,44 +309,66 @@ void Particle2D::resolveCollision(Particle2D& particle)
 
 
 
-/* Method for reacting to walls */
-void Particle2D::handleWallCollisions()
+/* Method for reacting to walls (each wall hit is noted in wallHits, and printed right away if report is true) */
+void Particle2D::handleWallCollisions(bool report)
 {
+    wallHits = 0;
     if (state.position.y > (600.0f - diameter)) {
-        std::cout << "Collision with bottom wall! Object diameter = " << diameter << std::endl;
+        wallHits |= WALL_BOTTOM;
+        if (report) std::cout << "Collision with bottom wall! Object diameter = " << diameter << std::endl;
         state.position.y = 600.0f - diameter - 0.1f;
         height = 600 - state.position.y - diameter;
         state.velocity.y = -state.velocity.y;
     }
     if (state.position.y < 0.0f) {
-        std::cout << "Collision with top wall! Object diameter = " << diameter << std::endl;
+        wallHits |= WALL_TOP;
+        if (report) std::cout << "Collision with top wall! Object diameter = " << diameter << std::endl;
         state.position.y = 0.1f;
         height = 600 - state.position.y - diameter;
         state.velocity.y = -state.velocity.y;
     }
     if (left.x < 0.0f) {
-        std::cout << "Collision with left wall! Object diameter = " << diameter << std::endl;
+        wallHits |= WALL_LEFT;
+        if (report) std::cout << "Collision with left wall! Object diameter = " << diameter << std::endl;
         state.position.x = 0.1f;
         state.velocity.x = -state.velocity.x;
     }
     if (right.x > 800.0f) {
-        std::cout << "Collision with right wall! Object diameter = " << diameter << std::endl;
+        wallHits |= WALL_RIGHT;
+        if (report) std::cout << "Collision with right wall! Object diameter = " << diameter << std::endl;
         state.position.x = 799.9f - diameter;
         state.velocity.x = -state.velocity.x;
     }
 }
 
 
+/* Prints the wall collisions from the last update, as handleWallCollisions() does when reporting them right away */
+void Particle2D::printWallHits()
+{
+    if (wallHits & WALL_BOTTOM) std::cout << "Collision with bottom wall! Object diameter = " << diameter << std::endl;
+    if (wallHits & WALL_TOP)    std::cout << "Collision with top wall! Object diameter = " << diameter << std::endl;
+    if (wallHits & WALL_LEFT)   std::cout << "Collision with left wall! Object diameter = " << diameter << std::endl;
+    if (wallHits & WALL_RIGHT)  std::cout << "Collision with right wall! Object diameter = " << diameter << std::endl;
+}
+
+
 
 
 /* Particle update method */
 void Particle2D::update(float dt)
+{
+    update(dt, true);
+}
+
+
+/* Particle update method, with the wall collision messages left for printWallHits() if report is false (so it prints nothing) */
+void Particle2D::update(float dt, bool report)
 {
     // Update the state
     state.position += state.velocity * dt;
     height = 600.0f - state.position.y - diameter;
 
-    handleWallCollisions();
+    handleWallCollisions(report);
 
     state.velocity += state.acceleration * dt;
     state.momentum = mass * state.velocity;
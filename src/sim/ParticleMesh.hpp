@@ -0,0 +1,464 @@
+/********************
+*
+*    ParticleMesh.hpp
+*
+*    Defines the ParticleMesh class, which works out the net Coulomb force and potential on every one of N charges
+*    from a grid (P3M): the smooth long-range part by FFT convolution on the grid, and the short-range rest pair by pair.
+*
+*********************/
+
+#pragma once
+#include <cmath>
+#include <atomic>
+#include <vector>
+#include <complex>
+#include <algorithm>
+#include <functional>
+#include "Vec2D.hpp"
+#include "ThreadPool.hpp"
+#include "VerletList.hpp"
+
+
+
+
+
+/*  Particle-particle particle-mesh (P3M) solver for the Coulomb force between every pair of charges.
+ *  1/r is split into erf(a r) / r, which is smooth and goes to the grid, and erfc(a r) / r, which dies off within
+ *  `cutoff` (a = 3 / cutoff, so erfc(a cutoff) = 2e-5) and is summed directly over the pairs in a VerletList
+ *  (with a skin of cutoff / 8, so while the charges move less than cutoff / 16 between Solves, the pairs aren't searched again).
+ *  Build deposits the charges onto the grid's nodes with cloud-in-cell (bilinear) weights. Solve convolves them with
+ *  erf(a r) / r by FFT, on a grid padded to twice the size so the charges don't see periodic images of each other,
+ *  takes the field at the nodes by central differences, interpolates it back to the charges with the same weights,
+ *  and adds the short-range pairs. Each charge's own share of the grid potential is taken back off.
+ *  The force law is 1/r^2 between charges in the plane (as in ChargedParticle::CoulombForce), whose potential isn't the
+ *  solution of the 2D Poisson equation (that would be log r), so the grid is convolved with the kernel itself rather than
+ *  dividing by k^2. The FFTs are radix-2, two real rows at a time in one complex transform, with the rows and columns split
+ *  across a ThreadPool. The grid potential is kept, so it can be drawn or sampled (PotentialAt) at no extra cost.
+ *  The error comes from spreading the charges over their cells, so it goes as (cell / cutoff)^2: with a cutoff of 4, 6 and 8
+ *  cells the force error is about 7e-3, 2e-3 and 1e-3 rms. A finer grid costs FFT time, a longer cutoff costs pairs.
+ *  The forces follow ChargedParticle::CoulombForce (like charges repel, with k = 8.987551787e9), between particle centers.  */
+class ParticleMesh
+{
+public:
+    float cell;                         // Grid spacing.
+    float cutoff;                       // Pairs closer than this get the short-range part summed directly.
+    float softening;                    // Added to the squared distances of the short-range pairs.
+
+    std::vector<Vec2D> forces;          // Net Coulomb force on each charge, from the last Solve.
+    std::vector<float> potentials;      // Electric potential at each charge due to all the others (its potential energy is charge * potential).
+
+    int grid_x, grid_y;                 // Nodes along each side of the grid (powers of two).
+    Vec2D origin;                       // Position of node (0, 0); node (i, j) sits at origin + cell * (i, j).
+    std::vector<float> grid_potential;  // Long-range potential at each node (row by row), from the last Solve.
+
+    /*  Size of the last grid built, and the work done by the last Solve.  */
+    struct Stats
+    {
+        int grid_x = 0, grid_y = 0;
+        long long pair_terms = 0;       // Short-range pairs within the cutoff.
+    };
+    Stats stats;
+
+
+    ParticleMesh(float cell = 16.0f, float cutoff = 64.0f, float softening = 0.0f)
+        : cell(cell), cutoff(cutoff), softening(softening), grid_x(0), grid_y(0), padded_x(0), padded_y(0), green_cutoff(0.0f), green_cell(0.0f) { }
+
+    void Build(const std::vector<Vec2D>& centers, const std::vector<float>& charges);
+    void Solve(ThreadPool* pool = nullptr);
+    template <typename P>
+    void Solve(const std::vector<P>& particles, ThreadPool* pool = nullptr);
+    float PotentialEnergy() const;
+    float PotentialAt(Vec2D point) const;
+
+    void Draw(sf::RenderWindow& window, sf::Uint8 alpha = 128);
+
+
+private:
+    typedef std::complex<double> Complex;
+
+    int padded_x, padded_y;             // Size of the padded grid the FFTs run on.
+    std::vector<Vec2D> centers;
+    std::vector<float> charges;
+    std::vector<int> node;              // Lower-left node of each charge's cell (as iy * grid_x + ix),
+    std::vector<float> tx, ty;          // and its offset within the cell, as a fraction of the cell.
+    std::vector<double> rho;            // Charge at each node of the padded grid.
+    std::vector<double> phi;            // Long-range potential (without k) at each node, padded_x to a row.
+    std::vector<Complex> spectrum;      // Half spectrum of the padded grid: padded_y rows of padded_x / 2 + 1.
+    std::vector<double> green;          // Half spectrum of erf(a r) / r on the padded grid (real, since the kernel is even).
+    float green_cutoff, green_cell;     // What `green` was worked out for.
+    double self[3][3];                  // erf(a r) / r between nodes (dx, dy) cells apart, for taking off the charges' own share.
+    std::vector<Complex> twiddle;       // exp(-2 pi i k / N) for the largest N.
+    std::vector<float> field_x, field_y;
+    VerletList neighbours;              // Pairs within the cutoff.
+    std::vector<sf::Vertex> vertices;   // Drawn by Draw.
+
+    double Alpha() const { return 3.0 / cutoff; }
+    static double LongRange(double r, double alpha);
+
+    void FFT(Complex* a, int n, bool inverse) const;
+    void Forward(const double* grid, int rows, ThreadPool* pool);
+    void Inverse(double* grid, int rows, ThreadPool* pool);
+    void Columns(bool inverse, ThreadPool* pool);
+    void Green(ThreadPool* pool);
+};
+
+
+
+
+
+
+/*  Returns erf(a r) / r, which is 2 a / sqrt(pi) at r = 0.  */
+double ParticleMesh::LongRange(double r, double alpha)
+{
+    return r > 0.0 ? std::erf(alpha * r) / r : 2.0 * alpha / std::sqrt(3.14159265358979);
+}
+
+
+/*  Sizes the grid to the charges' bounding box, and deposits them onto its nodes.
+ *  @param centers: Position of each charge (the particles' centers).
+ *  @param charges: Charge of each one.  */
+void ParticleMesh::Build(const std::vector<Vec2D>& centers, const std::vector<float>& charges)
+{
+    const int n = (int)centers.size();
+    this->centers.assign(centers.begin(), centers.end());
+    this->charges.assign(charges.begin(), charges.begin() + n);
+
+    // One spare node on every side, so the central differences never run off the grid
+    float min_x = n ? centers[0].x : 0.0f, max_x = min_x;
+    float min_y = n ? centers[0].y : 0.0f, max_y = min_y;
+    for (int i = 0; i < n; i++)
+    {
+        min_x = std::min(min_x, centers[i].x);  max_x = std::max(max_x, centers[i].x);
+        min_y = std::min(min_y, centers[i].y);  max_y = std::max(max_y, centers[i].y);
+    }
+    origin = Vec2D(min_x - cell, min_y - cell);
+    grid_x = grid_y = 4;
+    while (grid_x < (max_x - min_x) / cell + 4) grid_x *= 2;
+    while (grid_y < (max_y - min_y) / cell + 4) grid_y *= 2;
+    stats = Stats();
+    stats.grid_x = grid_x;
+    stats.grid_y = grid_y;
+
+    if (padded_x != 2 * grid_x || padded_y != 2 * grid_y)
+    {
+        padded_x = 2 * grid_x;
+        padded_y = 2 * grid_y;
+        green.clear();
+        const int largest = std::max(padded_x, padded_y);
+        twiddle.resize(largest / 2);
+        for (int k = 0; k < largest / 2; k++)
+            twiddle[k] = std::polar(1.0, -2.0 * 3.14159265358979 * k / largest);
+    }
+
+    // Cloud-in-cell: each charge is shared between the four nodes of its cell, by area
+    rho.assign((size_t)padded_x * padded_y, 0.0);
+    node.resize(n); tx.resize(n); ty.resize(n);
+    for (int i = 0; i < n; i++)
+    {
+        const float fx = (centers[i].x - origin.x) / cell, fy = (centers[i].y - origin.y) / cell;
+        const int ix = std::min(grid_x - 3, (int)fx), iy = std::min(grid_y - 3, (int)fy);
+        node[i] = iy * grid_x + ix;
+        tx[i] = fx - ix;
+        ty[i] = fy - iy;
+        double* r = &rho[(size_t)iy * padded_x + ix];
+        r[0] += charges[i] * (1.0 - tx[i]) * (1.0 - ty[i]);
+        r[1] += charges[i] * tx[i] * (1.0 - ty[i]);
+        r[padded_x] += charges[i] * (1.0 - tx[i]) * ty[i];
+        r[padded_x + 1] += charges[i] * tx[i] * ty[i];
+    }
+}
+
+
+/*  In-place radix-2 FFT of a[0, n), n a power of two no bigger than the padded grid (unscaled in both directions).  */
+void ParticleMesh::FFT(Complex* a, int n, bool inverse) const
+{
+    for (int i = 1, j = 0; i < n; i++)
+    {
+        int bit = n >> 1;
+        for (; j & bit; bit >>= 1) j ^= bit;
+        j ^= bit;
+        if (i < j) std::swap(a[i], a[j]);
+    }
+    const int largest = 2 * (int)twiddle.size();
+    for (int length = 2; length <= n; length <<= 1)
+    {
+        const int step = largest / length;
+        for (int i = 0; i < n; i += length)
+            for (int k = 0; k < length / 2; k++)
+            {
+                const Complex w = inverse ? std::conj(twiddle[k * step]) : twiddle[k * step];
+                const Complex u = a[i + k], v = a[i + k + length / 2] * w;
+                a[i + k] = u + v;
+                a[i + k + length / 2] = u - v;
+            }
+    }
+}
+
+
+/*  Transforms the first `rows` rows of a padded grid along x, two real rows per complex FFT, into the half spectrum
+ *  (the rows after them are taken to be zero).  */
+void ParticleMesh::Forward(const double* grid, int rows, ThreadPool* pool)
+{
+    const int half = padded_x / 2 + 1;
+    spectrum.assign((size_t)padded_y * half, Complex(0.0, 0.0));
+    auto body = [&](int begin, int end) {
+        std::vector<Complex> z(padded_x);
+        for (int p = begin; p < end; p++)
+        {
+            const double* a = grid + (size_t)(2 * p) * padded_x;
+            const double* b = a + padded_x;
+            for (int x = 0; x < padded_x; x++)
+                z[x] = Complex(a[x], b[x]);
+            FFT(z.data(), padded_x, false);
+            // Untangle the two rows: A_k = (Z_k + conj(Z_-k)) / 2, B_k = (Z_k - conj(Z_-k)) / 2i
+            Complex* sa = &spectrum[(size_t)(2 * p) * half];
+            Complex* sb = sa + half;
+            for (int k = 0; k < half; k++)
+            {
+                const Complex zk = z[k], zm = std::conj(z[(padded_x - k) & (padded_x - 1)]);
+                sa[k] = 0.5 * (zk + zm);
+                sb[k] = Complex(0.0, -0.5) * (zk - zm);
+            }
+        }
+    };
+    if (pool) pool->ParallelFor(0, rows / 2, body, 8);
+    else body(0, rows / 2);
+}
+
+
+/*  Transforms the half spectrum back along x, two rows per complex FFT, into the first `rows` rows of a padded grid
+ *  (scaled by 1 / size).  */
+void ParticleMesh::Inverse(double* grid, int rows, ThreadPool* pool)
+{
+    const int half = padded_x / 2 + 1;
+    const double scale = 1.0 / ((double)padded_x * padded_y);
+    auto body = [&](int begin, int end) {
+        std::vector<Complex> z(padded_x);
+        for (int p = begin; p < end; p++)
+        {
+            const Complex* sa = &spectrum[(size_t)(2 * p) * half];
+            const Complex* sb = sa + half;
+            // Z_k = A_k + i B_k, with the upper half from A_-k = conj(A_k)
+            for (int k = 0; k < half; k++)
+                z[k] = sa[k] + Complex(0.0, 1.0) * sb[k];
+            for (int k = half; k < padded_x; k++)
+                z[k] = std::conj(sa[padded_x - k]) + Complex(0.0, 1.0) * std::conj(sb[padded_x - k]);
+            FFT(z.data(), padded_x, true);
+            double* a = grid + (size_t)(2 * p) * padded_x;
+            double* b = a + padded_x;
+            for (int x = 0; x < padded_x; x++) {
+                a[x] = z[x].real() * scale;
+                b[x] = z[x].imag() * scale;
+            }
+        }
+    };
+    if (pool) pool->ParallelFor(0, rows / 2, body, 8);
+    else body(0, rows / 2);
+}
+
+
+/*  Transforms every column of the half spectrum along y.  */
+void ParticleMesh::Columns(bool inverse, ThreadPool* pool)
+{
+    const int half = padded_x / 2 + 1;
+    auto body = [&](int begin, int end) {
+        std::vector<Complex> z(padded_y);
+        for (int k = begin; k < end; k++)
+        {
+            for (int y = 0; y < padded_y; y++)  z[y] = spectrum[(size_t)y * half + k];
+            FFT(z.data(), padded_y, inverse);
+            for (int y = 0; y < padded_y; y++)  spectrum[(size_t)y * half + k] = z[y];
+        }
+    };
+    if (pool) pool->ParallelFor(0, half, body, 8);
+    else body(0, half);
+}
+
+
+/*  Works out the spectrum of erf(a r) / r on the padded grid (offsets past half the grid wrap round to negative ones),
+ *  and the kernel between nearby nodes. Only redone when the grid, spacing or cutoff change.  */
+void ParticleMesh::Green(ThreadPool* pool)
+{
+    const double alpha = Alpha();
+    if (!green.empty() && green_cutoff == cutoff && green_cell == cell) return;
+
+    std::vector<double> kernel((size_t)padded_x * padded_y);
+    for (int y = 0; y < padded_y; y++)
+        for (int x = 0; x < padded_x; x++)
+        {
+            const double dx = (x < grid_x ? x : x - padded_x) * (double)cell;
+            const double dy = (y < grid_y ? y : y - padded_y) * (double)cell;
+            kernel[(size_t)y * padded_x + x] = LongRange(std::sqrt(dx * dx + dy * dy), alpha);
+        }
+    Forward(kernel.data(), padded_y, pool);
+    Columns(false, pool);
+    green.resize(spectrum.size());
+    for (size_t k = 0; k < spectrum.size(); k++)
+        green[k] = spectrum[k].real();
+
+    for (int dy = -1; dy <= 1; dy++)
+        for (int dx = -1; dx <= 1; dx++)
+            self[dy + 1][dx + 1] = LongRange(std::sqrt((double)(dx * dx + dy * dy)) * cell, alpha);
+    green_cutoff = cutoff;
+    green_cell = cell;
+}
+
+
+/*  Works out the force on and potential at every charge deposited by the last Build.
+ *  @param pool: Threads to split the FFTs' rows and columns, and the charges, across (the calling thread does it all if null).  */
+void ParticleMesh::Solve(ThreadPool* pool)
+{
+    const int n = (int)centers.size();
+    forces.resize(n);
+    potentials.resize(n);
+    auto run = [&](int count, int grain, const std::function<void(int, int)>& body) {
+        if (pool) pool->ParallelFor(0, count, body, grain);
+        else body(0, count);
+    };
+
+    // Long range: convolve the charges with erf(a r) / r (only the charges' quarter of the padded grid is nonzero, or needed)
+    Green(pool);
+    Forward(rho.data(), grid_y, pool);
+    Columns(false, pool);
+    for (size_t k = 0; k < spectrum.size(); k++)
+        spectrum[k] *= green[k];
+    Columns(true, pool);
+    phi.resize((size_t)padded_x * grid_y);
+    Inverse(phi.data(), grid_y, pool);
+
+    grid_potential.resize((size_t)grid_x * grid_y);
+    field_x.assign(grid_potential.size(), 0.0f);
+    field_y.assign(grid_potential.size(), 0.0f);
+    run(grid_y, 16, [&](int begin, int end) {
+        for (int y = begin; y < end; y++)
+            for (int x = 0; x < grid_x; x++)
+            {
+                const double* p = &phi[(size_t)y * padded_x + x];
+                grid_potential[(size_t)y * grid_x + x] = (float)(8.987551787e9 * p[0]);
+                if (x == 0 || y == 0 || x == grid_x - 1 || y == grid_y - 1) continue;
+                field_x[(size_t)y * grid_x + x] = (float)(-(p[1] - p[-1]) / (2.0 * cell));
+                field_y[(size_t)y * grid_x + x] = (float)(-(p[padded_x] - p[-padded_x]) / (2.0 * cell));
+            }
+    });
+
+    // Back to the charges, with the same weights they were deposited with, less each charge's own share of the potential
+    run(n, 256, [&](int begin, int end) {
+        for (int i = begin; i < end; i++)
+        {
+            const float w[4] = { (1.0f - tx[i]) * (1.0f - ty[i]), tx[i] * (1.0f - ty[i]), (1.0f - tx[i]) * ty[i], tx[i] * ty[i] };
+            const int at[4] = { node[i], node[i] + 1, node[i] + grid_x, node[i] + grid_x + 1 };
+            const int dx[4] = { 0, 1, 0, 1 }, dy[4] = { 0, 0, 1, 1 };
+            double ex = 0.0, ey = 0.0, potential = 0.0, own = 0.0;
+            for (int a = 0; a < 4; a++)
+            {
+                ex += w[a] * field_x[at[a]];
+                ey += w[a] * field_y[at[a]];
+                potential += w[a] * phi[(size_t)(at[a] / grid_x) * padded_x + at[a] % grid_x];
+                for (int b = 0; b < 4; b++)
+                    own += w[a] * w[b] * self[dy[a] - dy[b] + 1][dx[a] - dx[b] + 1];
+            }
+            forces[i] = Vec2D((float)(8.987551787e9 * charges[i] * ex), (float)(8.987551787e9 * charges[i] * ey));
+            potentials[i] = (float)(8.987551787e9 * (potential - charges[i] * own));
+        }
+    });
+
+    // Short range: erfc(a r) / r over the pairs within the cutoff
+    const double alpha = Alpha();
+    std::vector<float> reach(n, 0.5f * cutoff);
+    neighbours.skin = 0.125f * cutoff;
+    const std::vector<std::pair<int,int>>& pairs = neighbours.FindPairs(centers, reach);
+    const float cutoff2 = cutoff * cutoff;
+    for (auto& pair : pairs)
+    {
+        const int i = pair.first, j = pair.second;
+        const double dx = centers[i].x - centers[j].x, dy = centers[i].y - centers[j].y;
+        const double d2 = dx * dx + dy * dy;
+        if (d2 >= cutoff2) continue;
+        const double r2 = d2 + softening;
+        if (r2 == 0.0) continue;
+        const double r = std::sqrt(r2);
+        const double near = std::erfc(alpha * r) / r;
+        const double s = 8.987551787e9 * (near + 2.0 * alpha / std::sqrt(3.14159265358979) * std::exp(-alpha * alpha * r2)) / r2;
+        const double f = charges[i] * charges[j] * s;
+        forces[i] += Vec2D((float)(f * dx), (float)(f * dy));
+        forces[j] -= Vec2D((float)(f * dx), (float)(f * dy));
+        potentials[i] += (float)(8.987551787e9 * charges[j] * near);
+        potentials[j] += (float)(8.987551787e9 * charges[i] * near);
+        stats.pair_terms++;
+    }
+}
+
+
+/*  Deposits a vector of ChargedParticles (or anything with a center and a charge) and solves the grid.
+ *  forces[i] and charge * potentials[i] are then the net force on and potential energy of particles[i], e.g. for
+ *  ChargedParticle::UpdateUnderField(t, dt, force, potential_energy).
+ *  @param particles: The charges.
+ *  @param pool: Threads to split the work across (may be null).  */
+template <typename P>
+void ParticleMesh::Solve(const std::vector<P>& particles, ThreadPool* pool)
+{
+    std::vector<Vec2D> centers(particles.size());
+    std::vector<float> charges(particles.size());
+    for (size_t i = 0; i < particles.size(); i++)
+    {
+        centers[i] = particles[i].center;
+        charges[i] = particles[i].charge;
+    }
+    Build(centers, charges);
+    Solve(pool);
+}
+
+
+/*  Returns the total electric potential energy, half the sum of charge * potential (each pair is in two potentials).  */
+float ParticleMesh::PotentialEnergy() const
+{
+    double energy = 0.0;
+    for (size_t i = 0; i < potentials.size(); i++)
+        energy += 0.5 * charges[i] * potentials[i];
+    return (float)energy;
+}
+
+
+/*  Returns the long-range (smoothed) potential at a point, interpolated from the grid of the last Solve (0 off the grid).  */
+float ParticleMesh::PotentialAt(Vec2D point) const
+{
+    const float fx = (point.x - origin.x) / cell, fy = (point.y - origin.y) / cell;
+    if (grid_potential.empty() || fx < 0.0f || fy < 0.0f || fx >= grid_x - 1 || fy >= grid_y - 1) return 0.0f;
+    const int ix = (int)fx, iy = (int)fy;
+    const float u = fx - ix, v = fy - iy;
+    const float* p = &grid_potential[(size_t)iy * grid_x + ix];
+    return (1.0f - u) * (1.0f - v) * p[0] + u * (1.0f - v) * p[1] + (1.0f - u) * v * p[grid_x] + u * v * p[grid_x + 1];
+}
+
+
+/*  Draws the grid potential from the last Solve under the particles: blue where it's positive and red where it's negative
+ *  (as ChargedParticle colors its charges), brightest at the largest magnitude on the grid, blended between the nodes.
+ *  @param window: The window to draw to.
+ *  @param alpha: Opacity of the brightest parts.  */
+void ParticleMesh::Draw(sf::RenderWindow& window, sf::Uint8 alpha)
+{
+    if (grid_potential.empty()) return;
+    float largest = 0.0f;
+    for (float phi : grid_potential)
+        largest = std::max(largest, std::fabs(phi));
+    if (largest == 0.0f) return;
+
+    auto color = [&](int x, int y) {
+        const float v = grid_potential[(size_t)y * grid_x + x] / largest;
+        const sf::Uint8 level = (sf::Uint8)(255.0f * std::fabs(v));
+        return v > 0.0f ? sf::Color(0, 0, level, alpha) : sf::Color(level, 0, 0, alpha);
+    };
+    vertices.resize((size_t)(grid_x - 1) * (grid_y - 1) * 6);
+    sf::Vertex* v = vertices.data();
+    for (int y = 0; y + 1 < grid_y; y++)
+        for (int x = 0; x + 1 < grid_x; x++)
+        {
+            const int corner_x[6] = { x, x + 1, x + 1, x, x + 1, x }, corner_y[6] = { y, y, y + 1, y, y + 1, y + 1 };
+            for (int c = 0; c < 6; c++, v++)
+            {
+                v->position = sf::Vector2f(origin.x + corner_x[c] * cell, origin.y + corner_y[c] * cell);
+                v->color = color(corner_x[c], corner_y[c]);
+            }
+        }
+    window.draw(vertices.data(), vertices.size(), sf::Triangles);
+}
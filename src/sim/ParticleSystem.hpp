@@ -0,0 +1,415 @@
+/********************
+*
+*    ParticleSystem.hpp
+*
+*    Defines the ParticleSystem class, a structure-of-arrays store for the balls
+*    of the Particle2D world, and ParticleView, which lets one of its particles be printed and drawn like a Particle2D.
+*
+*********************/
+
+#pragma once
+#include <new>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <iostream>
+#include <algorithm>
+#include "Particle2D.hpp"   // includes:  <string> and "Vec2D.hpp"
+#include "Narrowphase.hpp"
+
+
+
+
+
+/*  Allocator handing out memory aligned to `Alignment` bytes (a cache line by default), so SIMD loops
+ *  over the arrays start on an aligned boundary.  */
+template <typename T, size_t Alignment = 64>
+struct AlignedAllocator
+{
+    using value_type = T;
+    template <typename U> struct rebind { using other = AlignedAllocator<U, Alignment>; };
+
+    AlignedAllocator() = default;
+    template <typename U> AlignedAllocator(const AlignedAllocator<U, Alignment>&) { }
+
+    T* allocate(size_t n) { return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(Alignment))); }
+    void deallocate(T* p, size_t) { ::operator delete(p, std::align_val_t(Alignment)); }
+
+    template <typename U> bool operator==(const AlignedAllocator<U, Alignment>&) const { return true; }
+    template <typename U> bool operator!=(const AlignedAllocator<U, Alignment>&) const { return false; }
+};
+
+template <typename T>
+using AlignedVector = std::vector<T, AlignedAllocator<T>>;
+
+
+
+
+class ParticleView;
+
+
+/*  Structure-of-arrays store for the balls of the Particle2D world.
+ *  The fields the physics loops touch every frame (position, velocity, mass, radius, restitution) live in their
+ *  own contiguous, cache-line aligned arrays, so the integrate and collide loops stream through memory.
+ *  Names, colors and the shapes used for drawing live in separate cold arrays; the shapes are only created
+ *  the first time the system is drawn, so a system that's never drawn never allocates them.
+ *  Particles are referred to by index (the order they were added in). As in Particle2D, positions are
+ *  top-left corners, and the RK4 update and collision response give the same results as Particle2D's.  */
+class ParticleSystem
+{
+public:
+    /* Hot data, one entry per particle */
+    AlignedVector<float> x, y;              // Position (top-left corner).
+    AlignedVector<float> vx, vy;            // Velocity.
+    AlignedVector<float> mass;
+    AlignedVector<float> inv_mass;          // 1 / mass.
+    AlignedVector<float> radius;
+    AlignedVector<float> restitution;
+
+    /* Cold data */
+    std::vector<std::string> names;
+    std::vector<sf::Color> colors;
+
+    float width;                            // Right wall of the box.
+    float height;                           // Floor of the box.
+
+
+    ParticleSystem() : width(800.0f), height(600.0f) { }
+    ParticleSystem(float width, float height) : width(width), height(height) { }
+
+    int Size() const { return (int)x.size(); }
+    void Reserve(int n);
+    void Clear();
+
+    int Add(std::string name, float mass, float radius, sf::Color color, Vec2D position, Vec2D velocity, float restitution);
+    int Add(const Particle2D& particle);
+    void Remove(int i);
+
+    Vec2D Position(int i) const { return Vec2D(x[i], y[i]); }
+    Vec2D Velocity(int i) const { return Vec2D(vx[i], vy[i]); }
+    Vec2D Center(int i) const { return Vec2D(x[i] + radius[i], y[i] + radius[i]); }
+    ParticleView operator[](int i);
+
+    void Bounds(std::vector<Vec2D>& centers, std::vector<float>& radii) const;
+    void UpdateRK(float dt);
+    void UpdateRK(float dt, int begin, int end);
+    int ResolveWalls(Vec2D gravity = g);
+    template <typename Broadphase>
+    void ResolveCollisions(Broadphase& broadphase, BatchNarrowphase& narrowphase);
+    float TotalEnergy() const;
+    float TotalEnergy(int begin, int end) const;
+    void Draw(sf::RenderWindow& window);
+
+
+private:
+    std::vector<sf::CircleShape> images;    // Created on the first call to Draw.
+
+    friend class ParticleView;
+};
+
+
+
+
+/*  A reference to one particle of a ParticleSystem that prints and draws the way a Particle2D does,
+ *  so the printing and drawing helpers in Utils.hpp work on either.
+ *  Only valid until particles are added to or removed from the system.  */
+class ParticleView
+{
+public:
+    ParticleSystem& system;
+    int index;
+
+    ParticleView(ParticleSystem& system, int index) : system(system), index(index) { }
+
+    const std::string& Name() const { return system.names[index]; }
+    float Mass() const { return system.mass[index]; }
+    float Radius() const { return system.radius[index]; }
+    Vec2D Center() const { return system.Center(index); }
+    Particle2D::State State() const;
+
+    void draw(sf::RenderWindow& window);
+
+
+private:
+    /* Overloaded << for printing particle information (same format as Particle2D) */
+    friend std::ostream& operator<<(std::ostream& os, const ParticleView& p)
+    {
+        os << std::endl << std::endl;
+        os << "Particle2D \"" << p.Name() << "\":" << std::endl;
+        os << "------------"; for (size_t i = 0; i < p.Name().length()+2; i++) os << "-"; os << std::endl;
+        os << "   > Mass: " << p.Mass() << std::endl;
+        os << "   > Radius: " << p.Radius() << std::endl;
+        os << "   > Center: " << p.Center() << std::endl;
+        return os;
+    }
+};
+
+
+
+
+
+
+/*  Reserves room for n particles in every array.  */
+void ParticleSystem::Reserve(int n)
+{
+    x.reserve(n); y.reserve(n);
+    vx.reserve(n); vy.reserve(n);
+    mass.reserve(n); inv_mass.reserve(n);
+    radius.reserve(n); restitution.reserve(n);
+    names.reserve(n); colors.reserve(n);
+}
+
+
+/*  Removes every particle.  */
+void ParticleSystem::Clear()
+{
+    x.clear(); y.clear();
+    vx.clear(); vy.clear();
+    mass.clear(); inv_mass.clear();
+    radius.clear(); restitution.clear();
+    names.clear(); colors.clear();
+    images.clear();
+}
+
+
+/*  Adds a particle and returns its index.
+ *  @param name: The particle's name.
+ *  @param mass: The particle's mass.
+ *  @param radius: The particle's radius.
+ *  @param color: The color it's drawn in.
+ *  @param position: The particle's top-left corner.
+ *  @param velocity: The particle's velocity.
+ *  @param restitution: The particle's restitution.  */
+int ParticleSystem::Add(std::string name, float mass, float radius, sf::Color color, Vec2D position, Vec2D velocity, float restitution)
+{
+    x.push_back(position.x); y.push_back(position.y);
+    vx.push_back(velocity.x); vy.push_back(velocity.y);
+    this->mass.push_back(mass); inv_mass.push_back(1.0f / mass);
+    this->radius.push_back(radius); this->restitution.push_back(restitution);
+    names.push_back(std::move(name)); colors.push_back(color);
+    images.clear();
+    return Size() - 1;
+}
+
+
+/*  Adds a copy of a Particle2D and returns its index.  */
+int ParticleSystem::Add(const Particle2D& particle)
+{
+    return Add(particle.name, particle.mass, particle.radius, particle.color, particle.state.position, particle.state.velocity, particle.restitution);
+}
+
+
+/*  Removes particle i by moving the last particle into its place (so the last particle's index becomes i).  */
+void ParticleSystem::Remove(int i)
+{
+    const int last = Size() - 1;
+    x[i] = x[last]; y[i] = y[last];
+    vx[i] = vx[last]; vy[i] = vy[last];
+    mass[i] = mass[last]; inv_mass[i] = inv_mass[last];
+    radius[i] = radius[last]; restitution[i] = restitution[last];
+    names[i] = std::move(names[last]); colors[i] = colors[last];
+    x.pop_back(); y.pop_back();
+    vx.pop_back(); vy.pop_back();
+    mass.pop_back(); inv_mass.pop_back();
+    radius.pop_back(); restitution.pop_back();
+    names.pop_back(); colors.pop_back();
+    images.clear();
+}
+
+
+/*  Returns a view of particle i for printing and drawing.  */
+ParticleView ParticleSystem::operator[](int i)
+{
+    return ParticleView(*this, i);
+}
+
+
+/*  Fills the given vectors with each particle's center and radius, for handing to a broadphase.  */
+void ParticleSystem::Bounds(std::vector<Vec2D>& centers, std::vector<float>& radii) const
+{
+    const int n = Size();
+    centers.resize(n);
+    radii.assign(radius.begin(), radius.end());
+    for (int i = 0; i < n; i++)
+        centers[i] = Center(i);
+}
+
+
+/*  Advances every particle by dt under gravity with the same RK4 step and wall handling as updateRK() in Utils.hpp,
+ *  in one pass over the arrays. The intermediate derivatives are worked out in closed form (gravity is constant),
+ *  in the same order of operations, so the results match the Particle2D version exactly.
+ *  @param dt: The time step.  */
+void ParticleSystem::UpdateRK(float dt)
+{
+    UpdateRK(dt, 0, Size());
+}
+
+
+/*  Same as above, for particles [begin, end) only (each particle's step only touches its own entries,
+ *  so disjoint ranges can run on different threads).
+ *  @param dt: The time step.
+ *  @param begin, end: The range of particles to advance.  */
+void ParticleSystem::UpdateRK(float dt, int begin, int end)
+{
+    const float h = dt * 0.5f;
+    const float w = 1.0f / 6.0f;
+
+    // The velocity derivative is g at every sample point
+    const float dvx = w * ((g.x + 2.0f * (g.x + g.x)) + g.x);
+    const float dvy = w * ((g.y + 2.0f * (g.y + g.y)) + g.y);
+
+    float* __restrict px = x.data();
+    float* __restrict py = y.data();
+    float* __restrict pvx = vx.data();
+    float* __restrict pvy = vy.data();
+    const float* __restrict r = radius.data();
+
+    for (int i = begin; i < end; i++)
+    {
+        const float diameter = r[i] * 2.0f;
+        const float old_x = px[i];
+
+        // Position derivative at the four sample points: v, v - g dt/2, v - g dt/2, v - g dt (as evaluate() works it out)
+        const float ax = pvx[i], bx = pvx[i] - g.x * h, dx = pvx[i] - g.x * dt;
+        const float ay = pvy[i], by = pvy[i] - g.y * h, dy = pvy[i] - g.y * dt;
+        px[i] = px[i] + w * ((ax + 2.0f * (bx + bx)) + dx) * dt;
+        py[i] = py[i] + w * ((ay + 2.0f * (by + by)) + dy) * dt;
+
+        // Floor and ceiling use the new position; the side walls use last frame's edges, as in integrate()
+        if (py[i] > (height - diameter)) {
+            py[i] = height - diameter - 0.1f;
+            pvy[i] = -pvy[i];
+        }
+        if (py[i] < 0.0f) {
+            py[i] = 0.1f;
+            pvy[i] = -pvy[i];
+        }
+        if (old_x < 0.0f) {
+            px[i] = 0.1f;
+            pvx[i] = -pvx[i];
+        }
+        if (old_x + diameter > width) {
+            px[i] = (width - 0.1f) - diameter;
+            pvx[i] = -pvx[i];
+        }
+
+        pvx[i] = pvx[i] + dvx * dt;
+        pvy[i] = pvy[i] + dvy * dt;
+    }
+}
+
+
+/*  Bounces every particle that has crossed a wall back into the box, for the schemes in Integrators.hpp.
+ *  A particle that's gone a distance p past a wall is mirrored to p inside it, and its speed along the wall's normal
+ *  is set to what it would be there had it bounced off the wall elastically under `gravity`, so no energy is gained or lost.
+ *  (UpdateRK instead places the particle just inside the wall and flips its velocity, as Particle2D does.)
+ *  Returns the number of particles it moved.
+ *  @param gravity: The constant acceleration the particles are under (zero if there's none).  */
+int ParticleSystem::ResolveWalls(Vec2D gravity)
+{
+    int bounced = 0;
+    for (int i = 0; i < Size(); i++)
+    {
+        const float diameter = radius[i] * 2.0f;
+        const bool outside = y[i] > height - diameter || y[i] < 0.0f || x[i] < 0.0f || x[i] > width - diameter;
+        if (!outside) continue;
+        bounced++;
+        if (y[i] > height - diameter) {
+            const float p = y[i] - (height - diameter);
+            y[i] = (height - diameter) - p;
+            vy[i] = -std::sqrt(std::max(0.0f, vy[i] * vy[i] - 4.0f * gravity.y * p));
+        }
+        if (y[i] < 0.0f) {
+            const float p = -y[i];
+            y[i] = p;
+            vy[i] = std::sqrt(std::max(0.0f, vy[i] * vy[i] + 4.0f * gravity.y * p));
+        }
+        if (x[i] < 0.0f) {
+            const float p = -x[i];
+            x[i] = p;
+            vx[i] = std::sqrt(std::max(0.0f, vx[i] * vx[i] + 4.0f * gravity.x * p));
+        }
+        if (x[i] > width - diameter) {
+            const float p = x[i] - (width - diameter);
+            x[i] = (width - diameter) - p;
+            vx[i] = -std::sqrt(std::max(0.0f, vx[i] * vx[i] - 4.0f * gravity.x * p));
+        }
+    }
+    return bounced;
+}
+
+
+/*  Asks a broadphase for candidate pairs and runs them through a BatchNarrowphase,
+ *  which reads and updates the velocity arrays in place (no copying in or out).  */
+template <typename Broadphase>
+void ParticleSystem::ResolveCollisions(Broadphase& broadphase, BatchNarrowphase& narrowphase)
+{
+    std::vector<Vec2D> centers;
+    std::vector<float> radii;
+    Bounds(centers, radii);
+    narrowphase.Resolve(broadphase.FindPairs(centers, radii), x.data(), y.data(), vx.data(), vy.data(),
+                        mass.data(), radius.data(), restitution.data(), true);
+}
+
+
+/*  Returns the total kinetic and potential energy of the system (height measured from the floor, as in Particle2D).  */
+float ParticleSystem::TotalEnergy() const
+{
+    return TotalEnergy(0, Size());
+}
+
+
+/*  Returns the total energy of particles [begin, end), summed in index order.  */
+float ParticleSystem::TotalEnergy(int begin, int end) const
+{
+    float energy = 0.0f;
+    for (int i = begin; i < end; i++)
+    {
+        const float speed2 = vx[i] * vx[i] + vy[i] * vy[i];
+        energy += (mass[i] / 2) * speed2 + mass[i] * g.y * (height - y[i] - radius[i] * 2.0f);
+    }
+    return energy;
+}
+
+
+/*  Draws every particle, creating the shapes on the first call.  */
+void ParticleSystem::Draw(sf::RenderWindow& window)
+{
+    for (int i = 0; i < Size(); i++)
+        (*this)[i].draw(window);
+}
+
+
+
+
+/*  Builds the particle's state the way Particle2D keeps it (acceleration is gravity).  */
+Particle2D::State ParticleView::State() const
+{
+    Particle2D::State state;
+    state.position = system.Position(index);
+    state.velocity = system.Velocity(index);
+    state.acceleration = g;
+    state.momentum = Mass() * state.velocity;
+    state.kineticEnergy = (Mass()/2) * (state.velocity.magnitude() * state.velocity.magnitude());
+    state.potentialEnergy = Mass() * g.y * (system.height - state.position.y - Radius() * 2.0f);
+    state.totalEnergy = state.kineticEnergy + state.potentialEnergy;
+    return state;
+}
+
+
+/*  Draws the particle, creating the system's shapes first if they haven't been yet.  */
+void ParticleView::draw(sf::RenderWindow& window)
+{
+    std::vector<sf::CircleShape>& images = system.images;
+    if ((int)images.size() != system.Size())
+    {
+        images.resize(system.Size());
+        for (int i = 0; i < system.Size(); i++) {
+            images[i].setRadius(system.radius[i]);
+            images[i].setFillColor(system.colors[i]);
+        }
+    }
+    images[index].setPosition(system.Position(index));
+    window.draw(images[index]);
+}
@@ -0,0 +1,130 @@
+/********************
+*
+*    Respa.hpp
+*
+*    Defines the Respa class, which steps Particles (or ChargedParticles) with multiple time steps (r-RESPA):
+*    the slow, expensive forces every few steps as impulses, and the cheap ones and collisions every step.
+*
+*********************/
+
+#pragma once
+#include <vector>
+#include "Vec2D.hpp"
+#include "ThreadPool.hpp"
+#include "Particle.hpp"         // for Particle::Update and ResolveCollisions
+
+
+
+
+
+/*  r-RESPA (reversible reference system propagator) for a vector of Particles, or of any class derived from it.
+ *  The forces are split in two: slow ones that are expensive but change little over a step (e.g. the Coulomb forces
+ *  between every pair of charges, from a BarnesHut, FastMultipole or ParticleMesh solver), and fast ones that are cheap
+ *  but need the base step (each particle's own acceleration, i.e. gravity, anything else given per particle, and the
+ *  collisions). One Step covers `substeps` base steps dt: a half kick from the slow forces (velocity += F dt K / 2m),
+ *  K base steps of collisions and Particle::Update (Entity::Integrate under the fast forces, then the walls), and
+ *  another half kick from the slow forces at the new positions. That's velocity Verlet on the slow forces with the
+ *  inner steps as its drift, so it keeps Verlet's stability and energy behaviour, with the slow forces worked out once
+ *  per K base steps instead of every step. The slow forces at the end of one Step are the ones at the start of the
+ *  next, so they're kept (and worked out again only on the first Step, or after particles are added or removed).
+ *  K is bounded by how fast the slow forces change: a particle shouldn't travel far through their field in K dt.  */
+class Respa
+{
+public:
+    int substeps;                       // Base steps per Step (K).
+    std::vector<Vec2D> slow_forces;     // Slow force on each particle, at the current positions.
+
+    /*  Counts since construction (or Reset).  */
+    struct Stats
+    {
+        long long steps = 0;            // Calls to Step.
+        long long substeps = 0;         // Base steps taken.
+        long long slow_evaluations = 0; // Times the slow forces were worked out.
+    };
+    Stats stats;
+
+
+    Respa() : substeps(4) { }
+    Respa(int substeps) : substeps(substeps) { }
+
+    /*  No fast force beyond each particle's own acceleration.  */
+    struct NoForce
+    {
+        template <typename P>
+        Vec2D operator()(const P&) const { return Vec2D(0.f, 0.f); }
+    };
+
+    template <typename P, typename Slow, typename Broadphase, typename Fast = NoForce>
+    void Step(std::vector<P>& particles, double t, float dt, Slow slow, Broadphase& broadphase, Fast fast = Fast(), ThreadPool* pool = nullptr);
+
+    /*  Forgets the kept slow forces (e.g. after moving particles by hand) and the counts.  */
+    void Reset() { slow_forces.clear(); stats = Stats(); }
+
+
+private:
+    template <typename P>
+    void Kick(std::vector<P>& particles, float h, ThreadPool* pool);
+};
+
+
+
+
+
+
+/*  Changes every particle's velocity by its slow force times h over its mass (and its momentum and kinetic energy with it).  */
+template <typename P>
+void Respa::Kick(std::vector<P>& particles, float h, ThreadPool* pool)
+{
+    auto kick = [&](int begin, int end) {
+        for (int i = begin; i < end; i++)
+        {
+            P& particle = particles[i];
+            particle.kinematics.velocity += slow_forces[i] * (h / particle.mass);
+            particle.kinematics.momentum = particle.kinematics.velocity * particle.mass;
+            particle.kinetic_energy = particle.ResolveKineticEnergy(particle.kinematics.velocity);
+        }
+    };
+    if (pool) pool->ParallelFor(0, (int)particles.size(), kick, 256);
+    else kick(0, (int)particles.size());
+}
+
+
+/*  Advances the particles by substeps * dt.
+ *  @param particles: The particles (Particles, or any class derived from it).
+ *  @param t: The simulation time at the start of the step.
+ *  @param dt: The base step, which the collisions and fast forces are taken at.
+ *  @param slow: Called as slow(particles, forces) to fill `forces` with the slow force on each particle,
+ *               e.g. [&](const auto& p, std::vector<Vec2D>& f) { tree.Solve(p, &pool); f = tree.forces; }.
+ *  @param broadphase: A broadphase with a FindPairs(centers, radii) method, for the collisions on each base step.
+ *  @param fast: Called as fast(particle) for the fast force on each particle on each base step (none by default).
+ *  @param pool: Threads to split the kicks and the particles' updates across (the calling thread does it all if null).  */
+template <typename P, typename Slow, typename Broadphase, typename Fast>
+void Respa::Step(std::vector<P>& particles, double t, float dt, Slow slow, Broadphase& broadphase, Fast fast, ThreadPool* pool)
+{
+    const int n = (int)particles.size();
+    const float outer = dt * substeps;
+    if ((int)slow_forces.size() != n) {
+        slow_forces.assign(n, Vec2D(0.f, 0.f));
+        slow(particles, slow_forces);
+        stats.slow_evaluations++;
+    }
+
+    Kick(particles, 0.5f * outer, pool);
+    for (int k = 0; k < substeps; k++)
+    {
+        ResolveCollisions(particles, broadphase);
+        const double time = t + (double)k * dt;
+        auto update = [&](int begin, int end) {
+            for (int i = begin; i < end; i++)
+                particles[i].Particle::Update(time, dt, fast(particles[i]));
+        };
+        if (pool) pool->ParallelFor(0, n, update, 64);
+        else update(0, n);
+    }
+    slow(particles, slow_forces);
+    stats.slow_evaluations++;
+    Kick(particles, 0.5f * outer, pool);
+
+    stats.steps++;
+    stats.substeps += substeps;
+}
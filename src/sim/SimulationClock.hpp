@@ -0,0 +1,113 @@
+/********************
+*
+*    SimulationClock.hpp
+*
+*    Defines the SimulationClock class, which decides how many fixed physics steps
+*    to run each frame from the wall-clock time, so the physics rate doesn't depend on the frame rate.
+*
+*********************/
+
+#pragma once
+#include <chrono>
+#include <iostream>
+#include <algorithm>
+
+
+
+
+
+/*  Fixed-timestep clock with an accumulator.
+ *  Each frame, Tick adds the wall-clock time since the last frame (times `time_scale`) to the accumulator,
+ *  and returns how many whole steps of `step` fit in it; the remainder carries over to the next frame.
+ *  So the simulation keeps pace with real time at any frame rate, running several steps on a slow frame and none on a fast one.
+ *  A frame never runs more than `max_steps` steps: if a step costs more than the time it covers, the simulation slows down
+ *  instead of falling further behind every frame (the "spiral of death"), and the time it couldn't keep up with is dropped.
+ *  Alpha says how far the accumulator is into the next step, for drawing between the last two states.
+ *  In turbo mode, wall-clock time is ignored and every frame runs `render_every` steps, so the simulation runs
+ *  as fast as the machine allows and only every Nth step is drawn.  */
+class SimulationClock
+{
+public:
+    float step;             // Simulation time covered by one physics step.
+    float time_scale;       // Simulation seconds per wall-clock second.
+    int max_steps;          // Most steps run in one frame.
+    bool turbo;             // Whether to ignore wall-clock time and run `render_every` steps a frame.
+    int render_every;       // Steps per frame in turbo mode.
+
+    /*  Counts since the clock started.  */
+    struct Stats
+    {
+        long long steps = 0;        // Steps run.
+        long long frames = 0;       // Frames (calls to Tick or Advance).
+        int last_steps = 0;         // Steps run on the last frame.
+        double dropped = 0.0;       // Simulation time dropped by the max_steps guard.
+    };
+    Stats stats;
+
+
+    SimulationClock(float step, float time_scale = 1.0f, int max_steps = 8)
+        : step(step), time_scale(time_scale), max_steps(max_steps), turbo(false), render_every(100), accumulator(0.0), time(0.0),
+          last(std::chrono::steady_clock::now()) { }
+
+    int Tick();
+    int Advance(double wall_seconds);
+
+    float Alpha() const { return turbo ? 1.0f : (float)(accumulator / step); }
+    double NextStepIn() const { return turbo ? 0.0 : (step - accumulator) / time_scale; }     // Wall-clock seconds until another step is due.
+    double Time() const { return time; }
+
+    friend std::ostream& operator<<(std::ostream& os, const Stats& s)
+    {
+        os << "Steps: " << s.steps << "   Frames: " << s.frames << "   Steps per frame: " << (s.frames ? (double)s.steps / s.frames : 0.0)
+           << "   Dropped: " << s.dropped << " s";
+        return os;
+    }
+
+
+private:
+    double accumulator;                                 // Simulation time not yet covered by a step.
+    double time;                                        // Simulation time covered by the steps run so far.
+    std::chrono::steady_clock::time_point last;        // When Tick was last called.
+};
+
+
+
+
+
+
+/*  Measures the wall-clock time since the last call (or since the clock was made), and returns the number of steps to run.  */
+int SimulationClock::Tick()
+{
+    const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    const double elapsed = std::chrono::duration<double>(now - last).count();
+    last = now;
+    return Advance(elapsed);
+}
+
+
+/*  Adds wall_seconds of wall-clock time and returns the number of steps to run for it.
+ *  @param wall_seconds: Wall-clock time since the last frame.  */
+int SimulationClock::Advance(double wall_seconds)
+{
+    int steps;
+    if (turbo) {
+        steps = render_every;
+        accumulator = 0.0;
+    }
+    else {
+        accumulator += wall_seconds * time_scale;
+        steps = (int)(accumulator / step);
+        if (steps > max_steps) {
+            stats.dropped += accumulator - (double)max_steps * step;
+            steps = max_steps;
+            accumulator = 0.0;
+        }
+        else accumulator -= (double)steps * step;
+    }
+
+    time += (double)steps * step;
+    stats.steps += steps;
+    stats.frames++;
+    stats.last_steps = steps;
+    return steps;
+}
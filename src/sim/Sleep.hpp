@@ -0,0 +1,204 @@
+/********************
+*
+*    Sleep.hpp
+*
+*    Defines the SleepManager class, which puts groups of particles that have
+*    come to rest to sleep, so they're skipped by the integrator and the collision solver.
+*
+*********************/
+
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <iostream>
+#include <algorithm>
+#include "Vec2D.hpp"    // includes:  <cmath> and <SFML/Graphics.hpp>
+#include "ContactManager.hpp"
+
+
+
+
+
+/*  Island-based sleeping.
+ *  A particle counts as resting while its speed and kinetic energy both stay under their thresholds,
+ *  and it accumulates rest time for as long as that lasts. Particles in contact form an island (found with union-find),
+ *  and an island only goes to sleep once every particle in it has rested for `time_to_sleep`, so a stack never
+ *  falls asleep while one of its balls is still moving. Sleeping particles keep their position, have zero velocity,
+ *  and aren't integrated. A contact that hits a sleeping particle faster than `wake_speed`, or a call to Wake
+ *  (e.g. after applying an impulse), wakes the particle's whole island.  */
+class SleepManager
+{
+public:
+    float speed_threshold;      // Speed under which a particle counts as resting.
+    float energy_threshold;     // Kinetic energy under which a particle counts as resting.
+    float time_to_sleep;        // How long every particle of an island has to rest before the island sleeps.
+    float wake_speed;           // Approach speed above which a contact wakes a sleeping particle.
+
+    std::vector<uint8_t> asleep;        // Whether each particle is asleep.
+    std::vector<float> rest_time;       // How long each particle has been resting.
+    std::vector<int> island;            // Island of each particle, as of the last Update.
+
+    /*  Counts from the last frame.  */
+    struct Stats
+    {
+        int awake = 0;          // Particles awake after the last Update.
+        int asleep = 0;         // Particles asleep after the last Update.
+        int islands = 0;        // Number of islands (including lone particles).
+        int fell_asleep = 0;    // Particles put to sleep by the last Update.
+        int woken = 0;          // Particles woken between the previous Update and the last one.
+    };
+    Stats stats;
+
+
+    SleepManager() : speed_threshold(2.0f), energy_threshold(2.0f), time_to_sleep(1.0f), wake_speed(2.0f), woken(0) { }
+    SleepManager(float speed_threshold, float energy_threshold, float time_to_sleep, float wake_speed)
+        : speed_threshold(speed_threshold), energy_threshold(energy_threshold), time_to_sleep(time_to_sleep), wake_speed(wake_speed), woken(0) { }
+
+    bool IsAsleep(int i) const { return i < (int)asleep.size() && asleep[i]; }
+    void Wake(int i);
+    void Update(std::vector<Vec2D>& velocities, const std::vector<float>& masses, const std::vector<ContactManager::Contact>& contacts, float dt);
+
+    friend std::ostream& operator<<(std::ostream& os, const Stats& s)
+    {
+        os << "Awake: " << s.awake << "   Asleep: " << s.asleep << "   Islands: " << s.islands
+           << "   (fell asleep: " << s.fell_asleep << ", woken: " << s.woken << ")";
+        return os;
+    }
+
+
+private:
+    std::vector<int> parent;            // Union-find forest over particles.
+    std::vector<int> island_start;      // Where each island starts in `members`, plus one past the end.
+    std::vector<int> members;           // Particles grouped by island.
+    int woken;                          // Particles woken since the last Update.
+
+    void Resize(int n);
+    int Find(int i);
+};
+
+
+
+
+
+
+/*  Grows the per-particle arrays to n particles; new particles start awake.  */
+void SleepManager::Resize(int n)
+{
+    if ((int)asleep.size() == n) return;
+    asleep.resize(n, 0);
+    rest_time.resize(n, 0.0f);
+    island.resize(n, -1);
+    parent.resize(n);
+}
+
+
+/*  Finds the root of i's set, halving the path on the way up.  */
+int SleepManager::Find(int i)
+{
+    while (parent[i] != i) {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+    return i;
+}
+
+
+/*  Wakes particle i and every other particle on its island.
+ *  Call this after changing a sleeping particle's velocity from outside the simulation (e.g. applying an impulse).
+ *  @param i: The particle's index.  */
+void SleepManager::Wake(int i)
+{
+    if (!IsAsleep(i)) return;
+    const int k = island[i];
+    if (k < 0) {
+        asleep[i] = 0;
+        rest_time[i] = 0.0f;
+        woken++;
+        return;
+    }
+    for (int m = island_start[k]; m < island_start[k + 1]; m++)
+    {
+        const int j = members[m];
+        if (!asleep[j]) continue;
+        asleep[j] = 0;
+        rest_time[j] = 0.0f;
+        woken++;
+    }
+}
+
+
+/*  Accumulates rest time for the awake particles, rebuilds the islands from this frame's contacts,
+ *  and puts to sleep every island whose particles have all rested long enough (zeroing their velocities).
+ *  @param velocities: The velocity of each particle (sleeping particles' are set to zero).
+ *  @param masses: The mass of each particle.
+ *  @param contacts: This frame's contacts, e.g. from a ContactManager.
+ *  @param dt: The time step.  */
+void SleepManager::Update(std::vector<Vec2D>& velocities, const std::vector<float>& masses, const std::vector<ContactManager::Contact>& contacts, float dt)
+{
+    const int n = (int)velocities.size();
+    Resize(n);
+    stats = Stats();
+    stats.woken = woken;
+    woken = 0;
+
+    for (int i = 0; i < n; i++)
+    {
+        if (asleep[i]) continue;
+        const float speed2 = velocities[i].dot(velocities[i]);
+        const bool resting = speed2 <= speed_threshold * speed_threshold && 0.5f * masses[i] * speed2 <= energy_threshold;
+        rest_time[i] = resting ? rest_time[i] + dt : 0.0f;
+    }
+
+    // Islands are the connected components of the contact graph
+    for (int i = 0; i < n; i++)
+        parent[i] = i;
+    for (auto& contact : contacts)
+    {
+        const int a = Find(contact.a), b = Find(contact.b);
+        if (a != b) parent[std::max(a, b)] = std::min(a, b);
+    }
+
+    // Number the islands in order of their lowest particle, and group the particles by island
+    std::vector<int> root_island(n, -1);
+    int islands = 0;
+    for (int i = 0; i < n; i++)
+    {
+        const int root = Find(i);
+        if (root_island[root] < 0) root_island[root] = islands++;
+        island[i] = root_island[root];
+    }
+    island_start.assign(islands + 1, 0);
+    for (int i = 0; i < n; i++)
+        island_start[island[i] + 1]++;
+    for (int k = 0; k < islands; k++)
+        island_start[k + 1] += island_start[k];
+    members.resize(n);
+    std::vector<int> next(island_start.begin(), island_start.end() - 1);
+    for (int i = 0; i < n; i++)
+        members[next[island[i]]++] = i;
+
+    // An island sleeps once all of its particles have rested long enough (sleeping ones already have)
+    for (int k = 0; k < islands; k++)
+    {
+        bool ready = true;
+        bool any_awake = false;
+        for (int m = island_start[k]; m < island_start[k + 1] && ready; m++) {
+            const int i = members[m];
+            ready = asleep[i] || rest_time[i] >= time_to_sleep;
+            any_awake |= !asleep[i];
+        }
+        if (!ready || !any_awake) continue;
+        for (int m = island_start[k]; m < island_start[k + 1]; m++)
+        {
+            const int i = members[m];
+            if (asleep[i]) continue;
+            asleep[i] = 1;
+            velocities[i] = Vec2D(0.0f, 0.0f);
+            stats.fell_asleep++;
+        }
+    }
+
+    stats.islands = islands;
+    for (int i = 0; i < n; i++)
+        asleep[i] ? stats.asleep++ : stats.awake++;
+}
@@ -0,0 +1,124 @@
+/********************
+*
+*    Snapshot.hpp
+*
+*    Defines the Snapshot struct, a copy of what's needed to draw the particles at one step,
+*    and the SnapshotRenderer class, which draws one.
+*
+*********************/
+
+#pragma once
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include "Particle2D.hpp"
+#include "ParticleSystem.hpp"
+
+
+
+
+
+/*  What the particles looked like after a step: enough to draw them, and nothing that the simulation holds on to,
+ *  so it can be drawn on another thread while the simulation carries on. Capture reuses the vectors' storage,
+ *  so taking snapshots into the same few Snapshots (e.g. a TripleBuffer's) doesn't allocate once they've grown.
+ *  It also keeps the positions one step earlier, and how far the clock was into the next step when it was taken,
+ *  so a frame can be drawn between the two steps (as draw() in Utils.hpp does) however long after it's drawn.  */
+struct Snapshot
+{
+    long long step = 0;                 // Steps run when it was taken.
+    double time = 0.0;                  // Simulation time when it was taken.
+    int last_steps = 0;                 // Steps run since the snapshot before it.
+    int awake = 0, asleep = 0;          // Particles awake and asleep (from a SleepManager, if there is one).
+    std::vector<Vec2D> positions;       // Top-left corners.
+    std::vector<Vec2D> previous;        // Top-left corners one step before (left empty to draw without interpolating).
+    std::vector<float> radii;
+    std::vector<sf::Color> colors;
+    float alpha = 1.0f;                 // SimulationClock::Alpha() when it was taken.
+    std::chrono::steady_clock::time_point taken;    // Real time it was taken.
+
+    int Size() const { return (int)positions.size(); }
+
+    void Capture(const std::vector<Particle2D>& particles);
+    void Capture(const ParticleSystem& system);
+    float Alpha(double step_seconds) const;
+};
+
+
+/*  Draws Snapshots, keeping one shape per particle between frames (only resized or recolored when that changes).  */
+class SnapshotRenderer
+{
+public:
+    void Draw(const Snapshot& snapshot, sf::RenderWindow& window);
+    void Draw(const Snapshot& snapshot, float alpha, sf::RenderWindow& window);
+
+private:
+    std::vector<sf::CircleShape> shapes;
+};
+
+
+
+
+
+
+/*  Copies the particles' positions, radii and colors.  */
+void Snapshot::Capture(const std::vector<Particle2D>& particles)
+{
+    const int n = (int)particles.size();
+    positions.resize(n);
+    radii.resize(n);
+    colors.resize(n);
+    for (int i = 0; i < n; i++)
+    {
+        positions[i] = particles[i].state.position;
+        radii[i] = particles[i].radius;
+        colors[i] = particles[i].color;
+    }
+}
+
+
+/*  Copies the system's positions, radii and colors.  */
+void Snapshot::Capture(const ParticleSystem& system)
+{
+    const int n = system.Size();
+    positions.resize(n);
+    radii.assign(system.radius.begin(), system.radius.end());
+    colors.assign(system.colors.begin(), system.colors.end());
+    for (int i = 0; i < n; i++)
+        positions[i] = system.Position(i);
+}
+
+
+/*  Returns how far to draw between the previous and current positions now: the clock's alpha when the snapshot was
+ *  taken, plus the steps' worth of real time that has passed since (at most 1, since nothing later is known yet).
+ *  @param step_seconds: Real time per step (the step over the time scale).  */
+float Snapshot::Alpha(double step_seconds) const
+{
+    const double since = std::chrono::duration<double>(std::chrono::steady_clock::now() - taken).count();
+    return (float)std::min(1.0, alpha + since / step_seconds);
+}
+
+
+/*  Draws every particle in the snapshot where it was when it was taken.  */
+void SnapshotRenderer::Draw(const Snapshot& snapshot, sf::RenderWindow& window)
+{
+    Draw(snapshot, 1.0f, window);
+}
+
+
+/*  Draws every particle in the snapshot a fraction alpha of the way from its previous position to its current one
+ *  (at its current one if the snapshot has no previous positions).  */
+void SnapshotRenderer::Draw(const Snapshot& snapshot, float alpha, sf::RenderWindow& window)
+{
+    if ((int)shapes.size() != snapshot.Size())
+        shapes.resize(snapshot.Size());
+    const bool interpolate = (snapshot.previous.size() == snapshot.positions.size());
+    for (int i = 0; i < snapshot.Size(); i++)
+    {
+        sf::CircleShape& shape = shapes[i];
+        if (shape.getRadius() != snapshot.radii[i]) shape.setRadius(snapshot.radii[i]);
+        if (shape.getFillColor() != snapshot.colors[i]) shape.setFillColor(snapshot.colors[i]);
+        const Vec2D& position = snapshot.positions[i];
+        shape.setPosition(interpolate ? snapshot.previous[i] + (position - snapshot.previous[i]) * alpha : position);
+        window.draw(shape);
+    }
+}
@@ -0,0 +1,118 @@
+/********************
+*
+*    SpatialHash.hpp
+*
+*    Defines the SpatialHash class,
+*    a uniform-grid broadphase for finding candidate collision pairs.
+*
+*********************/
+
+#pragma once
+#include <cmath>
+#include <vector>
+#include <cstdint>
+#include <utility>
+#include <algorithm>
+#include "Vec2D.hpp"    // includes:  <cmath> and <SFML/Graphics.hpp>
+
+
+
+
+
+/*  Uniform-grid broadphase, stored as a spatial hash so the domain doesn't need to be bounded.
+ *  Each particle is binned into the cell containing its center. The cell size is taken from
+ *  the largest diameter in the set, so two overlapping particles always sit in the same or in
+ *  adjacent cells, and only those pairs are handed on to the narrowphase.
+ *  Pairs are reported once each, as (i, j) with i < j, sorted in the order the all-pairs loop visits them.  */
+class SpatialHash
+{
+public:
+    float cell_size;                            // Edge length of a grid cell (the largest diameter seen on the last call to FindPairs).
+    std::vector<std::pair<int,int>> pairs;      // Candidate pairs found on the last call to FindPairs.
+
+
+    SpatialHash() : cell_size(0.f), bucket_mask(0) { }
+
+    const std::vector<std::pair<int,int>>& FindPairs(const std::vector<Vec2D>& centers, const std::vector<float>& radii);
+
+
+private:
+    uint32_t bucket_mask;               // Number of hash buckets minus one (the bucket count is a power of two).
+    std::vector<int> cell_x;            // Cell x-coordinate of each particle.
+    std::vector<int> cell_y;            // Cell y-coordinate of each particle.
+    std::vector<uint32_t> bucket;       // Hash bucket of each particle.
+    std::vector<int> bucket_start;      // Offset of each bucket's first entry in `sorted` (one extra entry marks the end).
+    std::vector<int> sorted;            // Particle indices, counting-sorted by bucket.
+
+    /*  Hashes integer cell coordinates into a bucket index.  */
+    uint32_t Hash(int x, int y) const { return (((uint32_t)x * 73856093u) ^ ((uint32_t)y * 19349663u)) & bucket_mask; }
+};
+
+
+
+
+
+
+/*  Bins every particle into the grid and returns the list of candidate pairs,
+ *  i.e. pairs in the same or neighbouring cells whose bounding boxes overlap.
+ *  @param centers: The center of each particle.
+ *  @param radii: The radius of each particle (same length as centers).  */
+const std::vector<std::pair<int,int>>& SpatialHash::FindPairs(const std::vector<Vec2D>& centers, const std::vector<float>& radii)
+{
+    const int n = (int)centers.size();
+    pairs.clear();
+    if (n < 2) return pairs;
+
+    // Size the cells from the largest particle
+    float max_radius = 0.f;
+    for (int i = 0; i < n; i++)  max_radius = std::max(max_radius, radii[i]);
+    cell_size = (max_radius > 0.f) ? 2.f * max_radius : 1.f;
+    const float inv_cell_size = 1.f / cell_size;
+
+    // Roughly two buckets per particle keeps hash collisions rare
+    uint32_t buckets = 1;
+    while (buckets < 2u * (uint32_t)n)  buckets <<= 1;
+    bucket_mask = buckets - 1;
+
+    cell_x.resize(n);
+    cell_y.resize(n);
+    bucket.resize(n);
+    for (int i = 0; i < n; i++) {
+        cell_x[i] = (int)std::floor(centers[i].x * inv_cell_size);
+        cell_y[i] = (int)std::floor(centers[i].y * inv_cell_size);
+        bucket[i] = Hash(cell_x[i], cell_y[i]);
+    }
+
+    // Counting sort of the particle indices by bucket
+    bucket_start.assign(buckets + 1, 0);
+    for (int i = 0; i < n; i++)  bucket_start[bucket[i] + 1]++;
+    for (uint32_t b = 0; b < buckets; b++)  bucket_start[b + 1] += bucket_start[b];
+    sorted.resize(n);
+    std::vector<int> cursor(bucket_start.begin(), bucket_start.end() - 1);
+    for (int i = 0; i < n; i++)  sorted[cursor[bucket[i]]++] = i;
+
+    // Scan the 3x3 block of cells around each particle.
+    // Entries from other cells that happen to share a bucket are skipped by comparing cell coordinates.
+    for (int i = 0; i < n; i++)
+    {
+        const size_t first = pairs.size();
+        for (int oy = -1; oy <= 1; oy++)
+        for (int ox = -1; ox <= 1; ox++)
+        {
+            const int cx = cell_x[i] + ox;
+            const int cy = cell_y[i] + oy;
+            const uint32_t b = Hash(cx, cy);
+            for (int k = bucket_start[b]; k < bucket_start[b + 1]; k++)
+            {
+                const int j = sorted[k];
+                if (j <= i || cell_x[j] != cx || cell_y[j] != cy) continue;
+                const float reach = radii[i] + radii[j];
+                if (std::fabs(centers[j].x - centers[i].x) < reach && std::fabs(centers[j].y - centers[i].y) < reach)
+                    pairs.emplace_back(i, j);
+            }
+        }
+        // Keep the all-pairs visiting order, so the narrowphase runs in a deterministic order
+        std::sort(pairs.begin() + first, pairs.end());
+    }
+    return pairs;
+}
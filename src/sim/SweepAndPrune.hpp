@@ -0,0 +1,144 @@
+/********************
+*
+*    SweepAndPrune.hpp
+*
+*    Defines the SweepAndPrune class,
+*    a sort-based broadphase for finding candidate collision pairs.
+*
+*********************/
+
+#pragma once
+#include <cmath>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include "Vec2D.hpp"    // includes:  <cmath> and <SFML/Graphics.hpp>
+
+
+
+
+
+/*  Sweep-and-prune broadphase along the x-axis.
+ *  Keeps the interval endpoints [x - r, x + r] of every particle sorted between frames.
+ *  Since particles barely move from one frame to the next, the list is re-sorted with an insertion sort,
+ *  which runs in close to linear time on nearly sorted input. A single sweep over the sorted endpoints then
+ *  reports every pair whose x-intervals overlap (and whose y-intervals overlap too).
+ *  Unlike a uniform grid, this doesn't depend on a cell size, so mixed radii don't hurt it.
+ *  Pairs are reported once each, as (i, j) with i < j, sorted in the order the all-pairs loop visits them.  */
+class SweepAndPrune
+{
+public:
+    /*  One end of a particle's x-interval.  */
+    struct Endpoint
+    {
+        float value;        // The x-coordinate of the endpoint.
+        int index;          // The index of the particle it belongs to.
+        bool is_min;        // True for the left end of the interval, false for the right end.
+    };
+
+    std::vector<Endpoint> endpoints;            // Every particle's two endpoints, sorted by value (kept between frames).
+    std::vector<std::pair<int,int>> pairs;      // Candidate pairs found on the last call to FindPairs.
+    long long swaps;                            // Number of swaps the insertion sort made on the last call (a measure of coherence).
+
+
+    SweepAndPrune() : swaps(0) { }
+
+    const std::vector<std::pair<int,int>>& FindPairs(const std::vector<Vec2D>& centers, const std::vector<float>& radii);
+
+
+private:
+    std::vector<int> active;            // Particles whose interval is open at the current point of the sweep.
+    std::vector<int> active_slot;       // Position of each particle in `active`, for constant-time removal.
+
+    void Rebuild(int n);
+    void InsertionSort();
+};
+
+
+
+
+
+
+/*  Recreates the endpoint list from scratch, e.g. when the number of particles has changed.
+ *  @param n: The number of particles.  */
+void SweepAndPrune::Rebuild(int n)
+{
+    endpoints.resize(2 * n);
+    for (int i = 0; i < n; i++) {
+        endpoints[2*i]   = Endpoint{ 0.f, i, true };
+        endpoints[2*i+1] = Endpoint{ 0.f, i, false };
+    }
+    active_slot.assign(n, -1);
+}
+
+
+/*  Re-sorts the endpoint list by value.
+ *  Min endpoints go before max endpoints with the same value, so touching intervals count as overlapping.  */
+void SweepAndPrune::InsertionSort()
+{
+    swaps = 0;
+    for (size_t i = 1; i < endpoints.size(); i++)
+    {
+        Endpoint key = endpoints[i];
+        size_t j = i;
+        while (j > 0 && (endpoints[j-1].value > key.value || (endpoints[j-1].value == key.value && !endpoints[j-1].is_min && key.is_min)))
+        {
+            endpoints[j] = endpoints[j-1];
+            j--;
+            swaps++;
+        }
+        endpoints[j] = key;
+    }
+}
+
+
+/*  Updates the endpoints from the particles' current positions,
+ *  re-sorts them, and sweeps along the x-axis to collect the candidate pairs.
+ *  @param centers: The center of each particle.
+ *  @param radii: The radius of each particle (same length as centers).  */
+const std::vector<std::pair<int,int>>& SweepAndPrune::FindPairs(const std::vector<Vec2D>& centers, const std::vector<float>& radii)
+{
+    const int n = (int)centers.size();
+    pairs.clear();
+
+    bool rebuilt = (endpoints.size() != 2 * (size_t)n);
+    if (rebuilt)  Rebuild(n);
+
+    for (auto& endpoint : endpoints)
+        endpoint.value = endpoint.is_min ? centers[endpoint.index].x - radii[endpoint.index]
+                                         : centers[endpoint.index].x + radii[endpoint.index];
+
+    // A fresh list is in arbitrary order, so only lean on the insertion sort once it's been sorted once
+    if (rebuilt) {
+        std::sort(endpoints.begin(), endpoints.end(), [](const Endpoint& a, const Endpoint& b) {
+            return a.value < b.value || (a.value == b.value && a.is_min && !b.is_min);
+        });
+        swaps = 0;
+    }
+    else InsertionSort();
+
+    active.clear();
+    for (auto& endpoint : endpoints)
+    {
+        const int i = endpoint.index;
+        if (endpoint.is_min)
+        {
+            for (int k : active)
+                if (std::fabs(centers[i].y - centers[k].y) < radii[i] + radii[k])
+                    pairs.emplace_back(std::min(i, k), std::max(i, k));
+            active_slot[i] = (int)active.size();
+            active.push_back(i);
+        }
+        else
+        {
+            // Swap-remove this particle from the active list
+            const int last = active.back();
+            active[active_slot[i]] = last;
+            active_slot[last] = active_slot[i];
+            active.pop_back();
+        }
+    }
+
+    std::sort(pairs.begin(), pairs.end());
+    return pairs;
+}
@@ -0,0 +1,278 @@
+/********************
+*
+*    TaskGraph.hpp
+*
+*    Defines the TaskGraph class, a set of stages with dependencies between them
+*    that runs on a JobSystem and times every stage as it goes.
+*
+*********************/
+
+#pragma once
+#include <chrono>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <memory>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <functional>
+#include "JobSystem.hpp"
+
+
+
+
+
+/*  A dependency graph of stages, run as jobs on a JobSystem.
+ *  A stage is either a single task, or a loop split into chunks of `grain` indices that run concurrently.
+ *  A stage starts as soon as every stage it comes after has finished, so stages that don't depend on each other
+ *  run side by side, and chunks of different stages can interleave. Stages can only come after stages added
+ *  before them, so the graph can't have cycles. The graph is built once and Run every frame.
+ *  Each Run times every stage: when it became ready, when its first chunk started and its last one finished,
+ *  and the time spent in its chunks summed over threads (which is more than its wall time when it ran in parallel).  */
+class TaskGraph
+{
+public:
+    /*  Timing of one stage, in milliseconds from the start of Run.  */
+    struct Timing
+    {
+        double ready = 0.0;         // When the stages before it had all finished.
+        double start = 0.0;         // When its first chunk started.
+        double end = 0.0;           // When its last chunk finished.
+        double busy = 0.0;          // Time spent in its chunks, summed over threads.
+        int chunks = 0;
+    };
+
+    int Add(std::string name, std::function<void()> task, std::vector<int> after = {});
+    int AddParallel(std::string name, std::function<int()> size, std::function<void(int, int)> body, int grain, std::vector<int> after = {});
+
+    int Size() const { return (int)stages.size(); }
+    const std::string& Name(int stage) const { return stages[stage]->name; }
+    const Timing& Last(int stage) const { return stages[stage]->last; }
+    Timing Average(int stage) const;
+    double LastFrame() const { return last_frame; }
+    long long Runs() const { return runs; }
+
+    void Run(JobSystem& jobs);
+    void ResetTimings();
+
+    friend std::ostream& operator<<(std::ostream& os, const TaskGraph& graph)
+    {
+        const std::ios_base::fmtflags flags = os.flags();
+        const std::streamsize precision = os.precision();
+        os << std::fixed << std::setprecision(3);
+        os << "   " << std::left << std::setw(16) << "stage" << std::right << std::setw(10) << "ready" << std::setw(10) << "start"
+           << std::setw(10) << "end" << std::setw(10) << "wall" << std::setw(10) << "busy" << std::setw(8) << "chunks"
+           << "   (ms, averaged over " << graph.runs << " runs)" << std::endl;
+        for (int s = 0; s < graph.Size(); s++)
+        {
+            const Timing t = graph.Average(s);
+            os << "   " << std::left << std::setw(16) << graph.Name(s) << std::right << std::setw(10) << t.ready << std::setw(10) << t.start
+               << std::setw(10) << t.end << std::setw(10) << t.end - t.start << std::setw(10) << t.busy << std::setw(8) << t.chunks << std::endl;
+        }
+        os << "   " << std::left << std::setw(16) << "frame" << std::right << std::setw(30) << (graph.runs ? graph.total_frame / graph.runs : 0.0);
+        os.flags(flags);
+        os.precision(precision);
+        return os;
+    }
+
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Stage
+    {
+        std::string name;
+        std::function<void()> task;                 // Set for a single-task stage,
+        std::function<int()> size;                  // or these for a chunked loop over [0, size()).
+        std::function<void(int, int)> body;
+        int grain = 1;
+        std::vector<int> after;                     // Stages it waits for.
+        std::vector<int> next;                      // Stages that wait for it.
+
+        std::atomic<int> waiting{0};                // Stages before it not finished yet (during Run).
+        std::atomic<int> remaining{0};              // Chunks not finished yet.
+        std::atomic<long long> first_start{0};      // Nanoseconds from the start of Run.
+        std::atomic<long long> busy{0};
+        long long ready = 0;
+
+        Timing last;
+        Timing total;                               // Summed over runs, for Average.
+    };
+
+    std::vector<std::unique_ptr<Stage>> stages;
+    Clock::time_point origin;                       // Start of the current Run.
+    double last_frame = 0.0, total_frame = 0.0;
+    long long runs = 0;
+
+    long long Now() const { return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - origin).count(); }
+    int AddStage(std::unique_ptr<Stage> stage);
+    void Launch(int s, JobSystem& jobs, JobSystem::Counter& unfinished);
+    void RunChunk(int s, int chunk_begin, int chunk_end, JobSystem& jobs, JobSystem::Counter& unfinished);
+    void Finish(int s, JobSystem& jobs, JobSystem::Counter& unfinished);
+};
+
+
+
+
+
+
+/*  Adds the stage to the graph and links it to the stages it comes after.  */
+int TaskGraph::AddStage(std::unique_ptr<Stage> stage)
+{
+    const int index = Size();
+    for (int before : stage->after)
+    {
+        if (before < 0 || before >= index)
+            throw std::invalid_argument("TaskGraph::Add: Stage \"" + stage->name + "\" can only come after stages already added");
+        stages[before]->next.push_back(index);
+    }
+    stages.push_back(std::move(stage));
+    return index;
+}
+
+
+/*  Adds a stage that runs a single task, and returns its index.
+ *  @param name: Name of the stage, for the timings.
+ *  @param task: The work to do.
+ *  @param after: Indices of the stages that have to finish before it starts.  */
+int TaskGraph::Add(std::string name, std::function<void()> task, std::vector<int> after)
+{
+    std::unique_ptr<Stage> stage = std::make_unique<Stage>();
+    stage->name = std::move(name);
+    stage->task = std::move(task);
+    stage->after = std::move(after);
+    return AddStage(std::move(stage));
+}
+
+
+/*  Adds a stage that runs body(chunk_begin, chunk_end) over [0, size()) in chunks of `grain` indices, and returns its index.
+ *  The size is asked for when the stage starts, so it can change from run to run.
+ *  @param name: Name of the stage, for the timings.
+ *  @param size: Returns the number of indices to loop over.
+ *  @param body: The loop body, called with each chunk's range. Chunks run concurrently.
+ *  @param grain: The number of indices in a chunk.
+ *  @param after: Indices of the stages that have to finish before it starts.  */
+int TaskGraph::AddParallel(std::string name, std::function<int()> size, std::function<void(int, int)> body, int grain, std::vector<int> after)
+{
+    std::unique_ptr<Stage> stage = std::make_unique<Stage>();
+    stage->name = std::move(name);
+    stage->size = std::move(size);
+    stage->body = std::move(body);
+    stage->grain = std::max(1, grain);
+    stage->after = std::move(after);
+    return AddStage(std::move(stage));
+}
+
+
+/*  Returns a stage's timing averaged over the runs since the last ResetTimings.  */
+TaskGraph::Timing TaskGraph::Average(int stage) const
+{
+    Timing average;
+    if (runs == 0) return average;
+    const Timing& total = stages[stage]->total;
+    average.ready = total.ready / runs;
+    average.start = total.start / runs;
+    average.end = total.end / runs;
+    average.busy = total.busy / runs;
+    average.chunks = (int)(total.chunks / runs);
+    return average;
+}
+
+
+/*  Forgets the timings of earlier runs.  */
+void TaskGraph::ResetTimings()
+{
+    for (auto& stage : stages)
+        stage->total = Timing();
+    total_frame = 0.0;
+    runs = 0;
+}
+
+
+/*  Runs every stage once, each as soon as the stages it comes after are done, and returns when they all are.
+ *  The calling thread helps run the jobs.  */
+void TaskGraph::Run(JobSystem& jobs)
+{
+    origin = Clock::now();
+    JobSystem::Counter unfinished(Size());
+    for (auto& stage : stages)
+        stage->waiting.store((int)stage->after.size());
+    for (int s = 0; s < Size(); s++)
+        if (stages[s]->after.empty())
+            Launch(s, jobs, unfinished);
+    jobs.Wait(unfinished);
+
+    last_frame = Now() * 1e-6;
+    total_frame += last_frame;
+    runs++;
+    for (auto& stage : stages)
+    {
+        stage->total.ready += stage->last.ready;
+        stage->total.start += stage->last.start;
+        stage->total.end += stage->last.end;
+        stage->total.busy += stage->last.busy;
+        stage->total.chunks += stage->last.chunks;
+    }
+}
+
+
+/*  Submits a stage's jobs, once the stages before it are done.  */
+void TaskGraph::Launch(int s, JobSystem& jobs, JobSystem::Counter& unfinished)
+{
+    Stage& stage = *stages[s];
+    stage.ready = Now();
+    stage.first_start.store(-1);
+    stage.busy.store(0);
+
+    if (stage.task) {
+        stage.remaining.store(1);
+        stage.last.chunks = 1;
+        jobs.Submit([this, s, &jobs, &unfinished]() { RunChunk(s, 0, 0, jobs, unfinished); });
+        return;
+    }
+
+    const int size = stage.size();
+    const int chunks = std::max(1, (size + stage.grain - 1) / stage.grain);     // an empty loop still gets a (do-nothing) chunk, so it finishes
+    stage.remaining.store(chunks);
+    stage.last.chunks = chunks;
+    for (int k = 0; k < chunks; k++)
+    {
+        const int chunk_begin = k * stage.grain;
+        const int chunk_end = std::min(size, chunk_begin + stage.grain);
+        jobs.Submit([this, s, chunk_begin, chunk_end, &jobs, &unfinished]() { RunChunk(s, chunk_begin, chunk_end, jobs, unfinished); });
+    }
+}
+
+
+/*  Runs one chunk of a stage (or its task) and times it; the last chunk to finish finishes the stage.  */
+void TaskGraph::RunChunk(int s, int chunk_begin, int chunk_end, JobSystem& jobs, JobSystem::Counter& unfinished)
+{
+    Stage& stage = *stages[s];
+    const long long start = Now();
+    long long expected = -1;
+    stage.first_start.compare_exchange_strong(expected, start);
+
+    if (stage.task) stage.task();
+    else if (chunk_begin < chunk_end) stage.body(chunk_begin, chunk_end);
+
+    stage.busy.fetch_add(Now() - start);
+    if (stage.remaining.fetch_sub(1) == 1)
+        Finish(s, jobs, unfinished);
+}
+
+
+/*  Records a finished stage's timing, and launches the stages that were only waiting for it.  */
+void TaskGraph::Finish(int s, JobSystem& jobs, JobSystem::Counter& unfinished)
+{
+    Stage& stage = *stages[s];
+    stage.last.ready = stage.ready * 1e-6;
+    stage.last.start = stage.first_start.load() * 1e-6;
+    stage.last.end = Now() * 1e-6;
+    stage.last.busy = stage.busy.load() * 1e-6;
+
+    for (int n : stage.next)
+        if (stages[n]->waiting.fetch_sub(1) == 1)
+            Launch(n, jobs, unfinished);
+    unfinished.fetch_sub(1, std::memory_order_release);
+}
@@ -0,0 +1,144 @@
+/********************
+*
+*    ThreadPool.hpp
+*
+*    Defines the ThreadPool class, a fixed set of worker threads
+*    that split loops over index ranges between them.
+*
+*********************/
+
+#pragma once
+#include <mutex>
+#include <vector>
+#include <thread>
+#include <algorithm>
+#include <functional>
+#include <condition_variable>
+
+
+
+
+
+/*  A fixed pool of worker threads for data-parallel loops.
+ *  ParallelFor splits an index range into one contiguous chunk per thread (the calling thread takes the first one),
+ *  and returns once every chunk is done. The split only depends on the range and the number of threads,
+ *  so a loop body that writes to disjoint data gives the same result on every run.  */
+class ThreadPool
+{
+public:
+    ThreadPool() : ThreadPool((int)std::max(1u, std::thread::hardware_concurrency())) { }
+    ThreadPool(int threads);
+    ~ThreadPool();
+
+    int Size() const { return (int)workers.size() + 1; }
+
+    void ParallelFor(int begin, int end, const std::function<void(int, int)>& body, int min_chunk = 1);
+
+
+private:
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;               // Signals the workers that a new loop (or shutdown) is ready.
+    std::condition_variable done;               // Signals the caller that the last chunk has finished.
+
+    const std::function<void(int, int)>* body;  // Body of the loop being run.
+    int begin, end;                             // Range of the loop being run.
+    int chunks;                                 // Number of chunks the range is split into.
+    int remaining;                              // Worker chunks not finished yet.
+    long long generation;                       // Bumped for every loop, so workers can tell a new one has started.
+    bool stopping;
+
+    void Chunk(int k, int& chunk_begin, int& chunk_end) const;
+    void Work(int index);
+};
+
+
+
+
+
+
+/*  Starts the worker threads.
+ *  @param threads: Total number of threads to run loops on, counting the calling thread.  */
+ThreadPool::ThreadPool(int threads) : body(nullptr), begin(0), end(0), chunks(0), remaining(0), generation(0), stopping(false)
+{
+    for (int i = 1; i < threads; i++)
+        workers.emplace_back(&ThreadPool::Work, this, i);
+}
+
+
+/*  Stops and joins the worker threads.  */
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto& worker : workers)
+        worker.join();
+}
+
+
+/*  Gives the range of chunk k of the current loop.  */
+void ThreadPool::Chunk(int k, int& chunk_begin, int& chunk_end) const
+{
+    const long long length = end - begin;
+    chunk_begin = begin + (int)(length * k / chunks);
+    chunk_end = begin + (int)(length * (k + 1) / chunks);
+}
+
+
+/*  Worker thread loop: waits for a new loop, runs its chunk, and reports back.  */
+void ThreadPool::Work(int index)
+{
+    long long seen = 0;
+    while (true)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        wake.wait(lock, [&]() { return stopping || generation != seen; });
+        if (stopping) return;
+        seen = generation;
+        if (index >= chunks) continue;
+        lock.unlock();
+
+        int chunk_begin, chunk_end;
+        Chunk(index, chunk_begin, chunk_end);
+        (*body)(chunk_begin, chunk_end);
+
+        lock.lock();
+        if (--remaining == 0)  done.notify_one();
+    }
+}
+
+
+/*  Runs body(chunk_begin, chunk_end) over contiguous chunks covering [begin, end), one chunk per thread.
+ *  Ranges too small to be worth waking the workers for run on the calling thread.
+ *  @param begin, end: The index range.
+ *  @param body: The loop body, called with each chunk's range. Chunks run concurrently.
+ *  @param min_chunk: The smallest number of indices to give a thread.  */
+void ThreadPool::ParallelFor(int begin, int end, const std::function<void(int, int)>& body, int min_chunk)
+{
+    const int count = std::min(Size(), (end - begin) / std::max(1, min_chunk));
+    if (count <= 1) {
+        if (begin < end) body(begin, end);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        this->body = &body;
+        this->begin = begin;
+        this->end = end;
+        chunks = count;
+        remaining = count - 1;
+        generation++;
+    }
+    wake.notify_all();
+
+    int chunk_begin, chunk_end;
+    Chunk(0, chunk_begin, chunk_end);
+    body(chunk_begin, chunk_end);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [&]() { return remaining == 0; });
+}
@@ -0,0 +1,386 @@
+/********************
+*
+*    TiledCoulomb.hpp
+*
+*    Defines the TiledCoulomb class, which sums the Coulomb force and potential over every pair of N charges
+*    in cache-sized tiles with SIMD, using each pair once for both of its charges.
+*
+*********************/
+
+#pragma once
+#include <cmath>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include "Vec2D.hpp"
+#include "ThreadPool.hpp"
+#include "ParticleSystem.hpp"   // for AlignedVector; includes "Narrowphase.hpp" (BatchNarrowphase::Level and Detect)
+
+
+
+
+
+/*  Exact all-pairs Coulomb forces for mid-sized sets of charges (a few thousand to a few tens of thousands),
+ *  where a tree's build and walk cost more than they save.
+ *  The charges are split into tiles of TILE, and every pair of tiles (I, J) with I <= J is summed once: each pair's
+ *  force is added to one charge and taken off the other (Newton's third law), so the N^2 / 2 pairs are each worked out once.
+ *  A tile's positions, charges and sums fit in L1, so a row of charges sweeps the J tile without going out to memory.
+ *  Within a tile pair, a row runs 4, 8 or 16 partners at a time (SSE2, AVX2 or AVX-512, picked at runtime as in
+ *  BatchNarrowphase), with one reciprocal square root per pair (the hardware estimate and a Newton step) giving the
+ *  1/r, 1/r^3 and potential terms together, where ChargedParticle::CoulombForce used to take three square roots.
+ *  Solve with a ThreadPool splits the tile pairs into one run per thread, each adding into its own copy of the sums,
+ *  and the copies are added up in order, so the result is the same on every run with the same number of threads.
+ *  The forces follow ChargedParticle::CoulombForce (like charges repel, with k = 8.987551787e9), between particle centers.  */
+class TiledCoulomb
+{
+public:
+    static const int TILE = 512;        // Charges in a tile.
+
+    BatchNarrowphase::Level level;      // Instruction set in use.
+    float softening;                    // Added to every squared distance, to keep close passes finite (0 for plain Coulomb).
+    float max_force;                    // Largest force one pair can exert, as in CoulombForce(particle, max_force) (0 for no limit).
+
+    AlignedVector<float> x, y, q;       // Positions and charges, from the last Load.
+    AlignedVector<float> fx, fy;        // Net Coulomb force on each charge, from the last Solve.
+    AlignedVector<float> potentials;    // Electric potential at each charge due to all the others (its potential energy is charge * potential).
+
+
+    TiledCoulomb(float softening = 0.0f, float max_force = 0.0f)
+        : level(BatchNarrowphase::Detect()), softening(softening), max_force(max_force) { }
+    TiledCoulomb(float softening, float max_force, BatchNarrowphase::Level max_level)
+        : level(std::min(BatchNarrowphase::Detect(), max_level)), softening(softening), max_force(max_force) { }
+
+    int Size() const { return (int)x.size(); }
+    Vec2D Force(int i) const { return Vec2D(fx[i], fy[i]); }
+
+    void Load(const std::vector<Vec2D>& centers, const std::vector<float>& charges);
+    template <typename P>
+    void Load(const std::vector<P>& particles);
+    void Solve(ThreadPool* pool = nullptr);
+    float PotentialEnergy() const;
+    void Results(std::vector<Vec2D>& forces, std::vector<float>& potentials) const;
+
+
+private:
+    std::vector<std::pair<int,int>> tile_pairs;     // (I, J) with I <= J, row by row.
+    AlignedVector<float> partial;                   // Per-thread sums for the threaded Solve: fx, fy, potential for each thread.
+
+    template <bool CLAMP>
+    void Tile(int I, int J, float* sum_x, float* sum_y, float* sum_phi) const;
+    void Tiles(int first, int last, float* sum_x, float* sum_y, float* sum_phi) const;
+};
+
+
+
+
+
+
+/*  Sums one row of a tile pair one partner at a time: charge i (at xi, yi, with k times its charge kqi) against partners [j, j_end).
+ *  The row's own sums go into fxi, fyi and phii (the potential without its factor of k); the partners' go straight into the arrays.  */
+template <bool CLAMP>
+static inline void CoulombRowScalar(float xi, float yi, float kqi, int j, int j_end, const float* x, const float* y, const float* q,
+                                    float softening, float max_force, float* fx, float* fy, float* phi, float& fxi, float& fyi, float& phii)
+{
+    for (; j < j_end; j++)
+    {
+        const float dx = xi - x[j], dy = yi - y[j];
+        const float inv = 1.0f / std::sqrt(dx * dx + dy * dy + softening);
+        const float kqq = kqi * q[j];
+        float s = kqq * inv * inv * inv;
+        if (CLAMP)  s *= std::min(1.0f, max_force / (std::fabs(kqq) * inv * inv));
+        fxi += s * dx;      fx[j] -= s * dx;
+        fyi += s * dy;      fy[j] -= s * dy;
+        phii += q[j] * inv; phi[j] += kqi * inv;
+    }
+}
+
+
+/*  Sums tile pair [i_begin, i_end) x [j_begin, j_end) one pair at a time (only j > i, for a tile against itself).  */
+template <bool CLAMP>
+static void CoulombTileScalar(int i_begin, int i_end, int j_begin, int j_end, const float* x, const float* y, const float* q,
+                              float softening, float max_force, float* fx, float* fy, float* phi)
+{
+    for (int i = i_begin; i < i_end; i++)
+    {
+        const float kqi = 8.987551787e9f * q[i];
+        float fxi = 0.0f, fyi = 0.0f, phii = 0.0f;
+        CoulombRowScalar<CLAMP>(x[i], y[i], kqi, std::max(j_begin, i + 1), j_end, x, y, q, softening, max_force, fx, fy, phi, fxi, fyi, phii);
+        fx[i] += fxi;
+        fy[i] += fyi;
+        phi[i] += 8.987551787e9f * phii;
+    }
+}
+
+
+#ifdef NARROWPHASE_X86
+
+/*  Sums a tile pair four partners at a time with SSE2.  */
+template <bool CLAMP>
+__attribute__((target("sse2")))
+static void CoulombTileSSE2(int i_begin, int i_end, int j_begin, int j_end, const float* x, const float* y, const float* q,
+                            float softening, float max_force, float* fx, float* fy, float* phi)
+{
+    const __m128 eps = _mm_set1_ps(softening), limit = _mm_set1_ps(max_force);
+    const __m128 one = _mm_set1_ps(1.0f), half = _mm_set1_ps(0.5f), three_halves = _mm_set1_ps(1.5f);
+    const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    for (int i = i_begin; i < i_end; i++)
+    {
+        const float kqi = 8.987551787e9f * q[i];
+        const __m128 xi = _mm_set1_ps(x[i]), yi = _mm_set1_ps(y[i]), kq = _mm_set1_ps(kqi);
+        __m128 sum_x = _mm_setzero_ps(), sum_y = _mm_setzero_ps(), sum_phi = _mm_setzero_ps();
+        int j = std::max(j_begin, i + 1);
+        for (; j + 4 <= j_end; j += 4)
+        {
+            const __m128 dx = _mm_sub_ps(xi, _mm_loadu_ps(x + j));
+            const __m128 dy = _mm_sub_ps(yi, _mm_loadu_ps(y + j));
+            const __m128 qj = _mm_loadu_ps(q + j);
+            const __m128 r2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), eps);
+            __m128 inv = _mm_rsqrt_ps(r2);
+            inv = _mm_mul_ps(inv, _mm_sub_ps(three_halves, _mm_mul_ps(_mm_mul_ps(half, r2), _mm_mul_ps(inv, inv))));
+            const __m128 inv2 = _mm_mul_ps(inv, inv);
+            const __m128 kqq = _mm_mul_ps(kq, qj);
+            __m128 s = _mm_mul_ps(_mm_mul_ps(kqq, inv2), inv);
+            if (CLAMP)  s = _mm_mul_ps(s, _mm_min_ps(one, _mm_div_ps(limit, _mm_mul_ps(_mm_and_ps(kqq, abs_mask), inv2))));
+            const __m128 sx = _mm_mul_ps(s, dx), sy = _mm_mul_ps(s, dy);
+            sum_x = _mm_add_ps(sum_x, sx);
+            sum_y = _mm_add_ps(sum_y, sy);
+            sum_phi = _mm_add_ps(sum_phi, _mm_mul_ps(qj, inv));
+            _mm_storeu_ps(fx + j, _mm_sub_ps(_mm_loadu_ps(fx + j), sx));
+            _mm_storeu_ps(fy + j, _mm_sub_ps(_mm_loadu_ps(fy + j), sy));
+            _mm_storeu_ps(phi + j, _mm_add_ps(_mm_loadu_ps(phi + j), _mm_mul_ps(kq, inv)));
+        }
+        float lanes_x[4], lanes_y[4], lanes_phi[4];
+        _mm_storeu_ps(lanes_x, sum_x);  _mm_storeu_ps(lanes_y, sum_y);  _mm_storeu_ps(lanes_phi, sum_phi);
+        float fxi = (lanes_x[0] + lanes_x[1]) + (lanes_x[2] + lanes_x[3]);
+        float fyi = (lanes_y[0] + lanes_y[1]) + (lanes_y[2] + lanes_y[3]);
+        float phii = (lanes_phi[0] + lanes_phi[1]) + (lanes_phi[2] + lanes_phi[3]);
+        CoulombRowScalar<CLAMP>(x[i], y[i], kqi, j, j_end, x, y, q, softening, max_force, fx, fy, phi, fxi, fyi, phii);
+        fx[i] += fxi;
+        fy[i] += fyi;
+        phi[i] += 8.987551787e9f * phii;
+    }
+}
+
+
+/*  Sums a tile pair eight partners at a time with AVX2.  */
+template <bool CLAMP>
+__attribute__((target("avx2")))
+static void CoulombTileAVX2(int i_begin, int i_end, int j_begin, int j_end, const float* x, const float* y, const float* q,
+                            float softening, float max_force, float* fx, float* fy, float* phi)
+{
+    const __m256 eps = _mm256_set1_ps(softening), limit = _mm256_set1_ps(max_force);
+    const __m256 one = _mm256_set1_ps(1.0f), half = _mm256_set1_ps(0.5f), three_halves = _mm256_set1_ps(1.5f);
+    const __m256 abs_mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+    for (int i = i_begin; i < i_end; i++)
+    {
+        const float kqi = 8.987551787e9f * q[i];
+        const __m256 xi = _mm256_set1_ps(x[i]), yi = _mm256_set1_ps(y[i]), kq = _mm256_set1_ps(kqi);
+        __m256 sum_x = _mm256_setzero_ps(), sum_y = _mm256_setzero_ps(), sum_phi = _mm256_setzero_ps();
+        int j = std::max(j_begin, i + 1);
+        for (; j + 8 <= j_end; j += 8)
+        {
+            const __m256 dx = _mm256_sub_ps(xi, _mm256_loadu_ps(x + j));
+            const __m256 dy = _mm256_sub_ps(yi, _mm256_loadu_ps(y + j));
+            const __m256 qj = _mm256_loadu_ps(q + j);
+            const __m256 r2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)), eps);
+            __m256 inv = _mm256_rsqrt_ps(r2);
+            inv = _mm256_mul_ps(inv, _mm256_sub_ps(three_halves, _mm256_mul_ps(_mm256_mul_ps(half, r2), _mm256_mul_ps(inv, inv))));
+            const __m256 inv2 = _mm256_mul_ps(inv, inv);
+            const __m256 kqq = _mm256_mul_ps(kq, qj);
+            __m256 s = _mm256_mul_ps(_mm256_mul_ps(kqq, inv2), inv);
+            if (CLAMP)  s = _mm256_mul_ps(s, _mm256_min_ps(one, _mm256_div_ps(limit, _mm256_mul_ps(_mm256_and_ps(kqq, abs_mask), inv2))));
+            const __m256 sx = _mm256_mul_ps(s, dx), sy = _mm256_mul_ps(s, dy);
+            sum_x = _mm256_add_ps(sum_x, sx);
+            sum_y = _mm256_add_ps(sum_y, sy);
+            sum_phi = _mm256_add_ps(sum_phi, _mm256_mul_ps(qj, inv));
+            _mm256_storeu_ps(fx + j, _mm256_sub_ps(_mm256_loadu_ps(fx + j), sx));
+            _mm256_storeu_ps(fy + j, _mm256_sub_ps(_mm256_loadu_ps(fy + j), sy));
+            _mm256_storeu_ps(phi + j, _mm256_add_ps(_mm256_loadu_ps(phi + j), _mm256_mul_ps(kq, inv)));
+        }
+        float lanes_x[8], lanes_y[8], lanes_phi[8];
+        _mm256_storeu_ps(lanes_x, sum_x);  _mm256_storeu_ps(lanes_y, sum_y);  _mm256_storeu_ps(lanes_phi, sum_phi);
+        float fxi = 0.0f, fyi = 0.0f, phii = 0.0f;
+        for (int l = 0; l < 8; l++) {
+            fxi += lanes_x[l];
+            fyi += lanes_y[l];
+            phii += lanes_phi[l];
+        }
+        CoulombRowScalar<CLAMP>(x[i], y[i], kqi, j, j_end, x, y, q, softening, max_force, fx, fy, phi, fxi, fyi, phii);
+        fx[i] += fxi;
+        fy[i] += fyi;
+        phi[i] += 8.987551787e9f * phii;
+    }
+}
+
+
+/*  Sums a tile pair sixteen partners at a time with AVX-512.  */
+template <bool CLAMP>
+__attribute__((target("avx512f")))
+static void CoulombTileAVX512(int i_begin, int i_end, int j_begin, int j_end, const float* x, const float* y, const float* q,
+                              float softening, float max_force, float* fx, float* fy, float* phi)
+{
+    const __m512 eps = _mm512_set1_ps(softening), limit = _mm512_set1_ps(max_force);
+    const __m512 one = _mm512_set1_ps(1.0f), half = _mm512_set1_ps(0.5f), three_halves = _mm512_set1_ps(1.5f);
+    for (int i = i_begin; i < i_end; i++)
+    {
+        const float kqi = 8.987551787e9f * q[i];
+        const __m512 xi = _mm512_set1_ps(x[i]), yi = _mm512_set1_ps(y[i]), kq = _mm512_set1_ps(kqi);
+        __m512 sum_x = _mm512_setzero_ps(), sum_y = _mm512_setzero_ps(), sum_phi = _mm512_setzero_ps();
+        int j = std::max(j_begin, i + 1);
+        for (; j + 16 <= j_end; j += 16)
+        {
+            const __m512 dx = _mm512_sub_ps(xi, _mm512_loadu_ps(x + j));
+            const __m512 dy = _mm512_sub_ps(yi, _mm512_loadu_ps(y + j));
+            const __m512 qj = _mm512_loadu_ps(q + j);
+            const __m512 r2 = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(dx, dx), _mm512_mul_ps(dy, dy)), eps);
+            __m512 inv = _mm512_rsqrt14_ps(r2);
+            inv = _mm512_mul_ps(inv, _mm512_sub_ps(three_halves, _mm512_mul_ps(_mm512_mul_ps(half, r2), _mm512_mul_ps(inv, inv))));
+            const __m512 inv2 = _mm512_mul_ps(inv, inv);
+            const __m512 kqq = _mm512_mul_ps(kq, qj);
+            __m512 s = _mm512_mul_ps(_mm512_mul_ps(kqq, inv2), inv);
+            if (CLAMP)  s = _mm512_mul_ps(s, _mm512_min_ps(one, _mm512_div_ps(limit, _mm512_mul_ps(_mm512_abs_ps(kqq), inv2))));
+            const __m512 sx = _mm512_mul_ps(s, dx), sy = _mm512_mul_ps(s, dy);
+            sum_x = _mm512_add_ps(sum_x, sx);
+            sum_y = _mm512_add_ps(sum_y, sy);
+            sum_phi = _mm512_add_ps(sum_phi, _mm512_mul_ps(qj, inv));
+            _mm512_storeu_ps(fx + j, _mm512_sub_ps(_mm512_loadu_ps(fx + j), sx));
+            _mm512_storeu_ps(fy + j, _mm512_sub_ps(_mm512_loadu_ps(fy + j), sy));
+            _mm512_storeu_ps(phi + j, _mm512_add_ps(_mm512_loadu_ps(phi + j), _mm512_mul_ps(kq, inv)));
+        }
+        float fxi = _mm512_reduce_add_ps(sum_x), fyi = _mm512_reduce_add_ps(sum_y), phii = _mm512_reduce_add_ps(sum_phi);
+        CoulombRowScalar<CLAMP>(x[i], y[i], kqi, j, j_end, x, y, q, softening, max_force, fx, fy, phi, fxi, fyi, phii);
+        fx[i] += fxi;
+        fy[i] += fyi;
+        phi[i] += 8.987551787e9f * phii;
+    }
+}
+
+#endif
+
+
+/*  Copies in the charges to sum over.
+ *  @param centers: Position of each charge (the particles' centers).
+ *  @param charges: Charge of each one.  */
+void TiledCoulomb::Load(const std::vector<Vec2D>& centers, const std::vector<float>& charges)
+{
+    const int n = (int)centers.size();
+    x.resize(n); y.resize(n);
+    q.assign(charges.begin(), charges.begin() + n);
+    for (int i = 0; i < n; i++)
+    {
+        x[i] = centers[i].x;
+        y[i] = centers[i].y;
+    }
+
+    const int tiles = (n + TILE - 1) / TILE;
+    tile_pairs.clear();
+    for (int I = 0; I < tiles; I++)
+        for (int J = I; J < tiles; J++)
+            tile_pairs.push_back(std::make_pair(I, J));
+}
+
+
+/*  Copies in the centers and charges of a set of ChargedParticles.  */
+template <typename P>
+void TiledCoulomb::Load(const std::vector<P>& particles)
+{
+    std::vector<Vec2D> centers(particles.size());
+    std::vector<float> charges(particles.size());
+    for (size_t i = 0; i < particles.size(); i++)
+    {
+        centers[i] = particles[i].center;
+        charges[i] = particles[i].charge;
+    }
+    Load(centers, charges);
+}
+
+
+/*  Adds tile pair (I, J)'s forces and potentials into the sums, with the instruction set in use.  */
+template <bool CLAMP>
+void TiledCoulomb::Tile(int I, int J, float* sum_x, float* sum_y, float* sum_phi) const
+{
+    const int i_begin = I * TILE, i_end = std::min(Size(), i_begin + TILE);
+    const int j_begin = J * TILE, j_end = std::min(Size(), j_begin + TILE);
+#ifdef NARROWPHASE_X86
+    switch (level) {
+        case BatchNarrowphase::AVX512:  CoulombTileAVX512<CLAMP>(i_begin, i_end, j_begin, j_end, x.data(), y.data(), q.data(), softening, max_force, sum_x, sum_y, sum_phi);  return;
+        case BatchNarrowphase::AVX2:    CoulombTileAVX2<CLAMP>(i_begin, i_end, j_begin, j_end, x.data(), y.data(), q.data(), softening, max_force, sum_x, sum_y, sum_phi);    return;
+        case BatchNarrowphase::SSE2:    CoulombTileSSE2<CLAMP>(i_begin, i_end, j_begin, j_end, x.data(), y.data(), q.data(), softening, max_force, sum_x, sum_y, sum_phi);    return;
+        default:                        break;
+    }
+#endif
+    CoulombTileScalar<CLAMP>(i_begin, i_end, j_begin, j_end, x.data(), y.data(), q.data(), softening, max_force, sum_x, sum_y, sum_phi);
+}
+
+
+/*  Adds tile pairs [first, last) into the sums.  */
+void TiledCoulomb::Tiles(int first, int last, float* sum_x, float* sum_y, float* sum_phi) const
+{
+    for (int p = first; p < last; p++)
+    {
+        if (max_force > 0.0f)   Tile<true>(tile_pairs[p].first, tile_pairs[p].second, sum_x, sum_y, sum_phi);
+        else                    Tile<false>(tile_pairs[p].first, tile_pairs[p].second, sum_x, sum_y, sum_phi);
+    }
+}
+
+
+/*  Works out the net force and the potential at every charge, from every other one.
+ *  @param pool: Threads to split the tile pairs across (run on the calling thread alone if null).  */
+void TiledCoulomb::Solve(ThreadPool* pool)
+{
+    const int n = Size();
+    const int pairs = (int)tile_pairs.size();
+    fx.assign(n, 0.0f);
+    fy.assign(n, 0.0f);
+    potentials.assign(n, 0.0f);
+
+    const int runs = pool ? std::min(pool->Size(), pairs) : 1;
+    if (runs <= 1) {
+        Tiles(0, pairs, fx.data(), fy.data(), potentials.data());
+        return;
+    }
+
+    // Each run of tile pairs adds into its own three arrays; a run's pairs are mostly from one row, so they share their I tile
+    const int stride = (n + 15) & ~15;
+    partial.resize((size_t)runs * 3 * stride);
+    pool->ParallelFor(0, runs, [&](int run_begin, int run_end) {
+        for (int r = run_begin; r < run_end; r++)
+        {
+            float* sums = partial.data() + (size_t)r * 3 * stride;
+            std::fill(sums, sums + 3 * stride, 0.0f);
+            Tiles((int)((long long)pairs * r / runs), (int)((long long)pairs * (r + 1) / runs), sums, sums + stride, sums + 2 * stride);
+        }
+    }, 1);
+    pool->ParallelFor(0, n, [&](int begin, int end) {
+        for (int r = 0; r < runs; r++)
+        {
+            const float* sums = partial.data() + (size_t)r * 3 * stride;
+            for (int i = begin; i < end; i++)
+            {
+                fx[i] += sums[i];
+                fy[i] += sums[stride + i];
+                potentials[i] += sums[2 * stride + i];
+            }
+        }
+    }, 4096);
+}
+
+
+/*  Returns the system's electric potential energy (each pair counted once), from the last Solve.  */
+float TiledCoulomb::PotentialEnergy() const
+{
+    double energy = 0.0;
+    for (int i = 0; i < Size(); i++)
+        energy += (double)q[i] * potentials[i];
+    return (float)(0.5 * energy);
+}
+
+
+/*  Copies the forces and potentials from the last Solve out, in the form BarnesHut gives them (e.g. for BarnesHut::Compare).  */
+void TiledCoulomb::Results(std::vector<Vec2D>& forces, std::vector<float>& potentials) const
+{
+    forces.resize(Size());
+    for (int i = 0; i < Size(); i++)
+        forces[i] = Vec2D(fx[i], fy[i]);
+    potentials.assign(this->potentials.begin(), this->potentials.end());
+}
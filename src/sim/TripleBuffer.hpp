@@ -0,0 +1,67 @@
+/********************
+*
+*    TripleBuffer.hpp
+*
+*    Defines the TripleBuffer class, which hands the latest version of a value
+*    from one thread to another without either of them ever waiting.
+*
+*********************/
+
+#pragma once
+#include <atomic>
+
+
+
+
+
+/*  Three copies of a value shared by one writer thread and one reader thread.
+ *  The writer fills in Back() and Publishes it; the reader calls Front() to get the newest published copy.
+ *  Publish swaps the back copy with the middle one, and Front swaps the middle one to the front if it's newer,
+ *  so the writer always has a copy to itself, the reader holds on to its copy for as long as it likes,
+ *  and neither ever blocks: a writer that publishes faster than the reader reads just replaces the middle copy.
+ *  The swaps are a single atomic exchange of the middle copy's index, with a bit saying whether it's been read yet.  */
+template <typename T>
+class TripleBuffer
+{
+public:
+    TripleBuffer() : back(0), front(2), middle(1) { }
+
+    T& Back() { return buffers[back]; }
+    void Publish();
+
+    const T& Front();
+    bool Fresh() const { return (middle.load(std::memory_order_relaxed) & FRESH) != 0; }
+
+
+private:
+    static const int FRESH = 4;     // Set on the middle index when it holds a copy the reader hasn't seen.
+    static const int INDEX = 3;
+
+    T buffers[3];
+    int back;                       // Only touched by the writer.
+    int front;                      // Only touched by the reader.
+    std::atomic<int> middle;
+};
+
+
+
+
+
+
+/*  Makes the back copy the newest one, and gives the writer the old middle copy to fill in next.  */
+template <typename T>
+void TripleBuffer<T>::Publish()
+{
+    back = middle.exchange(back | FRESH, std::memory_order_acq_rel) & INDEX;
+}
+
+
+/*  Returns the newest published copy (the one returned last time if nothing newer has been published).
+ *  The reference stays valid, and the copy unchanged, until the next call.  */
+template <typename T>
+const T& TripleBuffer<T>::Front()
+{
+    if (Fresh())
+        front = middle.exchange(front, std::memory_order_acq_rel) & INDEX;
+    return buffers[front];
+}
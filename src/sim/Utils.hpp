@@ -1,5 +1,13 @@
+#pragma once
 #include <iostream>
 #include "Particle2D.hpp"
+#include "ContactManager.hpp"
+#include "EventDriven.hpp"
+#include "Narrowphase.hpp"
+#include "ThreadPool.hpp"
+#include "ContactColoring.hpp"
+#include "Sleep.hpp"
+#include "ParticleSystem.hpp"
 
 
 
@@ -15,15 +23,181 @@ void print(Particle2D& particle, int n, const int fps)
         print(particle);
 }
 
+void print(ParticleView particle)
+{
+    std::cout << particle;
+    particle.State().print();
+}
+
+void print(ParticleView particle, int n, const int fps)
+{
+    if (n % fps == 0)
+        print(particle);
+}
+
 
 
-// Loops through all particles and calls their resolveCollision() function to resolve their collisions.
+// Loops through all pairs of particles and calls resolveCollision() to resolve their collisions.
+// Each pair is visited once; visiting (j, i) after (i, j) never did anything, since the pair is separating by then.
 void resolveCollisions(std::vector<Particle2D>& particles)
 {
-    for (int i = 0; i < particles.size(); i++)
-        for (int j = 0; j < particles.size(); j++)
-            if (i != j)
-                particles[i].resolveCollision(particles[j]);
+    for (size_t i = 0; i < particles.size(); i++)
+        for (size_t j = i + 1; j < particles.size(); j++)
+            particles[i].resolveCollision(particles[j]);
+}
+
+
+// Copies each particle's center and radius into the given vectors, for handing to a broadphase.
+void gatherBounds(std::vector<Particle2D>& particles, std::vector<Vec2D>& centers, std::vector<float>& radii)
+{
+    centers.clear();
+    radii.clear();
+    centers.reserve(particles.size());
+    radii.reserve(particles.size());
+    for (auto& particle : particles)
+    {
+        centers.push_back(particle.center);
+        radii.push_back(particle.radius);
+    }
+}
+
+
+// Asks a broadphase (SpatialHash, SweepAndPrune or AABBTree) for candidate pairs, and only calls resolveCollision() on those.
+// The broadphase needs a FindPairs(centers, radii) method returning a list of (i, j) index pairs.
+template <typename Broadphase>
+void resolveCollisions(std::vector<Particle2D>& particles, Broadphase& broadphase)
+{
+    std::vector<Vec2D> centers;
+    std::vector<float> radii;
+    gatherBounds(particles, centers, radii);
+
+    for (auto& pair : broadphase.FindPairs(centers, radii))
+        particles[pair.first].resolveCollision(particles[pair.second]);
+}
+
+
+// Calls resolveCollision() on a contact's two particles,
+// and stores the impulse applied along the contact's normal on the contact, where it persists across frames.
+void resolveContact(std::vector<Particle2D>& particles, const std::vector<Vec2D>& centers, ContactManager::Contact& contact)
+{
+    Particle2D& a = particles[contact.a];
+    Vec2D before = a.state.velocity;
+    a.resolveCollision(particles[contact.b]);
+
+    Vec2D normal = centers[contact.b] - centers[contact.a];
+    float length = normal.magnitude();
+    contact.normal_impulse = (length > 0.0f) ? a.mass * (before - a.state.velocity).dot(normal) / length : 0.0f;
+}
+
+
+// Runs the broadphase's candidate pairs through a ContactManager, then resolves each contact once.
+template <typename Broadphase>
+void resolveCollisions(std::vector<Particle2D>& particles, Broadphase& broadphase, ContactManager& contacts)
+{
+    std::vector<Vec2D> centers;
+    std::vector<float> radii;
+    gatherBounds(particles, centers, radii);
+    contacts.Update(broadphase.FindPairs(centers, radii), centers, radii);
+
+    for (auto& contact : contacts.contacts)
+        resolveContact(particles, centers, contact);
+}
+
+
+// Same as above, but on several threads. The contacts are colored so that no two contacts of a color share a particle,
+// then the colors are resolved one after the other, with each color's contacts split across the pool.
+// The coloring doesn't depend on the thread count, so neither does the result.
+template <typename Broadphase>
+void resolveCollisions(std::vector<Particle2D>& particles, Broadphase& broadphase, ContactManager& contacts, ContactColoring& coloring, ThreadPool& pool)
+{
+    std::vector<Vec2D> centers;
+    std::vector<float> radii;
+    gatherBounds(particles, centers, radii);
+    contacts.Update(broadphase.FindPairs(centers, radii), centers, radii);
+    coloring.Color(contacts.contacts, (int)particles.size());
+
+    for (int c = 0; c < coloring.Colors(); c++)
+    {
+        const int begin = coloring.color_start[c];
+        const int end = coloring.color_start[c + 1];
+        if (coloring.overflow && c == coloring.Colors() - 1) {
+            for (int k = begin; k < end; k++)
+                resolveContact(particles, centers, contacts.contacts[coloring.order[k]]);
+            continue;
+        }
+        pool.ParallelFor(begin, end, [&](int chunk_begin, int chunk_end) {
+            for (int k = chunk_begin; k < chunk_end; k++)
+                resolveContact(particles, centers, contacts.contacts[coloring.order[k]]);
+        }, 256);
+    }
+}
+
+
+// Same as the ContactManager version, but contacts between two sleeping particles are skipped.
+// A sleeping particle hit faster than sleep.wake_speed wakes up (with its island) and takes part in the collision,
+// while a slower hit just bounces the moving particle off it, as if the sleeping one were part of the floor.
+template <typename Broadphase>
+void resolveCollisions(std::vector<Particle2D>& particles, Broadphase& broadphase, ContactManager& contacts, SleepManager& sleep)
+{
+    std::vector<Vec2D> centers;
+    std::vector<float> radii;
+    gatherBounds(particles, centers, radii);
+    contacts.Update(broadphase.FindPairs(centers, radii), centers, radii);
+
+    for (auto& contact : contacts.contacts)
+    {
+        const bool a_asleep = sleep.IsAsleep(contact.a);
+        const bool b_asleep = sleep.IsAsleep(contact.b);
+        if (a_asleep && b_asleep) continue;
+
+        if (a_asleep || b_asleep)
+        {
+            const int sleeper = a_asleep ? contact.a : contact.b;
+            Particle2D& mover = particles[a_asleep ? contact.b : contact.a];
+            Vec2D normal = centers[sleeper] - mover.center;
+            float length = normal.magnitude();
+            if (length == 0.0f) continue;
+            normal = normal / length;
+
+            float approach = mover.state.velocity.dot(normal);
+            if (approach <= 0.0f) continue;
+            if (approach > sleep.wake_speed) sleep.Wake(sleeper);
+            else {
+                mover.state.velocity = (mover.state.velocity - normal * (2.0f * approach)) * mover.restitution;
+                continue;
+            }
+        }
+        resolveContact(particles, centers, contact);
+    }
+}
+
+
+// Runs the broadphase's candidate pairs through a BatchNarrowphase, which tests them several at a time with SIMD.
+// The particles are copied into flat arrays on the way in, and the new velocities are copied back out at the end.
+template <typename Broadphase>
+void resolveCollisions(std::vector<Particle2D>& particles, Broadphase& broadphase, BatchNarrowphase& narrowphase)
+{
+    std::vector<Vec2D> centers;
+    std::vector<float> radii;
+    gatherBounds(particles, centers, radii);
+    const auto& pairs = broadphase.FindPairs(centers, radii);
+
+    const size_t n = particles.size();
+    std::vector<float> px(n), py(n), vx(n), vy(n), mass(n), restitution(n);
+    for (size_t i = 0; i < n; i++)
+    {
+        px[i] = particles[i].state.position.x;
+        py[i] = particles[i].state.position.y;
+        vx[i] = particles[i].state.velocity.x;
+        vy[i] = particles[i].state.velocity.y;
+        mass[i] = particles[i].mass;
+        restitution[i] = particles[i].restitution;
+    }
+
+    narrowphase.Resolve(pairs, px.data(), py.data(), vx.data(), vy.data(), mass.data(), radii.data(), restitution.data(), true);
+
+    for (size_t i = 0; i < n; i++)
+        particles[i].state.velocity = Vec2D(vx[i], vy[i]);
 }
 
 
@@ -44,13 +218,44 @@ void update(std::vector<Particle2D>& particles, const float dt, sf::RenderWindow
 }
 
 
+// Draws and prints every particle, then the total energy, after a parallel update.
+// The energies are added up in index order, as the serial loops do, so the total is the same as theirs on any number of threads.
+// With walls set, each particle's wall collision messages from update(dt, false) are printed first, where the serial update() prints them.
+void drawAndReport(std::vector<Particle2D>& particles, sf::RenderWindow& window, int n, const int fps, bool walls)
+{
+    float completeEnergy = 0.0f;
+    for (auto& particle : particles)
+    {
+        if (walls) particle.printWallHits();
+        particle.draw(window);
+        print(particle, n, fps);
+        completeEnergy += particle.state.totalEnergy;
+    }
+    if (n % fps == 0)
+        std::cout << std::endl << std::endl << "Total Energy: " << completeEnergy << std::endl << std::endl << std::endl;
+}
+
+
+// Same as update() above, but the particles' update() calls are split between the pool's threads.
+// Each update() only touches its own particle, and its wall collision messages are held back until the drawing and printing,
+// which are left on the calling thread with the energy total.
+void update(std::vector<Particle2D>& particles, const float dt, sf::RenderWindow& window, int n, const int fps, ThreadPool& pool)
+{
+    pool.ParallelFor(0, (int)particles.size(), [&](int begin, int end) {
+        for (int i = begin; i < end; i++)
+            particles[i].update(dt, false);
+    }, 256);
+    drawAndReport(particles, window, n, fps, true);
+}
+
+
 
 
 
 
 // Advances the physics state ahead from t to t+dt using one set of derivatives,
 // and once there, recalculates the derivatives at this new state.
-Particle2D::Derivative evaluate(const Particle2D::State& initial, double t, float dt, const Particle2D::Derivative& d)
+Particle2D::Derivative evaluate(const Particle2D::State& initial, [[maybe_unused]] double t, float dt, const Particle2D::Derivative& d)
 {
     Particle2D::State state;
     state.position = initial.position - d.dpos * dt;
@@ -145,4 +350,148 @@ void updateRK(std::vector<Particle2D>& particles, double t, float dt, sf::Render
     }
     if (n % fps == 0)
         std::cout << std::endl << std::endl << "Total Energy: " << completeEnergy << std::endl << std::endl << std::endl;
+}
+
+
+// Same as above, but the particles' Runge-Kutta steps are split between the pool's threads,
+// with the drawing, printing and energy total done afterwards on the calling thread.
+void updateRK(std::vector<Particle2D>& particles, double t, float dt, sf::RenderWindow& window, int n, const int fps, ThreadPool& pool)
+{
+    pool.ParallelFor(0, (int)particles.size(), [&](int begin, int end) {
+        for (int i = begin; i < end; i++)
+            updateRK(particles[i].state, t, dt, particles[i]);
+    }, 256);
+    drawAndReport(particles, window, n, fps, false);
+}
+
+
+// Advances the awake particles one step via the Runge-Kutta method, without drawing anything (sleeping particles aren't integrated).
+// Afterwards the SleepManager looks at this step's contacts for islands that have come to rest, and puts them to sleep.
+void stepRK(std::vector<Particle2D>& particles, double t, float dt, int n, const int fps, ContactManager& contacts, SleepManager& sleep)
+{
+    float completeEnergy = 0.0f;
+    for (size_t i = 0; i < particles.size(); i++)
+    {
+        Particle2D& particle = particles[i];
+        if (!sleep.IsAsleep(i))
+            updateRK(particle.state, t, dt, particle);
+        print(particle, n, fps);
+        completeEnergy += particle.state.totalEnergy;
+    }
+
+    std::vector<Vec2D> velocities;
+    std::vector<float> masses;
+    velocities.reserve(particles.size());
+    masses.reserve(particles.size());
+    for (auto& particle : particles)
+    {
+        velocities.push_back(particle.state.velocity);
+        masses.push_back(particle.mass);
+    }
+    sleep.Update(velocities, masses, contacts.contacts, dt);
+
+    for (size_t i = 0; i < particles.size(); i++)
+    {
+        if (!sleep.IsAsleep(i)) continue;
+        Particle2D::State& state = particles[i].state;
+        state.velocity = velocities[i];
+        state.momentum = particles[i].mass * state.velocity;
+        state.kineticEnergy = 0.0f;
+        state.totalEnergy = state.potentialEnergy;
+    }
+
+    if (n % fps == 0)
+        std::cout << std::endl << std::endl << "Total Energy: " << completeEnergy << std::endl
+                  << sleep.stats << std::endl << std::endl << std::endl;
+}
+
+
+// Same as above, then draws every particle (sleeping ones included).
+void updateRK(std::vector<Particle2D>& particles, double t, float dt, sf::RenderWindow& window, int n, const int fps, ContactManager& contacts, SleepManager& sleep)
+{
+    stepRK(particles, t, dt, n, fps, contacts, sleep);
+    for (auto& particle : particles)
+        particle.draw(window);
+}
+
+
+// Copies each particle's position, so the next frame can be drawn between it and the position after the next step.
+void savePositions(std::vector<Particle2D>& particles, std::vector<Vec2D>& positions)
+{
+    positions.resize(particles.size());
+    for (size_t i = 0; i < particles.size(); i++)
+        positions[i] = particles[i].state.position;
+}
+
+
+// Draws each particle a fraction alpha of the way from its saved previous position to its current one
+// (alpha from a SimulationClock, so the motion looks smooth when steps and frames don't line up).
+void draw(std::vector<Particle2D>& particles, const std::vector<Vec2D>& previous, float alpha, sf::RenderWindow& window)
+{
+    for (size_t i = 0; i < particles.size(); i++)
+    {
+        Particle2D& particle = particles[i];
+        if (i < previous.size())
+            particle.image.setPosition(previous[i] + (particle.state.position - previous[i]) * alpha);
+        particle.draw(window);
+    }
+}
+
+
+// Updates every particle of a ParticleSystem via the Runge-Kutta method in one pass over its arrays,
+// then draws and prints each one through a ParticleView. (Takes the time like the other updateRK overloads;
+// gravity is constant, so the step doesn't need it.)
+void updateRK(ParticleSystem& particles, double, float dt, sf::RenderWindow& window, int n, const int fps)
+{
+    particles.UpdateRK(dt);
+    for (int i = 0; i < particles.Size(); i++)
+    {
+        particles[i].draw(window);
+        print(particles[i], n, fps);
+    }
+    if (n % fps == 0)
+        std::cout << std::endl << std::endl << "Total Energy: " << particles.TotalEnergy() << std::endl << std::endl << std::endl;
+}
+
+
+
+
+
+
+// Loads the particles into an event-driven simulation and predicts its first events.
+// Particle2D positions are top-left corners, so they're converted to centers on the way in.
+void loadEventDriven(std::vector<Particle2D>& particles, EventDrivenSimulation& simulation)
+{
+    simulation.balls.clear();
+    for (auto& particle : particles)
+        simulation.Add(particle.state.position + Vec2D(particle.radius, particle.radius), particle.state.velocity, particle.radius, particle.mass);
+    simulation.Initialize();
+}
+
+
+// Copies the event-driven simulation's state at time t back into the particles, ready for drawing or printing.
+// Call simulation.Advance(t) first, so that no events are left before t.
+void storeEventDriven(EventDrivenSimulation& simulation, double t, std::vector<Particle2D>& particles)
+{
+    for (size_t i = 0; i < particles.size(); i++)
+    {
+        Particle2D& particle = particles[i];
+        particle.state.position = simulation.PositionAt(i, t) - Vec2D(particle.radius, particle.radius);
+        particle.state.velocity = simulation.VelocityAt(i, t);
+        particle.height = 600 - particle.state.position.y - particle.diameter;
+        particle.state.momentum = particle.mass * particle.state.velocity;
+        particle.state.kineticEnergy = (particle.mass/2) * particle.state.velocity.dot(particle.state.velocity);
+        particle.state.potentialEnergy = particle.mass * g.y * particle.height;
+        particle.state.totalEnergy = particle.state.kineticEnergy + particle.state.potentialEnergy;
+
+        // Update the image
+        particle.image.setPosition(particle.state.position);
+
+        // Update the particle's location parameters
+        particle.left = Vec2D(particle.state.position.x, particle.state.position.y + particle.radius);
+        particle.right = Vec2D(particle.state.position.x + particle.diameter, particle.state.position.y + particle.radius);
+        particle.center = Vec2D(particle.state.position.x + particle.radius, particle.state.position.y + particle.radius);
+        particle.top = Vec2D(particle.state.position.x + particle.radius, particle.state.position.y);
+        particle.bottom = Vec2D(particle.state.position.x + particle.radius, particle.state.position.y + particle.diameter);
+    }
 }
\ No newline at end of file
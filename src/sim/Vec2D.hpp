@@ -1,3 +1,4 @@
+#pragma once
 #include <cmath>
 #include <SFML/Graphics.hpp>
 
@@ -62,6 +63,13 @@ public:
     // Returns the angle a Vec2D object makes with the +x-axis, in radians.
     float angle() const { return atan2(y, x); }                                     // this angle (float = Vec2D.angle())
 
+    // Returns the angle a Vec2D object makes with the +x-axis, in radians, from 0 to 2pi.
+    float angle2pi() const { float a = atan2(y, x); return (a < 0) ? a + 6.28318530718f : a; }     // this angle, 0 to 2pi (float = Vec2D.angle2pi())
+
+    // Returns a Vec2D object mirrored across the x-axis,
+    // i.e. with the y-axis pointing up rather than down the window.
+    Vec2D flipX() const { return Vec2D(x, -y); }                                      // this flipped (Vec2D = Vec2D.flipX())
+
     // Returns the normalized (unit) vector of a Vec2D object.
     Vec2D normalize() const { return *this / magnitude(); }                          // this normalized (Vec2D = Vec2D.normalize())
 
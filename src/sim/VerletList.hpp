@@ -0,0 +1,158 @@
+/********************
+*
+*    VerletList.hpp
+*
+*    Defines the VerletList class,
+*    a neighbour list that is only rebuilt once the particles have moved far enough to need it.
+*
+*********************/
+
+#pragma once
+#include <cmath>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include "Vec2D.hpp"    // includes:  <cmath> and <SFML/Graphics.hpp>
+#include "SpatialHash.hpp"
+
+
+
+
+
+/*  Verlet neighbour list: every pair whose centers are within radii[i] + radii[j] + cutoff + skin, kept from step to step.
+ *  A pair that's out of reach when the list is built (the particles' radii plus `cutoff` apart) can only come into reach
+ *  once the two particles have closed the `skin` between them, so the list stays complete until some particle has moved
+ *  more than skin / 2 from where it was when the list was built; only then is it rebuilt (with a SpatialHash).
+ *  In between, a step just checks how far each particle has moved. A wider skin means fewer rebuilds but more pairs
+ *  to go through each step; in a dense granular run, a skin of a few percent of a diameter lasts 10-20 steps.
+ *  Has the same FindPairs(centers, radii) interface as the other broadphases (the pairs are a superset of theirs; the
+ *  narrowphase skips the ones that don't touch). For a force with a cutoff, pass half the cutoff as every radius.
+ *  Pairs are (i, j) with i < j, sorted, so the pairs of particle i are pairs[first[i]] up to pairs[first[i + 1]].  */
+class VerletList
+{
+public:
+    float skin;                                 // Extra reach kept in the list, to cover the particles' movement between rebuilds.
+    float cutoff;                               // Reach beyond the radii (0 to only find contacts).
+    std::vector<std::pair<int,int>> pairs;      // Pairs within reach + skin, as of the last rebuild.
+    std::vector<int> first;                     // Offset of each particle's first pair in `pairs` (one extra entry marks the end).
+
+    /*  How often the list has been rebuilt, and what it holds.  */
+    struct Stats
+    {
+        long long steps = 0;                    // Calls to FindPairs (or Update).
+        long long rebuilds = 0;
+        int steps_since_rebuild = 0;
+        float max_displacement = 0.0f;          // Furthest any particle had moved from the last rebuild, on the last step.
+        size_t bytes = 0;                       // Memory held by the list, and the positions it was built at.
+
+        double StepsPerRebuild() const { return rebuilds > 0 ? (double)steps / rebuilds : 0.0; }
+    };
+    Stats stats;
+
+
+    VerletList() : skin(2.f), cutoff(0.f) { }
+    VerletList(float skin, float cutoff = 0.f) : skin(skin), cutoff(cutoff) { }
+
+    bool NeedsRebuild(const std::vector<Vec2D>& centers, const std::vector<float>& radii);
+    void Rebuild(const std::vector<Vec2D>& centers, const std::vector<float>& radii);
+    bool Update(const std::vector<Vec2D>& centers, const std::vector<float>& radii);
+    const std::vector<std::pair<int,int>>& FindPairs(const std::vector<Vec2D>& centers, const std::vector<float>& radii);
+
+
+private:
+    SpatialHash grid;
+    std::vector<Vec2D> built_centers;           // Each particle's center when the list was last built,
+    std::vector<float> built_radii;             // and its radius.
+    std::vector<float> reach;                   // Each radius grown by half of cutoff + skin, for the hash.
+    float built_skin = 0.f, built_cutoff = 0.f;
+};
+
+
+
+
+
+
+/*  Returns whether the list has to be rebuilt before it can be used for these positions: some particle has moved more than
+ *  skin / 2 since the last rebuild, the number of particles has changed, or a radius, the skin or the cutoff has grown.
+ *  Records the largest displacement in stats.max_displacement.
+ *  @param centers: The center of each particle.
+ *  @param radii: The radius of each particle (same length as centers).  */
+bool VerletList::NeedsRebuild(const std::vector<Vec2D>& centers, const std::vector<float>& radii)
+{
+    const int n = (int)centers.size();
+    if (n != (int)built_centers.size() || stats.rebuilds == 0 || skin > built_skin || cutoff > built_cutoff) return true;
+
+    float max_d2 = 0.f;
+    bool grown = false;
+    for (int i = 0; i < n; i++)
+    {
+        const float dx = centers[i].x - built_centers[i].x;
+        const float dy = centers[i].y - built_centers[i].y;
+        max_d2 = std::max(max_d2, dx * dx + dy * dy);
+        grown |= (radii[i] > built_radii[i]);
+    }
+    stats.max_displacement = std::sqrt(max_d2);
+    return grown || 2.f * stats.max_displacement > skin;
+}
+
+
+/*  Rebuilds the list from scratch: bins the particles into a SpatialHash with their reach grown by half of cutoff + skin,
+ *  and keeps the pairs whose centers are within reach + skin of each other.
+ *  @param centers: The center of each particle.
+ *  @param radii: The radius of each particle (same length as centers).  */
+void VerletList::Rebuild(const std::vector<Vec2D>& centers, const std::vector<float>& radii)
+{
+    const int n = (int)centers.size();
+    const float grow = 0.5f * (cutoff + skin);
+    reach.resize(n);
+    for (int i = 0; i < n; i++)  reach[i] = radii[i] + grow;
+
+    pairs.clear();
+    first.assign(n + 1, 0);
+    for (auto& pair : grid.FindPairs(centers, reach))
+    {
+        const float dx = centers[pair.second].x - centers[pair.first].x;
+        const float dy = centers[pair.second].y - centers[pair.first].y;
+        const float range = reach[pair.first] + reach[pair.second];
+        if (dx * dx + dy * dy < range * range) {
+            pairs.push_back(pair);
+            first[pair.first + 1]++;
+        }
+    }
+    for (int i = 0; i < n; i++)  first[i + 1] += first[i];
+
+    built_centers.assign(centers.begin(), centers.end());
+    built_radii.assign(radii.begin(), radii.end());
+    built_skin = skin;
+    built_cutoff = cutoff;
+    stats.rebuilds++;
+    stats.steps_since_rebuild = 0;
+    stats.max_displacement = 0.f;
+    stats.bytes = pairs.capacity() * sizeof(pairs[0]) + first.capacity() * sizeof(int) + built_centers.capacity() * sizeof(Vec2D)
+                + (built_radii.capacity() + reach.capacity()) * sizeof(float);
+}
+
+
+/*  Counts a step, and rebuilds the list if it needs it. Returns whether it was rebuilt.
+ *  @param centers: The center of each particle.
+ *  @param radii: The radius of each particle (same length as centers).  */
+bool VerletList::Update(const std::vector<Vec2D>& centers, const std::vector<float>& radii)
+{
+    stats.steps++;
+    if (NeedsRebuild(centers, radii)) {
+        Rebuild(centers, radii);
+        return true;
+    }
+    stats.steps_since_rebuild++;
+    return false;
+}
+
+
+/*  Updates the list (see Update) and returns it: every pair within radii[i] + radii[j] + cutoff of each other is in it.
+ *  @param centers: The center of each particle.
+ *  @param radii: The radius of each particle (same length as centers).  */
+const std::vector<std::pair<int,int>>& VerletList::FindPairs(const std::vector<Vec2D>& centers, const std::vector<float>& radii)
+{
+    Update(centers, radii);
+    return pairs;
+}
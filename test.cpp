@@ -0,0 +1,568 @@
+#include <cmath>
+#include <atomic>
+#include <random>
+#include <thread>
+#include <string>
+#include <vector>
+#include <utility>
+#include <cstdlib>
+#include <sstream>
+#include <iomanip>
+#include <iostream>
+#include <algorithm>
+#include "src/sim/SpatialHash.hpp"
+#include "src/sim/SweepAndPrune.hpp"
+#include "src/sim/AABBTree.hpp"
+#include "src/sim/Particle.hpp"
+#include "src/sim/Particle2D.hpp"
+#include "src/sim/EventDriven.hpp"
+#include "src/sim/Narrowphase.hpp"
+#include "src/sim/TripleBuffer.hpp"
+#include "src/sim/Snapshot.hpp"
+#include "src/sim/Respa.hpp"
+#include "src/sim/ChargedParticle.hpp"
+#include "src/sim/TiledCoulomb.hpp"
+#include "src/sim/AdaptiveCoulomb.hpp"
+
+// Checks on the simulation's behaviour. Build and run with `make test`,
+// or with `make tsan` to run them under ThreadSanitizer (which also checks the threaded ones for data races).
+// Prints a line per check, and exits with a failure if any check fails.
+
+int failures = 0;
+
+
+
+// Prints whether a check passed, and counts it if it didn't.
+void check(bool passed, const std::string& name)
+{
+    std::cout << (passed ? "   > pass:  " : "   > FAIL:  ") << name << std::endl;
+    if (!passed) failures++;
+}
+
+
+
+// Forwards FindPairs to another broadphase, and keeps the centers it was asked about and the pairs it found.
+template <typename Broadphase>
+struct RecordingBroadphase
+{
+    Broadphase broadphase;
+    std::vector<Vec2D> centers;
+    std::vector<std::pair<int,int>> pairs;
+
+    const std::vector<std::pair<int,int>>& FindPairs(const std::vector<Vec2D>& centers, const std::vector<float>& radii)
+    {
+        this->centers = centers;
+        pairs = broadphase.FindPairs(centers, radii);
+        return pairs;
+    }
+};
+
+
+// Particles with radii from 2 to 40 scattered densely, so many pairs overlap and the radii differ a lot within them.
+std::vector<Particle> makeMixedParticles(int n, unsigned int seed)
+{
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> radius(2.0f, 40.0f);
+    std::uniform_real_distribution<float> position(0.0f, 20.0f * std::sqrt((float)n));
+    std::vector<Particle> particles;
+    particles.reserve(n);
+    for (int i = 0; i < n; i++)
+        particles.emplace_back("", sf::Color::White, 1.0f, radius(rng), Vec2D(position(rng), position(rng)), Vec2D(0.0f, 0.0f));
+    return particles;
+}
+
+
+// ResolveCollisions(particles, broadphase) has to hand the broadphase the particles' centers,
+// so that every pair that overlaps (as OverlappingWith sees it) is among the candidates, whatever the radii.
+template <typename Broadphase>
+void checkParticleBroadphase(const std::string& name)
+{
+    std::vector<Particle> particles = makeMixedParticles(500, 7u);
+    std::vector<std::pair<int,int>> overlapping;
+    for (int i = 0; i < (int)particles.size(); i++)
+        for (int j = i + 1; j < (int)particles.size(); j++)
+            if (particles[i].OverlappingWith(particles[j]))
+                overlapping.emplace_back(i, j);
+
+    RecordingBroadphase<Broadphase> recorder;
+    ResolveCollisions(particles, recorder);
+    std::vector<std::pair<int,int>> found;
+    for (auto pair : recorder.pairs)
+        found.emplace_back(std::min(pair.first, pair.second), std::max(pair.first, pair.second));
+    std::sort(found.begin(), found.end());
+
+    bool centers = true;
+    for (int i = 0; i < (int)particles.size(); i++)
+        centers &= (recorder.centers[i] == particles[i].center);
+    bool complete = !overlapping.empty();
+    for (auto pair : overlapping)
+        complete &= std::binary_search(found.begin(), found.end(), pair);
+    check(centers && complete, name + " finds all " + std::to_string(overlapping.size()) + " overlapping pairs of mixed-radius Particles");
+}
+
+
+
+// The collision response as it was before it went trig-free: rotate both velocities into the collision frame,
+// exchange the x-components, and rotate back (with the restitution applied after, as the old overloads did).
+void resolveCollisionTrig(Particle& a, Particle& b, float restitution)
+{
+    const float dx = b.kinematics.position.x - a.kinematics.position.x, dy = b.kinematics.position.y - a.kinematics.position.y;
+    const float dvx = a.kinematics.velocity.x - b.kinematics.velocity.x, dvy = a.kinematics.velocity.y - b.kinematics.velocity.y;
+    if (a.OverlappingWith(b) && dvx * dx + dvy * dy >= 0)
+    {
+        const float angle = -atan2(dy, dx);
+        const float m1 = a.mass, m2 = b.mass;
+        Vec2D u1 = a.Rotate(a.kinematics.velocity, angle);
+        Vec2D u2 = a.Rotate(b.kinematics.velocity, angle);
+        Vec2D v1 = Vec2D((u1.x * (m1 - m2) / (m1 + m2)) + (u2.x * 2 * m2 / (m1 + m2)), u1.y);
+        Vec2D v2 = Vec2D((u2.x * (m2 - m1) / (m1 + m2)) + (u1.x * 2 * m1 / (m1 + m2)), u2.y);
+        a.kinematics.velocity = a.Rotate(v1, -angle) * restitution;
+        b.kinematics.velocity = a.Rotate(v2, -angle) * restitution;
+    }
+}
+
+void resolveCollisionTrig(Particle2D& a, Particle2D& b)
+{
+    const float dx = b.state.position.x - a.state.position.x, dy = b.state.position.y - a.state.position.y;
+    const float dvx = a.state.velocity.x - b.state.velocity.x, dvy = a.state.velocity.y - b.state.velocity.y;
+    if (a.overlapping(b) && dvx * dx + dvy * dy >= 0)
+    {
+        const float angle = -atan2(dy, dx);
+        const float m1 = a.mass, m2 = b.mass;
+        Vec2D u1 = a.rotate(a.state.velocity, angle);
+        Vec2D u2 = a.rotate(b.state.velocity, angle);
+        Vec2D v1 = Vec2D((u1.x * (m1 - m2) / (m1 + m2)) + (u2.x * 2 * m2 / (m1 + m2)), u1.y);
+        Vec2D v2 = Vec2D((u2.x * (m2 - m1) / (m1 + m2)) + (u1.x * 2 * m1 / (m1 + m2)), u2.y);
+        a.state.velocity = a.rotate(v1, -angle) * a.restitution;
+        b.state.velocity = a.rotate(v2, -angle) * a.restitution;
+    }
+}
+
+
+// Both Particle::ResolveCollisionWith overloads, and Particle2D::resolveCollision, have to give the velocities
+// the rotate-based response gave, to within float rounding, on random pairs (some of them moving apart, which are left alone).
+void checkCollisionResponse()
+{
+    const int PAIRS = 20000;
+    std::mt19937 rng(13u);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+    std::uniform_real_distribution<float> mass(0.5f, 8.0f);
+    float worst[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    int responded = 0;      // Pairs the reference changed the velocities of (the rest were moving apart)
+    auto difference = [](Vec2D v, Vec2D reference) { return (v - reference).magnitude() / std::max(1.0f, reference.magnitude()); };
+
+    for (int k = 0; k < PAIRS; k++)
+    {
+        const Vec2D offset = Vec2D(unit(rng), unit(rng)) * 10.0f;      // Closer than the radii, so always overlapping
+        const Vec2D va = Vec2D(unit(rng), unit(rng)) * 50.0f, vb = Vec2D(unit(rng), unit(rng)) * 50.0f;
+        const float ma = mass(rng), mb = mass(rng);
+
+        for (int r = 0; r < 2; r++)
+        {
+            const float restitution = r ? 0.9f : 1.0f;
+            Particle a("", sf::Color::White, ma, 10.0f, Vec2D(100.0f, 100.0f), va), b("", sf::Color::White, mb, 10.0f, Vec2D(100.0f, 100.0f) + offset, vb);
+            Particle ra = a, rb = b;
+            if (r)  a.ResolveCollisionWith(b, restitution);
+            else    a.ResolveCollisionWith(b);
+            resolveCollisionTrig(ra, rb, restitution);
+            responded += (r == 0 && (ra.kinematics.velocity.x != va.x || ra.kinematics.velocity.y != va.y));
+            worst[r] = std::max(worst[r], std::max(difference(a.kinematics.velocity, ra.kinematics.velocity), difference(b.kinematics.velocity, rb.kinematics.velocity)));
+
+            Particle2D c("", ma, 10.0f, sf::Color::White, Vec2D(100.0f, 100.0f), va, g, restitution), d("", mb, 10.0f, sf::Color::White, Vec2D(100.0f, 100.0f) + offset, vb, g, restitution);
+            Particle2D rc = c, rd = d;
+            c.resolveCollision(d);
+            resolveCollisionTrig(rc, rd);
+            worst[2 + r] = std::max(worst[2 + r], std::max(difference(c.state.velocity, rc.state.velocity), difference(d.state.velocity, rd.state.velocity)));
+        }
+    }
+
+    const char* names[4] = { "Particle::ResolveCollisionWith(particle)", "Particle::ResolveCollisionWith(particle, 0.9)",
+                             "Particle2D::resolveCollision (restitution 1)", "Particle2D::resolveCollision (restitution 0.9)" };
+    for (int i = 0; i < 4; i++)
+    {
+        std::ostringstream line;
+        line << names[i] << " matches the rotate-based response on " << PAIRS << " pairs, " << responded << " colliding (worst relative difference "
+             << std::scientific << std::setprecision(1) << worst[i] << ")";
+        check(worst[i] < 1e-4f && responded > 0, line.str());
+    }
+}
+
+
+
+// Every instruction set has to end up with exactly the velocities the pairs give resolved one at a time, in order.
+// The balls are packed tight, so many particles are in several colliding pairs of a chunk and have to wait for the batch.
+void checkNarrowphaseLevels()
+{
+    const int n = 4000;
+    std::mt19937 rng(11u);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    std::vector<float> px(n), py(n), vx(n), vy(n), mass(n), radius(n), restitution(n);
+    const float side = std::sqrt((float)n) * 18.0f;
+    for (int i = 0; i < n; i++) {
+        px[i] = unit(rng) * side;
+        py[i] = unit(rng) * side;
+        vx[i] = unit(rng) * 100.0f - 50.0f;
+        vy[i] = unit(rng) * 100.0f - 50.0f;
+        radius[i] = 10.0f + 10.0f * unit(rng);
+        mass[i] = radius[i] / 10.0f;
+        restitution[i] = (i % 2) ? 1.0f : 0.9f;
+    }
+    std::vector<Vec2D> centers;
+    for (int i = 0; i < n; i++)  centers.emplace_back(px[i], py[i]);
+    SpatialHash grid;
+    const std::vector<std::pair<int,int>> pairs = grid.FindPairs(centers, radius);
+
+    // One pair at a time, as the narrowphase did before it batched the responses
+    std::vector<float> rx = vx, ry = vy;
+    long long resolved = 0;
+    for (auto& pair : pairs)
+    {
+        const int i = pair.first, j = pair.second;
+        const float dx = px[j] - px[i], dy = py[j] - py[i];
+        const float reach = radius[i] + radius[j];
+        if (dx * dx + dy * dy >= reach * reach || (rx[i] - rx[j]) * dx + (ry[i] - ry[j]) * dy < 0.f) continue;
+        const float distance = std::sqrt(dx * dx + dy * dy);
+        const float nx = dx / distance, ny = dy / distance;
+        const float m1 = mass[i], m2 = mass[j];
+        const float u1 = rx[i] * nx + ry[i] * ny, u2 = rx[j] * nx + ry[j] * ny;
+        const float v1 = (u1 * (m1 - m2) + u2 * 2 * m2) / (m1 + m2);
+        const float v2 = (u2 * (m2 - m1) + u1 * 2 * m1) / (m1 + m2);
+        const float e = restitution[i];
+        rx[i] = (rx[i] + nx * (v1 - u1)) * e;  ry[i] = (ry[i] + ny * (v1 - u1)) * e;
+        rx[j] = (rx[j] + nx * (v2 - u2)) * e;  ry[j] = (ry[j] + ny * (v2 - u2)) * e;
+        resolved++;
+    }
+
+    for (int level = BatchNarrowphase::SCALAR; level <= BatchNarrowphase::Detect(); level++)
+    {
+        BatchNarrowphase narrowphase((BatchNarrowphase::Level)level);
+        std::vector<float> wx = vx, wy = vy;
+        narrowphase.Resolve(pairs, px.data(), py.data(), wx.data(), wy.data(), mass.data(), radius.data(), restitution.data());
+        float worst = 0.0f;
+        for (int i = 0; i < n; i++)
+            worst = std::max(worst, std::abs(wx[i] - rx[i]) + std::abs(wy[i] - ry[i]));
+        check(worst == 0.0f && narrowphase.stats.resolved == resolved && narrowphase.stats.batched < resolved,
+              std::string(BatchNarrowphase::Name(narrowphase.level)) + " resolves " + std::to_string(resolved) + " pairs as one at a time would ("
+              + std::to_string(narrowphase.stats.batched) + " in lanes)");
+    }
+}
+
+
+// A ball put down on the floor has to stay on it (it used to get no wall event, and fell through),
+// and an inelastic ball dropped onto the floor has to come to rest there in a finite number of bounces
+// (it used to bounce ever lower and faster, so Advance never got past the time it would have stopped).
+void checkEventDrivenResting(float restitution)
+{
+    const std::string e = " (e = " + std::to_string(restitution).substr(0, 4) + ")";
+    const Vec2D gravity(0.f, 9.8f);
+
+    EventDrivenSimulation resting(0.f, 800.f, 0.f, 600.f, gravity, restitution);
+    resting.Add(Vec2D(400.f, 590.f), Vec2D(0.f, 0.f), 10.f, 1.f);
+    resting.Initialize();
+    resting.Advance(256.0);
+    const Vec2D p = resting.PositionAt(0, 256.0);
+    check(std::abs(p.y - 590.f) < 1e-3f && std::abs(p.x - 400.f) < 1e-3f, "a ball resting on the floor stays there" + e);
+
+    EventDrivenSimulation dropped(0.f, 800.f, 0.f, 600.f, gravity, restitution);
+    dropped.Add(Vec2D(400.f, 100.f), Vec2D(3.f, 0.f), 10.f, 1.f);
+    dropped.Add(Vec2D(200.f, 590.f), Vec2D(0.f, 0.f), 10.f, 1.f);
+    dropped.Add(Vec2D(200.f, 300.f), Vec2D(0.f, 0.f), 10.f, 1.f);      // Falls onto the resting ball
+    dropped.Initialize();
+    const float energy = dropped.TotalEnergy(0.0);
+    dropped.Advance(256.0);
+    bool inside = true;
+    for (int i = 0; i < 3; i++) {
+        const Vec2D q = dropped.PositionAt(i, 256.0);
+        inside &= (q.x >= 10.f - 1e-3f && q.x <= 790.f + 1e-3f && q.y >= 10.f - 1e-3f && q.y <= 590.f + 1e-3f);
+    }
+    const float gap = (dropped.PositionAt(2, 256.0) - dropped.PositionAt(1, 256.0)).magnitude() - 20.f;
+    check(inside && gap > -1e-2f, "dropped balls stay in the box and out of each other, after " + std::to_string(dropped.stats.events) + " events" + e);
+    if (restitution < 1.f)
+        check(dropped.balls[0].resting[1] && dropped.VelocityAt(0, 256.0).y == 0.f, "an inelastic ball comes to rest on the floor" + e);
+    else
+        check(std::abs(dropped.TotalEnergy(256.0) - energy) < 1e-3f * energy, "elastic balls keep their energy" + e);
+}
+
+
+
+// One thread publishes snapshots through a TripleBuffer as fast as it can while another reads them as fast as it can,
+// as the physics and render threads in main.cpp do. Every snapshot the reader gets has to be whole (every position
+// written in the same publish) and no older than the one before it, and it has to see the last one.
+void checkTripleBufferStress(int publishes)
+{
+    const int N = 64;
+    TripleBuffer<Snapshot> snapshots;
+    std::atomic<bool> done(false);
+
+    std::thread writer([&]() {
+        for (int k = 1; k <= publishes; k++)
+        {
+            Snapshot& snapshot = snapshots.Back();
+            snapshot.positions.assign(N, Vec2D((float)k, (float)k));
+            snapshot.previous.assign(N, Vec2D((float)(k - 1), (float)(k - 1)));
+            snapshot.step = k;
+            snapshots.Publish();
+        }
+        done = true;
+    });
+
+    long long last = 0, reads = 0, torn = 0, backwards = 0;
+    while (true)
+    {
+        const bool finished = done;
+        const Snapshot& snapshot = snapshots.Front();
+        for (int i = 0; i < snapshot.Size(); i++)
+            torn += (snapshot.positions[i].x != (float)snapshot.step || snapshot.previous[i].x != (float)(snapshot.step - 1));
+        backwards += (snapshot.step < last);
+        last = snapshot.step;
+        reads++;
+        if (finished && !snapshots.Fresh()) break;
+    }
+    writer.join();
+    check(torn == 0 && backwards == 0 && last == publishes, std::to_string(publishes) + " publishes against " + std::to_string(reads)
+          + " reads: no torn snapshots, none out of order, and the last one seen");
+}
+
+
+
+// Update(particles, pool, t, dt, ...) on ChargedParticles has to run Particle's Update overloads, giving exactly what
+// a plain loop of Particle::Update gives, for each set of trailing arguments. ChargedParticle's own overloads hide
+// Particle's, so a force alone didn't compile, and a force and restitution used to go to one that doesn't bounce
+// with restitution (and took the restitution as the particle's potential energy).
+void checkPooledChargedUpdate()
+{
+    const int n = 1000, STEPS = 50;
+    const float dt = 1.0f / 60.0f;
+    std::mt19937 rng(17u);
+    std::uniform_real_distribution<float> x(20.0f, 780.0f), y(20.0f, 580.0f), v(-300.0f, 300.0f), f(-50.0f, 50.0f);
+    std::vector<ChargedParticle> start;
+    std::vector<Vec2D> forces;
+    for (int i = 0; i < n; i++)
+    {
+        start.emplace_back("", sf::Color::White, 1.0f, 5.0f, 1e-4f, Vec2D(x(rng), y(rng)), Vec2D(v(rng), v(rng)));
+        start.back().trail_enabled = false;
+        start.back().SetBounds(0.0f, 800.0f, 0.0f, 600.0f);
+        start.back().potential_energy = -1.0f;
+        forces.emplace_back(f(rng), f(rng));
+    }
+
+    ThreadPool pool(4);
+    const char* names[4] = { "(force)", "(force, restitution)", "(force, damping)", "(force, damping, restitution)" };
+    for (int overload = 0; overload < 4; overload++)
+    {
+        std::vector<ChargedParticle> reference = start, pooled = start;
+        for (int s = 0; s < STEPS; s++)
+        {
+            const Vec2D force = forces[s % n];
+            for (auto& particle : reference)
+                switch (overload) {
+                    case 0:  particle.Particle::Update(s * dt, dt, force);  break;
+                    case 1:  particle.Particle::Update(s * dt, dt, force, 0.9f);  break;
+                    case 2:  particle.Particle::Update(s * dt, dt, force, 0.999);  break;
+                    default: particle.Particle::Update(s * dt, dt, force, 0.999, 0.9f);  break;
+                }
+            switch (overload) {
+                case 0:  Update(pooled, pool, s * dt, dt, force);  break;
+                case 1:  Update(pooled, pool, s * dt, dt, force, 0.9f);  break;
+                case 2:  Update(pooled, pool, s * dt, dt, force, 0.999);  break;
+                default: Update(pooled, pool, s * dt, dt, force, 0.999, 0.9f);  break;
+            }
+        }
+        bool same = true;
+        for (int i = 0; i < n; i++)
+            same &= (pooled[i].kinematics.position == reference[i].kinematics.position && pooled[i].kinematics.velocity == reference[i].kinematics.velocity
+                     && pooled[i].center == reference[i].center && pooled[i].potential_energy == -1.0f);
+        check(same, std::string("Update(charged particles, pool, t, dt, ") + (names[overload] + 1) + " runs Particle::Update" + names[overload] + " on each");
+    }
+}
+
+
+
+// Both ChargedParticle::CoulombForce overloads have to give the force TiledCoulomb gives, between the centers of a pair
+// of very different sizes (so measuring from the top-left corners would point it well off the line between them), for like and unlike
+// charges, and with a max_force small enough that the clamp applies (the force along the same line, at max_force).
+void checkCoulombForce()
+{
+    auto close = [](Vec2D v, Vec2D reference) { return (v - reference).magnitude() <= 1e-5f * reference.magnitude(); };
+    for (float sign : { 1.0f, -1.0f })
+    {
+        std::vector<ChargedParticle> pair;
+        pair.emplace_back("", sf::Color::White, 1.0f, 3.0f, 1e-4f, Vec2D(100.0f, 200.0f));
+        pair.emplace_back("", sf::Color::White, 1.0f, 40.0f, sign * 2e-4f, Vec2D(160.0f, 150.0f));
+        const std::string charges = (sign > 0.0f) ? "like charges" : "unlike charges";
+
+        TiledCoulomb tiled;
+        tiled.Load(pair);
+        tiled.Solve();
+        const Vec2D force = pair[0].CoulombForce(pair[1]);
+        const Vec2D along = pair[0].center - pair[1].center;
+        const bool outward = force.dot(along) * sign > 0.0f && std::abs(force.x * along.y - force.y * along.x) <= 1e-5f * force.magnitude() * along.magnitude();
+        check(close(force, tiled.Force(0)) && close(pair[1].CoulombForce(pair[0]), tiled.Force(1)) && outward,
+              "CoulombForce(particle) matches TiledCoulomb between the centers of a mixed-radius pair (" + charges + ")");
+
+        const float max_force = 0.25f * force.magnitude();
+        TiledCoulomb clamped(0.0f, max_force);
+        clamped.Load(pair);
+        clamped.Solve();
+        const Vec2D limited = pair[0].CoulombForce(pair[1], max_force);
+        check(close(limited, clamped.Force(0)) && close(pair[1].CoulombForce(pair[0], max_force), clamped.Force(1))
+              && std::abs(limited.magnitude() - max_force) <= 1e-5f * max_force && close(limited * 4.0f, force),
+              "CoulombForce(particle, max_force) matches TiledCoulomb when the clamp applies (" + charges + ")");
+        check(close(pair[0].CoulombForce(pair[1], 2.0f * force.magnitude()), force), "CoulombForce(particle, max_force) leaves a force under max_force alone (" + charges + ")");
+    }
+}
+
+
+// Kinetic plus Coulomb potential energy of a set of charges.
+double chargedEnergy(const std::vector<ChargedParticle>& particles, TiledCoulomb& coulomb)
+{
+    coulomb.Load(particles);
+    coulomb.Solve();
+    double energy = coulomb.PotentialEnergy();
+    for (auto& particle : particles)
+        energy += 0.5 * particle.mass * particle.kinematics.velocity.dot(particle.kinematics.velocity);
+    return energy;
+}
+
+
+// Like charges pushing each other apart in a box, stepped for 2 s with Respa at a few K, against Particle::Update's RK4
+// with the Coulomb forces worked out every step. Respa's energy drift has to stay within 4 times RK4's, with the
+// Coulomb forces worked out once per K steps (plus once to start). Particle centers go to the broadphase on every step.
+void checkRespaEnergy()
+{
+    const int n = 200, STEPS = 240;
+    const float dt = 1.0f / 120.0f;
+    std::mt19937 rng(5u);
+    std::uniform_real_distribution<float> x(250.0f, 550.0f), y(150.0f, 450.0f), v(-20.0f, 20.0f);
+    std::vector<ChargedParticle> start;
+    start.reserve(n);
+    for (int i = 0; i < n; i++)
+    {
+        start.emplace_back("", sf::Color::White, 1.0f, 4.0f, 1e-4f, Vec2D(x(rng), y(rng)), Vec2D(v(rng), v(rng)));
+        start.back().trail_enabled = false;
+        start.back().SetBounds(0.0f, 800.0f, 0.0f, 600.0f);
+    }
+    TiledCoulomb coulomb;
+    const double e0 = chargedEnergy(start, coulomb);
+
+    std::vector<ChargedParticle> reference = start;
+    SpatialHash grid;
+    for (int s = 0; s < STEPS; s++)
+    {
+        coulomb.Load(reference);
+        coulomb.Solve();
+        ResolveCollisions(reference, grid);
+        for (int i = 0; i < n; i++)
+            reference[i].Particle::Update(s * dt, dt, coulomb.Force(i));
+    }
+    const double rk4_drift = std::abs(chargedEnergy(reference, coulomb) - e0) / std::abs(e0);
+
+    auto slow = [&](const std::vector<ChargedParticle>& particles, std::vector<Vec2D>& forces) {
+        coulomb.Load(particles);
+        coulomb.Solve();
+        for (int i = 0; i < n; i++)  forces[i] = coulomb.Force(i);
+    };
+    for (int K : { 2, 4, 8 })
+    {
+        std::vector<ChargedParticle> particles = start;
+        Respa respa(K);
+        SpatialHash respa_grid;
+        for (int s = 0; s < STEPS / K; s++)
+            respa.Step(particles, s * K * dt, dt, slow, respa_grid);
+        const double drift = std::abs(chargedEnergy(particles, coulomb) - e0) / std::abs(e0);
+        std::ostringstream line;
+        line << "Respa K = " << K << " drifts " << std::scientific << std::setprecision(1) << drift << " against RK4's " << rk4_drift
+             << ", with " << respa.stats.slow_evaluations << " Coulomb solves";
+        check(drift < std::max(4.0 * rk4_drift, 1e-4) && respa.stats.slow_evaluations == STEPS / K + 1, line.str());
+    }
+}
+
+
+
+// Pairs of like charges (of different sizes, so the centers have to be put back where ChargedParticle keeps them)
+// fired at each other across the box, passing closer (about 20 px) than they move in main.cpp's dt.
+// Stepped frame by frame with AdaptiveCoulomb, the energy has to hold to within 1e-3, where Particle::Update at the same
+// dt (under the same forces from a TiledCoulomb) gets it well wrong, and each particle's potential energy has to add up to the total.
+void checkAdaptiveCoulomb()
+{
+    const int FRAMES = 60;
+    const float dt = 5.0f / 60.0f;
+    std::vector<ChargedParticle> start;
+    for (int k = 0; k < 3; k++)
+    {
+        const float y = 150.0f + 150.0f * k, offset = 4.0f * k;
+        start.emplace_back("", sf::Color::White, 1.0f + k, 4.0f + 4.0f * k, 1e-2f, Vec2D(150.0f, y), Vec2D(200.0f, 0.0f));
+        start.emplace_back("", sf::Color::White, 1.0f, 4.0f, 1e-2f, Vec2D(650.0f, y + offset), Vec2D(-200.0f, 0.0f));
+    }
+    for (auto& particle : start) {
+        particle.trail_enabled = false;
+        particle.SetBounds(0.0f, 800.0f, 0.0f, 600.0f);
+    }
+    TiledCoulomb coulomb;
+    const double e0 = chargedEnergy(start, coulomb);
+
+    std::vector<ChargedParticle> fixed = start;
+    for (int f = 0; f < FRAMES; f++)
+    {
+        coulomb.Load(fixed);
+        coulomb.Solve();
+        for (int i = 0; i < (int)fixed.size(); i++)
+            fixed[i].Particle::Update(f * dt, dt, coulomb.Force(i));
+    }
+    const double fixed_drift = std::abs(chargedEnergy(fixed, coulomb) - e0) / std::abs(e0);
+
+    std::vector<ChargedParticle> particles = start;
+    AdaptiveCoulomb adaptive;
+    int evaluations = 0;
+    for (int f = 0; f < FRAMES; f++) {
+        adaptive.Step(particles, dt);
+        evaluations += adaptive.scheme.stats.evaluations;
+    }
+    const double drift = std::abs(chargedEnergy(particles, coulomb) - e0) / std::abs(e0);
+    double potential = 0.0;
+    for (auto& particle : particles)  potential += 0.5 * particle.potential_energy;
+
+    std::ostringstream line;
+    line << "AdaptiveCoulomb drifts " << std::scientific << std::setprecision(1) << drift << " over " << FRAMES << " frames ("
+         << evaluations << " field samples), against " << fixed_drift << " for Particle::Update";
+    check(drift < 1e-3 && fixed_drift > 10.0 * drift, line.str());
+    check(std::abs(potential - coulomb.PotentialEnergy()) < 1e-4 * std::abs(coulomb.PotentialEnergy()), "AdaptiveCoulomb leaves each particle's potential energy at its new position");
+}
+
+
+
+int main()
+{
+    std::cout << "Broadphases on Particles" << std::endl;
+    checkParticleBroadphase<SpatialHash>("SpatialHash");
+    checkParticleBroadphase<SweepAndPrune>("SweepAndPrune");
+    checkParticleBroadphase<AABBTree>("AABBTree");
+
+    std::cout << std::endl << "Collision response" << std::endl;
+    checkCollisionResponse();
+
+    std::cout << std::endl << "Batched narrowphase" << std::endl;
+    checkNarrowphaseLevels();
+
+    std::cout << std::endl << "Event-driven simulation" << std::endl;
+    checkEventDrivenResting(1.0f);
+    checkEventDrivenResting(0.9f);
+
+    std::cout << std::endl << "Snapshots handed between threads" << std::endl;
+    checkTripleBufferStress(200000);
+
+    std::cout << std::endl << "Coulomb forces" << std::endl;
+    checkCoulombForce();
+
+    std::cout << std::endl << "Updating ChargedParticles on a pool" << std::endl;
+    checkPooledChargedUpdate();
+
+    std::cout << std::endl << "Multiple time steps" << std::endl;
+    checkRespaEnergy();
+
+    std::cout << std::endl << "Adaptive steps" << std::endl;
+    checkAdaptiveCoulomb();
+
+    std::cout << std::endl << (failures == 0 ? "All checks passed" : std::to_string(failures) + " check(s) failed") << std::endl;
+    return (failures == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}